@@ -0,0 +1,92 @@
+#pragma once
+
+#include <object.h>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* The archive format (.varch): objects stored as they are, with an index from every global symbol
+ * they define to the member defining it, so that ld can pick the members it needs without reading
+ * the others. An ArchiveHeader is followed by the ArchiveMembers, the ArchiveSymbols sorted by name,
+ * the strings and the members' contents, each 8-byte aligned so that image members are used in
+ * place once mapped. */
+
+constexpr char kArchiveMagic[8] = {'V', 'S', 'V', 'M', 'A', 'R', 'C', '\0'};
+constexpr int64_t kArchiveFormatVersion = 1;
+
+struct ArchiveHeader {
+    char magic[8];
+    int64_t format_version;
+    int64_t members_cnt;
+    int64_t members_offset;
+    int64_t symbols_cnt;
+    int64_t symbols_offset;
+    int64_t strings_offset;
+    int64_t strings_size;
+};
+
+struct ArchiveMember {
+    int64_t name_offset;
+    int64_t name_size;
+    int64_t offset;
+    int64_t size;
+};
+
+struct ArchiveSymbol {
+    int64_t name_offset;
+    int64_t name_size;
+    int64_t member;
+};
+
+/* A member to be archived: the object file's name and contents, and the object read from them for
+ * the index. */
+struct ArchiveInput {
+    std::string name;
+    std::string contents;
+    Object object;
+};
+
+/* False if two members define the same global symbol. */
+bool TryWriteArchive(const std::vector<ArchiveInput>& members, std::ostream* out, std::string* error);
+
+/* A validated, mapped archive. Members are only read when asked for. */
+class MappedArchive {
+public:
+    MappedArchive() = default;
+    MappedArchive(const MappedArchive&) = delete;
+    MappedArchive& operator=(const MappedArchive&) = delete;
+    ~MappedArchive();
+
+    static bool IsArchive(const void* data, size_t size);
+    /* Whether the file starts like an archive. */
+    static bool IsArchiveFile(const char* path);
+
+    bool TryMap(const char* path, std::string* error);
+
+    size_t MembersCnt() const;
+    std::string_view MemberName(size_t idx) const;
+
+    /* Index entries in name order. */
+    size_t SymbolsCnt() const;
+    std::string_view SymbolName(size_t idx) const;
+    size_t SymbolMember(size_t idx) const;
+    bool TryFindMember(std::string_view symbol, size_t* member) const;
+
+    bool TryReadMember(size_t idx, Object* object, std::string* error) const;
+
+private:
+    void Unmap();
+    std::string_view Name(int64_t offset, int64_t size) const;
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    std::string path_;
+    const ArchiveMember* members_ = nullptr;
+    size_t members_cnt_ = 0;
+    const ArchiveSymbol* symbols_ = nullptr;
+    size_t symbols_cnt_ = 0;
+    const char* strings_ = nullptr;
+    size_t strings_size_ = 0;
+};
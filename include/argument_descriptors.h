@@ -1,20 +1,118 @@
 #pragma once
 #include <cstdint>
+#include <cstring>
 
 #define ARG_VALUE                   0
 #define ARG_POINTER                 1
 #define ARG_REGISTER                2
 #define ARG_REGISTER_POINTER        3
+/* RAM[%base + offset] and RAM[%base + %index], written !base+offset and !base+%index. The offset
+ * is a 64-bit immediate or a label; the index is a register. */
+#define ARG_BASE_OFFSET             4
+#define ARG_BASE_INDEX              5
+/* Slot n of the current function's stack frame (see ENTER), written @n; n is a 16-bit index. */
+#define ARG_FRAME                   6
+/* ARG_VALUE and ARG_POINTER with a 1-, 2- or 4-byte immediate, sign-extended to 64 bits. Decoders
+ * hand them on as the 8-byte types. */
+#define ARG_VALUE_8                 7
+#define ARG_VALUE_16                8
+#define ARG_VALUE_32                9
+#define ARG_POINTER_8               10
+#define ARG_POINTER_16              11
+#define ARG_POINTER_32              12
 
 #define ASM_PREFIX_POINTER          '*'
 #define ASM_PREFIX_REGISTER         '%'
 #define ASM_PREFIX_REGISTER_POINTER '!'
+#define ASM_PREFIX_FRAME            '@'
 
-static inline void SetArgType(int8_t* descriptor, int index, int8_t type) {
-    *descriptor &= ~(3 << (index << 1));
-    *descriptor |= type << (index << 1);
+/* Follows the opcode of every instruction with arguments: four bits of argument type per
+ * argument, the first argument in the lowest bits. */
+using ArgDescriptor = uint16_t;
+
+static inline void SetArgType(ArgDescriptor* descriptor, int index, int8_t type) {
+    *descriptor &= ~(0xf << (index << 2));
+    *descriptor |= type << (index << 2);
+}
+
+static inline int8_t GetArgType(ArgDescriptor descriptor, int index) {
+    return (descriptor >> (index << 2)) & 0xf;
+}
+
+/* Bytes in the immediate of an ARG_VALUE or ARG_POINTER type of any width; 0 for other types. */
+static inline int ImmediateSize(int8_t type) {
+    switch (type) {
+        case ARG_VALUE:
+        case ARG_POINTER:
+            return 8;
+        case ARG_VALUE_8:
+        case ARG_POINTER_8:
+            return 1;
+        case ARG_VALUE_16:
+        case ARG_POINTER_16:
+            return 2;
+        case ARG_VALUE_32:
+        case ARG_POINTER_32:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+/* ARG_VALUE or ARG_POINTER for an immediate type of any width. */
+static inline int8_t WideArgType(int8_t type) {
+    return type == ARG_POINTER || (type >= ARG_POINTER_8 && type <= ARG_POINTER_32) ? ARG_POINTER : ARG_VALUE;
+}
+
+/* The type of `size` bytes for the same kind of immediate as `type`. */
+static inline int8_t ImmediateArgType(int8_t type, int size) {
+    int8_t base = WideArgType(type) == ARG_POINTER ? ARG_POINTER_8 : ARG_VALUE_8;
+    switch (size) {
+        case 1:
+            return base;
+        case 2:
+            return base + 1;
+        case 4:
+            return base + 2;
+        default:
+            return WideArgType(type);
+    }
+}
+
+/* The fewest bytes that sign-extend back to `value`. */
+static inline int ImmediateSizeFor(int64_t value) {
+    if (value == static_cast<int8_t>(value)) {
+        return 1;
+    }
+    if (value == static_cast<int16_t>(value)) {
+        return 2;
+    }
+    return value == static_cast<int32_t>(value) ? 4 : 8;
+}
+
+static inline int64_t ReadImmediate(const int8_t* bytes, int size) {
+    switch (size) {
+        case 1:
+            return bytes[0];
+        case 2: {
+            int16_t value = 0;
+            std::memcpy(&value, bytes, sizeof(value));
+            return value;
+        }
+        case 4: {
+            int32_t value = 0;
+            std::memcpy(&value, bytes, sizeof(value));
+            return value;
+        }
+        default: {
+            int64_t value = 0;
+            std::memcpy(&value, bytes, sizeof(value));
+            return value;
+        }
+    }
 }
 
-static inline int8_t GetArgType(int8_t descriptor, int index) {
-    return (descriptor >> (index << 1)) & 3;
+/* Little-endian, like everything else in the bytecode. */
+static inline void WriteImmediate(int8_t* bytes, int64_t value, int size) {
+    std::memcpy(bytes, &value, size);
 }
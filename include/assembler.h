@@ -1,4 +1,8 @@
 #pragma once
+#include <image.h>
 #include <fstream>
+#include <string>
 
-void Assemble(std::ifstream* in, std::ofstream* out);
+/* `optimization_level` is asm's -O level; see OptimizeObject(). */
+void Assemble(std::ifstream* in, std::ofstream* out, ObjectFormat format, const std::string& source_name,
+              int optimization_level);
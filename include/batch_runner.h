@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+/* Runs one job: reads guest input from `input`, writes guest output to `output`, returns success. */
+using BatchJobHandler = std::function<bool(std::FILE* input, std::FILE* output)>;
+
+/* Runs every input file through a handler on `workers_cnt` threads. `make_handler` is invoked once
+ * on each worker thread, so per-worker state (RAM, stacks, contexts) belongs in the handler it
+ * returns. The output of `dir/name.ext` is written to `dir/name.out`. Returns the number of failed
+ * jobs. */
+int RunBatch(const std::vector<std::string>& input_paths, int workers_cnt,
+             const std::function<BatchJobHandler()>& make_handler);
+
+/* One time slice of a job that can be preempted: the first call starts it on the given files,
+ * later calls resume it. Returns true while the job has work left; once it has finished, `*ok`
+ * tells whether it succeeded. */
+using PreemptibleJob = std::function<bool(std::FILE* input, std::FILE* output, bool* ok)>;
+
+/* Like RunBatch, but every job is started at once and the jobs are multiplexed as green threads
+ * over `workers_cnt` threads (see RunGreenThreads). `make_job` is invoked once per input file. */
+int RunPreemptibleBatch(const std::vector<std::string>& input_paths, int workers_cnt,
+                        const std::function<PreemptibleJob()>& make_job);
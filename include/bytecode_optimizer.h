@@ -0,0 +1,20 @@
+#pragma once
+
+#include <object.h>
+
+/* What asm -O<level> does to an object before writing it:
+ *   0  nothing
+ *   1  constant folding, PUSH x; POP x for registers and immediates, jumps to the next
+ *      instruction and unreachable code after JMP, RET and HALT
+ *   2  also jump threading, branches on constants, PUSH a; PUSH b; SWAP and PUSH x; POP x for
+ *      memory and frame operands, which may drop a fault the original would have raised
+ * Only code between two labels is rewritten as a unit, so every FUNC symbol, including the local
+ * ones, stays a valid entry point. Symbol positions, relocations and the line table are moved along
+ * with the code. Numeric code addresses are not understood and break, as they do with any edit. */
+void OptimizeObject(Object* object, int level);
+
+/* What ld -lto does to the module it merges all objects into: SYMBOL constants and never written
+ * variables become immediates, CALLs of short straight functions are replaced by their bodies,
+ * functions identical to an earlier one are no longer called, then everything -O2 does. It is only
+ * sound for a whole program, which has every reference to its symbols in sight. */
+void OptimizeProgram(Object* module);
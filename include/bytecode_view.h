@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* Read-only bytecode, wherever it lives; all the engines ever look at. */
+class BytecodeView {
+public:
+    BytecodeView() = default;
+    BytecodeView(const int8_t* data, size_t size) : data_(data), size_(size) {
+    }
+    BytecodeView(const std::vector<int8_t>& bytecode) : data_(bytecode.data()), size_(bytecode.size()) {
+    }
+
+    const int8_t* data() const {
+        return data_;
+    }
+    size_t size() const {
+        return size_;
+    }
+    const int8_t& operator[](size_t idx) const {
+        return data_[idx];
+    }
+    const int8_t* begin() const {
+        return data_;
+    }
+    const int8_t* end() const {
+        return data_ + size_;
+    }
+
+private:
+    const int8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
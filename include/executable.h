@@ -0,0 +1,44 @@
+#pragma once
+
+#include <bytecode_view.h>
+#include <object.h>
+#include <image.h>
+#include <line_table.h>
+#include <program_metadata.h>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* An executable as the engines run it. An image file is mapped and executed in place, and its
+ * symbols are only read once a stack trace needs them; an oosf file is parsed into an Object. */
+class Executable {
+public:
+    Executable();
+    explicit Executable(Object object);
+    Executable(Executable&&) noexcept;
+    Executable& operator=(Executable&&) noexcept;
+    ~Executable();
+
+    bool TryLoad(const char* path, std::string* error);
+
+    Object::ProcVersion GetProcVersion() const;
+    Object::ObjectType GetObjectType() const;
+    BytecodeView GetBytecode() const;
+    int64_t GetBssSize() const;
+    /* Function names by entry point, built on first use. */
+    const std::map<int64_t, std::string_view>& GetFunctions() const;
+    /* What ld stored, or else the result of AnalyzeProgram(); also done on first use. */
+    const ProgramMetadata& GetMetadata() const;
+    /* Empty if the program was linked from objects without one. */
+    const LineTable& GetLineTable() const;
+
+private:
+    struct Lazy;
+
+    std::unique_ptr<Object> object_;
+    std::unique_ptr<MappedImage> image_;
+    std::unique_ptr<Lazy> lazy_;
+};
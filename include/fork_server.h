@@ -0,0 +1,10 @@
+#pragma once
+
+#include <functional>
+
+/* Serves one request per connection accepted on a Unix socket at `socket_path`. Every connection is
+ * handled in a forked child, so the child starts from the parent's memory (shared copy-on-write)
+ * and whatever it does to it is thrown away when it exits. The handler reads the request from
+ * `connection_fd` and writes the reply there; its result becomes the child's exit status. Returns
+ * only on error. */
+int RunForkServer(const char* socket_path, const std::function<bool(int connection_fd)>& handler);
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+
+/* Guest RAM as the heap sees it. */
+class HeapMemory {
+public:
+    virtual ~HeapMemory() = default;
+    /* nullptr if `idx` is out of range. */
+    virtual int64_t* Word(int64_t idx) = 0;
+    /* Makes the words below `end` addressable; false if RAM cannot grow that far. */
+    virtual bool Reserve(int64_t end) = 0;
+};
+
+/* The allocator behind ALLOC, FREE and REALLOC: one free list per size class, with blocks carved
+ * out of RAM above the bss. The shared state lives in guest RAM from `base` (the executable's
+ * __bss_size) on, so both engines lay the heap out alike and snapshots carry it:
+ *   base           the break, where carving goes on; 0 before the first ALLOC
+ *   base + 1 + c   the first free block of class c
+ * Every block is a header word, c + 1 while allocated and -(c + 1) while free, and a payload whose
+ * index ALLOC returns. A free block links to the next one in its first payload word.
+ *
+ * Each guest thread has a GuestHeap of its own that caches a few free blocks of the small classes,
+ * so most ALLOCs and FREEs do not touch the shared lists. Flush() hands them back; checkpoints and
+ * finishing threads do so. */
+class GuestHeap {
+public:
+    /* Classes hold 1, 2, 3, 4, 6, 8, 12, ... words, up to the whole of RAM. */
+    static constexpr int kClassesCnt = 36;
+    /* Classes of up to 64 words. */
+    static constexpr int kCachedClassesCnt = 12;
+    static constexpr int kCacheSize = 8;
+    static constexpr int64_t kHeaderWords = 1 + kClassesCnt;
+
+    void SetBase(int64_t base);
+    /* Serializes access to the shared lists; nullptr while the program has a single thread. */
+    void SetMutex(std::mutex* mutex);
+
+    /* *ptr becomes 0 if `words` is not positive or RAM is exhausted. All three return false on a
+     * pointer that is not an allocated block and on a corrupted free list. */
+    bool TryAlloc(HeapMemory* memory, int64_t words, int64_t* ptr);
+    /* FREE 0 does nothing. */
+    bool TryFree(HeapMemory* memory, int64_t ptr);
+    /* Keeps the block if it is big enough and moves it otherwise; when RAM is exhausted *new_ptr
+     * becomes 0 and the block stays. REALLOC 0 n allocates and REALLOC p 0 frees. */
+    bool TryRealloc(HeapMemory* memory, int64_t ptr, int64_t words, int64_t* new_ptr);
+    void Flush(HeapMemory* memory);
+    /* Forgets the cached blocks, for when RAM is cleared. */
+    void Reset();
+
+private:
+    bool TryTakeBlock(HeapMemory* memory, int size_class, int64_t* ptr);
+    void PutBlock(HeapMemory* memory, int size_class, int64_t ptr);
+    bool TryGetAllocatedClass(HeapMemory* memory, int64_t ptr, int* size_class);
+
+    int64_t base_ = 0;
+    std::mutex* mutex_ = nullptr;
+    std::array<std::array<int64_t, kCacheSize>, kCachedClassesCnt> cache_;
+    std::array<int, kCachedClassesCnt> cache_cnt_{};
+};
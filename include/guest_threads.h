@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/* Threads started by SPAWN. Handles are shared by every thread of a program, so any thread may JOIN
+ * any other; a handle may be joined more than once. */
+class GuestThreads {
+public:
+    GuestThreads() = default;
+    GuestThreads(const GuestThreads&) = delete;
+    GuestThreads& operator=(const GuestThreads&) = delete;
+    ~GuestThreads();
+
+    /* Runs `body` on a new OS thread and returns its handle (never 0). The body stores the thread's
+     * result and returns whether the thread succeeded. */
+    int64_t Spawn(std::function<bool(int64_t* result)> body);
+    /* Waits for the thread; false on a bad handle, a self-join or a failed thread. */
+    bool Join(int64_t handle, int64_t* result);
+    void JoinAll();
+    /* Joins everything and forgets all handles. */
+    void Clear();
+
+    /* Serializes guest I/O once there is more than one thread. */
+    std::mutex* IOMutex();
+    /* Guards the guest heap's shared lists, likewise. */
+    std::mutex* HeapMutex();
+
+private:
+    struct Thread {
+        std::thread thread;
+        std::once_flag joined;
+        bool ok = false;
+        int64_t result = 0;
+    };
+
+    std::mutex mutex_;
+    std::deque<Thread> threads_;
+    std::mutex io_mutex_;
+    std::mutex heap_mutex_;
+};
+
+/* Locks `mutex` unless it is null. */
+class OptionalLock {
+public:
+    explicit OptionalLock(std::mutex* mutex) : mutex_(mutex) {
+        if (mutex_ != nullptr) {
+            mutex_->lock();
+        }
+    }
+    OptionalLock(const OptionalLock&) = delete;
+    OptionalLock& operator=(const OptionalLock&) = delete;
+    ~OptionalLock() {
+        if (mutex_ != nullptr) {
+            mutex_->unlock();
+        }
+    }
+
+private:
+    std::mutex* mutex_;
+};
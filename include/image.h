@@ -0,0 +1,165 @@
+#pragma once
+
+#include <object.h>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+/* The image format: a fixed-layout encoding of an Object that is used in place once mapped, unlike
+ * the varint-coded oosf one. An ImageHeader is followed by the section table and the sections,
+ * each 8-byte aligned, so every field can be read straight out of the mapping:
+ *   bytecode       the raw bytecode
+ *   symbols        ImageSymbols, sorted by name for binary search
+ *   strings        the names of symbols and relocations, not terminated
+ *   relocations    ImageRelocations (Object::required_symbols), sorted by position
+ *   metadata       optional, executables only: an ImageMetadata followed by its instruction
+ *                  starts (int64_t each), ImageBlocks and ImageFunctions (see program_metadata.h)
+ *   lines          optional: an ImageLineTable, its ImageLineFiles (names in the strings section)
+ *                  and the rows as EncodeLineRows() writes them
+ * Readers skip sections of types they do not know. */
+
+constexpr char kImageMagic[8] = {'V', 'S', 'V', 'M', 'I', 'M', 'G', '\0'};
+constexpr int64_t kImageFormatVersion = 1;
+
+enum ImageSectionType {
+    kImageSectionBytecode       = 1,
+    kImageSectionSymbols        = 2,
+    kImageSectionStrings        = 3,
+    kImageSectionRelocations    = 4,
+    kImageSectionMetadata       = 5,
+    kImageSectionLines          = 6,
+};
+
+struct ImageHeader {
+    char magic[8];
+    int64_t format_version;
+    int32_t proc_major, proc_minor, proc_patch;
+    int32_t object_type;
+    int64_t bss_size;
+    int64_t sections_cnt;
+    int64_t section_table_offset;
+};
+
+struct ImageSection {
+    int64_t type;
+    int64_t offset;
+    int64_t size;
+};
+
+struct ImageSymbol {
+    int64_t position;
+    int64_t name_offset;
+    int32_t name_size;
+    int32_t type;
+};
+
+struct ImageRelocation {
+    int64_t position;
+    int64_t name_offset;
+    int64_t name_size;
+};
+
+struct ImageMetadata {
+    int64_t invalid_at;
+    int64_t used_registers;
+    int64_t instructions_cnt;
+    int64_t blocks_cnt;
+    int64_t functions_cnt;
+};
+
+struct ImageBlock {
+    int64_t start;
+    int64_t end;
+    int32_t stack_delta;
+    int32_t stack_min;
+    int64_t jump_target;
+};
+
+struct ImageFunction {
+    int64_t start;
+    int64_t end;
+};
+
+struct ImageLineTable {
+    int64_t files_cnt;
+    int64_t rows_cnt;
+};
+
+struct ImageLineFile {
+    int64_t name_offset;
+    int64_t name_size;
+};
+
+enum ObjectFormat {
+    kObjectFormatImage  = 0,
+    kObjectFormatOOSF   = 1,
+};
+
+/* "image" or "oosf". */
+bool TryParseObjectFormat(const char* name, ObjectFormat* format);
+void WriteObject(const Object& obj, ObjectFormat format, std::ostream* out);
+/* Either format, told apart by the magic. */
+bool TryReadObjectFile(const char* path, Object* object, std::string* error);
+bool TryReadObjectFromMemory(const void* data, size_t size, Object* object, std::string* error);
+
+/* A validated image, mapped from a file or borrowed from memory. Names are checked as they are
+ * looked up, so opening an image costs the same whatever its symbol count. */
+class MappedImage {
+public:
+    MappedImage() = default;
+    MappedImage(const MappedImage&) = delete;
+    MappedImage& operator=(const MappedImage&) = delete;
+    ~MappedImage();
+
+    static bool IsImage(const void* data, size_t size);
+
+    bool TryMap(const char* path, std::string* error);
+    /* `data` must outlive the image. */
+    bool TryAttach(const void* data, size_t size, std::string* error);
+
+    Object::ProcVersion GetProcVersion() const;
+    Object::ObjectType GetObjectType() const;
+    int64_t GetBssSize() const;
+    const int8_t* Bytecode() const;
+    size_t BytecodeSize() const;
+
+    /* Symbols in name order. A name that does not fit into the string table reads as empty. */
+    size_t SymbolsCnt() const;
+    std::string_view SymbolName(size_t idx) const;
+    Symbol SymbolAt(size_t idx) const;
+    bool TryFindSymbol(std::string_view name, Symbol* symbol) const;
+
+    size_t RelocationsCnt() const;
+    int64_t RelocationPosition(size_t idx) const;
+    std::string_view RelocationName(size_t idx) const;
+
+    /* False if there is no metadata section or it does not fit the bytecode. */
+    bool TryReadMetadata(ProgramMetadata* metadata) const;
+    /* False if there is no line table or it is malformed. */
+    bool TryReadLineTable(LineTable* table) const;
+
+    /* Copies the whole image, for the tools that edit Objects. */
+    void ToObject(Object* obj) const;
+
+private:
+    void Unmap();
+    std::string_view Name(int64_t offset, int64_t size) const;
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    const ImageHeader* header_ = nullptr;
+    const int8_t* bytecode_ = nullptr;
+    size_t bytecode_size_ = 0;
+    const ImageSymbol* symbols_ = nullptr;
+    size_t symbols_cnt_ = 0;
+    const char* strings_ = nullptr;
+    size_t strings_size_ = 0;
+    const ImageRelocation* relocations_ = nullptr;
+    size_t relocations_cnt_ = 0;
+    const char* metadata_ = nullptr;
+    size_t metadata_size_ = 0;
+    const char* lines_ = nullptr;
+    size_t lines_size_ = 0;
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <argument_descriptors.h>
+#include <bytecode_view.h>
+#include <cstdint>
+
+/* How an instruction is laid out in the bytecode, for the tools that inspect or rewrite it. The
+ * engines decode operands on their own, since they load them on the way. */
+
+constexpr int kMaxArgsCnt = sizeof(ArgDescriptor) * 2;
+
+struct InstructionLayout {
+    int64_t start = 0;
+    int64_t size = 0;
+    int8_t opcode = 0;
+    int args_cnt = 0;
+    int from_stack_cnt = 0;
+    int to_stack_cnt = 0;
+    /* Per operand: its type as encoded, where its bytes start and how many there are. */
+    int8_t arg_types[kMaxArgsCnt] = {};
+    int64_t arg_offsets[kMaxArgsCnt] = {};
+    int arg_sizes[kMaxArgsCnt] = {};
+};
+
+/* False if no valid instruction starts at `ip`: an unknown opcode or argument type, a register
+ * above MAX_REGISTER or an instruction cut short by the end of the bytecode. */
+bool TryDecodeInstruction(BytecodeView bytecode, int64_t ip, InstructionLayout* instruction);
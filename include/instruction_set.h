@@ -10,8 +10,8 @@
 #undef PROC_VERSION_PATCH
 #endif
 
-#define PROC_VERSION_MAJOR 0
-#define PROC_VERSION_MINOR 5
+#define PROC_VERSION_MAJOR 1
+#define PROC_VERSION_MINOR 6
 #define PROC_VERSION_PATCH 0
 
 #ifdef MAX_REGISTER
@@ -46,7 +46,7 @@ DEF_CMD(POP,    0x02, 1, 1, 0, {
             // DO NOTHING
             break;
         case ARG_POINTER:
-            ASM_MOV_RAX_BY_PTR(TO_DATA_PTR(ARG(0)));
+            ASM_MOV_RAX_BY_DATA_OFFSET(TO_DATA_OFFSET(ARG(0)));
             break;
         case ARG_REGISTER:
             ASM_MOV_RAX_REG(ARG(0));
@@ -56,6 +56,15 @@ DEF_CMD(POP,    0x02, 1, 1, 0, {
             CONVERT_RBX_TO_DATA_PTR();
             ASM_MOV_RAX_BY_RBX();
             break;
+        case ARG_BASE_OFFSET:
+        case ARG_BASE_INDEX:
+            COMPUTE_DATA_INDEX(0);
+            ASM_MOV_RAX_BY_RSI_PLUS_RBX_TIMES_8();
+            break;
+        case ARG_FRAME:
+            CHECK_FRAME_SLOT(0);
+            ASM_MOV_RAX_BY_RBP_PLUS_DISP32(FRAME_SLOT_OFFSET(0));
+            break;
     }
     ASM_POP_RAX();
 })
@@ -147,7 +156,7 @@ DEF_CMD(RDINT,  0x13, 0, 0, 1, {
 }, {
     ASM_PUSH_RAX();
     ASM_SAVE_REGS();
-    ASM_CALL_VIA_RAX(READ_INT_CALL);
+    ASM_CALL_HELPER(READ_INT_CALL);
     ASM_MOV_RAX_RBX();
     ASM_RESTORE_REGS();
     ASM_MOV_RBX_RAX();
@@ -158,7 +167,7 @@ DEF_CMD(WRINT,  0x14, 0, 1, 0, {
 }, {
     ASM_MOV_RAX_RDI();
     ASM_SAVE_REGS();
-    ASM_CALL_VIA_RAX(WRITE_INT_CALL);
+    ASM_CALL_HELPER(WRITE_INT_CALL);
     ASM_RESTORE_REGS();
     ASM_POP_RAX();
 })
@@ -168,7 +177,7 @@ DEF_CMD(RDDBL,  0x15, 0, 0, 1, {
 }, {
     ASM_PUSH_RAX();
     ASM_SAVE_REGS();
-    ASM_CALL_VIA_RAX(READ_DOUBLE_CALL);
+    ASM_CALL_HELPER(READ_DOUBLE_CALL);
     ASM_RESTORE_REGS();
     ASM_MOV_XMM0_RAX();
 })
@@ -178,7 +187,7 @@ DEF_CMD(WRDBL,  0x16, 0, 1, 0, {
 }, {
     ASM_MOV_RAX_XMM0();
     ASM_SAVE_REGS();
-    ASM_CALL_VIA_RAX(WRITE_DOUBLE_CALL);
+    ASM_CALL_HELPER(WRITE_DOUBLE_CALL);
     ASM_RESTORE_REGS();
     ASM_POP_RAX();
 })
@@ -186,7 +195,7 @@ DEF_CMD(WRDBL,  0x16, 0, 1, 0, {
 DEF_CMD(HALT,   0x17, 0, 0, 0, {
     STOP_PROCESSOR
 }, {
-    ASM_CALL_VIA_RAX(HALT_CALL);
+    ASM_CALL_HELPER(HALT_CALL);
 })
 
 DEF_CMD(JMP,    0x18, 1, 0, 0, {
@@ -194,12 +203,17 @@ DEF_CMD(JMP,    0x18, 1, 0, 0, {
     LOAD_ARG(0, addr);
     JUMP_TO(addr);
 }, {
-    COMPUTE_ARG(0);
-    CONVERT_RBX_TO_CODE_PTR();
-    ASM_JMP_RBX();
+    CONSUME_FUEL_ON_BACK_EDGE(0);
+    if (ARG_TYPE(0) == ARG_VALUE) {
+        ASM_JMP_REL32(ARG(0));
+    } else {
+        COMPUTE_ARG(0);
+        CONVERT_RBX_TO_CODE_PTR();
+        ASM_JMP_RBX();
+    }
 })
 
-#define COND_JMP(name, opcode, operator_, asm_op) DEF_CMD(name, opcode, 1, 1, 1, {  \
+#define COND_JMP(name, opcode, operator_, cc) DEF_CMD(name, opcode, 1, 1, 1, {       \
     int64_t addr = 0;                                                               \
     LOAD_ARG(0, addr);                                                              \
     if (FROM_STACK(0) operator_ 0) {                                                \
@@ -207,18 +221,16 @@ DEF_CMD(JMP,    0x18, 1, 0, 0, {
     }                                                                               \
     TO_STACK(0) = FROM_STACK(0);                                                    \
 }, {                                                                                \
-    COMPUTE_ARG(0);                                                                 \
-    CONVERT_RBX_TO_CODE_PTR();                                                      \
-    ASM_CMP_IMM8_RAX(0);                                                            \
-    { asm_op }                                                                      \
+    CONSUME_FUEL_ON_BACK_EDGE(0);                                                   \
+    COND_BRANCH(0, cc, ASM_CMP_IMM8_RAX(0));                                        \
 })
 
-COND_JMP(JEQ,   0x19, ==, { ASM_JNE_REL8(2); ASM_JMP_RBX(); })
-COND_JMP(JGT,   0x1A, >, { ASM_JLE_REL8(2); ASM_JMP_RBX(); })
-COND_JMP(JLT,   0x1B, <, { ASM_JGE_REL8(2); ASM_JMP_RBX(); })
-COND_JMP(JNE,   0x1C, !=, { ASM_JE_REL8(2); ASM_JMP_RBX(); })
-COND_JMP(JGE,   0x1D, >=, { ASM_JL_REL8(2); ASM_JMP_RBX(); })
-COND_JMP(JLE,   0x1E, <=, { ASM_JG_REL8(2); ASM_JMP_RBX(); })
+COND_JMP(JEQ,   0x19, ==, CC_EQ)
+COND_JMP(JGT,   0x1A, >, CC_GT)
+COND_JMP(JLT,   0x1B, <, CC_LT)
+COND_JMP(JNE,   0x1C, !=, CC_NE)
+COND_JMP(JGE,   0x1D, >=, CC_GE)
+COND_JMP(JLE,   0x1E, <=, CC_LE)
 
 DEF_ALIAS(JZ, JEQ)
 DEF_ALIAS(JP, JGT)
@@ -282,6 +294,7 @@ DEF_CMD(CALL,   0x23, 1, 0, 0, {
     SAVE_ADDR();
     JUMP_TO(addr);
 }, {
+    CONSUME_FUEL();
     COMPUTE_ARG(0);
     CONVERT_RBX_TO_CODE_PTR();
     ASM_MOV_RAX_RCX();
@@ -291,7 +304,7 @@ DEF_CMD(CALL,   0x23, 1, 0, 0, {
 DEF_CMD(RET,    0x24, 0, 0, 0, {
     RESTORE_ADDR();
 }, {
-    ASM_MOV_BY_RBP_RBX();
+    ASM_LEAVE_ALL_FRAMES();
     ASM_ADD_IMM8_RBP(8);
     ASM_PUSH_RBX();
     ASM_RET();
@@ -303,7 +316,7 @@ DEF_CMD(DUMP,   0x26, 0, 0, 0, {
     PRINT_DUMP();
 }, {
     ASM_SAVE_REGS();
-    ASM_CALL_VIA_RAX(PRINT_DUMP_CALL);
+    ASM_CALL_HELPER(PRINT_DUMP_CALL);
     ASM_RESTORE_REGS();
 })
 
@@ -352,6 +365,349 @@ DEF_CMD(NOT,    0x32, 0, 1, 1, {
     ASM_MOVZX_AL_RAX();
 })
 
+DEF_CMD(CHKPT,  0x39, 0, 0, 0, {
+    SUSPEND_FOR_CHECKPOINT();
+}, {
+    ASM_SAVE_REGS();
+    ASM_PUSH_CALLEE_SAVED_REGS();
+    ASM_MOV_RSP_RDI();
+    ASM_MOV_RBP_RSI();
+    ASM_MOV_IMM64_RDX(NEXT_IP);
+    ASM_CALL_HELPER(CHECKPOINT_CALL);
+    ASM_POP_CALLEE_SAVED_REGS();
+    ASM_RESTORE_REGS();
+})
+
+/* SPAWN starts `func` on a new thread with a copy of the registers and the popped value as its
+ * only stack entry, and pushes a handle; the thread ends when `func` returns. JOIN replaces a
+ * handle with the value the thread had on top of its stack at that point. */
+DEF_CMD(SPAWN,  0x40, 1, 1, 1, {
+    int64_t addr = 0;
+    LOAD_ARG(0, addr);
+    SPAWN_THREAD(addr, FROM_STACK(0), TO_STACK(0));
+}, {
+    COMPUTE_ARG(0);
+    ASM_SAVE_REGS();
+    ASM_PUSH_CALLEE_SAVED_REGS();
+    ASM_MOV_RSP_RDI();
+    ASM_MOV_RBX_RSI();
+    ASM_CALL_HELPER(SPAWN_CALL);
+    ASM_MOV_RAX_RBX();
+    ASM_POP_CALLEE_SAVED_REGS();
+    ASM_RESTORE_REGS();
+    ASM_MOV_RBX_RAX();
+})
+
+DEF_CMD(JOIN,   0x41, 0, 1, 1, {
+    JOIN_THREAD(FROM_STACK(0), TO_STACK(0));
+}, {
+    ASM_MOV_RAX_RDI();
+    ASM_SAVE_REGS();
+    ASM_CALL_HELPER(JOIN_CALL);
+    ASM_MOV_RAX_RBX();
+    ASM_RESTORE_REGS();
+    ASM_MOV_RBX_RAX();
+})
+
+/* Atomic read-modify-write on a memory operand; each pushes the old value. CAS pops the expected
+ * value and, above it, the desired one. */
+DEF_CMD(CAS,    0x42, 1, 2, 1, {
+    TO_STACK(0) = FROM_STACK(0);
+    ATOMIC_COMPARE_EXCHANGE(0, TO_STACK(0), FROM_STACK(1));
+}, {
+    COMPUTE_ARG_ADDRESS(0);
+    ASM_MOV_RAX_RCX();
+    ASM_POP_RAX();
+    ASM_LOCK_CMPXCHG_RCX_BY_RBX();
+})
+
+DEF_CMD(FETCHADD, 0x43, 1, 1, 1, {
+    TO_STACK(0) = ATOMIC_FETCH_ADD(0, FROM_STACK(0));
+}, {
+    COMPUTE_ARG_ADDRESS(0);
+    ASM_LOCK_XADD_RAX_BY_RBX();
+})
+
+DEF_CMD(XCHG,   0x44, 1, 1, 1, {
+    TO_STACK(0) = ATOMIC_EXCHANGE(0, FROM_STACK(0));
+}, {
+    COMPUTE_ARG_ADDRESS(0);
+    ASM_XCHG_RAX_BY_RBX();
+})
+
+DEF_CMD(FENCE,  0x45, 0, 0, 0, {
+    MEMORY_FENCE();
+}, {
+    ASM_MFENCE();
+})
+
+/* Bulk operations on ranges of RAM words; the count is on top of the stack and the ranges below
+ * it. MEMCPY (dst, src, n) behaves like memmove and MEMSET (dst, value, n) fills. VADD and VMUL
+ * (dst, src, n) do dst[i] += src[i] and dst[i] *= src[i]; VSUM (src, n) and VDOT (a, b, n) push a
+ * total. The F-prefixed forms treat the words as doubles. */
+DEF_CMD(MEMCPY, 0x46, 0, 3, 0, {
+    BULK_COPY(FROM_STACK(0), FROM_STACK(1), FROM_STACK(2));
+}, {
+    ASM_BULK_CALL(MEMCPY_CALL);
+    ASM_POP_RBX();
+    ASM_POP_RBX();
+    ASM_POP_RAX();
+})
+
+DEF_CMD(MEMSET, 0x47, 0, 3, 0, {
+    BULK_FILL(FROM_STACK(0), FROM_STACK(1), FROM_STACK(2));
+}, {
+    ASM_BULK_CALL(MEMSET_CALL);
+    ASM_POP_RBX();
+    ASM_POP_RBX();
+    ASM_POP_RAX();
+})
+
+#define BULK_UPDATE_OP(name, opcode, type, kernel, helper) DEF_CMD(name, opcode, 0, 3, 0, { \
+    BULK_UPDATE(type, kernel, FROM_STACK(0), FROM_STACK(1), FROM_STACK(2));             \
+}, {                                                                                    \
+    ASM_BULK_CALL(helper);                                                              \
+    ASM_POP_RBX();                                                                      \
+    ASM_POP_RBX();                                                                      \
+    ASM_POP_RAX();                                                                      \
+})
+
+#define BULK_SUM_OP(name, opcode, type, helper) DEF_CMD(name, opcode, 0, 2, 1, {         \
+    BULK_SUM(type, FROM_STACK(0), FROM_STACK(1), TO_STACK(0));                          \
+}, {                                                                                    \
+    ASM_BULK_CALL(helper);                                                              \
+    ASM_POP_RAX();                                                                      \
+    ASM_MOV_RBX_RAX();                                                                  \
+})
+
+#define BULK_DOT_OP(name, opcode, type, helper) DEF_CMD(name, opcode, 0, 3, 1, {         \
+    BULK_DOT(type, FROM_STACK(0), FROM_STACK(1), FROM_STACK(2), TO_STACK(0));           \
+}, {                                                                                    \
+    ASM_BULK_CALL(helper);                                                              \
+    ASM_POP_RAX();                                                                      \
+    ASM_POP_RAX();                                                                      \
+    ASM_MOV_RBX_RAX();                                                                  \
+})
+
+BULK_SUM_OP(VSUM,       0x48, int64_t, VSUM_CALL)
+BULK_UPDATE_OP(VADD,    0x49, int64_t, VectorAdd, VADD_CALL)
+BULK_UPDATE_OP(VMUL,    0x50, int64_t, VectorMul, VMUL_CALL)
+BULK_DOT_OP(VDOT,       0x51, int64_t, VDOT_CALL)
+BULK_SUM_OP(FVSUM,      0x52, double, FVSUM_CALL)
+BULK_UPDATE_OP(FVADD,   0x53, double, VectorAdd, FVADD_CALL)
+BULK_UPDATE_OP(FVMUL,   0x54, double, VectorMul, FVMUL_CALL)
+BULK_DOT_OP(FVDOT,      0x55, double, FVDOT_CALL)
+
+/* The guest heap (see guest_heap.h), which lives right above the bss. ALLOC n pushes the RAM index
+ * of n fresh words, or 0 if it is out of memory; FREE p gives them back. REALLOC p n pushes where
+ * the block is now, with its contents, or 0 if it could not grow; the old block then stays. */
+DEF_CMD(ALLOC,  0x4A, 0, 1, 1, {
+    HEAP_ALLOC(FROM_STACK(0), TO_STACK(0));
+}, {
+    ASM_BULK_CALL(ALLOC_CALL);
+    ASM_MOV_RBX_RAX();
+})
+
+DEF_CMD(FREE,   0x4B, 0, 1, 0, {
+    HEAP_FREE(FROM_STACK(0));
+}, {
+    ASM_BULK_CALL(FREE_CALL);
+    ASM_POP_RAX();
+})
+
+DEF_CMD(REALLOC, 0x4C, 0, 2, 1, {
+    HEAP_REALLOC(FROM_STACK(0), FROM_STACK(1), TO_STACK(0));
+}, {
+    ASM_BULK_CALL(REALLOC_CALL);
+    ASM_POP_RAX();
+    ASM_MOV_RBX_RAX();
+})
+
+#undef BULK_UPDATE_OP
+#undef BULK_SUM_OP
+#undef BULK_DOT_OP
+
+/* Operations that bypass the stack: ADDR dst a b stores a + b into dst, which can be any operand
+ * POP accepts; MOV dst src copies. With register operands they compile to one or two x86
+ * instructions. */
+#define TERNARY_OP(name, opcode, operator_, lea, asm_op) DEF_CMD(name, opcode, 3, 0, 0, { \
+    int64_t lhs = 0;                                                            \
+    int64_t rhs = 0;                                                            \
+    LOAD_ARG(1, lhs);                                                           \
+    LOAD_ARG(2, rhs);                                                           \
+    STORE_ARG(0, lhs operator_ rhs);                                            \
+}, {                                                                            \
+    if (lea && ARG_TYPE(0) == ARG_REGISTER && ARG_TYPE(1) == ARG_REGISTER &&   \
+            ARG_TYPE(2) == ARG_REGISTER) {                                      \
+        ASM_LEA_BY_REG_PLUS_REG_REG(ARG(1), ARG(2), ARG(0));                    \
+    } else {                                                                    \
+        COMPUTE_ARG(2);                                                         \
+        ASM_MOV_RBX_RDX();                                                      \
+        COMPUTE_ARG(1);                                                         \
+        { asm_op; }                                                             \
+        ASM_MOV_RBX_RDX();                                                      \
+        STORE_RDX_TO_ARG(0);                                                    \
+    }                                                                           \
+})
+
+TERNARY_OP(ADDR, 0x56, +, true,  { ASM_ADD_RDX_RBX(); })
+TERNARY_OP(SUBR, 0x57, -, false, { ASM_SUB_RDX_RBX(); })
+TERNARY_OP(MULR, 0x58, *, false, { ASM_IMUL_RDX_RBX(); })
+
+#undef TERNARY_OP
+
+DEF_CMD(MOV,    0x59, 2, 0, 0, {
+    int64_t value = 0;
+    LOAD_ARG(1, value);
+    STORE_ARG(0, value);
+}, {
+    if (ARG_TYPE(0) == ARG_REGISTER && ARG_TYPE(1) == ARG_REGISTER) {
+        ASM_MOV_REG_REG(ARG(1), ARG(0));
+    } else {
+        COMPUTE_ARG(1);
+        ASM_MOV_RBX_RDX();
+        STORE_RDX_TO_ARG(0);
+    }
+})
+
+/* Compare-and-branch without touching the stack: BLT a b label jumps if a < b. DECJNZ x label
+ * decrements x in place and jumps unless it reached zero. */
+#define BRANCH(name, opcode, operator_, cc) DEF_CMD(name, opcode, 3, 0, 0, {       \
+    int64_t lhs = 0;                                                            \
+    int64_t rhs = 0;                                                            \
+    int64_t addr = 0;                                                           \
+    LOAD_ARG(0, lhs);                                                           \
+    LOAD_ARG(1, rhs);                                                           \
+    LOAD_ARG(2, addr);                                                          \
+    if (lhs operator_ rhs) {                                                    \
+        JUMP_TO(addr);                                                          \
+    }                                                                           \
+}, {                                                                            \
+    CONSUME_FUEL_ON_BACK_EDGE(2);                                               \
+    COND_BRANCH(2, cc, COMPARE_ARGS(0, 1));                                     \
+})
+
+BRANCH(BEQ,     0x60, ==, CC_EQ)
+BRANCH(BNE,     0x61, !=, CC_NE)
+BRANCH(BLT,     0x62, <, CC_LT)
+BRANCH(BLE,     0x63, <=, CC_LE)
+BRANCH(BGT,     0x64, >, CC_GT)
+BRANCH(BGE,     0x65, >=, CC_GE)
+
+#undef BRANCH
+
+DEF_CMD(DECJNZ, 0x66, 2, 0, 0, {
+    int64_t counter = 0;
+    int64_t addr = 0;
+    LOAD_ARG(0, counter);
+    LOAD_ARG(1, addr);
+    STORE_ARG(0, --counter);
+    if (counter != 0) {
+        JUMP_TO(addr);
+    }
+}, {
+    CONSUME_FUEL_ON_BACK_EDGE(1);
+    COND_BRANCH(1, CC_NE, DECREMENT_ARG(0));
+})
+
+/* ENTER n gives the current function n zeroed locals, @0 to @n-1, until LEAVE or RET. A
+ * function may enter several frames; the locals are those of the latest one. */
+DEF_CMD(ENTER,  0x67, 1, 0, 0, {
+    int64_t size = 0;
+    LOAD_ARG(0, size);
+    ENTER_FRAME(size);
+}, {
+    ASM_ENTER_FRAME(0);
+})
+
+DEF_CMD(LEAVE,  0x68, 0, 0, 0, {
+    LEAVE_FRAME();
+}, {
+    ASM_LEAVE_FRAME();
+})
+
+/* NCALL id calls the host function registered under `id` (see native_functions.h); it pops its
+ * own arguments and pushes its result. */
+DEF_CMD(NCALL,  0x69, 1, 0, 0, {
+    int64_t id = 0;
+    LOAD_ARG(0, id);
+    NATIVE_CALL(id);
+}, {
+    ASM_NATIVE_CALL(0);
+})
+
+/* FP intrinsics. The JIT uses a single SSE instruction where there is one (FFLOOR to FROUND need
+ * SSE4.1 and FMA the FMA extension) and otherwise calls the <cmath> function the interpreter
+ * uses, so the engines agree bit for bit. FMIN a b and FMAX a b behave like minsd and maxsd: b
+ * wins unless a is strictly smaller (larger). FMA a b c is a * b + c with a single rounding. FROUND
+ * rounds to nearest even. */
+#define FP_UNARY_OP(name, opcode, function, asm_op) DEF_CMD(name, opcode, 0, 1, 1, {   \
+    AS_DOUBLE(TO_STACK(0)) = function(AS_DOUBLE(FROM_STACK(0)));                    \
+}, {                                                                                \
+    ASM_MOV_RAX_XMM0();                                                             \
+    { asm_op }                                                                      \
+    ASM_MOV_XMM0_RAX();                                                             \
+})
+
+#define FP_BINARY_OP(name, opcode, function, asm_op) DEF_CMD(name, opcode, 0, 2, 1, {  \
+    AS_DOUBLE(TO_STACK(0)) = function(AS_DOUBLE(FROM_STACK(0)), AS_DOUBLE(FROM_STACK(1))); \
+}, {                                                                                \
+    ASM_MOVSD_BY_RSP_XMM0();                                                        \
+    ASM_MOV_RAX_XMM1();                                                             \
+    ASM_ADD_IMM8_RSP(8);                                                            \
+    { asm_op }                                                                      \
+    ASM_MOV_XMM0_RAX();                                                             \
+})
+
+FP_UNARY_OP(FSQRT,  0x70, std::sqrt, { ASM_SQRTSD_XMM0_XMM0(); })
+
+DEF_CMD(FABS,   0x71, 0, 1, 1, {
+    AS_DOUBLE(TO_STACK(0)) = std::fabs(AS_DOUBLE(FROM_STACK(0)));
+}, {
+    ASM_BTR_IMM8_RAX(63);
+})
+
+#define FP_MIN_MAX_OP(name, opcode, operator_, asm_op) DEF_CMD(name, opcode, 0, 2, 1, { \
+    double lhs = AS_DOUBLE(FROM_STACK(0));                                          \
+    double rhs = AS_DOUBLE(FROM_STACK(1));                                          \
+    AS_DOUBLE(TO_STACK(0)) = lhs operator_ rhs ? lhs : rhs;                         \
+}, {                                                                                \
+    ASM_MOVSD_BY_RSP_XMM0();                                                        \
+    ASM_MOV_RAX_BY_RSP();                                                           \
+    { asm_op }                                                                      \
+    ASM_MOV_XMM0_RAX();                                                             \
+    ASM_ADD_IMM8_RSP(8);                                                            \
+})
+
+FP_MIN_MAX_OP(FMIN, 0x72, <, { ASM_MINSD_BY_RSP_XMM0(); })
+FP_MIN_MAX_OP(FMAX, 0x73, >, { ASM_MAXSD_BY_RSP_XMM0(); })
+
+DEF_CMD(FMA,    0x74, 0, 3, 1, {
+    AS_DOUBLE(TO_STACK(0)) = std::fma(AS_DOUBLE(FROM_STACK(0)), AS_DOUBLE(FROM_STACK(1)), AS_DOUBLE(FROM_STACK(2)));
+}, {
+    ASM_MOV_RAX_XMM2();
+    ASM_MOVSD_BY_RSP_XMM1();
+    ASM_MOVSD_BY_RSP_PLUS_8_XMM0();
+    ASM_ADD_IMM8_RSP(16);
+    ASM_FMA_XMM0_XMM1_XMM2_RAX();
+})
+
+FP_UNARY_OP(FFLOOR, 0x75, std::floor, { ASM_ROUND_XMM0(ROUND_FLOOR, FLOOR_CALL); })
+FP_UNARY_OP(FCEIL,  0x76, std::ceil, { ASM_ROUND_XMM0(ROUND_CEIL, CEIL_CALL); })
+FP_UNARY_OP(FTRUNC, 0x77, std::trunc, { ASM_ROUND_XMM0(ROUND_TRUNC, TRUNC_CALL); })
+FP_UNARY_OP(FROUND, 0x78, std::nearbyint, { ASM_ROUND_XMM0(ROUND_CURRENT_MODE, NEARBYINT_CALL); })
+FP_UNARY_OP(FSIN,   0x79, std::sin, { ASM_MATH_CALL(SIN_CALL); })
+FP_UNARY_OP(FCOS,   0x7A, std::cos, { ASM_MATH_CALL(COS_CALL); })
+FP_UNARY_OP(FTAN,   0x7B, std::tan, { ASM_MATH_CALL(TAN_CALL); })
+FP_BINARY_OP(FATAN2, 0x7C, std::atan2, { ASM_MATH_CALL(ATAN2_CALL); })
+FP_UNARY_OP(FEXP,   0x7D, std::exp, { ASM_MATH_CALL(EXP_CALL); })
+FP_UNARY_OP(FLOG,   0x7E, std::log, { ASM_MATH_CALL(LOG_CALL); })
+FP_BINARY_OP(FPOW,  0x7F, std::pow, { ASM_MATH_CALL(POW_CALL); })
+
+#undef FP_UNARY_OP
+#undef FP_BINARY_OP
+#undef FP_MIN_MAX_OP
+
 #ifdef DEF_ALIAS_UNDEFINED
 #undef DEF_ALIAS_UNDEFINED
 #undef DEF_ALIAS
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+class OutputStream;
+
+/* Read-only mapping of a whole file; input streams can parse it in place without read() calls. */
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    /* Fails for descriptors that cannot be mapped, e.g. pipes and terminals. */
+    bool TryMap(int fd);
+    void Unmap();
+    const char* Data() const;
+    size_t Size() const;
+
+private:
+    void* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+/* Buffered guest I/O shared by the interpreter and the JIT helpers. Numbers are parsed and
+ * formatted by hand, so RDINT/WRINT never touch stdio locks or locale tables; the text produced
+ * is byte-identical to printf("%ld\n") and printf("%lf\n"). Streams never own their descriptor. */
+
+class InputStream {
+public:
+    static constexpr size_t kBufferSize = 1 << 16;
+    static constexpr size_t kMaxTokenLength = 512;
+
+    InputStream();
+    explicit InputStream(int fd);
+
+    void Attach(int fd);
+    void Attach(const char* data, size_t size);
+    void Rewind();
+    /* `output` is flushed before every blocking read, so prompts appear before input is awaited. */
+    void Tie(OutputStream* output);
+    /* In binary mode every value is a raw little-endian 8-byte word instead of text. */
+    void SetBinary(bool binary);
+
+    /* Mimic scanf("%ld") / scanf("%lf"): on failure `value` is left untouched. */
+    bool ReadInt(int64_t* value);
+    bool ReadDouble(double* value);
+
+private:
+    bool SkipSpaces();
+    bool ReadWord(void* value);
+    void Refill();
+
+    std::unique_ptr<char[]> buffer_;
+    const char* memory_ = nullptr;
+    const char* cur_ = nullptr;
+    const char* end_ = nullptr;
+    int fd_ = -1;
+    bool eof_ = true;
+    bool binary_ = false;
+    OutputStream* tied_output_ = nullptr;
+};
+
+class OutputStream {
+public:
+    static constexpr size_t kBufferSize = 1 << 16;
+    static constexpr size_t kMaxRecordLength = 512;
+
+    OutputStream();
+    explicit OutputStream(int fd);
+    OutputStream(const OutputStream&) = delete;
+    OutputStream& operator=(const OutputStream&) = delete;
+    ~OutputStream();
+
+    void Attach(int fd);
+    /* Output beyond `capacity` bytes is dropped. */
+    void Attach(char* buffer, size_t capacity);
+    void Rewind();
+
+    void WriteInt(int64_t value);
+    void WriteDouble(double value);
+    void Printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    void Flush();
+
+    /* Bytes stored so far in an attached memory buffer. */
+    size_t GetMemorySize() const;
+
+private:
+    char* Reserve(size_t length);
+
+    std::unique_ptr<char[]> buffer_;
+    size_t size_ = 0;
+    int fd_ = -1;
+    char* memory_ = nullptr;
+    size_t memory_capacity_ = 0;
+    size_t memory_size_ = 0;
+};
+
+/* Process-wide streams over stdin/stdout, used when no other streams are set. */
+InputStream* StandardInput();
+OutputStream* StandardOutput();
@@ -1,22 +1,39 @@
 #pragma once
 
 #include <instruction_set.h>
-#include <object.h>
+#include <executable.h>
+#include <processor.h>
+#include <ram.h>
+#include <io_stream.h>
+#include <snapshot.h>
+#include <guest_threads.h>
+#include <guest_heap.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 #include <sys/mman.h>
 
 class ProtectedMemoryArena {
 public:
     explicit ProtectedMemoryArena(int64_t size, int prot_flags = PROT_READ | PROT_WRITE);
+    ProtectedMemoryArena(const ProtectedMemoryArena&) = delete;
+    ProtectedMemoryArena& operator=(const ProtectedMemoryArena&) = delete;
     ~ProtectedMemoryArena();
     void* Begin() const;
     void* End() const;
     int64_t Size() const;
+    void Protect(int prot_flags);
+    void Clear();
+    /* Maps `size` bytes of `fd` copy-on-write over the arena starting at `offset`. */
+    bool TryMapFile(int64_t offset, int64_t size, int fd, int64_t file_offset);
 
 private:
     void* pre_canary_;
     void* data_;
     void* post_canary_;
     int64_t size_;
+    int prot_flags_;
 };
 
 class ExecutionContext {
@@ -25,23 +42,114 @@ public:
     static constexpr int64_t kSize = sizeof(int64_t) * 6; /* Callee-saved registers: RBP, RBX, R12-R15 */
 private:
     void* rsp;
-    friend void PrepareUserContext(ExecutionContext&, char*, void*, void*);
+    friend void PrepareUserContext(ExecutionContext&, char*, void*, const int64_t*);
 };
 
-class JITCompiler {
+class JITCompiler;
+
+/* Everything a single run of compiled code mutates. The native code itself only addresses guest
+ * memory relative to RSI, so any number of instances may execute one JITCompiler concurrently,
+ * each on its own thread. */
+class JITInstance {
 public:
-    JITCompiler();
-    ~JITCompiler();
+    static constexpr int64_t kDataSize = RAM::kChunkSize * RAM::kMaxChunksCnt * sizeof(int64_t);
+
+    JITInstance();
+
+    void SetIO(InputStream* input, OutputStream* output);
+    bool Execute(const JITCompiler& compiler);
+    void Reset();
+    Processor::ExecutionStatus GetStatus() const;
+
+    /* CHKPT (or SIGUSR1, serviced at the next CHKPT) writes a snapshot to `path`. */
+    void SetCheckpointPath(std::string path);
+    /* Maps the snapshot's RAM image and makes the next Execute() resume from it. */
+    bool TryRestore(const JITCompiler& compiler, const char* path, std::string* error);
+    /* Makes Execute() return at the next CHKPT; calling it again resumes from there. */
+    void SetStopAtCheckpoint(bool stop);
+    /* Makes Execute() return after `fuel` back-edges and calls; calling it again resumes, possibly
+     * on another thread. 0 means no limit. */
+    void SetFuel(int64_t fuel);
+    /* Stopped at a CHKPT or out of fuel, so the next Execute() resumes. */
+    bool IsSuspended() const;
+
+    InputStream* Input() const;
+    OutputStream* Output() const;
+    std::mutex* IOMutex() const;
+    void Stop(Processor::ExecutionStatus status);
+    /* Stop() with an error, from a helper: records the failing instruction, unknown for a null
+     * `return_address`, and the guest call stack for the stack trace. */
+    void Fail(Processor::ExecutionStatus status, const void* return_address, const int64_t* call_stack_top);
+    /* Where the last Fail() happened: -1 for an unknown instruction, return addresses outermost first. */
+    int64_t GetFailureIP() const;
+    const std::vector<int64_t>& GetFailureCallStack() const;
+    /* SPAWN and JOIN; a spawned thread is another instance sharing this one's RAM. */
+    int64_t Spawn(const int64_t* saved_regs, uint64_t entry);
+    bool Join(int64_t handle, int64_t* result);
+    /* `top` is RAX at the thread's last RET: the result, unless the data stack, which ends at
+     * `stack_top`, is empty; the result is 0 then, as in the interpreter. */
+    void FinishThread(int64_t top, const int64_t* stack_top);
+    /* This thread's view of the guest heap; its base is the compiled program's. */
+    GuestHeap* Heap();
+    /* Called by CHKPT code with the registers it pushed, the call stack top and the next IP. */
+    void Suspend(const int64_t* saved_regs, const int64_t* call_stack_top, uint64_t resume_ip);
+
+private:
+    explicit JITInstance(std::shared_ptr<ProtectedMemoryArena> data);
+    void PrepareStart(const JITCompiler& compiler);
+    char* DataBase() const;
+    bool TryWriteCheckpoint(const JITCompiler& compiler, std::string* error) const;
 
+    std::shared_ptr<ProtectedMemoryArena> data_;
+    ProtectedMemoryArena data_stack_, call_stack_;
+    ExecutionContext supervisor_context_, user_context_;
+    InputStream* input_ = StandardInput();
+    OutputStream* output_ = StandardOutput();
+    Processor::ExecutionStatus status_ = Processor::kExecStatusOk;
+    std::string checkpoint_path_;
+    bool stop_at_checkpoint_ = false;
+    int64_t fuel_per_run_ = 0;
+    std::shared_ptr<GuestThreads> threads_;
+    std::mutex* io_mutex_ = nullptr;
+    GuestHeap heap_;
+    const JITCompiler* compiler_ = nullptr;
+    bool is_thread_ = false;
+    int64_t thread_result_ = 0;
+    std::unique_ptr<Snapshot> restored_;
+    const int64_t* suspended_regs_ = nullptr;
+    const int64_t* suspended_call_stack_ = nullptr;
+    uint64_t suspended_ip_ = 0;
+    int64_t failure_ip_ = -1;
+    std::vector<int64_t> failure_call_stack_;
+};
+
+class JITCompiler {
+public:
     const Object::ProcVersion& GetProcessorVersion() const;
-    void Compile(const Object& obj);
-    void Execute();
+    void Compile(const Executable& executable);
+    void* EntryPoint() const;
+    /* Bottom return address of a spawned thread's call stack. */
+    void* ThreadExitPoint() const;
+    uint64_t GetProgramHash() const;
+    /* The executable's __bss_size, where the guest heap starts. */
+    int64_t HeapBase() const;
+
+    /* Translation between bytecode offsets and native code, for call stacks in snapshots. */
+    void* InstructionAddress(uint64_t ip) const;
+    uint64_t ReturnAddressToIP(const void* return_address) const;
+    /* The instruction a helper called from native code returns into. */
+    uint64_t HelperReturnAddressToIP(const void* return_address) const;
 
 private:
+    /* False, before any code is installed, if `metadata` disagrees with the instructions it finds. */
+    bool TryCompile(BytecodeView bytecode, const ProgramMetadata& metadata);
+
     std::optional<ProtectedMemoryArena> code_;
-    ProtectedMemoryArena data_;
-    ProtectedMemoryArena data_stack_, call_stack_;
     std::vector<void*> code_addr_table_;
+    std::vector<int64_t> instruction_starts_;
+    int64_t thread_exit_offset_ = 0;
+    uint64_t program_hash_ = 0;
+    int64_t heap_base_ = 0;
 
     const Object::ProcVersion version_{PROC_VERSION_MAJOR, PROC_VERSION_MINOR, PROC_VERSION_PATCH};
 };
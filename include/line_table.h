@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Where the bytecode came from: asm records a row for every instruction it emits, ld carries the
+ * rows over into the executable. A row covers the bytecode from its position up to the next row's;
+ * rows with a negative file cover code nothing is known about. */
+struct LineTable {
+    struct Row {
+        int64_t position;
+        int32_t file;
+        int32_t line;
+    };
+
+    std::vector<std::string> files;
+    /* Sorted by position. */
+    std::vector<Row> rows;
+
+    bool Empty() const;
+    /* The row covering `position`, nullptr if no source is known for it. */
+    const Row* Find(int64_t position) const;
+};
+
+/* The rows as stored in images: per row, the position delta shifted left by one with the low bit
+ * set if the file changes, the file index if it does, then the line delta. All varint-coded, so a
+ * row usually takes two bytes. */
+void EncodeLineRows(const std::vector<LineTable::Row>& rows, std::string* out);
+/* False unless exactly `rows_cnt` rows with increasing positions below `bytecode_size` and files
+ * below `files_cnt` fill the data. */
+bool TryDecodeLineRows(const char* data, size_t size, int64_t rows_cnt, int64_t files_cnt, int64_t bytecode_size,
+                       std::vector<LineTable::Row>* rows);
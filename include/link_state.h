@@ -0,0 +1,54 @@
+#pragma once
+
+#include <object.h>
+#include <image.h>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/* What ld -incremental keeps next to the executable, as a.vexe.ldstate, to relink it after some
+ * inputs change: where every input went, the global symbols and the fields that hold a global
+ * symbol defined by another input. A full incremental link leaves room after every input's code
+ * and bss, so that an edited input can be put back in place while it still fits. */
+struct LinkState {
+    struct Input {
+        std::string path;
+        uint64_t hash = 0;
+        /* The slot the input's code went into, and how much of it the code takes. */
+        int64_t code_offset = 0;
+        int64_t code_size = 0;
+        int64_t code_used = 0;
+        int64_t bss_offset = 0;
+        int64_t bss_size = 0;
+        int64_t bss_used = 0;
+    };
+
+    /* A global symbol with its value in the executable. */
+    struct Definition {
+        std::string name;
+        size_t input = 0;
+        Symbol symbol;
+    };
+
+    /* A field of `size` bytes at `position` in the executable that holds a global symbol of another
+     * input. Fields keep their size: a new value that does not fit takes a full link. */
+    struct Relocation {
+        size_t input = 0;
+        int64_t position = 0;
+        int size = 0;
+        std::string symbol;
+    };
+
+    ObjectFormat format = kObjectFormatImage;
+    uint64_t executable_hash = 0;
+    std::vector<Input> inputs;
+    std::vector<Definition> definitions;
+    std::vector<Relocation> relocations;
+};
+
+/* FNV-1a over the file's contents; false if it cannot be read. */
+bool TryHashFile(const char* path, uint64_t* hash);
+
+void WriteLinkState(const LinkState& state, std::ostream* out);
+bool TryReadLinkState(const char* path, LinkState* state, std::string* error);
@@ -1,7 +1,36 @@
 #pragma once
 
+#include <archive.h>
+#include <link_state.h>
 #include <object.h>
+#include <memory>
 #include <vector>
 
+struct LinkOptions {
+    /* Drop the functions and variables that nothing reachable from the entry point refers to. */
+    bool collect_garbage = true;
+    /* Merge the objects into one module and optimize it as a whole first (see OptimizeProgram). */
+    bool lto = false;
+    /* Threads for decoding, symbol resolution and relocation; 0 for one per hardware thread. */
+    int threads = 0;
+};
+
 bool TryLoadObject(std::vector<Object>* obj, const char* filename);
-bool TryLink(const std::vector<Object>& objects, Object* executable, std::string* error);
+/* Appends the objects read from `paths`, read on up to `threads` threads (0 for one per hardware
+ * thread). On failure nothing is appended and `error` names the first file that failed. */
+bool TryLoadObjects(const std::vector<std::string>& paths, int threads, std::vector<Object>* objects,
+                    std::string* error);
+/* Appends the archive members defining the symbols the objects require, then those the appended
+ * members require, and so on. A symbol is taken from the first archive indexing it; the members
+ * nobody needs are never read. */
+bool TryPullArchiveMembers(const std::vector<std::unique_ptr<MappedArchive>>& archives, std::vector<Object>* objects,
+                           std::string* error);
+/* With `state`, links for TryRelink instead: no garbage collection or LTO, room to grow left after
+ * every object, and the link recorded in `state` (all but the inputs' paths and hashes). */
+bool TryLink(const std::vector<Object>& objects, const LinkOptions& options, Object* executable, std::string* error,
+             LinkState* state = nullptr);
+/* Puts a new version of object #input back into its slot in an executable TryLink made with
+ * `state`, re-applying only the fields that name its symbols, and updates `state`. Fails, leaving
+ * both untouched, if the object outgrew its slot, a field cannot hold a symbol's new value, or a
+ * symbol other objects use is gone; a full link is needed then. */
+bool TryRelink(const Object& object, size_t input, Object* executable, LinkState* state, std::string* error);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+/* Host functions that guest code calls with NCALL id. A native function takes up to
+ * kMaxNativeArgs int64_t words, popped from the guest stack with the deepest one as the first
+ * argument, and returns void or an int64_t that is pushed. Doubles travel as their bits.
+ *
+ * The table is process-wide and not synchronized: register everything before preparing the
+ * programs that use it, since the JIT binds NCALL to the function at compile time. */
+
+constexpr int kMaxNativeFunctions = 256;
+constexpr int kMaxNativeArgs = 6;
+
+struct NativeFunction {
+    void* address = nullptr;
+    int args_cnt = 0;
+    bool has_result = false;
+    /* Calls `address` with args_cnt words from `args`; the interpreter's way in. */
+    int64_t (*invoke)(void* address, const int64_t* args) = nullptr;
+};
+
+bool TryRegisterNativeFunction(int64_t id, const NativeFunction& function, std::string* error);
+/* nullptr if nothing is registered under `id`. */
+const NativeFunction* FindNativeFunction(int64_t id);
+
+template <class R, class... Args, size_t... I>
+int64_t InvokeNativeFunction(void* address, const int64_t* args, std::index_sequence<I...>) {
+    auto function = reinterpret_cast<R (*)(Args...)>(address);
+    if constexpr (std::is_void_v<R>) {
+        function(args[I]...);
+        return 0;
+    } else {
+        return function(args[I]...);
+    }
+}
+
+template <class R, class... Args>
+bool TryRegisterNativeFunction(int64_t id, R (*function)(Args...), std::string* error) {
+    static_assert((std::is_same_v<Args, int64_t> && ...), "native functions take int64_t arguments");
+    static_assert(std::is_void_v<R> || std::is_same_v<R, int64_t>, "native functions return void or int64_t");
+    static_assert(sizeof...(Args) <= kMaxNativeArgs, "too many arguments for a native function");
+
+    NativeFunction native;
+    native.address = reinterpret_cast<void*>(function);
+    native.args_cnt = sizeof...(Args);
+    native.has_result = !std::is_void_v<R>;
+    native.invoke = [](void* address, const int64_t* args) {
+        return InvokeNativeFunction<R, Args...>(address, args, std::index_sequence_for<Args...>());
+    };
+    return TryRegisterNativeFunction(id, native, error);
+}
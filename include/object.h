@@ -1,6 +1,9 @@
 #pragma once
 
 #include <oosf/types.h>
+#include <line_table.h>
+#include <program_metadata.h>
+#include <optional>
 #include <vector>
 #include <unordered_map>
 
@@ -42,6 +45,10 @@ struct Object : public Serializable {
     std::unordered_map<std::string, Symbol> defined_symbols;
     std::unordered_map<int64_t, std::string> required_symbols;
     int64_t bss_size = 0;
+    /* Set by ld for executables. Only the image format stores it. */
+    std::optional<ProgramMetadata> metadata;
+    /* Set by asm, merged by ld. Only the image format stores it. */
+    LineTable line_table;
 
     static constexpr char kTypeName[] = "vobj";
 
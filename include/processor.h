@@ -2,9 +2,14 @@
 
 #include <instruction_set.h>
 #include <array>
+#include <io_stream.h>
 #include <vector>
 #include <object.h>
+#include <executable.h>
 #include <ram.h>
+#include <guest_threads.h>
+#include <guest_heap.h>
+#include <snapshot.h>
 
 class Processor {
 public:
@@ -18,23 +23,64 @@ public:
         kExecStatusEmptyDataStack,
         kExecStatusEmptyCallStack,
         kExecStatusInvalidOpcode,
-        kExecStatusDivZero
+        kExecStatusDivZero,
+        kExecStatusCheckpoint,
+        kExecStatusOutOfFuel,
+        kExecStatusInvalidThread,
+        kExecStatusNoFrame,
+        kExecStatusInvalidNativeCall,
+        kExecStatusInvalidHeapPointer
     };
     static constexpr int kDataStackMaxSize = 4096;
     static constexpr int kCallStackMaxSize = 4096;
+    /* In words, counting two words of bookkeeping per frame. */
+    static constexpr int kFrameStackMaxSize = 1 << 16;
 
     const Object::ProcVersion& GetVersion() const;
-    bool Execute(const std::vector<int8_t>& bytecode, RAM* ram);
+    void SetIO(InputStream* input, OutputStream* output);
+    /* Where SPAWN registers the threads it starts; they share the RAM passed to Execute(). */
+    void SetThreads(GuestThreads* threads);
+    /* Where ALLOC starts carving: the executable's __bss_size. */
+    void SetHeapBase(int64_t base);
+    /* Returns the blocks this thread caches to the heap in RAM, as before a snapshot. */
+    void FlushHeap(RAM* ram);
+    void Reset();
+    /* Returns true on HALT and when suspended at a checkpoint or out of fuel (see GetStatus());
+     * calling it again resumes where it stopped. */
+    bool Execute(BytecodeView bytecode, RAM* ram);
+    ExecutionStatus GetStatus() const;
+    /* Every Execute() runs at most `fuel` instructions; 0 means no limit. */
+    void SetFuel(int64_t fuel);
+    void SaveState(Snapshot* snapshot) const;
+    bool TryRestoreState(const Snapshot& snapshot);
     void Dump() const;
-    void PrintStackTrace(const Object& obj) const;
+    void PrintStackTrace(const Executable& executable) const;
 
 private:
-    inline bool FillArgs(const std::vector<int8_t>& bytecode, int64_t** args, int64_t* arg_stubs, RAM* ram, int argcnt, uint64_t* ip);
+    bool TrySpawn(BytecodeView bytecode, RAM* ram, uint64_t entry, int64_t arg, int64_t* handle);
+    /* Whether the current function has ENTERed a frame that it has not left yet. */
+    bool HasFrame() const;
+    void LeaveFrame();
+    bool TryNativeCall(int64_t id);
+    inline bool FillArgs(BytecodeView bytecode, int64_t** args, int64_t* arg_stubs, RAM* ram, int argcnt, uint64_t* ip);
 
     std::array<int64_t, (MAX_REGISTER) + 1> registers_;
     std::vector<int64_t> data_stack_;
     std::vector<int64_t> call_stack_;
+    /* Frames in Snapshot::frame_stack layout; the current one is on top. */
+    std::vector<int64_t> frame_stack_;
     uint64_t instruction_pointer_ = 0;
     ExecutionStatus status_ = kExecStatusOk;
+    int64_t fuel_per_run_ = 0;
+    GuestThreads* threads_ = nullptr;
+    std::mutex* io_mutex_ = nullptr;
+    GuestHeap heap_;
+    bool is_thread_ = false;
+    InputStream* input_ = StandardInput();
+    OutputStream* output_ = StandardOutput();
     const Object::ProcVersion version_{PROC_VERSION_MAJOR, PROC_VERSION_MINOR, PROC_VERSION_PATCH};
 };
+
+/* The failing instruction, if `ip` is not negative, then the return addresses on `call_stack` from
+ * the innermost one, each with its function and, where the line table has it, its source line. */
+void PrintStackTrace(OutputStream* out, const Executable& executable, int64_t ip, const std::vector<int64_t>& call_stack);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <bytecode_view.h>
+#include <cstdint>
+#include <vector>
+
+/* What a linear decode of the bytecode tells about it. ld stores this in executables (see the
+ * image metadata section); anything else either reads it back or calls AnalyzeProgram(). */
+
+/* A run of instructions entered only at `start`. Its stack effect counts the block's own
+ * instructions; CALL and NCALL count as neutral, since what their callees pop and push is not
+ * known statically. */
+struct BasicBlock {
+    int64_t start = 0;
+    int64_t end = 0;
+    /* Depth at the end and lowest depth reached, relative to the depth on entry. */
+    int32_t stack_delta = 0;
+    int32_t stack_min = 0;
+    /* Some direct jump, branch, CALL or SPAWN names `start`. */
+    bool jump_target = false;
+};
+
+/* A function symbol's bytecode, up to the next function or the end of the bytecode. */
+struct FunctionExtent {
+    int64_t start = 0;
+    int64_t end = 0;
+};
+
+struct ProgramMetadata {
+    /* Offset of the first byte that is not a valid instruction, -1 if everything decodes. Nothing
+     * below covers the bytecode from there on. */
+    int64_t invalid_at = -1;
+    /* Bit i is set if some operand names guest register i. */
+    uint8_t used_registers = 0;
+    std::vector<int64_t> instruction_starts;
+    std::vector<BasicBlock> blocks;
+    std::vector<FunctionExtent> functions;
+};
+
+/* `function_starts` need not be sorted; entries outside the bytecode are dropped. */
+void AnalyzeProgram(BytecodeView bytecode, std::vector<int64_t> function_starts, ProgramMetadata* metadata);
@@ -1,7 +1,11 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
+#include <mutex>
+#include <vector>
 
+/* At() and Grow() may be called from several guest threads at once; the other methods may not. */
 class RAM {
 public:
     static constexpr int kChunkSizeLog = 9;
@@ -14,13 +18,28 @@ public:
     RAM();
     ~RAM();
     int64_t* At(int64_t idx, bool* ok);
+    /* Like At(), but also clamps *cnt to the words left in idx's chunk, which are contiguous. */
+    int64_t* Span(int64_t idx, int64_t* cnt, bool* ok);
     bool Resize(int64_t max_idx);
+    /* Like Resize(), but never shrinks. */
+    bool Grow(int64_t max_idx);
+    void Clear();
+
+    /* Snapshot support: chunks that have been touched so far, and adoption of a mapped RAM image
+     * whose i-th chunk becomes chunk indices[i]. The image is mapped copy-on-write. */
+    void GetTouchedChunks(std::vector<int64_t>* indices, std::vector<const void*>* chunks) const;
+    bool TryMapImage(int fd, int64_t offset, const std::vector<int64_t>& indices);
 
 private:
     Chunk* AllocateChunk();
     Chunk* ExtractFromPool();
     void InsertInPool(Chunk* chunk);
+    bool IsMapped(const Chunk* chunk) const;
+    void UnmapImage();
     int chunks_cnt_ = kInitialChunksCnt;
     int pool_size_ = 0;
     std::array<Chunk*, kMaxChunksCnt> chunk_table_;
+    std::mutex allocation_mutex_;
+    Chunk* image_ = nullptr;
+    int64_t image_chunks_cnt_ = 0;
 };
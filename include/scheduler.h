@@ -0,0 +1,13 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+/* One time slice of a green thread: runs it until it yields or finishes and returns true if it
+ * yielded and wants more time. Slices of one thread never overlap, but consecutive slices may run
+ * on different OS threads. */
+using GreenThread = std::function<bool()>;
+
+/* Multiplexes `threads` over `workers_cnt` OS threads. Every worker round-robins its own queue and
+ * steals from the other queues when it runs dry. Returns when every thread has finished. */
+void RunGreenThreads(std::vector<GreenThread> threads, int workers_cnt);
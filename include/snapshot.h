@@ -0,0 +1,57 @@
+#pragma once
+
+#include <instruction_set.h>
+#include <executable.h>
+#include <array>
+#include <csignal>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Engine-neutral image of a suspended program. A snapshot taken by `vm` can be restored by `jit`
+ * and vice versa as long as the bytecode is the same. On disk the RAM chunks come last and are
+ * page-aligned, so restoring maps them instead of reading them. */
+struct Snapshot {
+    static constexpr int64_t kChunkBytes = 4096;
+
+    Snapshot() = default;
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    ~Snapshot();
+
+    uint64_t program_hash = 0;
+    uint64_t instruction_pointer = 0;
+    std::array<int64_t, (MAX_REGISTER) + 1> registers{};
+    std::vector<int64_t> data_stack;            /* Bottom first */
+    std::vector<int64_t> call_stack;            /* Bytecode return addresses, bottom first */
+    /* ENTER frames, bottom first, each laid out as its locals, the call depth it was entered at
+     * and the number of locals. */
+    std::vector<int64_t> frame_stack;
+    std::vector<int64_t> chunk_indices;         /* RAM chunks present in the image, ascending */
+
+    /* Filled by the engine before writing: contents of the chunks listed in chunk_indices. */
+    std::vector<const void*> chunks;
+
+    /* Filled by TryReadSnapshot: the open snapshot file and the offset of the RAM image in it. */
+    int image_fd = -1;
+    int64_t image_offset = 0;
+};
+
+struct SnapshotFrame {
+    int64_t begin;                              /* Index of the first local in frame_stack */
+    int64_t size;
+    int64_t depth;
+};
+
+/* Splits snapshot.frame_stack into frames, bottom first; fails if it is malformed. */
+bool TryParseFrames(const Snapshot& snapshot, std::vector<SnapshotFrame>* frames);
+
+uint64_t HashBytecode(BytecodeView bytecode);
+
+bool TryWriteSnapshot(const char* path, const Snapshot& snapshot, std::string* error);
+bool TryReadSnapshot(const char* path, Snapshot* snapshot, std::string* error);
+
+/* Set by SIGUSR1 once InstallCheckpointSignalHandler() has run. The interpreter takes a snapshot at
+ * the next instruction boundary, the JIT at the next CHKPT. */
+extern volatile std::sig_atomic_t checkpoint_requested;
+void InstallCheckpointSignalHandler();
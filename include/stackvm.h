@@ -0,0 +1,92 @@
+#pragma once
+
+#include <executable.h>
+#include <image.h>
+#include <jit_compiler.h>
+#include <native_functions.h>
+#include <virtual_machine.h>
+#include <io_stream.h>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <string>
+
+/* Embedding API: parse and prepare an executable once, then run it any number of times through
+ * cheap, independent ProgramInstances. Objects in either format are read with TryReadObjectFile()
+ * and TryReadObjectFromMemory() (see image.h); Executable::TryLoad() maps an image instead. */
+
+class PreparedProgram {
+public:
+    enum Engine {
+        kEngineInterpreter  = 0,
+        kEngineJIT          = 1,
+    };
+
+    /* Checks that `executable` can run on this processor and compiles it if `engine` is the JIT. */
+    static std::shared_ptr<const PreparedProgram> TryPrepare(Executable executable, Engine engine, std::string* error);
+    static std::shared_ptr<const PreparedProgram> TryPrepare(Object executable, Engine engine, std::string* error);
+
+    Engine GetEngine() const;
+    const Executable& GetExecutable() const;
+    const JITCompiler& GetCompiler() const;
+
+private:
+    PreparedProgram(Executable executable, Engine engine);
+
+    Executable executable_;
+    Engine engine_;
+    std::optional<JITCompiler> compiler_;
+};
+
+/* Private RAM, stacks and I/O for one run of a PreparedProgram. Not thread-safe itself, but any
+ * number of instances of one program may run concurrently. */
+class ProgramInstance {
+public:
+    explicit ProgramInstance(std::shared_ptr<const PreparedProgram> program);
+    ProgramInstance(const ProgramInstance&) = delete;
+    ProgramInstance& operator=(const ProgramInstance&) = delete;
+
+    /* With `map_input`, regular input files are mmap'd and parsed in place; `binary_input`
+     * switches RDINT/RDDBL to raw 8-byte words. Applied by the next SetIO(). */
+    void SetInputMode(bool map_input, bool binary_input);
+    void SetIO(std::FILE* input, std::FILE* output);
+    void SetIO(int input_fd, int output_fd);
+    /* RDINT/RDDBL consume `data`; WRINT/WRDBL fill `buffer`. Both must outlive the instance. */
+    void SetInputBuffer(const char* data, size_t size);
+    void SetOutputBuffer(char* buffer, size_t capacity);
+    size_t GetOutputSize();
+
+    bool Run();
+    /* Zeroes guest memory and registers and rewinds buffer-backed I/O. */
+    void Reset();
+
+    /* Snapshots are engine-neutral: one taken under either engine restores under both. The
+     * restored state is used by the next Run() only; Reset() discards it. */
+    void SetCheckpointPath(std::string path);
+    bool TryRestore(const char* snapshot_path, std::string* error);
+    /* With `stop`, Run() returns at the next CHKPT and the following Run() resumes from it. */
+    void SetStopAtCheckpoint(bool stop);
+    /* Preempts Run() after `fuel` instructions (interpreter) or back-edges and calls (JIT); the next
+     * Run() resumes, on any thread. 0 means no limit. */
+    void SetFuel(int64_t fuel);
+    Processor::ExecutionStatus GetStatus() const;
+    /* Stopped at a CHKPT or out of fuel, so the next Run() resumes. */
+    bool IsSuspended() const;
+
+private:
+    std::shared_ptr<const PreparedProgram> program_;
+    std::unique_ptr<VirtualMachine> vm_;
+    std::unique_ptr<JITInstance> jit_instance_;
+    InputStream own_input_;
+    OutputStream own_output_;
+    MappedFile input_mapping_;
+    bool map_input_ = false;
+    bool binary_input_ = false;
+    InputStream* input_ = StandardInput();
+    OutputStream* output_ = StandardOutput();
+};
+
+/* The whole `vm`/`jit` command line:
+ * [-j <threads>] [-m] [-b] [-c <snapshot>] [-r <snapshot>] [-s <socket>] [-f <fuel>]
+ * <executable> [<input>...] */
+int RunStackVMTool(int argc, char* argv[], PreparedProgram::Engine engine);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/* Symbol names interned once: every distinct name is copied into the pool and gets a dense id, so
+ * that tables keyed by name can be vectors indexed by id. Lookups compare the precomputed hashes
+ * before any bytes. The pool is not thread safe; hash names on any thread, intern them on one. */
+class SymbolPool {
+public:
+    using Id = uint32_t;
+    static constexpr Id kNoId = UINT32_MAX;
+
+    static uint64_t Hash(std::string_view name);
+
+    /* `hash` must be Hash(name). */
+    Id Intern(std::string_view name, uint64_t hash);
+    Id Find(std::string_view name, uint64_t hash) const;
+    std::string_view Name(Id id) const;
+    size_t Size() const;
+
+private:
+    struct Entry {
+        std::string_view name;
+        uint64_t hash;
+    };
+
+    size_t Slot(std::string_view name, uint64_t hash) const;
+    void Rehash();
+    std::string_view Store(std::string_view name);
+
+    std::vector<Entry> entries_;
+    /* Open addressing with linear probing; a power of two in size, never more than half full. */
+    std::vector<Id> slots_;
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    size_t block_used_ = 0;
+    size_t block_size_ = 0;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+/* Kernels behind MEMSET and the V* instructions, shared by the interpreter and the JIT. The widest
+ * implementation the CPU supports (AVX2, otherwise SSE2) is picked by CPUID on first use. */
+
+constexpr int kVectorLanes = 4;
+
+/* Running total of VSUM/VDOT. Element i of a range always goes to lane i % kVectorLanes, whatever
+ * the ISA and however the range is split into pieces, so double totals are reproducible. */
+template <class T>
+struct VectorLanes {
+    T lane[kVectorLanes] = {};
+    int phase = 0;
+
+    void Add(T x);
+    T Total() const;
+};
+
+void VectorFill(int64_t* dst, int64_t value, int64_t cnt);
+/* dst[i] += src[i] and dst[i] *= src[i]; integers wrap around. */
+void VectorAdd(int64_t* dst, const int64_t* src, int64_t cnt);
+void VectorAdd(double* dst, const double* src, int64_t cnt);
+void VectorMul(int64_t* dst, const int64_t* src, int64_t cnt);
+void VectorMul(double* dst, const double* src, int64_t cnt);
+void VectorSum(const int64_t* src, int64_t cnt, VectorLanes<int64_t>* sum);
+void VectorSum(const double* src, int64_t cnt, VectorLanes<double>* sum);
+void VectorDot(const int64_t* a, const int64_t* b, int64_t cnt, VectorLanes<int64_t>* sum);
+void VectorDot(const double* a, const double* b, int64_t cnt, VectorLanes<double>* sum);
+
+/* "avx2" or "sse2". */
+const char* VectorKernelsISA();
@@ -2,13 +2,37 @@
 
 #include <processor.h>
 #include <ram.h>
-#include <object.h>
+#include <executable.h>
+#include <snapshot.h>
+#include <string>
 
 class VirtualMachine {
 public:
+    VirtualMachine();
     const Object::ProcVersion& GetProcessorVersion() const;
-    void Execute(const Object& obj);
+    void SetIO(InputStream* input, OutputStream* output);
+    bool Execute(const Executable& executable);
+    void Reset();
+
+    /* CHKPT (or SIGUSR1) writes a snapshot to `path`; without a path checkpoints are ignored. */
+    void SetCheckpointPath(std::string path);
+    /* Makes Execute() return at the next checkpoint; calling it again resumes from there. */
+    void SetStopAtCheckpoint(bool stop);
+    /* Makes Execute() return after `fuel` instructions; calling it again resumes. 0 means no limit. */
+    void SetFuel(int64_t fuel);
+    Processor::ExecutionStatus GetStatus() const;
+    /* Stopped at a checkpoint or out of fuel, so the next Execute() resumes. */
+    bool IsSuspended() const;
+    /* Loads registers, stacks and RAM from a snapshot; the next Execute() resumes from it. */
+    bool TryRestore(const Executable& executable, const char* path, std::string* error);
 private:
+    void WriteCheckpoint(const Executable& executable);
+
+
     Processor processor_;
     RAM ram_;
+    GuestThreads threads_;
+    OutputStream* output_ = StandardOutput();
+    std::string checkpoint_path_;
+    bool stop_at_checkpoint_ = false;
 };
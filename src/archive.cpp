@@ -0,0 +1,229 @@
+#include <archive.h>
+#include <image.h>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int64_t RoundUpTo8(int64_t value) {
+    return (value + 7) & ~int64_t(7);
+}
+
+bool TryWriteArchive(const std::vector<ArchiveInput>& members, std::ostream* out, std::string* error) {
+    std::string strings;
+    std::vector<ArchiveMember> member_table;
+    member_table.reserve(members.size());
+    for (const ArchiveInput& member : members) {
+        member_table.push_back(ArchiveMember{static_cast<int64_t>(strings.size()),
+                                             static_cast<int64_t>(member.name.size()), 0,
+                                             static_cast<int64_t>(member.contents.size())});
+        strings += member.name;
+    }
+
+    /* Local symbols cannot be referred to from other objects, so they are not indexed. */
+    std::map<std::string_view, size_t> sorted_symbols;
+    for (size_t i = 0; i < members.size(); ++i) {
+        for (const auto& [name, symbol] : members[i].object.defined_symbols) {
+            if (name.empty() || name[0] == '.') {
+                continue;
+            }
+            auto [iter, inserted] = sorted_symbols.emplace(name, i);
+            if (!inserted) {
+                *error = "Symbol " + name + " is defined in both " + members[iter->second].name + " and " +
+                         members[i].name;
+                return false;
+            }
+        }
+    }
+    std::vector<ArchiveSymbol> symbols;
+    symbols.reserve(sorted_symbols.size());
+    for (const auto& [name, member] : sorted_symbols) {
+        symbols.push_back(ArchiveSymbol{static_cast<int64_t>(strings.size()), static_cast<int64_t>(name.size()),
+                                        static_cast<int64_t>(member)});
+        strings += name;
+    }
+
+    ArchiveHeader header{};
+    std::memcpy(header.magic, kArchiveMagic, sizeof(kArchiveMagic));
+    header.format_version = kArchiveFormatVersion;
+    header.members_cnt = member_table.size();
+    header.members_offset = sizeof(ArchiveHeader);
+    header.symbols_cnt = symbols.size();
+    header.symbols_offset = header.members_offset + sizeof(ArchiveMember) * member_table.size();
+    header.strings_offset = header.symbols_offset + sizeof(ArchiveSymbol) * symbols.size();
+    header.strings_size = strings.size();
+    int64_t offset = header.strings_offset + header.strings_size;
+    for (ArchiveMember& member : member_table) {
+        member.offset = offset = RoundUpTo8(offset);
+        offset += member.size;
+    }
+
+    std::string buffer;
+    buffer.reserve(offset);
+    buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    buffer.append(reinterpret_cast<const char*>(member_table.data()), sizeof(ArchiveMember) * member_table.size());
+    buffer.append(reinterpret_cast<const char*>(symbols.data()), sizeof(ArchiveSymbol) * symbols.size());
+    buffer += strings;
+    for (size_t i = 0; i < members.size(); ++i) {
+        buffer.resize(member_table[i].offset, '\0');
+        buffer += members[i].contents;
+    }
+    out->write(buffer.data(), buffer.size());
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+MappedArchive::~MappedArchive() {
+    Unmap();
+}
+
+bool MappedArchive::IsArchive(const void* data, size_t size) {
+    return size >= sizeof(ArchiveHeader) && std::memcmp(data, kArchiveMagic, sizeof(kArchiveMagic)) == 0;
+}
+
+bool MappedArchive::IsArchiveFile(const char* path) {
+    std::FILE* file = std::fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    char magic[sizeof(kArchiveMagic)] = {};
+    bool is_archive = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                      std::memcmp(magic, kArchiveMagic, sizeof(kArchiveMagic)) == 0;
+    std::fclose(file);
+    return is_archive;
+}
+
+bool MappedArchive::TryMap(const char* path, std::string* error) {
+    Unmap();
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *error = std::string("Failed to open ") + path;
+        return false;
+    }
+    struct stat st{};
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        *error = std::string("Failed to map ") + path;
+        return false;
+    }
+    data_ = static_cast<const char*>(data);
+    size_ = st.st_size;
+    path_ = path;
+
+    const auto* header = reinterpret_cast<const ArchiveHeader*>(data_);
+    int64_t file_size = size_;
+    auto fits = [file_size](int64_t offset, int64_t cnt, int64_t item_size) {
+        return offset >= 0 && offset % 8 == 0 && offset <= file_size && cnt >= 0 && cnt <= (file_size - offset) / item_size;
+    };
+    if (!IsArchive(data_, size_) || header->format_version != kArchiveFormatVersion ||
+        !fits(header->members_offset, header->members_cnt, sizeof(ArchiveMember)) ||
+        !fits(header->symbols_offset, header->symbols_cnt, sizeof(ArchiveSymbol)) ||
+        !fits(header->strings_offset, header->strings_size, 1)) {
+        Unmap();
+        *error = std::string(path) + ": malformed archive header";
+        return false;
+    }
+    members_ = reinterpret_cast<const ArchiveMember*>(data_ + header->members_offset);
+    members_cnt_ = header->members_cnt;
+    for (size_t i = 0; i < members_cnt_; ++i) {
+        if (!fits(members_[i].offset, members_[i].size, 1)) {
+            Unmap();
+            *error = std::string(path) + ": malformed member table";
+            return false;
+        }
+    }
+    symbols_ = reinterpret_cast<const ArchiveSymbol*>(data_ + header->symbols_offset);
+    symbols_cnt_ = header->symbols_cnt;
+    strings_ = data_ + header->strings_offset;
+    strings_size_ = header->strings_size;
+    return true;
+}
+
+size_t MappedArchive::MembersCnt() const {
+    return members_cnt_;
+}
+
+std::string_view MappedArchive::MemberName(size_t idx) const {
+    return Name(members_[idx].name_offset, members_[idx].name_size);
+}
+
+size_t MappedArchive::SymbolsCnt() const {
+    return symbols_cnt_;
+}
+
+std::string_view MappedArchive::SymbolName(size_t idx) const {
+    return Name(symbols_[idx].name_offset, symbols_[idx].name_size);
+}
+
+size_t MappedArchive::SymbolMember(size_t idx) const {
+    return symbols_[idx].member;
+}
+
+bool MappedArchive::TryFindMember(std::string_view symbol, size_t* member) const {
+    size_t begin = 0, end = symbols_cnt_;
+    while (begin < end) {
+        size_t middle = begin + (end - begin) / 2;
+        if (SymbolName(middle) < symbol) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    if (begin == symbols_cnt_ || SymbolName(begin) != symbol || symbols_[begin].member < 0 ||
+        symbols_[begin].member >= static_cast<int64_t>(members_cnt_)) {
+        return false;
+    }
+    *member = symbols_[begin].member;
+    return true;
+}
+
+bool MappedArchive::TryReadMember(size_t idx, Object* object, std::string* error) const {
+    const char* data = data_ + members_[idx].offset;
+    size_t size = members_[idx].size;
+    std::string name = path_ + "(" + std::string(MemberName(idx)) + ")";
+    if (MappedImage::IsImage(data, size)) {
+        MappedImage image;
+        if (!image.TryAttach(data, size, error)) {
+            *error = name + ": " + *error;
+            return false;
+        }
+        image.ToObject(object);
+        return true;
+    }
+    if (!TryReadObjectFromMemory(data, size, object, error)) {
+        *error = "Failed to read " + name;
+        return false;
+    }
+    return true;
+}
+
+void MappedArchive::Unmap() {
+    if (data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    path_.clear();
+    members_ = nullptr;
+    members_cnt_ = 0;
+    symbols_ = nullptr;
+    symbols_cnt_ = 0;
+    strings_ = nullptr;
+    strings_size_ = 0;
+}
+
+std::string_view MappedArchive::Name(int64_t offset, int64_t size) const {
+    if (offset < 0 || size < 0 || offset > static_cast<int64_t>(strings_size_) ||
+        size > static_cast<int64_t>(strings_size_) - offset) {
+        return {};
+    }
+    return std::string_view(strings_ + offset, size);
+}
@@ -0,0 +1,71 @@
+#include <archive.h>
+#include <image.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+static int ListArchive(const char* path) {
+    MappedArchive archive;
+    std::string error;
+    if (!archive.TryMap(path, &error)) {
+        std::fprintf(stderr, "ERROR %s\n", error.c_str());
+        return 1;
+    }
+    std::printf("Members:\n");
+    for (size_t i = 0; i < archive.MembersCnt(); ++i) {
+        std::string name(archive.MemberName(i));
+        std::printf("%zu\t%s\n", i, name.c_str());
+    }
+    std::printf("Symbols:\n");
+    for (size_t i = 0; i < archive.SymbolsCnt(); ++i) {
+        std::string name(archive.SymbolName(i));
+        std::printf("%s\t%zu\n", name.c_str(), archive.SymbolMember(i));
+    }
+    std::printf("Total %zu members, %zu symbols.\n", archive.MembersCnt(), archive.SymbolsCnt());
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc == 3 && std::strcmp(argv[1], "-t") == 0) {
+        return ListArchive(argv[2]);
+    }
+    if (argc < 2 || argv[1][0] == '-') {
+        std::fprintf(stderr, "Usage: %s ARCHIVE.varch OBJECT.vobj... (create) or %s -t ARCHIVE.varch (list)\n",
+                     argv[0], argv[0]);
+        return 1;
+    }
+
+    std::vector<ArchiveInput> members(argc - 2);
+    for (int i = 2; i < argc; ++i) {
+        ArchiveInput& member = members[i - 2];
+        std::ifstream in(argv[i], std::ios_base::binary);
+        if (!in.good()) {
+            std::fprintf(stderr, "ERROR cannot open %s\n", argv[i]);
+            return 1;
+        }
+        member.contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        std::string error;
+        if (!TryReadObjectFromMemory(member.contents.data(), member.contents.size(), &member.object, &error)) {
+            std::fprintf(stderr, "ERROR cannot load %s: %s\n", argv[i], error.c_str());
+            return 1;
+        }
+        if (member.object.object_type != Object::kObjectStaticLinkable) {
+            std::fprintf(stderr, "ERROR file %s is not static linkable\n", argv[i]);
+            return 1;
+        }
+        const char* name = std::strrchr(argv[i], '/');
+        member.name = name == nullptr ? argv[i] : name + 1;
+    }
+
+    std::ofstream out(argv[1], std::ios_base::binary);
+    std::string error;
+    if (!TryWriteArchive(members, &out, &error)) {
+        out.close();
+        std::remove(argv[1]);
+        std::fprintf(stderr, "ERROR %s\n", error.c_str());
+        return 1;
+    }
+    return 0;
+}
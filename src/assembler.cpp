@@ -4,10 +4,12 @@
 #include <algorithm>
 #include <vector>
 #include <cstdlib>
+#include <cstring>
 
 #include "assembler.h"
 #include "argument_descriptors.h"
-#include "oosf/output_data_stream.h"
+#include "bytecode_optimizer.h"
+#include "image.h"
 #include "object.h"
 
 struct Command {
@@ -45,6 +47,8 @@ static CommandTable command_table;
 
 }
 
+constexpr int kSymbolImmediateSize = 4;
+
 class Tokenizer {
 public:
     Tokenizer(std::string& data) : data_(data), token_begin(data.begin()), token_end(data.begin()) {
@@ -224,7 +228,43 @@ const char* ParseSymbol(Tokenizer* tok, Object* object) {
     return nullptr;
 }
 
-const char* ParseArgument(Tokenizer* tok, Object* object, int8_t* arg_descr, int8_t index) {
+static bool TryParseRegister(std::string_view token, int8_t* reg) {
+    long value = 0;
+    if (ParseLong(&value, token) && value >= 0 && value <= MAX_REGISTER) {
+        *reg = value;
+        return true;
+    }
+    return false;
+}
+
+/* The part of !base+offset or !base+%index after the base register. */
+static const char* ParseIndexing(std::string_view token, Object* object, int8_t* arg_type) {
+    bool negative = token[0] == '-';
+    token.remove_prefix(1);
+    if (!token.empty() && token[0] == ASM_PREFIX_REGISTER) {
+        int8_t index = 0;
+        if (negative || !TryParseRegister(token.substr(1), &index)) {
+            return "Invalid index register";
+        }
+        *arg_type = ARG_BASE_INDEX;
+        object->bytecode.push_back(index);
+        return nullptr;
+    }
+
+    *arg_type = ARG_BASE_OFFSET;
+    object->bytecode.resize(object->bytecode.size() + sizeof(int64_t));
+    void* buffer = static_cast<void*>(object->bytecode.data() + (object->bytecode.size() - sizeof(int64_t)));
+    if (long value = 0; ParseLong(&value, token)) {
+        *static_cast<int64_t*>(buffer) = negative ? -value : value;
+    } else if (!negative && ValidName(token)) {
+        object->required_symbols[object->bytecode.size() - sizeof(int64_t)] = token;
+    } else {
+        return "Invalid offset";
+    }
+    return nullptr;
+}
+
+const char* ParseArgument(Tokenizer* tok, Object* object, ArgDescriptor* arg_descr, int8_t index) {
     tok->NextToken();
     if (tok->IsEnd()) {
         return "Not enough arguments";
@@ -246,34 +286,60 @@ const char* ParseArgument(Tokenizer* tok, Object* object, int8_t* arg_descr, int
             arg_type = ARG_REGISTER_POINTER;
             prefix_length = 1;
             break;
+        case ASM_PREFIX_FRAME:
+            arg_type = ARG_FRAME;
+            prefix_length = 1;
+            break;
         default:
             break;
     }
 
-    SetArgType(arg_descr, index, arg_type);
     token.remove_prefix(prefix_length);
-    if (arg_type == ARG_VALUE || arg_type == ARG_POINTER) {
-        object->bytecode.resize(object->bytecode.size() + sizeof(int64_t));
-
-        void* buffer = static_cast<void*>(object->bytecode.data() + (object->bytecode.size() - sizeof(int64_t)));
-        if (long value = 0; ParseLong(&value, token)) {
-            *static_cast<int64_t*>(buffer) = value;
-        } else if (double value = 0; arg_type == ARG_VALUE && ParseDouble(&value, token)) {
-            *static_cast<double*>(buffer) = value;
+    if (size_t separator = token.find_first_of("+-", 1);
+            arg_type == ARG_REGISTER_POINTER && separator != std::string_view::npos) {
+        int8_t base = 0;
+        if (!TryParseRegister(token.substr(0, separator), &base)) {
+            return "Invalid register";
+        }
+        object->bytecode.push_back(base);
+        if (const char* error = ParseIndexing(token.substr(separator), object, &arg_type)) {
+            return error;
+        }
+    } else if (arg_type == ARG_VALUE || arg_type == ARG_POINTER) {
+        /* Numbers take the fewest bytes that hold them; symbols get four, which ld widens when the
+         * value does not fit. */
+        int64_t value = 0;
+        int size = kSymbolImmediateSize;
+        if (long number = 0; ParseLong(&number, token)) {
+            value = number;
+            size = ImmediateSizeFor(value);
+        } else if (double number = 0; arg_type == ARG_VALUE && ParseDouble(&number, token)) {
+            std::memcpy(&value, &number, sizeof(value));
+            size = ImmediateSizeFor(value);
         } else if (ValidName(token)) {
-            object->required_symbols[object->bytecode.size() - sizeof(int64_t)] = token;
+            object->required_symbols[object->bytecode.size()] = token;
         } else {
             return "Invalid label name";
         }
+        object->bytecode.resize(object->bytecode.size() + size);
+        WriteImmediate(object->bytecode.data() + (object->bytecode.size() - size), value, size);
+        arg_type = ImmediateArgType(arg_type, size);
+    } else if (arg_type == ARG_FRAME) {
+        long slot = 0;
+        if (!ParseLong(&slot, token) || slot < 0 || slot > UINT16_MAX) {
+            return "Invalid frame slot";
+        }
+        object->bytecode.push_back(static_cast<int8_t>(slot & 0xff));
+        object->bytecode.push_back(static_cast<int8_t>(slot >> 8));
     } else {
-        long value = 0;
-        if (ParseLong(&value, token) && value >= 0 && value <= MAX_REGISTER) {
-            object->bytecode.push_back(value);
-        } else {
+        int8_t reg = 0;
+        if (!TryParseRegister(token, &reg)) {
             return "Invalid register";
         }
+        object->bytecode.push_back(reg);
     }
 
+    SetArgType(arg_descr, index, arg_type);
     return nullptr;
 }
 
@@ -281,10 +347,12 @@ const char* ParseCommand(Tokenizer* tok, Object* object) {
     Command command = ::command_table[tok->Token()];
     object->bytecode.push_back(command.opcode);
 
+    /* Arguments grow the bytecode, so the descriptor is filled in once they are all parsed. */
+    size_t descriptor_offset = object->bytecode.size();
+    ArgDescriptor arguments_descriptor = 0;
     if (command.args_count > 0) {
-        object->bytecode.push_back(0);
+        object->bytecode.resize(descriptor_offset + sizeof(ArgDescriptor));
     }
-    int8_t& arguments_descriptor = object->bytecode.back();
 
     for (int8_t i = 0; i < command.args_count; ++i) {
         const char* error = ParseArgument(tok, object, &arguments_descriptor, i);
@@ -292,6 +360,9 @@ const char* ParseCommand(Tokenizer* tok, Object* object) {
             return error;
         }
     }
+    if (command.args_count > 0) {
+        std::memcpy(object->bytecode.data() + descriptor_offset, &arguments_descriptor, sizeof(ArgDescriptor));
+    }
 
     tok->NextToken();
     if (!tok->IsEnd()) {
@@ -301,7 +372,8 @@ const char* ParseCommand(Tokenizer* tok, Object* object) {
     return nullptr;
 }
 
-void Assemble(std::ifstream* in, std::ofstream* out) {
+void Assemble(std::ifstream* in, std::ofstream* out, ObjectFormat format, const std::string& source_name,
+              int optimization_level) {
 #define PERROR(reason) PrintError(line_counter, tokenizer.GetOffset(), std::max(tokenizer.GetLength(), 1UL), line, reason); return;
 
     std::string line;
@@ -312,6 +384,7 @@ void Assemble(std::ifstream* in, std::ofstream* out) {
     object.proc_version.minor = PROC_VERSION_MINOR;
     object.proc_version.patch = PROC_VERSION_PATCH;
     object.object_type = Object::kObjectStaticLinkable;
+    object.line_table.files.push_back(source_name);
 
     while (std::getline(*in, line)) {
         ++line_counter;
@@ -331,7 +404,9 @@ void Assemble(std::ifstream* in, std::ofstream* out) {
         } else if (cmd == "SYMBOL") {
             error = ParseSymbol(&tokenizer, &object);
         } else if (::command_table.Contains(cmd)) {
+            int64_t position = object.bytecode.size();
             error = ParseCommand(&tokenizer, &object);
+            object.line_table.rows.push_back(LineTable::Row{position, 0, line_counter});
         } else {
             error = "Unknown instruction";
         }
@@ -341,8 +416,7 @@ void Assemble(std::ifstream* in, std::ofstream* out) {
         }
     }
 
-    OutputDataStream dstream(out, object.defined_symbols.size() + object.required_symbols.size() + 1);
-    Object::RegisterIn(&dstream);
-    dstream.Write(object);
+    OptimizeObject(&object, optimization_level);
+    WriteObject(object, format, out);
 }
 
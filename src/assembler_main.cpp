@@ -1,15 +1,34 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <cstring>
 #include <fs_utils.h>
 #include <assembler.h>
 
 int main(int argc, char* argv[]) {
-    if (argc == 1) {
+    ObjectFormat format = kObjectFormatImage;
+    int optimization_level = 0;
+    int first_input = 1;
+    for (; first_input < argc && argv[first_input][0] == '-'; ++first_input) {
+        const char* option = argv[first_input];
+        if (std::strcmp(option, "-f") == 0 && first_input + 1 < argc) {
+            if (!TryParseObjectFormat(argv[++first_input], &format)) {
+                std::cerr << "Unknown object format " << argv[first_input] << " (expected image or oosf)" << std::endl;
+                return 1;
+            }
+        } else if (std::strcmp(option, "-O0") == 0 || std::strcmp(option, "-O1") == 0 ||
+                   std::strcmp(option, "-O2") == 0) {
+            optimization_level = option[2] - '0';
+        } else {
+            std::cerr << "Unknown option " << option << " (expected -f image|oosf or -O0, -O1, -O2)" << std::endl;
+            return 1;
+        }
+    }
+    if (argc == first_input) {
         std::cerr << "Warning! No input files specified" << std::endl;
     }
 
-    for (int i = 1; i < argc; ++i) {
+    for (int i = first_input; i < argc; ++i) {
         std::string in_path(argv[i]);
         std::ifstream in(in_path);
 
@@ -26,7 +45,7 @@ int main(int argc, char* argv[]) {
             std::cerr << "Failed to open " << out_path << ", skipping..." << std::endl;
             continue;
         }
-        Assemble(&in, &out);
+        Assemble(&in, &out, format, in_path, optimization_level);
     }
     return 0;
 }
@@ -0,0 +1,119 @@
+#include <batch_runner.h>
+#include <fs_utils.h>
+#include <scheduler.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <sys/resource.h>
+
+static bool TryOpenJobFiles(const std::string& input_path, std::FILE** input, std::FILE** output) {
+    std::string output_path = input_path;
+    ReplaceExtension(&output_path, "out");
+    if (output_path == input_path) {
+        std::fprintf(stderr, "Refusing to overwrite input %s\n", input_path.c_str());
+        return false;
+    }
+
+    *input = std::fopen(input_path.c_str(), "r");
+    if (*input == nullptr) {
+        std::fprintf(stderr, "Failed to open %s\n", input_path.c_str());
+        return false;
+    }
+    *output = std::fopen(output_path.c_str(), "w");
+    if (*output == nullptr) {
+        std::fprintf(stderr, "Failed to open %s\n", output_path.c_str());
+        std::fclose(*input);
+        return false;
+    }
+    return true;
+}
+
+static void FinishJob(const std::string& input_path, std::FILE* input, std::FILE* output, bool ok) {
+    std::fclose(input);
+    std::fclose(output);
+    if (!ok) {
+        std::string output_path = input_path;
+        ReplaceExtension(&output_path, "out");
+        std::fprintf(stderr, "Execution failed on %s, see %s\n", input_path.c_str(), output_path.c_str());
+    }
+}
+
+static bool RunJob(const BatchJobHandler& handler, const std::string& input_path) {
+    std::FILE* input = nullptr;
+    std::FILE* output = nullptr;
+    if (!TryOpenJobFiles(input_path, &input, &output)) {
+        return false;
+    }
+    bool ok = handler(input, output);
+    FinishJob(input_path, input, output, ok);
+    return ok;
+}
+
+int RunBatch(const std::vector<std::string>& input_paths, int workers_cnt,
+             const std::function<BatchJobHandler()>& make_handler) {
+    std::atomic<size_t> next_job{0};
+    std::atomic<int> failed_jobs{0};
+
+    auto worker = [&]() {
+        BatchJobHandler handler = make_handler();
+        for (size_t job = next_job++; job < input_paths.size(); job = next_job++) {
+            if (!RunJob(handler, input_paths[job])) {
+                ++failed_jobs;
+            }
+        }
+    };
+
+    workers_cnt = std::clamp<int>(workers_cnt, 1, std::max<size_t>(input_paths.size(), 1));
+    std::vector<std::thread> workers;
+    workers.reserve(workers_cnt);
+    for (int i = 0; i < workers_cnt; ++i) {
+        workers.emplace_back(worker);
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    return failed_jobs;
+}
+
+int RunPreemptibleBatch(const std::vector<std::string>& input_paths, int workers_cnt,
+                        const std::function<PreemptibleJob()>& make_job) {
+    /* Every started job keeps its two files open until it finishes. */
+    rlimit files_limit;
+    if (getrlimit(RLIMIT_NOFILE, &files_limit) == 0 && files_limit.rlim_cur < files_limit.rlim_max) {
+        files_limit.rlim_cur = files_limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files_limit);
+    }
+
+    std::atomic<int> failed_jobs{0};
+    std::vector<GreenThread> threads;
+    threads.reserve(input_paths.size());
+    for (const std::string& input_path : input_paths) {
+        struct JobState {
+            PreemptibleJob job;
+            std::FILE* input = nullptr;
+            std::FILE* output = nullptr;
+        };
+        auto state = std::make_shared<JobState>();
+        state->job = make_job();
+
+        threads.emplace_back([state, &input_path, &failed_jobs]() {
+            if (state->input == nullptr && !TryOpenJobFiles(input_path, &state->input, &state->output)) {
+                ++failed_jobs;
+                return false;
+            }
+            bool ok = false;
+            if (state->job(state->input, state->output, &ok)) {
+                return true;
+            }
+            FinishJob(input_path, state->input, state->output, ok);
+            if (!ok) {
+                ++failed_jobs;
+            }
+            return false;
+        });
+    }
+
+    RunGreenThreads(std::move(threads), workers_cnt);
+    return failed_jobs;
+}
@@ -0,0 +1,763 @@
+#include <bytecode_optimizer.h>
+#include <instruction_decoder.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+enum Opcode : int8_t {
+#define DEF_CMD(name, code, ...) kOpcode##name = code,
+#include <instruction_set.h>
+#undef DEF_CMD
+};
+
+namespace {
+
+/* An operand out of the bytecode. Immediates are kept by value and as their wide type, along with
+ * the relocation that fills them in, if any; everything else is kept as encoded. */
+struct Operand {
+    int8_t type = ARG_VALUE;
+    int64_t value = 0;
+    std::string symbol;
+    int8_t bytes[sizeof(int64_t) + 1] = {};
+    int size = 0;
+
+    bool IsImmediate() const {
+        return ImmediateSize(type) > 0;
+    }
+
+    bool IsConstant() const {
+        return type == ARG_VALUE && symbol.empty();
+    }
+
+    bool operator==(const Operand& other) const {
+        if (type != other.type || symbol != other.symbol) {
+            return false;
+        }
+        if (IsImmediate()) {
+            return value == other.value;
+        }
+        return size == other.size && std::memcmp(bytes, other.bytes, size) == 0;
+    }
+};
+
+struct Instruction {
+    int8_t opcode = 0;
+    int args_cnt = 0;
+    Operand args[kMaxArgsCnt];
+    int32_t file = -1;
+    int32_t line = 0;
+    /* Some FUNC symbol points here, so control may come in from anywhere. */
+    bool label = false;
+    bool removed = false;
+};
+
+constexpr size_t kNoInstruction = static_cast<size_t>(-1);
+/* Every round only shrinks the code, so this is a bound on work, not on quality in practice. */
+constexpr int kMaxRounds = 16;
+constexpr int kMaxThreadingSteps = 8;
+/* Instructions in a function body, RET aside, for it to be inlined. */
+constexpr int kMaxInlinedInstructions = 8;
+
+class Optimizer {
+public:
+    Optimizer(Object* object, int level) : object_(object), level_(level) {
+    }
+
+    bool TryDecode();
+    void Run();
+    void Encode();
+
+    /* The whole-program passes, for a module holding all of the program. */
+    void PropagateConstants();
+    void InlineCalls();
+    void FoldIdenticalFunctions();
+
+private:
+    /* The first instruction still there at or after `idx`. */
+    size_t Next(size_t idx) const;
+    void Remove(size_t idx);
+    /* Up to `cnt` instructions from `first` on with no label but maybe on the first. */
+    int Window(size_t first, int cnt, size_t* window) const;
+    /* The instruction a local label names, kNoInstruction for anything else. */
+    size_t Target(const Operand& operand) const;
+
+    bool Simplify(size_t idx);
+    bool ThreadJump(Operand* target);
+    bool RemoveUnreachable();
+
+    /* The body of the function starting at `entry` without its RET, if it is short and straight
+     * and leaves the call stack alone. */
+    bool TryGetInlineBody(size_t entry, std::vector<Instruction>* body) const;
+    /* The instruction, if any, that a CALL or jump operand transfers control to. */
+    size_t Destination(const Instruction& instruction, int operand) const;
+
+    Object* object_;
+    int level_;
+    std::vector<Instruction> code_;
+    std::vector<int64_t> starts_;
+    std::unordered_map<std::string, size_t> labels_;
+};
+
+}
+
+static bool IsBinaryFoldable(int8_t opcode) {
+    switch (opcode) {
+        case kOpcodeADD:
+        case kOpcodeSUB:
+        case kOpcodeMUL:
+        case kOpcodeDIV:
+        case kOpcodeMOD:
+        case kOpcodeAND:
+        case kOpcodeOR:
+        case kOpcodeXOR:
+        case kOpcodeCLT:
+        case kOpcodeCGT:
+        case kOpcodeCLE:
+        case kOpcodeCGE:
+        case kOpcodeCEQ:
+        case kOpcodeCNE:
+        case kOpcodeFADD:
+        case kOpcodeFSUB:
+        case kOpcodeFMUL:
+        case kOpcodeFDIV:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static double AsDouble(int64_t value) {
+    double result = 0;
+    std::memcpy(&result, &value, sizeof(result));
+    return result;
+}
+
+static int64_t FromDouble(double value) {
+    int64_t result = 0;
+    std::memcpy(&result, &value, sizeof(result));
+    return result;
+}
+
+/* Folds what both engines agree on. Overflow wraps, as on the hardware; the cases where the
+ * interpreter's C++ and the JIT's instructions part ways (INT64_MIN / -1) are left alone, as are
+ * BOOL and NOT. So are SHL and SHR altogether: the JIT shifts the right operand by the left one. */
+static bool TryFoldBinary(int8_t opcode, int64_t lhs, int64_t rhs, int64_t* result) {
+    uint64_t ulhs = lhs, urhs = rhs;
+    switch (opcode) {
+        case kOpcodeADD: *result = ulhs + urhs; return true;
+        case kOpcodeSUB: *result = ulhs - urhs; return true;
+        case kOpcodeMUL: *result = ulhs * urhs; return true;
+        case kOpcodeAND: *result = lhs & rhs; return true;
+        case kOpcodeOR:  *result = lhs | rhs; return true;
+        case kOpcodeXOR: *result = lhs ^ rhs; return true;
+        case kOpcodeCLT: *result = lhs < rhs; return true;
+        case kOpcodeCGT: *result = lhs > rhs; return true;
+        case kOpcodeCLE: *result = lhs <= rhs; return true;
+        case kOpcodeCGE: *result = lhs >= rhs; return true;
+        case kOpcodeCEQ: *result = lhs == rhs; return true;
+        case kOpcodeCNE: *result = lhs != rhs; return true;
+        case kOpcodeFADD: *result = FromDouble(AsDouble(lhs) + AsDouble(rhs)); return true;
+        case kOpcodeFSUB: *result = FromDouble(AsDouble(lhs) - AsDouble(rhs)); return true;
+        case kOpcodeFMUL: *result = FromDouble(AsDouble(lhs) * AsDouble(rhs)); return true;
+        case kOpcodeFDIV: *result = FromDouble(AsDouble(lhs) / AsDouble(rhs)); return true;
+        case kOpcodeDIV:
+        case kOpcodeMOD:
+            if (rhs == 0 || (lhs == INT64_MIN && rhs == -1)) {
+                return false;
+            }
+            *result = opcode == kOpcodeDIV ? lhs / rhs : lhs % rhs;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool TryFoldUnary(int8_t opcode, int64_t value, int64_t* result) {
+    switch (opcode) {
+        case kOpcodeNEG: *result = -static_cast<uint64_t>(value); return true;
+        case kOpcodeFNEG: *result = value ^ INT64_MIN; return true;
+        case kOpcodeITD: *result = FromDouble(static_cast<double>(value)); return true;
+        default:
+            return false;
+    }
+}
+
+/* Whether JEQ and the like jump for `value` on top of the stack. */
+static bool TryEvaluateJump(int8_t opcode, int64_t value, bool* taken) {
+    switch (opcode) {
+        case kOpcodeJEQ: *taken = value == 0; return true;
+        case kOpcodeJGT: *taken = value > 0; return true;
+        case kOpcodeJLT: *taken = value < 0; return true;
+        case kOpcodeJNE: *taken = value != 0; return true;
+        case kOpcodeJGE: *taken = value >= 0; return true;
+        case kOpcodeJLE: *taken = value <= 0; return true;
+        default:
+            return false;
+    }
+}
+
+static bool TryEvaluateBranch(int8_t opcode, int64_t lhs, int64_t rhs, bool* taken) {
+    switch (opcode) {
+        case kOpcodeBEQ: *taken = lhs == rhs; return true;
+        case kOpcodeBNE: *taken = lhs != rhs; return true;
+        case kOpcodeBLT: *taken = lhs < rhs; return true;
+        case kOpcodeBLE: *taken = lhs <= rhs; return true;
+        case kOpcodeBGT: *taken = lhs > rhs; return true;
+        case kOpcodeBGE: *taken = lhs >= rhs; return true;
+        default:
+            return false;
+    }
+}
+
+/* Which operand of a jump or branch holds the destination, -1 for other instructions. CALL and
+ * SPAWN are left out: threading them would change what stack traces show. */
+static int JumpOperand(int8_t opcode) {
+    switch (opcode) {
+        case kOpcodeJMP:
+        case kOpcodeJEQ:
+        case kOpcodeJGT:
+        case kOpcodeJLT:
+        case kOpcodeJNE:
+        case kOpcodeJGE:
+        case kOpcodeJLE:
+            return 0;
+        case kOpcodeDECJNZ:
+            return 1;
+        case kOpcodeBEQ:
+        case kOpcodeBNE:
+        case kOpcodeBLT:
+        case kOpcodeBLE:
+        case kOpcodeBGT:
+        case kOpcodeBGE:
+            return 2;
+        default:
+            return -1;
+    }
+}
+
+bool Optimizer::TryDecode() {
+    const LineTable& lines = object_->line_table;
+    size_t relocations_used = 0;
+    int64_t ip = 0;
+    while (ip < static_cast<int64_t>(object_->bytecode.size())) {
+        InstructionLayout layout;
+        if (!TryDecodeInstruction(object_->bytecode, ip, &layout)) {
+            return false;
+        }
+        Instruction instruction;
+        instruction.opcode = layout.opcode;
+        instruction.args_cnt = layout.args_cnt;
+        for (int i = 0; i < layout.args_cnt; ++i) {
+            Operand& operand = instruction.args[i];
+            const int8_t* bytes = object_->bytecode.data() + layout.arg_offsets[i];
+            operand.size = layout.arg_sizes[i];
+            int64_t relocation = layout.arg_offsets[i];
+            if (ImmediateSize(layout.arg_types[i]) > 0) {
+                operand.type = WideArgType(layout.arg_types[i]);
+                operand.value = ReadImmediate(bytes, operand.size);
+            } else {
+                operand.type = layout.arg_types[i];
+                std::memcpy(operand.bytes, bytes, operand.size);
+                relocation = operand.type == ARG_BASE_OFFSET ? relocation + 1 : -1;
+            }
+            if (auto iter = object_->required_symbols.find(relocation); iter != object_->required_symbols.end()) {
+                operand.symbol = iter->second;
+                ++relocations_used;
+            }
+        }
+        if (const LineTable::Row* row = lines.Find(ip)) {
+            instruction.file = row->file;
+            instruction.line = row->line;
+        }
+        code_.push_back(std::move(instruction));
+        starts_.push_back(ip);
+        ip += layout.size;
+    }
+    if (relocations_used != object_->required_symbols.size()) {
+        return false;
+    }
+
+    for (const auto& [name, symbol] : object_->defined_symbols) {
+        if (symbol.type != Symbol::kSymbolFunction) {
+            continue;
+        }
+        size_t idx = std::lower_bound(starts_.begin(), starts_.end(), symbol.position) - starts_.begin();
+        labels_[name] = idx;
+        if (idx < code_.size()) {
+            code_[idx].label = true;
+        }
+    }
+    return true;
+}
+
+size_t Optimizer::Next(size_t idx) const {
+    while (idx < code_.size() && code_[idx].removed) {
+        ++idx;
+    }
+    return idx;
+}
+
+void Optimizer::Remove(size_t idx) {
+    code_[idx].removed = true;
+    if (code_[idx].label) {
+        if (size_t next = Next(idx + 1); next < code_.size()) {
+            code_[next].label = true;
+        }
+    }
+}
+
+int Optimizer::Window(size_t first, int cnt, size_t* window) const {
+    int found = 0;
+    for (size_t idx = first; found < cnt && idx < code_.size(); idx = Next(idx + 1)) {
+        if (found > 0 && code_[idx].label) {
+            break;
+        }
+        window[found++] = idx;
+    }
+    return found;
+}
+
+size_t Optimizer::Target(const Operand& operand) const {
+    if (operand.type != ARG_VALUE || operand.symbol.empty()) {
+        return kNoInstruction;
+    }
+    auto iter = labels_.find(operand.symbol);
+    return iter == labels_.end() ? kNoInstruction : iter->second;
+}
+
+/* Follows a chain of JMPs to where it ends. A chain that runs in circles is left as it is. */
+bool Optimizer::ThreadJump(Operand* target) {
+    std::vector<std::string_view> seen{target->symbol};
+    const Operand* end = target;
+    for (int step = 0; step < kMaxThreadingSteps; ++step) {
+        size_t idx = Target(*end);
+        idx = idx == kNoInstruction ? idx : Next(idx);
+        if (idx >= code_.size() || code_[idx].opcode != kOpcodeJMP || code_[idx].args[0].type != ARG_VALUE ||
+            code_[idx].args[0].symbol.empty()) {
+            break;
+        }
+        end = &code_[idx].args[0];
+        if (std::find(seen.begin(), seen.end(), end->symbol) != seen.end()) {
+            return false;
+        }
+        seen.push_back(end->symbol);
+    }
+    if (end == target) {
+        return false;
+    }
+    target->symbol = end->symbol;
+    target->size = end->size;
+    return true;
+}
+
+bool Optimizer::Simplify(size_t idx) {
+    size_t window[3];
+    int cnt = Window(idx, 3, window);
+    Instruction& first = code_[idx];
+    Instruction* second = cnt > 1 ? &code_[window[1]] : nullptr;
+    Instruction* third = cnt > 2 ? &code_[window[2]] : nullptr;
+
+    if (first.opcode == kOpcodePUSH && first.args[0].IsConstant() && second != nullptr) {
+        int64_t result = 0;
+        if (second->opcode == kOpcodePUSH && second->args[0].IsConstant() && third != nullptr &&
+            IsBinaryFoldable(third->opcode) &&
+            TryFoldBinary(third->opcode, first.args[0].value, second->args[0].value, &result)) {
+            first.args[0].value = result;
+            Remove(window[1]);
+            Remove(window[2]);
+            return true;
+        }
+        if (TryFoldUnary(second->opcode, first.args[0].value, &result)) {
+            first.args[0].value = result;
+            Remove(window[1]);
+            return true;
+        }
+        bool taken = false;
+        if (level_ >= 2 && TryEvaluateJump(second->opcode, first.args[0].value, &taken)) {
+            if (taken) {
+                second->opcode = kOpcodeJMP;
+            } else {
+                Remove(window[1]);
+            }
+            return true;
+        }
+    }
+
+    if (first.opcode == kOpcodePUSH && second != nullptr && second->opcode == kOpcodePOP &&
+        first.args[0] == second->args[0]) {
+        int8_t type = first.args[0].type;
+        if (type == ARG_VALUE || type == ARG_REGISTER || level_ >= 2) {
+            Remove(idx);
+            Remove(window[1]);
+            return true;
+        }
+    }
+
+    if (level_ >= 2 && first.opcode == kOpcodePUSH && second != nullptr && second->opcode == kOpcodePUSH &&
+        third != nullptr && third->opcode == kOpcodeSWAP) {
+        std::swap(first.args[0], second->args[0]);
+        Remove(window[2]);
+        return true;
+    }
+
+    bool taken = false;
+    if (level_ >= 2 && first.args_cnt == 3 && first.args[0].IsConstant() && first.args[1].IsConstant() &&
+        TryEvaluateBranch(first.opcode, first.args[0].value, first.args[1].value, &taken)) {
+        if (!taken) {
+            Remove(idx);
+            return true;
+        }
+        first.opcode = kOpcodeJMP;
+        first.args_cnt = 1;
+        first.args[0] = std::move(first.args[2]);
+        first.args[1] = first.args[2] = Operand();
+        return true;
+    }
+
+    if (first.opcode == kOpcodeJMP) {
+        size_t target = Target(first.args[0]);
+        if (target != kNoInstruction && Next(target) == Next(idx + 1)) {
+            Remove(idx);
+            return true;
+        }
+    }
+
+    if (int operand = JumpOperand(first.opcode); level_ >= 2 && operand >= 0) {
+        return ThreadJump(&first.args[operand]);
+    }
+    return false;
+}
+
+bool Optimizer::RemoveUnreachable() {
+    bool changed = false;
+    for (size_t idx = Next(0); idx < code_.size(); idx = Next(idx + 1)) {
+        int8_t opcode = code_[idx].opcode;
+        if (opcode != kOpcodeJMP && opcode != kOpcodeRET && opcode != kOpcodeHALT) {
+            continue;
+        }
+        for (size_t dead = Next(idx + 1); dead < code_.size() && !code_[dead].label; dead = Next(dead + 1)) {
+            Remove(dead);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void Optimizer::Run() {
+    bool changed = true;
+    for (int round = 0; round < kMaxRounds && changed; ++round) {
+        changed = false;
+        for (size_t idx = Next(0); idx < code_.size(); idx = Next(idx + 1)) {
+            while (Simplify(idx)) {
+                changed = true;
+                if (code_[idx].removed) {
+                    break;
+                }
+            }
+        }
+        changed |= RemoveUnreachable();
+    }
+}
+
+/* Operands naming SYMBOL constants get the constant itself. Variables that no instruction but PUSH
+ * reads and whose address is never taken are never written either, so they read as the zero bss
+ * starts out with. Writes through numeric addresses are not seen. */
+void Optimizer::PropagateConstants() {
+    std::unordered_map<std::string, bool> written;
+    for (const Instruction& instruction : code_) {
+        for (int i = 0; i < instruction.args_cnt; ++i) {
+            const Operand& operand = instruction.args[i];
+            auto symbol = object_->defined_symbols.find(operand.symbol);
+            if (operand.symbol.empty() || symbol == object_->defined_symbols.end() ||
+                symbol->second.type != Symbol::kSymbolVariable) {
+                continue;
+            }
+            bool read = instruction.opcode == kOpcodePUSH && operand.type == ARG_POINTER;
+            written[operand.symbol] |= !read;
+        }
+    }
+
+    for (Instruction& instruction : code_) {
+        for (int i = 0; i < instruction.args_cnt; ++i) {
+            Operand& operand = instruction.args[i];
+            auto symbol = object_->defined_symbols.find(operand.symbol);
+            if (operand.symbol.empty() || symbol == object_->defined_symbols.end()) {
+                continue;
+            }
+            if (symbol->second.type == Symbol::kSymbolUndefined) {
+                if (operand.type == ARG_BASE_OFFSET) {
+                    std::memcpy(operand.bytes + 1, &symbol->second.position, sizeof(int64_t));
+                } else {
+                    operand.value = symbol->second.position;
+                }
+                operand.symbol.clear();
+            } else if (symbol->second.type == Symbol::kSymbolVariable && !written.at(operand.symbol)) {
+                operand.type = ARG_VALUE;
+                operand.value = 0;
+                operand.symbol.clear();
+            }
+        }
+    }
+}
+
+bool Optimizer::TryGetInlineBody(size_t entry, std::vector<Instruction>* body) const {
+    body->clear();
+    for (size_t idx = Next(entry); idx < code_.size(); idx = Next(idx + 1)) {
+        const Instruction& instruction = code_[idx];
+        if (idx != Next(entry) && instruction.label) {
+            return false;
+        }
+        if (instruction.opcode == kOpcodeRET) {
+            return true;
+        }
+        switch (instruction.opcode) {
+            case kOpcodeENTER:
+            case kOpcodeLEAVE:
+            case kOpcodeDUMP:
+            case kOpcodeCHKPT:
+                return false;
+            default:
+                break;
+        }
+        if (JumpOperand(instruction.opcode) >= 0 || static_cast<int>(body->size()) == kMaxInlinedInstructions) {
+            return false;
+        }
+        for (int i = 0; i < instruction.args_cnt; ++i) {
+            if (instruction.args[i].type == ARG_FRAME) {
+                return false;
+            }
+        }
+        body->push_back(instruction);
+        body->back().label = false;
+    }
+    return false;
+}
+
+/* CALL f becomes the body of f when it is short and straight (see TryGetInlineBody). The inlined
+ * instructions keep their own source lines; a fault in them shows the caller as the function.
+ * Calls inside inlined bodies are not inlined again, so recursion cannot blow up. */
+void Optimizer::InlineCalls() {
+    std::unordered_map<size_t, std::vector<Instruction>> bodies;
+    std::vector<bool> inlinable(code_.size(), false);
+    for (const auto& [name, entry] : labels_) {
+        if (entry < code_.size() && bodies.count(entry) == 0) {
+            std::vector<Instruction> body;
+            if (TryGetInlineBody(entry, &body)) {
+                bodies.emplace(entry, std::move(body));
+            }
+        }
+    }
+
+    std::vector<Instruction> code;
+    std::vector<size_t> moved(code_.size() + 1);
+    /* A label on a call to an empty body goes to whatever comes next. */
+    bool label = false;
+    for (size_t idx = 0; idx < code_.size(); ++idx) {
+        moved[idx] = code.size();
+        Instruction& instruction = code_[idx];
+        label |= instruction.label;
+        size_t callee = instruction.removed || instruction.opcode != kOpcodeCALL ? kNoInstruction : Target(instruction.args[0]);
+        auto body = callee == kNoInstruction ? bodies.end() : bodies.find(callee);
+        if (body == bodies.end()) {
+            code.push_back(std::move(instruction));
+            code.back().label = label && !code.back().removed;
+            label = label && code.back().removed;
+            continue;
+        }
+        for (const Instruction& inlined : body->second) {
+            code.push_back(inlined);
+            code.back().label = label;
+            label = false;
+        }
+    }
+    moved[code_.size()] = code.size();
+    code_ = std::move(code);
+    for (auto& [name, idx] : labels_) {
+        idx = moved[idx];
+    }
+}
+
+size_t Optimizer::Destination(const Instruction& instruction, int operand) const {
+    bool transfers = operand == JumpOperand(instruction.opcode) ||
+                     (operand == 0 && (instruction.opcode == kOpcodeCALL || instruction.opcode == kOpcodeSPAWN));
+    size_t target = transfers ? Target(instruction.args[operand]) : kNoInstruction;
+    return target == kNoInstruction ? target : Next(target);
+}
+
+/* Code between two labels that matches an earlier such unit instruction for instruction, and
+ * ends in JMP, RET or HALT or falls into the same code, is no longer called or jumped to: CALL, SPAWN and jumps go to the
+ * earlier one, and once nothing refers to the copy, ld's garbage collection drops it. References
+ * to a unit from inside itself and to units folded already count as equal, so loops and callers of
+ * folded functions fold too. Taking a function's address keeps its copy apart. */
+void Optimizer::FoldIdenticalFunctions() {
+    std::unordered_map<size_t, std::string> names;
+    for (const auto& [name, idx] : labels_) {
+        size_t start = Next(idx);
+        if (start < code_.size() && (names.count(start) == 0 || name < names[start])) {
+            names[start] = name;
+        }
+    }
+    std::vector<size_t> starts;
+    for (size_t idx = Next(0); idx < code_.size(); idx = Next(idx + 1)) {
+        if (idx == Next(0) || code_[idx].label) {
+            starts.push_back(idx);
+        }
+    }
+
+    std::unordered_map<size_t, size_t> folded;
+    auto canonical = [&folded](size_t start) {
+        for (auto iter = folded.find(start); iter != folded.end(); iter = folded.find(start)) {
+            start = iter->second;
+        }
+        return start;
+    };
+    auto append = [](std::string* key, const void* data, size_t size) {
+        key->append(static_cast<const char*>(data), size);
+    };
+    for (int round = 0; round < kMaxRounds; ++round) {
+        std::unordered_map<std::string, size_t> units;
+        bool changed = false;
+        for (size_t u = 0; u < starts.size(); ++u) {
+            size_t start = starts[u];
+            size_t end = u + 1 < starts.size() ? starts[u + 1] : code_.size();
+            if (folded.count(start) != 0) {
+                continue;
+            }
+            std::string key;
+            int8_t last = 0;
+            for (size_t idx = start; idx < end; idx = Next(idx + 1)) {
+                const Instruction& instruction = code_[idx];
+                last = instruction.opcode;
+                append(&key, &instruction.opcode, sizeof(instruction.opcode));
+                append(&key, &instruction.args_cnt, sizeof(instruction.args_cnt));
+                for (int i = 0; i < instruction.args_cnt; ++i) {
+                    const Operand& operand = instruction.args[i];
+                    append(&key, &operand.type, sizeof(operand.type));
+                    if (operand.IsImmediate()) {
+                        append(&key, &operand.value, sizeof(operand.value));
+                    } else {
+                        append(&key, operand.bytes, operand.size);
+                    }
+                    size_t target = Target(operand);
+                    target = target == kNoInstruction ? target : canonical(Next(target));
+                    const std::string& symbol = target == start ? std::string(1, '\1') :
+                                                names.count(target) != 0 ? names[target] : operand.symbol;
+                    int64_t size = symbol.size();
+                    append(&key, &size, sizeof(size));
+                    key += symbol;
+                }
+            }
+            if (last != kOpcodeJMP && last != kOpcodeRET && last != kOpcodeHALT) {
+                if (end == code_.size()) {
+                    continue;
+                }
+                /* Falling through, the unit only matches those that fall into the same code. */
+                key += '\0';
+                key += names[canonical(end)];
+            }
+            auto [iter, inserted] = units.emplace(std::move(key), start);
+            if (!inserted) {
+                folded[start] = iter->second;
+                changed = true;
+            }
+        }
+        if (!changed) {
+            break;
+        }
+    }
+
+    for (size_t idx = Next(0); idx < code_.size(); idx = Next(idx + 1)) {
+        Instruction& instruction = code_[idx];
+        for (int i = 0; i < instruction.args_cnt; ++i) {
+            size_t destination = Destination(instruction, i);
+            if (destination != kNoInstruction && folded.count(destination) != 0) {
+                instruction.args[i].symbol = names[canonical(destination)];
+            }
+        }
+    }
+}
+
+void Optimizer::Encode() {
+    std::vector<int8_t> bytecode;
+    std::unordered_map<int64_t, std::string> relocations;
+    std::vector<LineTable::Row> rows;
+    /* Where each instruction, or the first one kept after it, ends up. */
+    std::vector<int64_t> positions(code_.size() + 1);
+
+    for (size_t idx = 0; idx < code_.size(); ++idx) {
+        const Instruction& instruction = code_[idx];
+        positions[idx] = bytecode.size();
+        if (instruction.removed) {
+            continue;
+        }
+        if (instruction.file >= 0) {
+            rows.push_back(LineTable::Row{static_cast<int64_t>(bytecode.size()), instruction.file, instruction.line});
+        } else if (!rows.empty() && rows.back().file >= 0) {
+            rows.push_back(LineTable::Row{static_cast<int64_t>(bytecode.size()), -1, 0});
+        }
+        bytecode.push_back(instruction.opcode);
+        if (instruction.args_cnt == 0) {
+            continue;
+        }
+        size_t descriptor_offset = bytecode.size();
+        ArgDescriptor descriptor = 0;
+        bytecode.resize(descriptor_offset + sizeof(descriptor));
+        for (int i = 0; i < instruction.args_cnt; ++i) {
+            const Operand& operand = instruction.args[i];
+            size_t offset = bytecode.size();
+            if (operand.IsImmediate()) {
+                int size = operand.symbol.empty() ? ImmediateSizeFor(operand.value) : operand.size;
+                SetArgType(&descriptor, i, ImmediateArgType(operand.type, size));
+                bytecode.resize(offset + size);
+                WriteImmediate(bytecode.data() + offset, operand.value, size);
+            } else {
+                SetArgType(&descriptor, i, operand.type);
+                bytecode.insert(bytecode.end(), operand.bytes, operand.bytes + operand.size);
+                /* The label of !base+label follows the base register. */
+                ++offset;
+            }
+            if (!operand.symbol.empty()) {
+                relocations[offset] = operand.symbol;
+            }
+        }
+        std::memcpy(bytecode.data() + descriptor_offset, &descriptor, sizeof(descriptor));
+    }
+    positions[code_.size()] = bytecode.size();
+
+    for (auto& [name, symbol] : object_->defined_symbols) {
+        if (symbol.type == Symbol::kSymbolFunction) {
+            symbol.position = positions[labels_[name]];
+        }
+    }
+    object_->bytecode = std::move(bytecode);
+    object_->required_symbols = std::move(relocations);
+    object_->line_table.rows = std::move(rows);
+}
+
+void OptimizeProgram(Object* module) {
+    Optimizer optimizer(module, 2);
+    if (!optimizer.TryDecode()) {
+        return;
+    }
+    optimizer.PropagateConstants();
+    optimizer.InlineCalls();
+    optimizer.Run();
+    optimizer.FoldIdenticalFunctions();
+    optimizer.Run();
+    optimizer.Encode();
+}
+
+void OptimizeObject(Object* object, int level) {
+    if (level <= 0) {
+        return;
+    }
+    Optimizer optimizer(object, level);
+    if (!optimizer.TryDecode()) {
+        return;
+    }
+    optimizer.Run();
+    optimizer.Encode();
+}
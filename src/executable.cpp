@@ -0,0 +1,112 @@
+#include <executable.h>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+struct Executable::Lazy {
+    std::once_flag functions_built;
+    std::map<int64_t, std::string_view> functions;
+    std::once_flag metadata_built;
+    ProgramMetadata metadata;
+    std::once_flag line_table_built;
+    LineTable line_table;
+};
+
+Executable::Executable() : object_(std::make_unique<Object>()), lazy_(std::make_unique<Lazy>()) {
+}
+
+Executable::Executable(Object object)
+    : object_(std::make_unique<Object>(std::move(object))), lazy_(std::make_unique<Lazy>()) {
+}
+
+Executable::Executable(Executable&&) noexcept = default;
+Executable& Executable::operator=(Executable&&) noexcept = default;
+Executable::~Executable() = default;
+
+bool Executable::TryLoad(const char* path, std::string* error) {
+    std::FILE* file = std::fopen(path, "rb");
+    if (file == nullptr) {
+        *error = std::string("Failed to open ") + path;
+        return false;
+    }
+    char magic[sizeof(kImageMagic)] = {};
+    bool is_image = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                    std::memcmp(magic, kImageMagic, sizeof(kImageMagic)) == 0;
+    std::fclose(file);
+
+    lazy_ = std::make_unique<Lazy>();
+    if (!is_image) {
+        image_.reset();
+        object_ = std::make_unique<Object>();
+        return TryReadObjectFile(path, object_.get(), error);
+    }
+    object_.reset();
+    image_ = std::make_unique<MappedImage>();
+    return image_->TryMap(path, error);
+}
+
+Object::ProcVersion Executable::GetProcVersion() const {
+    return image_ ? image_->GetProcVersion() : object_->proc_version;
+}
+
+Object::ObjectType Executable::GetObjectType() const {
+    return image_ ? image_->GetObjectType() : object_->object_type;
+}
+
+BytecodeView Executable::GetBytecode() const {
+    return image_ ? BytecodeView(image_->Bytecode(), image_->BytecodeSize()) : BytecodeView(object_->bytecode);
+}
+
+int64_t Executable::GetBssSize() const {
+    return image_ ? image_->GetBssSize() : object_->bss_size;
+}
+
+const std::map<int64_t, std::string_view>& Executable::GetFunctions() const {
+    std::call_once(lazy_->functions_built, [this]() {
+        auto& functions = lazy_->functions;
+        if (image_) {
+            for (size_t i = 0; i < image_->SymbolsCnt(); ++i) {
+                Symbol symbol = image_->SymbolAt(i);
+                if (symbol.type == Symbol::kSymbolFunction) {
+                    functions[symbol.position] = image_->SymbolName(i);
+                }
+            }
+            return;
+        }
+        for (const auto& [name, symbol] : object_->defined_symbols) {
+            if (symbol.type == Symbol::kSymbolFunction) {
+                functions[symbol.position] = name;
+            }
+        }
+    });
+    return lazy_->functions;
+}
+
+const ProgramMetadata& Executable::GetMetadata() const {
+    std::call_once(lazy_->metadata_built, [this]() {
+        if (image_ && image_->TryReadMetadata(&lazy_->metadata)) {
+            return;
+        }
+        if (object_ && object_->metadata) {
+            lazy_->metadata = *object_->metadata;
+            return;
+        }
+        std::vector<int64_t> function_starts;
+        for (const auto& [position, name] : GetFunctions()) {
+            function_starts.push_back(position);
+        }
+        AnalyzeProgram(GetBytecode(), std::move(function_starts), &lazy_->metadata);
+    });
+    return lazy_->metadata;
+}
+
+const LineTable& Executable::GetLineTable() const {
+    std::call_once(lazy_->line_table_built, [this]() {
+        if (!image_) {
+            lazy_->line_table = object_->line_table;
+        } else if (!image_->TryReadLineTable(&lazy_->line_table)) {
+            lazy_->line_table = LineTable();
+        }
+    });
+    return lazy_->line_table;
+}
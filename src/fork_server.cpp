@@ -0,0 +1,57 @@
+#include <fork_server.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int RunForkServer(const char* socket_path, const std::function<bool(int connection_fd)>& handler) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (std::strlen(socket_path) >= sizeof(address.sun_path)) {
+        std::fprintf(stderr, "Socket path %s is too long\n", socket_path);
+        return 1;
+    }
+    std::strcpy(address.sun_path, socket_path);
+
+    int server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(socket_path);
+    if (server_fd < 0 || bind(server_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(server_fd, SOMAXCONN) != 0) {
+        std::fprintf(stderr, "Failed to listen on %s: %s\n", socket_path, std::strerror(errno));
+        return 1;
+    }
+
+    /* Nobody waits for the children; let the kernel reap them. */
+    std::signal(SIGCHLD, SIG_IGN);
+    std::fflush(nullptr);
+
+    while (true) {
+        int connection_fd = accept4(server_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            std::fprintf(stderr, "Failed to accept on %s: %s\n", socket_path, std::strerror(errno));
+            break;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(server_fd);
+            bool ok = handler(connection_fd);
+            close(connection_fd);
+            /* Skip the parent's atexit handlers and stream destructors. */
+            _exit(ok ? 0 : 1);
+        }
+        if (pid < 0) {
+            std::fprintf(stderr, "Failed to fork: %s\n", std::strerror(errno));
+        }
+        close(connection_fd);
+    }
+
+    close(server_fd);
+    return 1;
+}
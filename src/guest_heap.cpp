@@ -0,0 +1,201 @@
+#include <guest_heap.h>
+#include <guest_threads.h>
+#include <algorithm>
+
+static int64_t ClassWords(int size_class) {
+    if (size_class == 0) {
+        return 1;
+    }
+    return size_class % 2 == 1 ? int64_t(1) << ((size_class + 1) / 2) : int64_t(3) << (size_class / 2 - 1);
+}
+
+/* The smallest class that holds `words`, which must be positive. */
+static int SizeClass(int64_t words) {
+    if (words <= 2) {
+        return words - 1;
+    }
+    int log = 63 - __builtin_clzll(words - 1);
+    return words <= (int64_t(3) << (log - 1)) ? 2 * log : 2 * log + 1;
+}
+
+void GuestHeap::SetBase(int64_t base) {
+    base_ = base;
+}
+
+void GuestHeap::SetMutex(std::mutex* mutex) {
+    mutex_ = mutex;
+}
+
+bool GuestHeap::TryAlloc(HeapMemory* memory, int64_t words, int64_t* ptr) {
+    *ptr = 0;
+    if (words <= 0 || words > ClassWords(kClassesCnt - 1)) {
+        return true;
+    }
+    int size_class = SizeClass(words);
+    if (size_class >= kCachedClassesCnt) {
+        OptionalLock lock(mutex_);
+        if (!TryTakeBlock(memory, size_class, ptr)) {
+            return false;
+        }
+    } else if (cache_cnt_[size_class] > 0) {
+        *ptr = cache_[size_class][--cache_cnt_[size_class]];
+    } else {
+        /* Refills half of the cache on the way; the blocks come out in the order they were taken. */
+        OptionalLock lock(mutex_);
+        if (!TryTakeBlock(memory, size_class, ptr)) {
+            return false;
+        }
+        int64_t refill[kCacheSize / 2];
+        int refill_cnt = 0;
+        while (*ptr != 0 && refill_cnt < kCacheSize / 2) {
+            int64_t block = 0;
+            if (!TryTakeBlock(memory, size_class, &block)) {
+                return false;
+            }
+            if (block == 0) {
+                break;
+            }
+            refill[refill_cnt++] = block;
+        }
+        while (refill_cnt > 0) {
+            cache_[size_class][cache_cnt_[size_class]++] = refill[--refill_cnt];
+        }
+    }
+    if (*ptr != 0) {
+        *memory->Word(*ptr - 1) = size_class + 1;
+    }
+    return true;
+}
+
+bool GuestHeap::TryFree(HeapMemory* memory, int64_t ptr) {
+    if (ptr == 0) {
+        return true;
+    }
+    int size_class = 0;
+    if (!TryGetAllocatedClass(memory, ptr, &size_class)) {
+        return false;
+    }
+    *memory->Word(ptr - 1) = -(size_class + 1);
+    if (size_class >= kCachedClassesCnt) {
+        OptionalLock lock(mutex_);
+        PutBlock(memory, size_class, ptr);
+        return true;
+    }
+
+    auto& cache = cache_[size_class];
+    int& cache_cnt = cache_cnt_[size_class];
+    if (cache_cnt == kCacheSize) {
+        /* A full cache hands its older half back. */
+        OptionalLock lock(mutex_);
+        for (int i = 0; i < kCacheSize / 2; ++i) {
+            PutBlock(memory, size_class, cache[i]);
+        }
+        std::copy(cache.begin() + kCacheSize / 2, cache.end(), cache.begin());
+        cache_cnt -= kCacheSize / 2;
+    }
+    cache[cache_cnt++] = ptr;
+    return true;
+}
+
+bool GuestHeap::TryRealloc(HeapMemory* memory, int64_t ptr, int64_t words, int64_t* new_ptr) {
+    if (ptr == 0) {
+        return TryAlloc(memory, words, new_ptr);
+    }
+    if (words <= 0) {
+        *new_ptr = 0;
+        return TryFree(memory, ptr);
+    }
+    int size_class = 0;
+    if (!TryGetAllocatedClass(memory, ptr, &size_class)) {
+        return false;
+    }
+    int64_t old_words = ClassWords(size_class);
+    if (words <= old_words) {
+        *new_ptr = ptr;
+        return true;
+    }
+    if (!TryAlloc(memory, words, new_ptr)) {
+        return false;
+    }
+    if (*new_ptr == 0) {
+        return true;
+    }
+    for (int64_t i = 0; i < old_words; ++i) {
+        *memory->Word(*new_ptr + i) = *memory->Word(ptr + i);
+    }
+    return TryFree(memory, ptr);
+}
+
+void GuestHeap::Flush(HeapMemory* memory) {
+    if (std::all_of(cache_cnt_.begin(), cache_cnt_.end(), [](int cnt) { return cnt == 0; })) {
+        return;
+    }
+    OptionalLock lock(mutex_);
+    for (int size_class = 0; size_class < kCachedClassesCnt; ++size_class) {
+        for (int i = 0; i < cache_cnt_[size_class]; ++i) {
+            PutBlock(memory, size_class, cache_[size_class][i]);
+        }
+        cache_cnt_[size_class] = 0;
+    }
+}
+
+void GuestHeap::Reset() {
+    cache_cnt_.fill(0);
+    mutex_ = nullptr;
+}
+
+/* Pops a free block of the class, carving one at the break if there is none; *ptr stays 0 if RAM
+ * is exhausted. The shared state must be locked. */
+bool GuestHeap::TryTakeBlock(HeapMemory* memory, int size_class, int64_t* ptr) {
+    *ptr = 0;
+    if (!memory->Reserve(base_ + kHeaderWords)) {
+        return true;
+    }
+    int64_t* brk = memory->Word(base_);
+    int64_t* head = memory->Word(base_ + 1 + size_class);
+    if (*brk == 0) {
+        *brk = base_ + kHeaderWords;
+    }
+
+    if (*head != 0) {
+        int64_t* header = memory->Word(*head - 1);
+        int64_t* next = memory->Word(*head);
+        if (*head <= base_ + kHeaderWords || header == nullptr || next == nullptr || *header != -(size_class + 1)) {
+            return false;
+        }
+        *ptr = *head;
+        *head = *next;
+        return true;
+    }
+
+    int64_t end = *brk + 1 + ClassWords(size_class);
+    if (*brk < base_ + kHeaderWords) {
+        return false;
+    }
+    if (!memory->Reserve(end)) {
+        return true;
+    }
+    *memory->Word(*brk) = -(size_class + 1);
+    *ptr = *brk + 1;
+    *brk = end;
+    return true;
+}
+
+/* The block's header must already say it is free. The shared state must be locked. */
+void GuestHeap::PutBlock(HeapMemory* memory, int size_class, int64_t ptr) {
+    int64_t* head = memory->Word(base_ + 1 + size_class);
+    *memory->Word(ptr) = *head;
+    *head = ptr;
+}
+
+bool GuestHeap::TryGetAllocatedClass(HeapMemory* memory, int64_t ptr, int* size_class) {
+    if (ptr <= base_ + kHeaderWords) {
+        return false;
+    }
+    int64_t* header = memory->Word(ptr - 1);
+    if (header == nullptr || *header <= 0 || *header > kClassesCnt) {
+        return false;
+    }
+    *size_class = *header - 1;
+    return memory->Word(ptr + ClassWords(*size_class) - 1) != nullptr;
+}
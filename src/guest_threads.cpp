@@ -0,0 +1,60 @@
+#include <guest_threads.h>
+
+GuestThreads::~GuestThreads() {
+    JoinAll();
+}
+
+int64_t GuestThreads::Spawn(std::function<bool(int64_t* result)> body) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Thread& thread = threads_.emplace_back();
+    thread.thread = std::thread([&thread, body = std::move(body)]() {
+        thread.ok = body(&thread.result);
+    });
+    return threads_.size();
+}
+
+bool GuestThreads::Join(int64_t handle, int64_t* result) {
+    Thread* thread = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (handle <= 0 || handle > static_cast<int64_t>(threads_.size())) {
+            return false;
+        }
+        thread = &threads_[handle - 1];
+    }
+    if (thread->thread.get_id() == std::this_thread::get_id()) {
+        return false;
+    }
+    std::call_once(thread->joined, [thread]() {
+        thread->thread.join();
+    });
+    *result = thread->result;
+    return thread->ok;
+}
+
+void GuestThreads::JoinAll() {
+    int64_t result = 0;
+    for (int64_t handle = 1; ; ++handle) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (handle > static_cast<int64_t>(threads_.size())) {
+                return;
+            }
+        }
+        Join(handle, &result);
+    }
+}
+
+void GuestThreads::Clear() {
+    JoinAll();
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads_.clear();
+}
+
+std::mutex* GuestThreads::IOMutex() {
+    return &io_mutex_;
+}
+
+std::mutex* GuestThreads::HeapMutex() {
+    return &heap_mutex_;
+}
@@ -0,0 +1,492 @@
+#include <image.h>
+#include <oosf/input_data_stream.h>
+#include <oosf/output_data_stream.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int64_t RoundUpTo8(int64_t value) {
+    return (value + 7) & ~int64_t(7);
+}
+
+template <class T>
+static void Append(std::string* buffer, const T* values, size_t cnt) {
+    buffer->append(reinterpret_cast<const char*>(values), sizeof(T) * cnt);
+}
+
+static void WriteImage(const Object& obj, std::ostream* out) {
+    std::string strings;
+    std::unordered_map<std::string_view, int64_t> string_offsets;
+    auto intern = [&strings, &string_offsets](std::string_view name) {
+        auto [iter, inserted] = string_offsets.emplace(name, strings.size());
+        if (inserted) {
+            strings += name;
+        }
+        return iter->second;
+    };
+
+    std::map<std::string_view, Symbol> sorted_symbols(obj.defined_symbols.begin(), obj.defined_symbols.end());
+    std::vector<ImageSymbol> symbols;
+    symbols.reserve(sorted_symbols.size());
+    for (const auto& [name, symbol] : sorted_symbols) {
+        symbols.push_back(ImageSymbol{symbol.position, intern(name), static_cast<int32_t>(name.size()), symbol.type});
+    }
+
+    std::map<int64_t, std::string_view> sorted_relocations(obj.required_symbols.begin(), obj.required_symbols.end());
+    std::vector<ImageRelocation> relocations;
+    relocations.reserve(sorted_relocations.size());
+    for (const auto& [position, name] : sorted_relocations) {
+        relocations.push_back(ImageRelocation{position, intern(name), static_cast<int64_t>(name.size())});
+    }
+
+    std::string metadata;
+    if (obj.metadata) {
+        const ProgramMetadata& source = *obj.metadata;
+        ImageMetadata header{source.invalid_at, source.used_registers,
+                             static_cast<int64_t>(source.instruction_starts.size()),
+                             static_cast<int64_t>(source.blocks.size()), static_cast<int64_t>(source.functions.size())};
+        Append(&metadata, &header, 1);
+        Append(&metadata, source.instruction_starts.data(), source.instruction_starts.size());
+        for (const BasicBlock& block : source.blocks) {
+            ImageBlock image_block{block.start, block.end, block.stack_delta, block.stack_min, block.jump_target};
+            Append(&metadata, &image_block, 1);
+        }
+        for (const FunctionExtent& function : source.functions) {
+            ImageFunction image_function{function.start, function.end};
+            Append(&metadata, &image_function, 1);
+        }
+    }
+
+    std::string lines;
+    if (!obj.line_table.Empty()) {
+        ImageLineTable header{static_cast<int64_t>(obj.line_table.files.size()),
+                              static_cast<int64_t>(obj.line_table.rows.size())};
+        Append(&lines, &header, 1);
+        for (const std::string& file : obj.line_table.files) {
+            ImageLineFile image_file{intern(file), static_cast<int64_t>(file.size())};
+            Append(&lines, &image_file, 1);
+        }
+        EncodeLineRows(obj.line_table.rows, &lines);
+    }
+
+    struct Content {
+        ImageSectionType type;
+        const void* data;
+        size_t size;
+    };
+    std::vector<Content> contents = {
+        {kImageSectionBytecode, obj.bytecode.data(), obj.bytecode.size()},
+        {kImageSectionSymbols, symbols.data(), symbols.size() * sizeof(ImageSymbol)},
+        {kImageSectionStrings, strings.data(), strings.size()},
+        {kImageSectionRelocations, relocations.data(), relocations.size() * sizeof(ImageRelocation)},
+    };
+    /* The optional sections are left out when there is nothing in them. */
+    if (obj.metadata) {
+        contents.push_back({kImageSectionMetadata, metadata.data(), metadata.size()});
+    }
+    if (!lines.empty()) {
+        contents.push_back({kImageSectionLines, lines.data(), lines.size()});
+    }
+    const int64_t sections_cnt = contents.size();
+
+    ImageHeader header{};
+    std::memcpy(header.magic, kImageMagic, sizeof(kImageMagic));
+    header.format_version = kImageFormatVersion;
+    header.proc_major = obj.proc_version.major;
+    header.proc_minor = obj.proc_version.minor;
+    header.proc_patch = obj.proc_version.patch;
+    header.object_type = obj.object_type;
+    header.bss_size = obj.bss_size;
+    header.sections_cnt = sections_cnt;
+    header.section_table_offset = sizeof(ImageHeader);
+
+    std::vector<ImageSection> sections(sections_cnt);
+    int64_t offset = sizeof(ImageHeader) + sizeof(ImageSection) * sections_cnt;
+    for (int64_t i = 0; i < sections_cnt; ++i) {
+        offset = RoundUpTo8(offset);
+        sections[i] = ImageSection{contents[i].type, offset, static_cast<int64_t>(contents[i].size)};
+        offset += contents[i].size;
+    }
+
+    std::string buffer;
+    buffer.reserve(offset);
+    Append(&buffer, &header, 1);
+    Append(&buffer, sections.data(), sections_cnt);
+    for (int64_t i = 0; i < sections_cnt; ++i) {
+        buffer.resize(sections[i].offset, '\0');
+        Append(&buffer, static_cast<const char*>(contents[i].data), contents[i].size);
+    }
+    out->write(buffer.data(), buffer.size());
+}
+
+bool TryParseObjectFormat(const char* name, ObjectFormat* format) {
+    if (std::strcmp(name, "image") == 0) {
+        *format = kObjectFormatImage;
+    } else if (std::strcmp(name, "oosf") == 0) {
+        *format = kObjectFormatOOSF;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void WriteObject(const Object& obj, ObjectFormat format, std::ostream* out) {
+    if (format == kObjectFormatImage) {
+        WriteImage(obj, out);
+        return;
+    }
+    OutputDataStream dstream(out, obj.defined_symbols.size() + obj.required_symbols.size() + 1);
+    Object::RegisterIn(&dstream);
+    dstream.Write(obj);
+}
+
+static bool TryReadOOSF(std::FILE* file, const char* name, Object* object, std::string* error) {
+    InputDataStream dstream(file);
+    Object::RegisterIn(&dstream);
+    ReadStatus read_status = dstream.TryRead(object);
+    std::fclose(file);
+
+    if (read_status != kStatusOk) {
+        *error = std::string("Failed to read ") + name;
+        return false;
+    }
+    return true;
+}
+
+bool TryReadObjectFile(const char* path, Object* object, std::string* error) {
+    std::FILE* file = std::fopen(path, "rb");
+    if (file == nullptr) {
+        *error = std::string("Failed to open ") + path;
+        return false;
+    }
+    char magic[sizeof(kImageMagic)] = {};
+    if (std::fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+        std::memcmp(magic, kImageMagic, sizeof(kImageMagic)) == 0) {
+        std::fclose(file);
+        MappedImage image;
+        if (!image.TryMap(path, error)) {
+            return false;
+        }
+        image.ToObject(object);
+        return true;
+    }
+    std::rewind(file);
+    return TryReadOOSF(file, path, object, error);
+}
+
+bool TryReadObjectFromMemory(const void* data, size_t size, Object* object, std::string* error) {
+    if (MappedImage::IsImage(data, size)) {
+        /* Everything is copied out anyway, so a copy also takes care of alignment. */
+        std::vector<int64_t> aligned((size + sizeof(int64_t) - 1) / sizeof(int64_t));
+        std::memcpy(aligned.data(), data, size);
+        MappedImage image;
+        if (!image.TryAttach(aligned.data(), size, error)) {
+            return false;
+        }
+        image.ToObject(object);
+        return true;
+    }
+    std::FILE* file = fmemopen(const_cast<void*>(data), size, "rb");
+    if (file == nullptr) {
+        *error = "Failed to open in-memory object";
+        return false;
+    }
+    return TryReadOOSF(file, "in-memory object", object, error);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+MappedImage::~MappedImage() {
+    Unmap();
+}
+
+bool MappedImage::IsImage(const void* data, size_t size) {
+    return size >= sizeof(ImageHeader) && std::memcmp(data, kImageMagic, sizeof(kImageMagic)) == 0;
+}
+
+bool MappedImage::TryMap(const char* path, std::string* error) {
+    Unmap();
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *error = std::string("Failed to open ") + path;
+        return false;
+    }
+    struct stat st{};
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        *error = std::string("Failed to map ") + path;
+        return false;
+    }
+    if (!TryAttach(data, st.st_size, error)) {
+        munmap(data, st.st_size);
+        *error = std::string(path) + ": " + *error;
+        return false;
+    }
+    mapped_ = true;
+    return true;
+}
+
+bool MappedImage::TryAttach(const void* data, size_t size, std::string* error) {
+    Unmap();
+    if (reinterpret_cast<uintptr_t>(data) % alignof(ImageHeader) != 0 || !IsImage(data, size)) {
+        *error = "not an image";
+        return false;
+    }
+    const char* bytes = static_cast<const char*>(data);
+    const auto* header = reinterpret_cast<const ImageHeader*>(bytes);
+    int64_t file_size = size;
+    if (header->format_version != kImageFormatVersion || header->sections_cnt < 0 ||
+        header->section_table_offset < 0 || header->section_table_offset % 8 != 0 ||
+        header->section_table_offset > file_size ||
+        header->sections_cnt > (file_size - header->section_table_offset) / static_cast<int64_t>(sizeof(ImageSection))) {
+        *error = "malformed image header";
+        return false;
+    }
+
+    const auto* sections = reinterpret_cast<const ImageSection*>(bytes + header->section_table_offset);
+    for (int64_t i = 0; i < header->sections_cnt; ++i) {
+        const ImageSection& section = sections[i];
+        if (section.offset < 0 || section.size < 0 || section.offset % 8 != 0 ||
+            section.offset > file_size || section.size > file_size - section.offset) {
+            *error = "malformed section table";
+            return false;
+        }
+        const char* begin = bytes + section.offset;
+        switch (section.type) {
+            case kImageSectionBytecode:
+                bytecode_ = reinterpret_cast<const int8_t*>(begin);
+                bytecode_size_ = section.size;
+                break;
+            case kImageSectionSymbols:
+                symbols_ = reinterpret_cast<const ImageSymbol*>(begin);
+                symbols_cnt_ = section.size / sizeof(ImageSymbol);
+                break;
+            case kImageSectionStrings:
+                strings_ = begin;
+                strings_size_ = section.size;
+                break;
+            case kImageSectionRelocations:
+                relocations_ = reinterpret_cast<const ImageRelocation*>(begin);
+                relocations_cnt_ = section.size / sizeof(ImageRelocation);
+                break;
+            case kImageSectionMetadata:
+                metadata_ = begin;
+                metadata_size_ = section.size;
+                break;
+            case kImageSectionLines:
+                lines_ = begin;
+                lines_size_ = section.size;
+                break;
+            default:
+                break;
+        }
+    }
+    data_ = bytes;
+    size_ = size;
+    header_ = header;
+    return true;
+}
+
+Object::ProcVersion MappedImage::GetProcVersion() const {
+    return Object::ProcVersion{header_->proc_major, header_->proc_minor, header_->proc_patch};
+}
+
+Object::ObjectType MappedImage::GetObjectType() const {
+    return static_cast<Object::ObjectType>(header_->object_type);
+}
+
+int64_t MappedImage::GetBssSize() const {
+    return header_->bss_size;
+}
+
+const int8_t* MappedImage::Bytecode() const {
+    return bytecode_;
+}
+
+size_t MappedImage::BytecodeSize() const {
+    return bytecode_size_;
+}
+
+size_t MappedImage::SymbolsCnt() const {
+    return symbols_cnt_;
+}
+
+std::string_view MappedImage::SymbolName(size_t idx) const {
+    return Name(symbols_[idx].name_offset, symbols_[idx].name_size);
+}
+
+Symbol MappedImage::SymbolAt(size_t idx) const {
+    return Symbol(symbols_[idx].position, static_cast<Symbol::SymbolType>(symbols_[idx].type));
+}
+
+bool MappedImage::TryFindSymbol(std::string_view name, Symbol* symbol) const {
+    size_t begin = 0, end = symbols_cnt_;
+    while (begin < end) {
+        size_t middle = begin + (end - begin) / 2;
+        if (SymbolName(middle) < name) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    if (begin == symbols_cnt_ || SymbolName(begin) != name) {
+        return false;
+    }
+    *symbol = SymbolAt(begin);
+    return true;
+}
+
+size_t MappedImage::RelocationsCnt() const {
+    return relocations_cnt_;
+}
+
+int64_t MappedImage::RelocationPosition(size_t idx) const {
+    return relocations_[idx].position;
+}
+
+std::string_view MappedImage::RelocationName(size_t idx) const {
+    return Name(relocations_[idx].name_offset, relocations_[idx].name_size);
+}
+
+bool MappedImage::TryReadMetadata(ProgramMetadata* metadata) const {
+    if (metadata_ == nullptr || metadata_size_ < sizeof(ImageMetadata)) {
+        return false;
+    }
+    const auto* header = reinterpret_cast<const ImageMetadata*>(metadata_);
+    int64_t size = metadata_size_ - sizeof(ImageMetadata);
+    int64_t bytecode_size = bytecode_size_;
+    if (header->instructions_cnt < 0 || header->blocks_cnt < 0 || header->functions_cnt < 0 ||
+        header->instructions_cnt > size / static_cast<int64_t>(sizeof(int64_t)) ||
+        header->blocks_cnt > (size - header->instructions_cnt * static_cast<int64_t>(sizeof(int64_t))) /
+                             static_cast<int64_t>(sizeof(ImageBlock)) ||
+        header->functions_cnt > (size - header->instructions_cnt * static_cast<int64_t>(sizeof(int64_t)) -
+                                 header->blocks_cnt * static_cast<int64_t>(sizeof(ImageBlock))) /
+                                static_cast<int64_t>(sizeof(ImageFunction)) ||
+        header->invalid_at < -1 || header->invalid_at >= bytecode_size ||
+        header->used_registers < 0 || header->used_registers > 0xff) {
+        return false;
+    }
+
+    const auto* starts = reinterpret_cast<const int64_t*>(header + 1);
+    const auto* blocks = reinterpret_cast<const ImageBlock*>(starts + header->instructions_cnt);
+    const auto* functions = reinterpret_cast<const ImageFunction*>(blocks + header->blocks_cnt);
+    auto in_bytecode = [bytecode_size](int64_t start, int64_t end) {
+        return start >= 0 && start <= end && end <= bytecode_size;
+    };
+    for (int64_t i = 0; i < header->instructions_cnt; ++i) {
+        if (starts[i] < 0 || starts[i] >= bytecode_size || (i > 0 && starts[i] <= starts[i - 1])) {
+            return false;
+        }
+    }
+    for (int64_t i = 0; i < header->blocks_cnt; ++i) {
+        if (!in_bytecode(blocks[i].start, blocks[i].end)) {
+            return false;
+        }
+    }
+    for (int64_t i = 0; i < header->functions_cnt; ++i) {
+        if (!in_bytecode(functions[i].start, functions[i].end)) {
+            return false;
+        }
+    }
+
+    metadata->invalid_at = header->invalid_at;
+    metadata->used_registers = header->used_registers;
+    metadata->instruction_starts.assign(starts, starts + header->instructions_cnt);
+    metadata->blocks.resize(header->blocks_cnt);
+    for (int64_t i = 0; i < header->blocks_cnt; ++i) {
+        metadata->blocks[i] = BasicBlock{blocks[i].start, blocks[i].end, blocks[i].stack_delta, blocks[i].stack_min,
+                                         blocks[i].jump_target != 0};
+    }
+    metadata->functions.resize(header->functions_cnt);
+    for (int64_t i = 0; i < header->functions_cnt; ++i) {
+        metadata->functions[i] = FunctionExtent{functions[i].start, functions[i].end};
+    }
+    return true;
+}
+
+bool MappedImage::TryReadLineTable(LineTable* table) const {
+    if (lines_ == nullptr || lines_size_ < sizeof(ImageLineTable)) {
+        return false;
+    }
+    const auto* header = reinterpret_cast<const ImageLineTable*>(lines_);
+    int64_t size = lines_size_ - sizeof(ImageLineTable);
+    if (header->files_cnt < 0 || header->files_cnt > size / static_cast<int64_t>(sizeof(ImageLineFile))) {
+        return false;
+    }
+    const auto* files = reinterpret_cast<const ImageLineFile*>(header + 1);
+    const char* rows = reinterpret_cast<const char*>(files + header->files_cnt);
+    if (!TryDecodeLineRows(rows, lines_ + lines_size_ - rows, header->rows_cnt, header->files_cnt, bytecode_size_,
+                           &table->rows)) {
+        return false;
+    }
+    table->files.clear();
+    for (int64_t i = 0; i < header->files_cnt; ++i) {
+        table->files.emplace_back(Name(files[i].name_offset, files[i].name_size));
+    }
+    return true;
+}
+
+void MappedImage::ToObject(Object* obj) const {
+    obj->proc_version = GetProcVersion();
+    obj->object_type = GetObjectType();
+    obj->bytecode.assign(bytecode_, bytecode_ + bytecode_size_);
+    obj->defined_symbols.clear();
+    obj->defined_symbols.reserve(symbols_cnt_);
+    for (size_t i = 0; i < symbols_cnt_; ++i) {
+        obj->defined_symbols.emplace(SymbolName(i), SymbolAt(i));
+    }
+    obj->required_symbols.clear();
+    obj->required_symbols.reserve(relocations_cnt_);
+    for (size_t i = 0; i < relocations_cnt_; ++i) {
+        obj->required_symbols.emplace(RelocationPosition(i), RelocationName(i));
+    }
+    obj->bss_size = GetBssSize();
+    obj->metadata.reset();
+    ProgramMetadata metadata;
+    if (TryReadMetadata(&metadata)) {
+        obj->metadata = std::move(metadata);
+    }
+    LineTable line_table;
+    obj->line_table = TryReadLineTable(&line_table) ? std::move(line_table) : LineTable();
+}
+
+void MappedImage::Unmap() {
+    if (mapped_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    header_ = nullptr;
+    bytecode_ = nullptr;
+    bytecode_size_ = 0;
+    symbols_ = nullptr;
+    symbols_cnt_ = 0;
+    strings_ = nullptr;
+    strings_size_ = 0;
+    relocations_ = nullptr;
+    relocations_cnt_ = 0;
+    metadata_ = nullptr;
+    metadata_size_ = 0;
+    lines_ = nullptr;
+    lines_size_ = 0;
+}
+
+std::string_view MappedImage::Name(int64_t offset, int64_t size) const {
+    if (offset < 0 || size < 0 || offset > static_cast<int64_t>(strings_size_) ||
+        size > static_cast<int64_t>(strings_size_) - offset) {
+        return {};
+    }
+    return std::string_view(strings_ + offset, size);
+}
@@ -0,0 +1,77 @@
+#include <instruction_decoder.h>
+#include <instruction_set.h>
+#include <cstring>
+
+static bool ValidRegister(BytecodeView bytecode, int64_t offset) {
+    return bytecode[offset] >= 0 && bytecode[offset] <= MAX_REGISTER;
+}
+
+bool TryDecodeInstruction(BytecodeView bytecode, int64_t ip, InstructionLayout* instruction) {
+    int64_t bytecode_size = bytecode.size();
+    if (ip < 0 || ip >= bytecode_size) {
+        return false;
+    }
+    instruction->start = ip;
+    instruction->opcode = bytecode[ip++];
+    switch (instruction->opcode) {
+#define DEF_CMD(name, code, args, pops, pushes, ...)                    \
+        case code:                                                      \
+            instruction->args_cnt = args;                               \
+            instruction->from_stack_cnt = pops;                         \
+            instruction->to_stack_cnt = pushes;                         \
+            break;
+#include <instruction_set.h>
+#undef DEF_CMD
+        default:
+            return false;
+    }
+
+    ArgDescriptor descriptor = 0;
+    if (instruction->args_cnt > 0) {
+        if (ip + static_cast<int64_t>(sizeof(descriptor)) > bytecode_size) {
+            return false;
+        }
+        std::memcpy(&descriptor, bytecode.data() + ip, sizeof(descriptor));
+        ip += sizeof(descriptor);
+    }
+    for (int i = 0; i < instruction->args_cnt; ++i) {
+        int8_t type = GetArgType(descriptor, i);
+        int size = ImmediateSize(type);
+        switch (type) {
+            case ARG_REGISTER:
+            case ARG_REGISTER_POINTER:
+                size = 1;
+                break;
+            case ARG_BASE_OFFSET:
+                size = 1 + sizeof(int64_t);
+                break;
+            case ARG_BASE_INDEX:
+            case ARG_FRAME:
+                size = 2;
+                break;
+            default:
+                if (size == 0) {
+                    return false;
+                }
+                break;
+        }
+        if (ip + size > bytecode_size) {
+            return false;
+        }
+        bool registers_ok = true;
+        if (type == ARG_REGISTER || type == ARG_REGISTER_POINTER || type == ARG_BASE_OFFSET) {
+            registers_ok = ValidRegister(bytecode, ip);
+        } else if (type == ARG_BASE_INDEX) {
+            registers_ok = ValidRegister(bytecode, ip) && ValidRegister(bytecode, ip + 1);
+        }
+        if (!registers_ok) {
+            return false;
+        }
+        instruction->arg_types[i] = type;
+        instruction->arg_offsets[i] = ip;
+        instruction->arg_sizes[i] = size;
+        ip += size;
+    }
+    instruction->size = ip - instruction->start;
+    return true;
+}
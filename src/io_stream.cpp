@@ -0,0 +1,422 @@
+#include <io_stream.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static inline bool IsSpace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+MappedFile::~MappedFile() {
+    Unmap();
+}
+
+bool MappedFile::TryMap(int fd) {
+    Unmap();
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+        return false;
+    }
+    if (file_stat.st_size == 0) {
+        return true;
+    }
+
+    void* data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+    data_ = data;
+    size_ = file_stat.st_size;
+    return true;
+}
+
+void MappedFile::Unmap() {
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+}
+
+const char* MappedFile::Data() const {
+    return static_cast<const char*>(data_);
+}
+
+size_t MappedFile::Size() const {
+    return size_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+InputStream::InputStream() : buffer_(new char[kBufferSize]) {
+}
+
+InputStream::InputStream(int fd) : InputStream() {
+    Attach(fd);
+}
+
+void InputStream::Attach(int fd) {
+    fd_ = fd;
+    memory_ = nullptr;
+    cur_ = end_ = buffer_.get();
+    eof_ = false;
+}
+
+void InputStream::Attach(const char* data, size_t size) {
+    fd_ = -1;
+    memory_ = cur_ = data;
+    end_ = data + size;
+    eof_ = true;
+}
+
+void InputStream::Rewind() {
+    if (memory_ != nullptr) {
+        cur_ = memory_;
+    }
+}
+
+void InputStream::Tie(OutputStream* output) {
+    tied_output_ = output;
+}
+
+void InputStream::SetBinary(bool binary) {
+    binary_ = binary;
+}
+
+void InputStream::Refill() {
+    size_t pending = end_ - cur_;
+    std::memmove(buffer_.get(), cur_, pending);
+    cur_ = buffer_.get();
+    end_ = cur_ + pending;
+
+    if (tied_output_ != nullptr) {
+        tied_output_->Flush();
+    }
+    while (true) {
+        ssize_t bytes_read = read(fd_, const_cast<char*>(end_), buffer_.get() + kBufferSize - end_);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            eof_ = true;
+        } else {
+            end_ += bytes_read;
+        }
+        break;
+    }
+}
+
+bool InputStream::SkipSpaces() {
+    while (true) {
+        while (cur_ < end_ && IsSpace(*cur_)) {
+            ++cur_;
+        }
+        if (cur_ < end_ || eof_) {
+            break;
+        }
+        Refill();
+    }
+    /* Buffer the whole token, but never wait for more input once a delimiter has arrived. */
+    while (!eof_ && static_cast<size_t>(end_ - cur_) < kMaxTokenLength && std::find_if(cur_, end_, IsSpace) == end_) {
+        Refill();
+    }
+    return cur_ < end_;
+}
+
+bool InputStream::ReadWord(void* value) {
+    static constexpr size_t kWordSize = sizeof(int64_t);
+    while (!eof_ && static_cast<size_t>(end_ - cur_) < kWordSize) {
+        Refill();
+    }
+    if (static_cast<size_t>(end_ - cur_) < kWordSize) {
+        return false;
+    }
+    /* Both engines only run on x86-64, so the host byte order is already little-endian. */
+    std::memcpy(value, cur_, kWordSize);
+    cur_ += kWordSize;
+    return true;
+}
+
+bool InputStream::ReadInt(int64_t* value) {
+    if (binary_) {
+        return ReadWord(value);
+    }
+    if (!SkipSpaces()) {
+        return false;
+    }
+
+    const char* ptr = cur_;
+    bool negative = false;
+    if (*ptr == '-' || *ptr == '+') {
+        negative = (*ptr == '-');
+        ++ptr;
+    }
+    if (ptr == end_ || !IsDigit(*ptr)) {
+        return false;
+    }
+
+    /* Like strtol, saturate on overflow. */
+    const uint64_t limit = negative ? static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) + 1
+                                    : std::numeric_limits<int64_t>::max();
+    uint64_t magnitude = 0;
+    bool overflow = false;
+    for (; ptr < end_ && IsDigit(*ptr); ++ptr) {
+        uint64_t digit = *ptr - '0';
+        if (magnitude > (limit - digit) / 10) {
+            overflow = true;
+        } else {
+            magnitude = magnitude * 10 + digit;
+        }
+    }
+    cur_ = ptr;
+
+    if (overflow) {
+        magnitude = limit;
+    }
+    *value = negative ? static_cast<int64_t>(0 - magnitude) : static_cast<int64_t>(magnitude);
+    return true;
+}
+
+/* Powers of ten that are exact in a double. */
+static constexpr double kExactPowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+bool InputStream::ReadDouble(double* value) {
+    if (binary_) {
+        return ReadWord(value);
+    }
+    if (!SkipSpaces()) {
+        return false;
+    }
+
+    /* Fast path for plain decimals whose value is exactly computable: at most 15 significant
+     * digits and a small power of ten. Everything else (exponents, long mantissas, inf, nan, hex)
+     * goes through strtod on a copy of the token. */
+    const char* ptr = cur_;
+    bool negative = false;
+    if (*ptr == '-' || *ptr == '+') {
+        negative = (*ptr == '-');
+        ++ptr;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0, fraction_digits = 0;
+    bool has_digits = false, fast = true;
+    for (; ptr < end_ && IsDigit(*ptr); ++ptr) {
+        has_digits = true;
+        if (mantissa != 0 || *ptr != '0') {
+            ++digits;
+        }
+        mantissa = mantissa * 10 + (*ptr - '0');
+        fast = fast && digits <= 15;
+    }
+    if (ptr < end_ && *ptr == '.') {
+        for (++ptr; ptr < end_ && IsDigit(*ptr); ++ptr) {
+            has_digits = true;
+            if (mantissa != 0 || *ptr != '0') {
+                ++digits;
+            }
+            mantissa = mantissa * 10 + (*ptr - '0');
+            ++fraction_digits;
+            fast = fast && digits <= 15 && fraction_digits <= 22;
+        }
+    }
+    fast = fast && has_digits && (ptr == end_ || IsSpace(*ptr));
+
+    if (fast) {
+        double result = static_cast<double>(mantissa) / kExactPowersOfTen[fraction_digits];
+        *value = negative ? -result : result;
+        cur_ = ptr;
+        return true;
+    }
+
+    char token[kMaxTokenLength + 1];
+    size_t length = 0;
+    while (cur_ + length < end_ && length < kMaxTokenLength && !IsSpace(cur_[length])) {
+        token[length] = cur_[length];
+        ++length;
+    }
+    token[length] = '\0';
+
+    char* token_end = nullptr;
+    double result = std::strtod(token, &token_end);
+    if (token_end == token) {
+        return false;
+    }
+    cur_ += token_end - token;
+    *value = result;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+OutputStream::OutputStream() : buffer_(new char[kBufferSize]) {
+}
+
+OutputStream::OutputStream(int fd) : OutputStream() {
+    Attach(fd);
+}
+
+OutputStream::~OutputStream() {
+    Flush();
+}
+
+void OutputStream::Attach(int fd) {
+    Flush();
+    fd_ = fd;
+    memory_ = nullptr;
+}
+
+void OutputStream::Attach(char* buffer, size_t capacity) {
+    Flush();
+    fd_ = -1;
+    memory_ = buffer;
+    memory_capacity_ = capacity;
+    memory_size_ = 0;
+}
+
+void OutputStream::Rewind() {
+    if (memory_ != nullptr) {
+        size_ = 0;
+        memory_size_ = 0;
+    }
+}
+
+void OutputStream::Flush() {
+    if (memory_ != nullptr) {
+        size_t length = std::min(size_, memory_capacity_ - memory_size_);
+        std::memcpy(memory_ + memory_size_, buffer_.get(), length);
+        memory_size_ += length;
+    } else if (fd_ >= 0) {
+        const char* ptr = buffer_.get();
+        const char* end = ptr + size_;
+        while (ptr < end) {
+            ssize_t written = write(fd_, ptr, end - ptr);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                break;
+            }
+            ptr += written;
+        }
+    }
+    size_ = 0;
+}
+
+size_t OutputStream::GetMemorySize() const {
+    return memory_size_;
+}
+
+char* OutputStream::Reserve(size_t length) {
+    if (size_ + length > kBufferSize) {
+        Flush();
+    }
+    return buffer_.get() + size_;
+}
+
+/* Writes the decimal digits of `value` ending right before `end`, returns the first digit. */
+static inline char* FormatUnsigned(char* end, uint64_t value) {
+    do {
+        *--end = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    return end;
+}
+
+void OutputStream::WriteInt(int64_t value) {
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    *--end = '\n';
+    uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    char* begin = FormatUnsigned(end, magnitude);
+    if (value < 0) {
+        *--begin = '-';
+    }
+
+    size_t length = digits + sizeof(digits) - begin;
+    std::memcpy(Reserve(length), begin, length);
+    size_ += length;
+}
+
+void OutputStream::WriteDouble(double value) {
+    static constexpr int kFractionDigits = 6;
+    static constexpr double kFractionScale = 1e6;
+    static constexpr double kFastPathLimit = 9e18;
+
+    double magnitude = std::fabs(value);
+    if (!(magnitude < kFastPathLimit)) {
+        Printf("%lf\n", value);
+        return;
+    }
+
+    /* Both the split and the residual of the scaling are exact, so rounding matches printf's
+     * round-half-to-even on the exact binary value. */
+    uint64_t integral = static_cast<uint64_t>(magnitude);
+    double fraction = magnitude - static_cast<double>(integral);
+    double scaled = fraction * kFractionScale;
+    double residual = std::fma(fraction, kFractionScale, -scaled);
+    double scaled_floor = std::floor(scaled);
+    uint64_t fraction_value = static_cast<uint64_t>(scaled_floor);
+    double tail = (scaled - scaled_floor) - 0.5;
+    if (tail > 0 || (tail == 0 && (residual > 0 || (residual == 0 && (fraction_value & 1))))) {
+        ++fraction_value;
+    }
+    if (fraction_value >= static_cast<uint64_t>(kFractionScale)) {
+        fraction_value -= static_cast<uint64_t>(kFractionScale);
+        ++integral;
+    }
+
+    char digits[48];
+    char* end = digits + sizeof(digits);
+    *--end = '\n';
+    for (int i = 0; i < kFractionDigits; ++i) {
+        *--end = static_cast<char>('0' + fraction_value % 10);
+        fraction_value /= 10;
+    }
+    *--end = '.';
+    char* begin = FormatUnsigned(end, integral);
+    if (std::signbit(value)) {
+        *--begin = '-';
+    }
+
+    size_t length = digits + sizeof(digits) - begin;
+    std::memcpy(Reserve(length), begin, length);
+    size_ += length;
+}
+
+void OutputStream::Printf(const char* format, ...) {
+    char* dest = Reserve(kMaxRecordLength);
+    std::va_list args;
+    va_start(args, format);
+    int length = std::vsnprintf(dest, kMaxRecordLength, format, args);
+    va_end(args);
+    if (length > 0) {
+        size_ += std::min<size_t>(length, kMaxRecordLength - 1);
+    }
+}
+
+InputStream* StandardInput() {
+    static InputStream stream(STDIN_FILENO);
+    stream.Tie(StandardOutput());
+    return &stream;
+}
+
+OutputStream* StandardOutput() {
+    static OutputStream stream(STDOUT_FILENO);
+    return &stream;
+}
@@ -2,12 +2,19 @@
 #include <ram.h>
 #include <processor.h>
 #include <argument_descriptors.h>
+#include <vector_kernels.h>
+#include <native_functions.h>
 
 #include <sys/mman.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
 
 static constexpr int64_t kPageSize = 1 << 12;
+static_assert(sizeof(RAM::Chunk) == kPageSize && Snapshot::kChunkBytes == kPageSize,
+              "a RAM chunk must be exactly one page");
 
 static int64_t RoundUp(int64_t value, int64_t divisor) {
     return ((value + divisor - 1) / divisor) * divisor;
@@ -15,6 +22,7 @@ static int64_t RoundUp(int64_t value, int64_t divisor) {
 
 ProtectedMemoryArena::ProtectedMemoryArena(int64_t size, int prot_flags) {
     size_ = size = RoundUp(size, kPageSize);
+    prot_flags_ = prot_flags;
     char* buffer = static_cast<char*>(mmap(NULL, size + 2 * kPageSize, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
     pre_canary_ = buffer;
     data_ = buffer + kPageSize;
@@ -38,6 +46,23 @@ int64_t ProtectedMemoryArena::Size() const {
     return size_;
 }
 
+void ProtectedMemoryArena::Protect(int prot_flags) {
+    prot_flags_ = prot_flags;
+    mprotect(data_, size_, prot_flags);
+}
+
+void ProtectedMemoryArena::Clear() {
+    /* Not MADV_DONTNEED: pages mapped from a snapshot would come back with the file contents. */
+    mmap(data_, size_, prot_flags_, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0);
+}
+
+bool ProtectedMemoryArena::TryMapFile(int64_t offset, int64_t size, int fd, int64_t file_offset) {
+    if (offset < 0 || size <= 0 || offset + size > size_ || offset % kPageSize != 0) {
+        return false;
+    }
+    return mmap(static_cast<char*>(data_) + offset, size, prot_flags_, MAP_PRIVATE | MAP_FIXED, fd, file_offset) != MAP_FAILED;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 extern "C" void DoSwitch(void** old_rsp, void** new_rsp);
@@ -48,37 +73,396 @@ void ExecutionContext::SwitchTo(ExecutionContext& context) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-JITCompiler::JITCompiler()
-    : data_(RAM::kChunkSize * RAM::kMaxChunksCnt * sizeof(int64_t)),
-    data_stack_(Processor::kDataStackMaxSize * sizeof(int64_t)),
-    call_stack_(Processor::kCallStackMaxSize * sizeof(int64_t)) {
-}
-
-JITCompiler::~JITCompiler() {
-}
-
 const Object::ProcVersion& JITCompiler::GetProcessorVersion() const {
     return version_;
 }
 
-static thread_local ExecutionContext supervisor_context, user_context;
+/* The instance whose code is running on this thread; helpers called from native code use it
+ * instead of any process-wide state. */
+static thread_local JITInstance* current_instance = nullptr;
+
+/* Its fuel counter. Every guest thread has an OS thread of its own, so every one gets its own
+ * counter; native code reaches it relative to FS, which needs it in the static TLS block. */
+static thread_local int64_t current_fuel __attribute__((tls_model("initial-exec"))) = 0;
 
-void PrepareUserContext(ExecutionContext& user_context, char* user_stack, void* call_stack, void* entry_point) {
+static int32_t CurrentFuelOffset() {
+    static const int32_t offset = []() {
+        char* thread_pointer = nullptr;
+        asm("mov %%fs:0, %0" : "=r"(thread_pointer));
+        return static_cast<int32_t>(reinterpret_cast<char*>(&current_fuel) - thread_pointer);
+    }();
+    return offset;
+}
+
+void PrepareUserContext(ExecutionContext& user_context, char* user_stack, void* entry_point, const int64_t* callee_saved) {
     user_stack -= sizeof(void*);
     *((void**)user_stack) = entry_point;
     user_stack -= ExecutionContext::kSize;
-    std::memset(user_stack, 0, ExecutionContext::kSize);
-    std::memcpy(user_stack, &call_stack, sizeof(void*));
+    std::memcpy(user_stack, callee_saved, ExecutionContext::kSize);
     user_context.rsp = user_stack;
 }
 
+JITInstance::JITInstance()
+    : JITInstance(std::make_shared<ProtectedMemoryArena>(kDataSize)) {
+    threads_ = std::make_shared<GuestThreads>();
+}
+
+JITInstance::JITInstance(std::shared_ptr<ProtectedMemoryArena> data)
+    : data_(std::move(data)),
+    data_stack_(Processor::kDataStackMaxSize * sizeof(int64_t)),
+    call_stack_((Processor::kCallStackMaxSize + Processor::kFrameStackMaxSize) * sizeof(int64_t)) {
+}
+
+void JITInstance::SetIO(InputStream* input, OutputStream* output) {
+    input_ = input;
+    output_ = output;
+}
+
+/* The entry stub (see JITCompiler::Compile) pops R8-R11, RAX and the first instruction's address
+ * from the user stack, so a fresh start and a restored snapshot differ only in what is put there. */
+void JITInstance::PrepareStart(const JITCompiler& compiler) {
+    Snapshot initial_state;
+    const Snapshot& state = restored_ ? *restored_ : initial_state;
+
+    int64_t* call_stack = static_cast<int64_t*>(call_stack_.End());
+    if (is_thread_) {
+        *--call_stack = reinterpret_cast<int64_t>(compiler.ThreadExitPoint());
+    }
+    /* Frames go right under the return address they were entered below (see ASM_ENTER_FRAME). */
+    std::vector<SnapshotFrame> frames;
+    TryParseFrames(state, &frames);
+    auto frame = frames.begin();
+    auto push_frames = [&](int64_t depth) {
+        for (; frame != frames.end() && frame->depth == depth; ++frame) {
+            for (int64_t slot = frame->size - 1; slot >= 0; --slot) {
+                *--call_stack = state.frame_stack[frame->begin + slot];
+            }
+            *--call_stack = -(frame->size + 1);
+        }
+    };
+    push_frames(0);
+    for (size_t i = 0; i < state.call_stack.size(); ++i) {
+        *--call_stack = reinterpret_cast<int64_t>(compiler.InstructionAddress(state.call_stack[i]));
+        push_frames(i + 1);
+    }
+
+    /* The native stack holds all guest values but the top one, which lives in RAX, over a filler
+     * slot that the first PUSH leaves at the bottom. */
+    int64_t* user_stack = static_cast<int64_t*>(data_stack_.End());
+    int64_t top = 0;
+    if (!state.data_stack.empty()) {
+        *--user_stack = 0;
+        for (size_t i = 0; i + 1 < state.data_stack.size(); ++i) {
+            *--user_stack = state.data_stack[i];
+        }
+        top = state.data_stack.back();
+    }
+    *--user_stack = reinterpret_cast<int64_t>(compiler.InstructionAddress(state.instruction_pointer));
+    *--user_stack = top;
+    for (int i = 3; i >= 0; --i) {
+        *--user_stack = state.registers[i];                 /* R8-R11 */
+    }
+
+    const int64_t callee_saved[] = {
+        reinterpret_cast<int64_t>(call_stack),              /* RBP */
+        reinterpret_cast<int64_t>(DataBase()),              /* RBX, moved to RSI by the stub */
+        state.registers[4], state.registers[5], state.registers[6], state.registers[7], /* R12-R15 */
+    };
+    PrepareUserContext(user_context_, reinterpret_cast<char*>(user_stack), compiler.EntryPoint(), callee_saved);
+    restored_.reset();
+}
+
+bool JITInstance::Execute(const JITCompiler& compiler) {
+    bool resuming = IsSuspended();
+    status_ = Processor::kExecStatusOk;
+    if (!resuming) {
+        PrepareStart(compiler);
+    }
+    JITInstance* outer_instance = current_instance;
+    int64_t outer_fuel = current_fuel;
+    current_instance = this;
+    current_fuel = fuel_per_run_ > 0 ? fuel_per_run_ : INT64_MAX;
+    compiler_ = &compiler;
+    heap_.SetBase(compiler.HeapBase());
+    supervisor_context_.SwitchTo(user_context_);
+    while (status_ == Processor::kExecStatusCheckpoint && !is_thread_) {
+        std::string error;
+        output_->Flush();
+        if (!checkpoint_path_.empty() && !TryWriteCheckpoint(compiler, &error)) {
+            std::fprintf(stderr, "Checkpoint failed: %s\n", error.c_str());
+        }
+        if (stop_at_checkpoint_) {
+            break;
+        }
+        status_ = Processor::kExecStatusOk;
+        supervisor_context_.SwitchTo(user_context_);
+    }
+    current_instance = outer_instance;
+    current_fuel = outer_fuel;
+
+    if (!is_thread_ && !IsSuspended()) {
+        /* The program is over once the main thread is, but RAM has to outlive its threads. */
+        threads_->JoinAll();
+    }
+    OptionalLock lock(io_mutex_);
+    output_->Flush();
+    return status_ == Processor::kExecStatusOk || IsSuspended();
+}
+
+void JITInstance::Reset() {
+    threads_->Clear();
+    io_mutex_ = nullptr;
+    heap_.Reset();
+    data_->Clear();
+    restored_.reset();
+    status_ = Processor::kExecStatusOk;
+}
+
+void JITInstance::SetCheckpointPath(std::string path) {
+    checkpoint_path_ = std::move(path);
+}
+
+void JITInstance::SetStopAtCheckpoint(bool stop) {
+    stop_at_checkpoint_ = stop;
+}
+
+void JITInstance::SetFuel(int64_t fuel) {
+    fuel_per_run_ = fuel;
+}
+
+bool JITInstance::IsSuspended() const {
+    return status_ == Processor::kExecStatusCheckpoint || status_ == Processor::kExecStatusOutOfFuel;
+}
+
+char* JITInstance::DataBase() const {
+    return static_cast<char*>(data_->Begin());
+}
+
+/* The guest heap over the flat data area, which is all addressable from the start. */
+class DataHeapMemory : public HeapMemory {
+public:
+    static constexpr int64_t kWordsCnt = JITInstance::kDataSize >> 3;
+
+    explicit DataHeapMemory(char* data) : data_(reinterpret_cast<int64_t*>(data)) {
+    }
+    int64_t* Word(int64_t idx) override {
+        return idx < 0 || idx >= kWordsCnt ? nullptr : data_ + idx;
+    }
+    bool Reserve(int64_t end) override {
+        return end <= kWordsCnt;
+    }
+
+private:
+    int64_t* data_;
+};
+
+GuestHeap* JITInstance::Heap() {
+    return &heap_;
+}
+
+/* Layout of what CHKPT pushes, from RSP upwards; the guest data stack continues above it. */
+enum SavedRegister {
+    kSavedR15, kSavedR14, kSavedR13, kSavedR12, kSavedRSI,
+    kSavedR11, kSavedR10, kSavedR9, kSavedR8, kSavedRAX,
+    kSavedRegistersCnt
+};
+
+void JITInstance::Suspend(const int64_t* saved_regs, const int64_t* call_stack_top, uint64_t resume_ip) {
+    if (is_thread_ || (checkpoint_path_.empty() && !stop_at_checkpoint_)) {
+        return;
+    }
+    checkpoint_requested = 0;
+    DataHeapMemory memory(DataBase());
+    heap_.Flush(&memory);
+    suspended_regs_ = saved_regs;
+    suspended_call_stack_ = call_stack_top;
+    suspended_ip_ = resume_ip;
+    Stop(Processor::kExecStatusCheckpoint);
+}
+
+bool JITInstance::TryWriteCheckpoint(const JITCompiler& compiler, std::string* error) const {
+    Snapshot snapshot;
+    snapshot.program_hash = compiler.GetProgramHash();
+    snapshot.instruction_pointer = suspended_ip_;
+
+    const int64_t* saved = suspended_regs_;
+    snapshot.registers = {saved[kSavedR8], saved[kSavedR9], saved[kSavedR10], saved[kSavedR11],
+                          saved[kSavedR12], saved[kSavedR13], saved[kSavedR14], saved[kSavedR15]};
+
+    const int64_t* stack_top = saved + kSavedRegistersCnt;
+    const int64_t* stack_bottom = static_cast<const int64_t*>(data_stack_.End());
+    if (stack_top < stack_bottom) {
+        for (const int64_t* value = stack_bottom - 2; value >= stack_top; --value) {
+            snapshot.data_stack.push_back(*value);
+        }
+        snapshot.data_stack.push_back(saved[kSavedRAX]);
+    }
+
+    /* Only the top-down walk can tell frames from return addresses. */
+    const int64_t* call_stack_bottom = static_cast<const int64_t*>(call_stack_.End());
+    std::vector<const int64_t*> entries;
+    for (const int64_t* entry = suspended_call_stack_; entry < call_stack_bottom; entry += *entry < 0 ? -*entry : 1) {
+        entries.push_back(entry);
+    }
+    for (auto iter = entries.rbegin(); iter != entries.rend(); ++iter) {
+        const int64_t* entry = *iter;
+        if (*entry >= 0) {
+            snapshot.call_stack.push_back(compiler.ReturnAddressToIP(reinterpret_cast<const void*>(*entry)));
+            continue;
+        }
+        int64_t size = -*entry - 1;
+        snapshot.frame_stack.insert(snapshot.frame_stack.end(), entry + 1, entry + 1 + size);
+        snapshot.frame_stack.push_back(snapshot.call_stack.size());
+        snapshot.frame_stack.push_back(size);
+    }
+
+    /* Pages that hold only zeros stay out of the image, since restoring leaves missing pages zero.
+     * Residency cannot tell: swapped-out pages and evicted pages of a restored image are not
+     * resident yet hold data. */
+    const char* data = DataBase();
+    for (int64_t i = 0; i < kDataSize / kPageSize; ++i) {
+        const int64_t* page = reinterpret_cast<const int64_t*>(data + i * kPageSize);
+        if (std::any_of(page, page + kPageSize / sizeof(int64_t), [](int64_t word) { return word != 0; })) {
+            snapshot.chunk_indices.push_back(i);
+            snapshot.chunks.push_back(page);
+        }
+    }
+
+    return TryWriteSnapshot(checkpoint_path_.c_str(), snapshot, error);
+}
+
+bool JITInstance::TryRestore(const JITCompiler& compiler, const char* path, std::string* error) {
+    auto snapshot = std::make_unique<Snapshot>();
+    if (!TryReadSnapshot(path, snapshot.get(), error)) {
+        return false;
+    }
+    if (snapshot->program_hash != compiler.GetProgramHash()) {
+        *error = std::string(path) + " was taken from a different program";
+        return false;
+    }
+    /* The user stack also carries the entry frame: R8-R11, RAX, the resume address and the filler. */
+    std::vector<SnapshotFrame> frames;
+    if (snapshot->data_stack.size() + 7 > Processor::kDataStackMaxSize ||
+        snapshot->call_stack.size() > Processor::kCallStackMaxSize ||
+        snapshot->frame_stack.size() > Processor::kFrameStackMaxSize || !TryParseFrames(*snapshot, &frames)) {
+        *error = std::string(path) + " does not fit into the JIT stacks";
+        return false;
+    }
+
+    data_->Clear();
+    const auto& indices = snapshot->chunk_indices;
+    for (size_t begin = 0, end = 0; begin < indices.size(); begin = end) {
+        for (end = begin + 1; end < indices.size() && indices[end] == indices[end - 1] + 1; ++end) {
+        }
+        if (indices[begin] < 0 || !data_->TryMapFile(indices[begin] * kPageSize, (end - begin) * kPageSize,
+                                                    snapshot->image_fd, snapshot->image_offset + begin * kPageSize)) {
+            *error = std::string("Failed to map the RAM image of ") + path;
+            data_->Clear();
+            return false;
+        }
+    }
+    restored_ = std::move(snapshot);
+    return true;
+}
+
+Processor::ExecutionStatus JITInstance::GetStatus() const {
+    return status_;
+}
+
+InputStream* JITInstance::Input() const {
+    return input_;
+}
+
+OutputStream* JITInstance::Output() const {
+    return output_;
+}
+
+std::mutex* JITInstance::IOMutex() const {
+    return io_mutex_;
+}
+
+/* The thread starts at `entry` with a copy of the registers CHKPT-style saved by SPAWN and the
+ * popped value as its only stack entry. Guest I/O is serialized from now on. */
+int64_t JITInstance::Spawn(const int64_t* saved_regs, uint64_t entry) {
+    io_mutex_ = threads_->IOMutex();
+    heap_.SetMutex(threads_->HeapMutex());
+
+    std::shared_ptr<JITInstance> thread(new JITInstance(data_));
+    thread->threads_ = threads_;
+    thread->io_mutex_ = io_mutex_;
+    thread->heap_.SetMutex(threads_->HeapMutex());
+    thread->SetIO(input_, output_);
+    thread->fuel_per_run_ = fuel_per_run_;
+    thread->is_thread_ = true;
+
+    thread->restored_ = std::make_unique<Snapshot>();
+    thread->restored_->instruction_pointer = entry;
+    thread->restored_->registers = {saved_regs[kSavedR8], saved_regs[kSavedR9], saved_regs[kSavedR10],
+                                    saved_regs[kSavedR11], saved_regs[kSavedR12], saved_regs[kSavedR13],
+                                    saved_regs[kSavedR14], saved_regs[kSavedR15]};
+    thread->restored_->data_stack.push_back(saved_regs[kSavedRAX]);
+
+    const JITCompiler* compiler = compiler_;
+    return threads_->Spawn([thread, compiler](int64_t* result) {
+        bool ok = thread->Execute(*compiler);
+        while (ok && thread->IsSuspended()) {
+            ok = thread->Execute(*compiler);
+        }
+        *result = thread->thread_result_;
+        return ok;
+    });
+}
+
+bool JITInstance::Join(int64_t handle, int64_t* result) {
+    return threads_->Join(handle, result);
+}
+
+void JITInstance::FinishThread(int64_t top, const int64_t* stack_top) {
+    DataHeapMemory memory(DataBase());
+    heap_.Flush(&memory);
+    thread_result_ = stack_top == data_stack_.End() ? 0 : top;
+    Stop(Processor::kExecStatusOk);
+}
+
+void JITInstance::Stop(Processor::ExecutionStatus status) {
+    status_ = status;
+    user_context_.SwitchTo(supervisor_context_);
+}
+
+void JITInstance::Fail(Processor::ExecutionStatus status, const void* return_address, const int64_t* call_stack_top) {
+    failure_ip_ = return_address == nullptr ? -1 : compiler_->HelperReturnAddressToIP(return_address);
+    failure_call_stack_.clear();
+    const int64_t* call_stack_bottom = static_cast<const int64_t*>(call_stack_.End());
+    for (const int64_t* entry = call_stack_top; entry < call_stack_bottom; entry += *entry < 0 ? -*entry : 1) {
+        if (*entry >= 0) {
+            failure_call_stack_.push_back(compiler_->ReturnAddressToIP(reinterpret_cast<const void*>(*entry)));
+        }
+    }
+    std::reverse(failure_call_stack_.begin(), failure_call_stack_.end());
+    Stop(status);
+}
+
+int64_t JITInstance::GetFailureIP() const {
+    return failure_ip_;
+}
+
+const std::vector<int64_t>& JITInstance::GetFailureCallStack() const {
+    return failure_call_stack_;
+}
+
+/* For helpers that native code enters with `call`. Compiled code keeps the guest call stack top in
+ * RBP, which the helper's own frame saves. */
+#define FAIL(status) current_instance->Fail((status), __builtin_return_address(0), \
+                                            *static_cast<const int64_t* const*>(__builtin_frame_address(0)))
+
+/* Reached by a plain JMP, so it must not rely on stack alignment; nor is there a return address. */
 static void BadJumpAddressHandler() {
-    std::printf("Jump to invalid address\n");
-    std::exit(1);
+    current_instance->Fail(Processor::kExecStatusIPOutOfRange, nullptr,
+                           *static_cast<const int64_t* const*>(__builtin_frame_address(0)));
 }
 
 template <class T>
-static inline bool TryGet(const std::vector<int8_t>& bytecode, int64_t* ip, T* dest) {
+static inline bool TryGet(BytecodeView bytecode, int64_t* ip, T* dest) {
     if ((*ip + sizeof(T)) > bytecode.size()) {
         return false;
     }
@@ -88,14 +472,18 @@ static inline bool TryGet(const std::vector<int8_t>& bytecode, int64_t* ip, T* d
 }
 
 
-bool FillArgs(const std::vector<int8_t>& bytecode, int* arg_types, int64_t* arg_values, int argcnt, int64_t* ip) {
+/* arg_values holds the immediate or the (base) register, arg_extras the offset or the index
+ * register of ARG_BASE_OFFSET and ARG_BASE_INDEX operands. */
+bool FillArgs(BytecodeView bytecode, int* arg_types, int64_t* arg_values, int64_t* arg_extras,
+              int argcnt, int64_t* ip) {
 #define TRY_GET(x) if (!TryGet(bytecode, ip, ( x ))) { return false; }
     if (argcnt == 0) {
         return true;
     }
 
-    int8_t arg_descriptor = 0;
+    ArgDescriptor arg_descriptor = 0;
     int8_t reg_buffer = 0;
+    uint16_t slot_buffer = 0;
     TRY_GET(&arg_descriptor);
 
     for (int i = 0; i < argcnt; ++i) {
@@ -108,14 +496,52 @@ bool FillArgs(const std::vector<int8_t>& bytecode, int* arg_types, int64_t* arg_
             case ARG_POINTER:
                 TRY_GET(arg_values + i);
                 break;
+            case ARG_VALUE_8:
+            case ARG_VALUE_16:
+            case ARG_VALUE_32:
+            case ARG_POINTER_8:
+            case ARG_POINTER_16:
+            case ARG_POINTER_32: {
+                int size = ImmediateSize(arg_types[i]);
+                if (*ip + size > static_cast<int64_t>(bytecode.size())) {
+                    return false;
+                }
+                arg_values[i] = ReadImmediate(&bytecode[*ip], size);
+                *ip += size;
+                arg_types[i] = WideArgType(arg_types[i]);
+                break;
+            }
             case ARG_REGISTER:
             case ARG_REGISTER_POINTER:
                 TRY_GET(&reg_buffer);
-                if (reg_buffer < 0 || reg_buffer >= MAX_REGISTER) {
+                if (reg_buffer < 0 || reg_buffer > MAX_REGISTER) {
                     return false;
                 }
                 arg_values[i] = reg_buffer;
                 break;
+            case ARG_BASE_OFFSET:
+            case ARG_BASE_INDEX:
+                TRY_GET(&reg_buffer);
+                if (reg_buffer < 0 || reg_buffer > MAX_REGISTER) {
+                    return false;
+                }
+                arg_values[i] = reg_buffer;
+                if (arg_types[i] == ARG_BASE_OFFSET) {
+                    TRY_GET(arg_extras + i);
+                    break;
+                }
+                TRY_GET(&reg_buffer);
+                if (reg_buffer < 0 || reg_buffer > MAX_REGISTER) {
+                    return false;
+                }
+                arg_extras[i] = reg_buffer;
+                break;
+            case ARG_FRAME:
+                TRY_GET(&slot_buffer);
+                arg_values[i] = slot_buffer;
+                break;
+            default:
+                return false;
         }
     }
 
@@ -126,7 +552,8 @@ bool FillArgs(const std::vector<int8_t>& bytecode, int* arg_types, int64_t* arg_
     case code: {                                                                                \
         int arg_types[argcnt + 1] = {};                                                         \
         int64_t arg_values[argcnt + 1] = {};                                                    \
-        if (!FillArgs(obj.bytecode, arg_types, arg_values, argcnt, &instruction_pointer)) {     \
+        int64_t arg_extras[argcnt + 1] = {};                                                    \
+        if (!FillArgs(bytecode, arg_types, arg_values, arg_extras, argcnt, &instruction_pointer)) { \
             throw std::runtime_error("Instruction is corrupted! Cannot read arguments.");       \
         }                                                                                       \
         asm_codegen ;                                                                           \
@@ -170,73 +597,177 @@ void AppendInstruction(std::vector<int8_t>* native_code, Directly<T> value) {
     }
 }
 
-void* ToDataPointer(const ProtectedMemoryArena& data, int64_t addr) {
-    if (addr < 0 || addr >= (data.Size() >> 3)) {
+/* Guest memory is addressed as [RSI + disp32], so a bss address becomes a byte offset. */
+int32_t ToDataOffset(int64_t addr) {
+    if (addr < 0 || addr >= (JITInstance::kDataSize >> 3)) {
         throw std::runtime_error("Bad data pointer!");
     }
-    return static_cast<int64_t*>(data.Begin()) + addr;
+    return static_cast<int32_t>(addr << 3);
 }
 
-static thread_local void* rsp_buffer;
-
-#define STACK_ALIGN_PRE         \
-    asm ("mov %%rsp, %0\n"      \
-         "and $-0x10, %%rsp\n"  \
-         : "=m"(rsp_buffer));
-
-#define STACK_ALIGN_POST        \
-    asm ("mov %0, %%rsp"        \
-         :                      \
-         : "m"(rsp_buffer));
+/* Helpers below are entered through ASM_CALL_HELPER, which aligns the stack for them. */
 
 void OverflowCall() {
-    STACK_ALIGN_PRE
-    std::printf("Pointer out of of bounds! Stopping...");
-    user_context.SwitchTo(supervisor_context);
-    // UNREACHABLE
-    STACK_ALIGN_POST
+    FAIL(Processor::kExecStatusAddressOutOfRange);
 }
 
 int64_t ReadIntCall() {
-    STACK_ALIGN_PRE
-    int64_t result;
-    std::scanf("%ld", &result);
-    STACK_ALIGN_POST
+    int64_t result = 0;
+    OptionalLock lock(current_instance->IOMutex());
+    current_instance->Input()->ReadInt(&result);
     return result;
 }
 
 void WriteIntCall(int64_t x) {
-    STACK_ALIGN_PRE
-    std::printf("%ld\n", x);
-    STACK_ALIGN_POST
+    OptionalLock lock(current_instance->IOMutex());
+    current_instance->Output()->WriteInt(x);
 }
 
 double ReadDoubleCall() {
-    STACK_ALIGN_PRE
-    double result;
-    std::scanf("%lf", &result);
-    STACK_ALIGN_POST
+    double result = 0;
+    OptionalLock lock(current_instance->IOMutex());
+    current_instance->Input()->ReadDouble(&result);
     return result;
 }
 
 void WriteDoubleCall(double d) {
-    STACK_ALIGN_PRE
-    std::printf("%.6lf\n", d);
-    STACK_ALIGN_POST
+    OptionalLock lock(current_instance->IOMutex());
+    current_instance->Output()->WriteDouble(d);
+}
+
+int64_t SpawnCall(const int64_t* saved_regs, uint64_t entry) {
+    return current_instance->Spawn(saved_regs, entry);
+}
+
+int64_t JoinCall(int64_t handle) {
+    int64_t result = 0;
+    if (!current_instance->Join(handle, &result)) {
+        FAIL(Processor::kExecStatusInvalidThread);
+    }
+    return result;
+}
+
+/* Where a spawned thread's entry function returns to. */
+void ThreadExitCall(int64_t top, const int64_t* stack_top) {
+    current_instance->FinishThread(top, stack_top);
+}
+
+/* Bulk instructions: `operands` are the guest stack values under the count, nearest first, and
+ * `data` is the data base. */
+static int64_t* DataRange(char* data, int64_t idx, int64_t cnt) {
+    constexpr int64_t kWordsCnt = JITInstance::kDataSize >> 3;
+    if (idx < 0 || cnt < 0 || idx > kWordsCnt - cnt) {
+        OverflowCall();
+    }
+    return reinterpret_cast<int64_t*>(data) + idx;
+}
+
+void MemcpyCall(const int64_t* operands, char* data, int64_t cnt) {
+    int64_t* src = DataRange(data, operands[0], cnt);
+    std::memmove(DataRange(data, operands[1], cnt), src, cnt * sizeof(int64_t));
+}
+
+void MemsetCall(const int64_t* operands, char* data, int64_t cnt) {
+    VectorFill(DataRange(data, operands[1], cnt), operands[0], cnt);
+}
+
+template <class T>
+void VectorAddCall(const int64_t* operands, char* data, int64_t cnt) {
+    const T* src = reinterpret_cast<const T*>(DataRange(data, operands[0], cnt));
+    VectorAdd(reinterpret_cast<T*>(DataRange(data, operands[1], cnt)), src, cnt);
+}
+
+template <class T>
+void VectorMulCall(const int64_t* operands, char* data, int64_t cnt) {
+    const T* src = reinterpret_cast<const T*>(DataRange(data, operands[0], cnt));
+    VectorMul(reinterpret_cast<T*>(DataRange(data, operands[1], cnt)), src, cnt);
+}
+
+template <class T>
+int64_t VectorSumCall(const int64_t* operands, char* data, int64_t cnt) {
+    VectorLanes<T> sum;
+    VectorSum(reinterpret_cast<const T*>(DataRange(data, operands[0], cnt)), cnt, &sum);
+    T total = sum.Total();
+    int64_t result = 0;
+    std::memcpy(&result, &total, sizeof(result));
+    return result;
+}
+
+template <class T>
+int64_t VectorDotCall(const int64_t* operands, char* data, int64_t cnt) {
+    VectorLanes<T> sum;
+    const T* b = reinterpret_cast<const T*>(DataRange(data, operands[0], cnt));
+    VectorDot(reinterpret_cast<const T*>(DataRange(data, operands[1], cnt)), b, cnt, &sum);
+    T total = sum.Total();
+    int64_t result = 0;
+    std::memcpy(&result, &total, sizeof(result));
+    return result;
+}
+
+/* The heap instructions go through ASM_BULK_CALL as well; REALLOC's block is in operands[0]. */
+int64_t AllocCall(const int64_t*, char* data, int64_t words) {
+    DataHeapMemory memory(data);
+    int64_t ptr = 0;
+    if (!current_instance->Heap()->TryAlloc(&memory, words, &ptr)) {
+        FAIL(Processor::kExecStatusInvalidHeapPointer);
+    }
+    return ptr;
+}
+
+void FreeCall(const int64_t*, char* data, int64_t ptr) {
+    DataHeapMemory memory(data);
+    if (!current_instance->Heap()->TryFree(&memory, ptr)) {
+        FAIL(Processor::kExecStatusInvalidHeapPointer);
+    }
+}
+
+int64_t ReallocCall(const int64_t* operands, char* data, int64_t words) {
+    DataHeapMemory memory(data);
+    int64_t new_ptr = 0;
+    if (!current_instance->Heap()->TryRealloc(&memory, operands[0], words, &new_ptr)) {
+        FAIL(Processor::kExecStatusInvalidHeapPointer);
+    }
+    return new_ptr;
+}
+
+/* The FP intrinsics use one SSE instruction where the CPU has it and the <cmath> function the
+ * interpreter uses otherwise. */
+static bool CpuSupportsSSE41() {
+    static const bool supported = __builtin_cpu_supports("sse4.1");
+    return supported;
+}
+
+static bool CpuSupportsFMA() {
+    static const bool supported = __builtin_cpu_supports("fma");
+    return supported;
+}
+
+void CheckpointCall(const int64_t* saved_regs, const int64_t* call_stack_top, uint64_t resume_ip) {
+    current_instance->Suspend(saved_regs, call_stack_top, resume_ip);
+}
+
+/* May return on another thread than it was called on, so nothing may follow the switch. */
+void YieldCall() {
+    current_instance->Stop(Processor::kExecStatusOutOfFuel);
+}
+
+void InvalidNativeCall() {
+    FAIL(Processor::kExecStatusInvalidNativeCall);
+}
+
+void NoFrameCall() {
+    FAIL(Processor::kExecStatusNoFrame);
 }
 
 void HaltCall() {
-    STACK_ALIGN_PRE
-    user_context.SwitchTo(supervisor_context);
-    STACK_ALIGN_POST
+    current_instance->Stop(Processor::kExecStatusOk);
 }
 
 extern "C" void FuncCall();
 
 void PrintDumpCall() {
-    STACK_ALIGN_PRE
-    std::printf("Dump is currently unavailable\n");
-    STACK_ALIGN_POST
+    OptionalLock lock(current_instance->IOMutex());
+    current_instance->Output()->Printf("Dump is currently unavailable\n");
 }
 
 void Log() {
@@ -294,17 +825,22 @@ std::ostream& operator<<(std::ostream& out, const Directly<T>& d) {
 #define ASM_MOV_RAX_XMM0()          APPEND_INSTRUCTION(0x66, 0x48, 0x0f, 0x6e, 0xc0)
 #define ASM_CVTTSD2SI_XMM0_RAX()    APPEND_INSTRUCTION(0xf2, 0x48, 0x0f, 0x2c, 0xc0)
 #define ASM_MOV_RAX_RDI()           APPEND_INSTRUCTION(0x48, 0x89, 0xc7)
-#define ASM_SAVE_REGS()             APPEND_INSTRUCTION(0x50, 0x41, 0x50, 0x41, 0x51, 0x41, 0x52, 0x41, 0x53)
-#define ASM_RESTORE_REGS()          APPEND_INSTRUCTION(0x41, 0x5b, 0x41, 0x5a, 0x41, 0x59, 0x41, 0x58, 0x58)
+#define ASM_SAVE_REGS()             APPEND_INSTRUCTION(0x50, 0x41, 0x50, 0x41, 0x51, 0x41, 0x52, 0x41, 0x53, 0x56)
+#define ASM_RESTORE_REGS()          APPEND_INSTRUCTION(0x5e, 0x41, 0x5b, 0x41, 0x5a, 0x41, 0x59, 0x41, 0x58, 0x58)
 #define ASM_ZERO_RAX()              APPEND_INSTRUCTION(0x48, 0x31, 0xc0)
 #define ASM_JMP_RBX()               APPEND_INSTRUCTION(0xff, 0xe3)
+#define ASM_JMP_RDI()               APPEND_INSTRUCTION(0xff, 0xe7)
+#define ASM_MOV_RBX_RDI()           APPEND_INSTRUCTION(0x48, 0x89, 0xdf)
+#define ASM_JCC_REL8(cc, x)         APPEND_INSTRUCTION((int)(cc), x)
+#define ASM_CMP_RDX_RBX()           APPEND_INSTRUCTION(0x48, 0x39, 0xd3)
+#define ASM_CMP_REG_REG(lhs_no, rhs_no) \
+                                    APPEND_INSTRUCTION(0x4d, 0x39, ENCODE_REG(rhs_no, lhs_no))
+#define ASM_CMP_IMM32_REG(reg_no, x) \
+                                    APPEND_INSTRUCTION(0x49, 0x81, (int)(0xf8 | (reg_no)), MakeDirectly(static_cast<int32_t>(x)))
+#define ASM_DEC_REG(reg_no)         APPEND_INSTRUCTION(0x49, 0xff, (int)(0xc8 | (reg_no)))
+#define ASM_DEC_RBX()               APPEND_INSTRUCTION(0x48, 0xff, 0xcb)
+#define ASM_DEC_BY_RBX()            APPEND_INSTRUCTION(0x48, 0xff, 0x0b)
 #define ASM_CMP_IMM8_RAX(x)         APPEND_INSTRUCTION(0x48, 0x83, 0xf8, x)
-#define ASM_JNE_REL8(x)             APPEND_INSTRUCTION(0x75, x)
-#define ASM_JLE_REL8(x)             APPEND_INSTRUCTION(0x7e, x)
-#define ASM_JGE_REL8(x)             APPEND_INSTRUCTION(0x7d, x)
-#define ASM_JE_REL8(x)              APPEND_INSTRUCTION(0x74, x)
-#define ASM_JL_REL8(x)              APPEND_INSTRUCTION(0x7c, x)
-#define ASM_JG_REL8(x)              APPEND_INSTRUCTION(0x7f, x)
 #define ASM_MOV_IMM64_RBX(x)        APPEND_INSTRUCTION(0x48, 0xbb, MakeDirectly(x))
 #define ASM_MOV_BY_RBX_RBX()        APPEND_INSTRUCTION(0x48, 0x8b, 0x1b)
 #define ASM_MOV_REG_RBX(reg_no)     APPEND_INSTRUCTION(0x4c, 0x89, ENCODE_REG(reg_no, RBX_NO))
@@ -318,9 +854,208 @@ std::ostream& operator<<(std::ostream& out, const Directly<T>& d) {
 #define ASM_MOV_RAX_REG(reg_no)     APPEND_INSTRUCTION(0x49, 0x89, ENCODE_REG(RAX_NO, reg_no))
 #define ASM_MOV_REG_RAX(reg_no)     APPEND_INSTRUCTION(0x4c, 0x89, ENCODE_REG(reg_no, RAX_NO))
 #define ASM_MOV_RBX_BY_RAX()        APPEND_INSTRUCTION(0x48, 0x89, 0x18)
-#define ASM_MOV_RAX_BY_PTR(ptr)     APPEND_INSTRUCTION(0x48, 0xa3, (ptr))
+#define ASM_MOV_RAX_BY_DATA_OFFSET(x) \
+                                    APPEND_INSTRUCTION(0x48, 0x89, 0x86, MakeDirectly(static_cast<int32_t>(x)))
+#define ASM_MOV_BY_DATA_OFFSET_RBX(x) \
+                                    APPEND_INSTRUCTION(0x48, 0x8b, 0x9e, MakeDirectly(static_cast<int32_t>(x)))
+#define ASM_LEA_BY_RSI_PLUS_RBX_TIMES_8_RBX() \
+                                    APPEND_INSTRUCTION(0x48, 0x8d, 0x1c, 0xde)
+#define ASM_MOV_RBX_RSI()           APPEND_INSTRUCTION(0x48, 0x89, 0xde)
+#define ASM_MOV_RSP_RDI()           APPEND_INSTRUCTION(0x48, 0x89, 0xe7)
+#define ASM_MOV_RSP_RSI()           APPEND_INSTRUCTION(0x48, 0x89, 0xe6)
+#define ASM_MOV_RBP_RSI()           APPEND_INSTRUCTION(0x48, 0x89, 0xee)
+#define ASM_MOV_IMM64_RDX(x)        APPEND_INSTRUCTION(0x48, 0xba, MakeDirectly(x))
+#define ASM_PUSH_CALLEE_SAVED_REGS() \
+                                    APPEND_INSTRUCTION(0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57)
+#define ASM_POP_CALLEE_SAVED_REGS() APPEND_INSTRUCTION(0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c)
+#define ASM_LEA_BY_DATA_OFFSET_RBX(x) \
+                                    APPEND_INSTRUCTION(0x48, 0x8d, 0x9e, MakeDirectly(static_cast<int32_t>(x)))
+#define ASM_LOCK_CMPXCHG_RCX_BY_RBX() \
+                                    APPEND_INSTRUCTION(0xf0, 0x48, 0x0f, 0xb1, 0x0b)
+#define ASM_LOCK_XADD_RAX_BY_RBX()  APPEND_INSTRUCTION(0xf0, 0x48, 0x0f, 0xc1, 0x03)
+#define ASM_XCHG_RAX_BY_RBX()       APPEND_INSTRUCTION(0x48, 0x87, 0x03)
+#define ASM_MFENCE()                APPEND_INSTRUCTION(0x0f, 0xae, 0xf0)
+#define ASM_LEA_BY_REG_PLUS_DISP32_RBX(reg_no, x) \
+                                    APPEND_INSTRUCTION(0x49, 0x8d, 0x9c, (int)(0x20 | (reg_no)), MakeDirectly(static_cast<int32_t>(x)))
+#define ASM_LEA_BY_REG_PLUS_REG_RBX(base_no, index_no) \
+                                    APPEND_INSTRUCTION(0x4b, 0x8d, 0x5c, (int)(((index_no) << 3) | (base_no)), 0x00)
+#define ASM_LEA_BY_REG_PLUS_REG_REG(base_no, index_no, reg_no) \
+                                    APPEND_INSTRUCTION(0x4f, 0x8d, (int)(0x44 | ((reg_no) << 3)), (int)(((index_no) << 3) | (base_no)), 0x00)
+#define ASM_MOV_REG_REG(src_no, dst_no) \
+                                    APPEND_INSTRUCTION(0x4d, 0x89, ENCODE_REG(src_no, dst_no))
+#define ASM_ADD_RCX_RBX()           APPEND_INSTRUCTION(0x48, 0x01, 0xcb)
+#define ASM_ADD_RDX_RBX()           APPEND_INSTRUCTION(0x48, 0x01, 0xd3)
+#define ASM_SUB_RDX_RBX()           APPEND_INSTRUCTION(0x48, 0x29, 0xd3)
+#define ASM_IMUL_RDX_RBX()          APPEND_INSTRUCTION(0x48, 0x0f, 0xaf, 0xda)
+#define ASM_MOV_RBX_RDX()           APPEND_INSTRUCTION(0x48, 0x89, 0xda)
+#define ASM_MOV_RDX_REG(reg_no)     APPEND_INSTRUCTION(0x49, 0x89, ENCODE_REG(RDX_NO, reg_no))
+#define ASM_MOV_RDX_BY_RBX()        APPEND_INSTRUCTION(0x48, 0x89, 0x13)
+#define ASM_MOV_BY_RSI_PLUS_RBX_TIMES_8_RBX() \
+                                    APPEND_INSTRUCTION(0x48, 0x8b, 0x1c, 0xde)
+#define ASM_MOV_RAX_BY_RSI_PLUS_RBX_TIMES_8() \
+                                    APPEND_INSTRUCTION(0x48, 0x89, 0x04, 0xde)
+#define ASM_DEC_FUEL()              APPEND_INSTRUCTION(0x64, 0x48, 0x83, 0x2c, 0x25, MakeDirectly(CurrentFuelOffset()), 0x01)
+#define ASM_JNS_REL8(x)             APPEND_INSTRUCTION(0x79, x)
+#define ASM_ENTRY_STUB()            APPEND_INSTRUCTION(0x41, 0x58, 0x41, 0x59, 0x41, 0x5a, 0x41, 0x5b, 0x58, 0xc3)
+#define ASM_MOV_RSP_RBX()           APPEND_INSTRUCTION(0x48, 0x89, 0xe3)
+#define ASM_AND_IMM8_RSP(x)         APPEND_INSTRUCTION(0x48, 0x83, 0xe4, x)
+#define ASM_POP_RSP()               APPEND_INSTRUCTION(0x5c)
 #define ASM_MOV_RAX_BY_RBX()        APPEND_INSTRUCTION(0x48, 0x89, 0x03)
 #define ASM_CALL_VIA_RAX(ptr)       APPEND_INSTRUCTION(0x48, 0xb8, ptr, 0xff, 0xd0)
+#define ASM_SUB_IMM32_RBP(x)        APPEND_INSTRUCTION(0x48, 0x81, 0xed, MakeDirectly(static_cast<int32_t>(x)))
+#define ASM_MOV_IMM32_BY_RBP(x)     APPEND_INSTRUCTION(0x48, 0xc7, 0x45, 0x00, MakeDirectly(static_cast<int32_t>(x)))
+#define ASM_CMP_IMM32_BY_RBP(x)     APPEND_INSTRUCTION(0x48, 0x81, 0x7d, 0x00, MakeDirectly(static_cast<int32_t>(x)))
+#define ASM_ZERO_BY_RBP_PLUS_DISP32(x) \
+                                    APPEND_INSTRUCTION(0x48, 0xc7, 0x85, MakeDirectly(static_cast<int32_t>(x)), MakeDirectly(static_cast<int32_t>(0)))
+#define ASM_ZERO_BY_RBP_PLUS_RCX_TIMES_8() \
+                                    APPEND_INSTRUCTION(0x48, 0xc7, 0x44, 0xcd, 0x00, MakeDirectly(static_cast<int32_t>(0)))
+#define ASM_MOV_BY_RBP_PLUS_DISP32_RBX(x) \
+                                    APPEND_INSTRUCTION(0x48, 0x8b, 0x9d, MakeDirectly(static_cast<int32_t>(x)))
+#define ASM_LEA_BY_RBP_PLUS_DISP32_RBX(x) \
+                                    APPEND_INSTRUCTION(0x48, 0x8d, 0x9d, MakeDirectly(static_cast<int32_t>(x)))
+#define ASM_MOV_RAX_BY_RBP_PLUS_DISP32(x) \
+                                    APPEND_INSTRUCTION(0x48, 0x89, 0x85, MakeDirectly(static_cast<int32_t>(x)))
+#define ASM_LEA_BY_RBP_PLUS_RBX_TIMES_8_RBP() \
+                                    APPEND_INSTRUCTION(0x48, 0x8d, 0x6c, 0xdd, 0x00)
+#define ASM_MOV_IMM32_RCX(x)        APPEND_INSTRUCTION(0x48, 0xc7, 0xc1, MakeDirectly(static_cast<int32_t>(x)))
+#define ASM_DEC_RCX()               APPEND_INSTRUCTION(0x48, 0xff, 0xc9)
+#define ASM_TEST_RBX_RBX()          APPEND_INSTRUCTION(0x48, 0x85, 0xdb)
+#define ASM_NEG_RBX()               APPEND_INSTRUCTION(0x48, 0xf7, 0xdb)
+#define ASM_JNZ_REL8(x)             APPEND_INSTRUCTION(0x75, x)
+#define ASM_JS_REL8(x)              APPEND_INSTRUCTION(0x78, x)
+#define ASM_JL_REL8(x)              APPEND_INSTRUCTION(0x7c, x)
+#define ASM_JMP_REL8(x)             APPEND_INSTRUCTION(0xeb, x)
+#define ASM_SQRTSD_XMM0_XMM0()      APPEND_INSTRUCTION(0xf2, 0x0f, 0x51, 0xc0)
+#define ASM_ROUNDSD_XMM0_XMM0(mode) APPEND_INSTRUCTION(0x66, 0x0f, 0x3a, 0x0b, 0xc0, mode)
+#define ASM_MINSD_BY_RSP_XMM0()     APPEND_INSTRUCTION(0xf2, 0x0f, 0x5d, 0x04, 0x24)
+#define ASM_MAXSD_BY_RSP_XMM0()     APPEND_INSTRUCTION(0xf2, 0x0f, 0x5f, 0x04, 0x24)
+#define ASM_BTR_IMM8_RAX(x)         APPEND_INSTRUCTION(0x48, 0x0f, 0xba, 0xf0, x)
+#define ASM_MOV_RAX_XMM1()          APPEND_INSTRUCTION(0x66, 0x48, 0x0f, 0x6e, 0xc8)
+#define ASM_MOV_RAX_XMM2()          APPEND_INSTRUCTION(0x66, 0x48, 0x0f, 0x6e, 0xd0)
+#define ASM_MOV_XMM2_RAX()          APPEND_INSTRUCTION(0x66, 0x48, 0x0f, 0x7e, 0xd0)
+#define ASM_MOVSD_BY_RSP_XMM1()     APPEND_INSTRUCTION(0xf2, 0x0f, 0x10, 0x0c, 0x24)
+#define ASM_MOVSD_BY_RSP_PLUS_8_XMM0() \
+                                    APPEND_INSTRUCTION(0xf2, 0x0f, 0x10, 0x44, 0x24, 0x08)
+#define ASM_VFMADD231SD_XMM0_XMM1_XMM2() \
+                                    APPEND_INSTRUCTION(0xc4, 0xe2, 0xf9, 0xb9, 0xd1)
+#define ASM_PUSH_CALLER_SAVED_REGS() \
+                                    APPEND_INSTRUCTION(0x41, 0x50, 0x41, 0x51, 0x41, 0x52, 0x41, 0x53, 0x56)
+#define ASM_POP_CALLER_SAVED_REGS() APPEND_INSTRUCTION(0x5e, 0x41, 0x5b, 0x41, 0x5a, 0x41, 0x59, 0x41, 0x58)
+
+/* Direct branches to bytecode addresses; the rel32 is patched once all code is laid out. */
+#define ASM_JMP_REL32(ip) {                                                                 \
+    APPEND_INSTRUCTION(0xe9, MakeDirectly(static_cast<int32_t>(0)));                        \
+    branch_fixups.push_back(Fixup{(ip), native_code.size() - sizeof(int32_t)});             \
+}
+#define ASM_JCC_REL32(cc, ip) {                                                             \
+    APPEND_INSTRUCTION(0x0f, (int)(cc), MakeDirectly(static_cast<int32_t>(0)));             \
+    branch_fixups.push_back(Fixup{(ip), native_code.size() - sizeof(int32_t)});             \
+}
+
+/* Calls a C++ helper on a 16-byte aligned stack; the original RSP is kept in RBX and on the stack. */
+#define ASM_CALL_HELPER_SIZE        22
+#define ASM_CALL_HELPER(ptr)    {   \
+    ASM_MOV_RSP_RBX();              \
+    ASM_AND_IMM8_RSP(-16);          \
+    ASM_PUSH_RBX();                 \
+    ASM_PUSH_RBX();                 \
+    ASM_CALL_VIA_RAX(ptr);          \
+    ASM_POP_RSP();                  \
+}
+/* Bulk instructions: RDI = the stack under the count, RSI = data base, RDX = the count; the
+ * helper's result ends up in RBX. */
+#define ASM_BULK_CALL(ptr)      {   \
+    ASM_MOV_RSP_RDI();              \
+    ASM_MOV_RAX_RDX();              \
+    ASM_SAVE_REGS();                \
+    ASM_CALL_HELPER(ptr);           \
+    ASM_MOV_RAX_RBX();              \
+    ASM_RESTORE_REGS();             \
+}
+/* System V integer argument registers; 8 and 9 stand for R8 and R9. */
+static const int kNativeArgRegisters[kMaxNativeArgs] = {7, 6, 2, 1, 8, 9};
+#define ARG_REG_NO(i)               (kNativeArgRegisters[i] & 7)
+#define ARG_REG_REX(i)              (kNativeArgRegisters[i] >> 3)
+#define ASM_MOV_RAX_ARG_REG(i)      APPEND_INSTRUCTION((int)(0x48 | ARG_REG_REX(i)), 0x89, ENCODE_REG(RAX_NO, ARG_REG_NO(i)))
+#define ASM_MOV_BY_RSP_PLUS_DISP8_ARG_REG(x, i) \
+                                    APPEND_INSTRUCTION((int)(0x48 | (ARG_REG_REX(i) << 2)), 0x8b, (int)(0x44 | (ARG_REG_NO(i) << 3)), 0x24, x)
+#define ASM_MOV_BY_RSP_PLUS_DISP8_RAX(x) \
+                                    APPEND_INSTRUCTION(0x48, 0x8b, 0x44, 0x24, x)
+#define ASM_PUSH_REG(reg_no)        APPEND_INSTRUCTION(0x41, (int)(0x50 | (reg_no)))
+#define ASM_POP_REG(reg_no)         APPEND_INSTRUCTION(0x41, (int)(0x58 | (reg_no)))
+#define ASM_PUSH_RSI()              APPEND_INSTRUCTION(0x56)
+#define ASM_POP_RSI()               APPEND_INSTRUCTION(0x5e)
+
+/* NCALL of a registered function is a direct call with the arguments in their System V
+ * registers. RSI and the caller-saved guest registers (R8-R11) are kept, all four even if the
+ * program never names them, since CHKPT and DUMP show them; RAX only when the function leaves the
+ * old top of the stack in place. */
+#define ASM_NATIVE_CALL(x)      {                                                   \
+    if (arg_types[x] != ARG_VALUE) {                                                \
+        throw std::runtime_error("NCALL needs an immediate function id");          \
+    }                                                                               \
+    const NativeFunction* native = FindNativeFunction(arg_values[x]);               \
+    if (native == nullptr) {                                                        \
+        ASM_CALL_HELPER(INVALID_NATIVE_CALL);                                       \
+    } else {                                                                        \
+        int args_cnt = native->args_cnt;                                            \
+        int saved_cnt = 5;                                                          \
+        if (args_cnt == 0) {                                                        \
+            ASM_PUSH_RAX();                                                         \
+        }                                                                           \
+        for (int reg = 0; reg < 4; ++reg) {                                         \
+            ASM_PUSH_REG(reg);                                                      \
+        }                                                                           \
+        ASM_PUSH_RSI();                                                             \
+        for (int arg = 0; arg + 1 < args_cnt; ++arg) {                              \
+            ASM_MOV_BY_RSP_PLUS_DISP8_ARG_REG(8 * (saved_cnt + args_cnt - 2 - arg), arg); \
+        }                                                                           \
+        if (args_cnt > 0) {                                                         \
+            ASM_MOV_RAX_ARG_REG(args_cnt - 1);                                      \
+        }                                                                           \
+        ASM_CALL_HELPER(native->address);                                           \
+        ASM_POP_RSI();                                                              \
+        for (int reg = 3; reg >= 0; --reg) {                                        \
+            ASM_POP_REG(reg);                                                       \
+        }                                                                           \
+        if (native->has_result && args_cnt > 1) {                                   \
+            ASM_ADD_IMM8_RSP(8 * (args_cnt - 1));                                   \
+        } else if (!native->has_result && args_cnt == 0) {                          \
+            ASM_POP_RAX();                                                          \
+        } else if (!native->has_result) {                                           \
+            ASM_MOV_BY_RSP_PLUS_DISP8_RAX(8 * (args_cnt - 1));                      \
+            ASM_ADD_IMM8_RSP(8 * args_cnt);                                         \
+        }                                                                           \
+    }                                                                               \
+}
+
+/* Calls a `double (double...)` function on XMM0-XMM2; the result is left in XMM0. RAX is about
+ * to be overwritten, so unlike ASM_SAVE_REGS only R8-R11 and RSI are kept. */
+#define ASM_MATH_CALL(ptr)      {   \
+    ASM_PUSH_CALLER_SAVED_REGS();   \
+    ASM_CALL_HELPER(ptr);           \
+    ASM_POP_CALLER_SAVED_REGS();    \
+}
+/* roundsd immediates; 0x8 suppresses the inexact exception like the <cmath> functions do. */
+#define ROUND_FLOOR                 0x9
+#define ROUND_CEIL                  0xa
+#define ROUND_TRUNC                 0xb
+#define ROUND_CURRENT_MODE          0xc
+#define ASM_ROUND_XMM0(mode, fallback)              \
+    if (CpuSupportsSSE41()) {                       \
+        ASM_ROUNDSD_XMM0_XMM0(mode);                \
+    } else {                                        \
+        ASM_MATH_CALL(fallback);                    \
+    }
+/* RAX = XMM0 * XMM1 + XMM2, rounded once. */
+#define ASM_FMA_XMM0_XMM1_XMM2_RAX()                \
+    if (CpuSupportsFMA()) {                         \
+        ASM_VFMADD231SD_XMM0_XMM1_XMM2();           \
+        ASM_MOV_XMM2_RAX();                         \
+    } else {                                        \
+        ASM_MATH_CALL(FMA_CALL);                    \
+        ASM_MOV_XMM0_RAX();                         \
+    }
 #define ASM_MOV_BY_RSP_RBX()        APPEND_INSTRUCTION(0x48, 0x8b, 0x1c, 0x24)
 #define ASM_UCOMISD_XMM0_XMM0()     APPEND_INSTRUCTION(0x66, 0x0f, 0x2e, 0xc0)
 #define ASM_SETNP_AL()              APPEND_INSTRUCTION(0x0f, 0x9b, 0xc0)
@@ -354,37 +1089,142 @@ std::ostream& operator<<(std::ostream& out, const Directly<T>& d) {
 #define ENCODE_REG(reg1, reg2)      (int)(0xC0 | ((reg1) << 3) | (reg2))
 #define RBX_NO                      0x03
 #define RAX_NO                      0x00
-#define TO_DATA_PTR(addr)           ToDataPointer(data_, addr)
+#define RDX_NO                      0x02
+#define TO_DATA_OFFSET(addr)        ToDataOffset(addr)
+#define NEXT_IP                     static_cast<uint64_t>(instruction_pointer)
+
+#define CHECK_RBX_DATA_INDEX()      {                       \
+    ASM_MOV_IMM64_RCX((JITInstance::kDataSize >> 3));       \
+    ASM_CMP_RBX_RCX();                                      \
+    ASM_JAE_IMM8(ASM_CALL_HELPER_SIZE);                     \
+    ASM_CALL_HELPER(OVERFLOW_CALL);                         \
+}
 
-#define CONVERT_RBX_TO_DATA_PTR()   {       \
-    ASM_MOV_IMM64_RCX((data_.Size() >> 3)); \
-    ASM_CMP_RBX_RCX();                      \
-    ASM_JAE_IMM8(12);                       \
-    ASM_MOV_IMM64_RBX(OVERFLOW_CALL);       \
-    ASM_JMP_RBX();                          \
-    ASM_MOV_IMM64_RCX(data_.Begin());       \
-    ASM_LEA_BY_RCX_PLUS_RBX_TIMES_8_RBX();  \
+#define CONVERT_RBX_TO_DATA_PTR()   {                       \
+    CHECK_RBX_DATA_INDEX();                                 \
+    ASM_LEA_BY_RSI_PLUS_RBX_TIMES_8_RBX();                  \
 }
 
+/* RBX = checked word index of an ARG_BASE_OFFSET or ARG_BASE_INDEX operand, which is then accessed
+ * as [RSI + RBX * 8]. */
+#define COMPUTE_DATA_INDEX(x)                                                       \
+    if (arg_types[x] == ARG_BASE_INDEX) {                                           \
+        ASM_LEA_BY_REG_PLUS_REG_RBX(arg_values[x], arg_extras[x]);                  \
+    } else if (arg_extras[x] == static_cast<int32_t>(arg_extras[x])) {              \
+        ASM_LEA_BY_REG_PLUS_DISP32_RBX(arg_values[x], arg_extras[x]);               \
+    } else {                                                                        \
+        ASM_MOV_REG_RBX(arg_values[x]);                                             \
+        ASM_MOV_IMM64_RCX(arg_extras[x]);                                           \
+        ASM_ADD_RCX_RBX();                                                          \
+    }                                                                               \
+    CHECK_RBX_DATA_INDEX();
+
 #define CONVERT_RBX_TO_CODE_PTR() {             \
-    ASM_MOV_IMM64_RCX(obj.bytecode.size());     \
+    ASM_MOV_IMM64_RCX(bytecode.size());         \
     ASM_CMP_RBX_RCX();                          \
-    ASM_JAE_IMM8(12);                           \
-    ASM_MOV_IMM64_RBX(OVERFLOW_CALL);           \
-    ASM_JMP_RBX();                              \
+    ASM_JAE_IMM8(ASM_CALL_HELPER_SIZE);         \
+    ASM_CALL_HELPER(OVERFLOW_CALL);             \
     ASM_MOV_IMM64_RCX(code_addr_table_.data()); \
     ASM_MOV_BY_RCX_PLUS_RBX_TIMES_8_RBX();      \
 }
 
+/* Frames live on the call stack under the return address of the function that entered them:
+ * [RBP] = -(locals + 1), then slot n at [RBP + 8 * (n + 1)]. Return addresses are positive, so
+ * a negative word on top of the call stack means the current function has a frame. Like CALL,
+ * ENTER relies on the guard page under the call stack, which it zeroes from the top down. */
+#define FRAME_SLOT_OFFSET(x)        (8 * (arg_values[x] + 1))
+#define CHECK_FRAME_SLOT(x)     {                           \
+    ASM_CMP_IMM32_BY_RBP(-(arg_values[x] + 1));             \
+    ASM_JL_REL8(ASM_CALL_HELPER_SIZE);                      \
+    ASM_CALL_HELPER(OVERFLOW_CALL);                         \
+}
+
+#define ASM_ENTER_FRAME(x)      {                                                   \
+    if (arg_types[x] != ARG_VALUE || arg_values[x] < 0 ||                           \
+        arg_values[x] > Processor::kFrameStackMaxSize) {                            \
+        throw std::runtime_error("ENTER needs an immediate frame size");           \
+    }                                                                               \
+    ASM_SUB_IMM32_RBP(8 * (arg_values[x] + 1));                                     \
+    if (arg_values[x] <= 4) {                                                       \
+        for (int64_t slot = arg_values[x] - 1; slot >= 0; --slot) {                 \
+            ASM_ZERO_BY_RBP_PLUS_DISP32(8 * (slot + 1));                            \
+        }                                                                           \
+    } else {                                                                        \
+        ASM_MOV_IMM32_RCX(arg_values[x]);                                           \
+        ASM_ZERO_BY_RBP_PLUS_RCX_TIMES_8();                                         \
+        ASM_DEC_RCX();                                                              \
+        ASM_JNZ_REL8(-14);                                                          \
+    }                                                                               \
+    ASM_MOV_IMM32_BY_RBP(-(arg_values[x] + 1));                                     \
+}
+
+#define ASM_LEAVE_FRAME()       {                   \
+    ASM_MOV_BY_RBP_RBX();                           \
+    ASM_TEST_RBX_RBX();                             \
+    ASM_JS_REL8(ASM_CALL_HELPER_SIZE);              \
+    ASM_CALL_HELPER(NO_FRAME_CALL);                 \
+    ASM_NEG_RBX();                                  \
+    ASM_LEA_BY_RBP_PLUS_RBX_TIMES_8_RBP();          \
+}
+
+/* Leaves RBX = the return address on top of the call stack. */
+#define ASM_LEAVE_ALL_FRAMES()  {                   \
+    ASM_MOV_BY_RBP_RBX();                           \
+    ASM_TEST_RBX_RBX();                             \
+    ASM_JNS_REL8(10);                               \
+    ASM_NEG_RBX();                                  \
+    ASM_LEA_BY_RBP_PLUS_RBX_TIMES_8_RBP();          \
+    ASM_JMP_REL8(-19);                              \
+}
+
+/* Decrements the running instance's fuel counter and yields to the supervisor once it goes negative. */
+#define ASM_YIELD_SIZE              (10 + ASM_CALL_HELPER_SIZE + 10)
+#define CONSUME_FUEL() {                    \
+    ASM_DEC_FUEL();                         \
+    ASM_JNS_REL8(ASM_YIELD_SIZE);           \
+    ASM_SAVE_REGS();                        \
+    ASM_CALL_HELPER(YIELD_CALL);            \
+    ASM_RESTORE_REGS();                     \
+}
+
+/* Jumps that may close a loop; forward jumps to known targets cannot. */
+#define CONSUME_FUEL_ON_BACK_EDGE(x) {                                      \
+    if (arg_types[x] != ARG_VALUE || arg_values[x] <= instruction_pointer) { \
+        CONSUME_FUEL();                                                     \
+    }                                                                       \
+}
+
+/* RBX = address of a memory operand, for the atomic instructions. */
+#define COMPUTE_ARG_ADDRESS(x)                                                      \
+    switch (arg_types[x]) {                                                         \
+        case ARG_POINTER:                                                           \
+            ASM_LEA_BY_DATA_OFFSET_RBX(TO_DATA_OFFSET(arg_values[x]));              \
+            break;                                                                  \
+        case ARG_REGISTER_POINTER:                                                  \
+            ASM_MOV_REG_RBX(arg_values[x]);                                         \
+            CONVERT_RBX_TO_DATA_PTR();                                              \
+            break;                                                                  \
+        case ARG_BASE_OFFSET:                                                       \
+        case ARG_BASE_INDEX:                                                        \
+            COMPUTE_DATA_INDEX(x);                                                  \
+            ASM_LEA_BY_RSI_PLUS_RBX_TIMES_8_RBX();                                  \
+            break;                                                                  \
+        case ARG_FRAME:                                                             \
+            CHECK_FRAME_SLOT(x);                                                    \
+            ASM_LEA_BY_RBP_PLUS_DISP32_RBX(FRAME_SLOT_OFFSET(x));                   \
+            break;                                                                  \
+        default:                                                                    \
+            throw std::runtime_error("Atomic instructions need a memory operand");  \
+    }
+
 #define COMPUTE_ARG(x)                                                              \
     switch (arg_types[x]) {                                                         \
         case ARG_VALUE:                                                             \
             ASM_MOV_IMM64_RBX(arg_values[x]);                                       \
             break;                                                                  \
-        case ARG_POINTER: {                                                         \
-            ASM_MOV_IMM64_RBX(TO_DATA_PTR(arg_values[x]));                          \
-            ASM_MOV_BY_RBX_RBX();                                                   \
-        } break;                                                                    \
+        case ARG_POINTER:                                                           \
+            ASM_MOV_BY_DATA_OFFSET_RBX(TO_DATA_OFFSET(arg_values[x]));              \
+            break;                                                                  \
         case ARG_REGISTER:                                                          \
             ASM_MOV_REG_RBX(arg_values[x]);                                         \
             break;                                                                  \
@@ -393,6 +1233,83 @@ std::ostream& operator<<(std::ostream& out, const Directly<T>& d) {
             CONVERT_RBX_TO_DATA_PTR();                                              \
             ASM_MOV_BY_RBX_RBX();                                                   \
             break;                                                                  \
+        case ARG_BASE_OFFSET:                                                       \
+        case ARG_BASE_INDEX:                                                        \
+            COMPUTE_DATA_INDEX(x);                                                  \
+            ASM_MOV_BY_RSI_PLUS_RBX_TIMES_8_RBX();                                  \
+            break;                                                                  \
+        case ARG_FRAME:                                                             \
+            CHECK_FRAME_SLOT(x);                                                    \
+            ASM_MOV_BY_RBP_PLUS_DISP32_RBX(FRAME_SLOT_OFFSET(x));                   \
+            break;                                                                  \
+    }
+
+/* Signed condition codes, as the second byte of jcc rel32; jcc rel8 is 0x10 less, and flipping
+ * the lowest bit negates the condition. */
+#define CC_EQ   0x84
+#define CC_NE   0x85
+#define CC_LT   0x8c
+#define CC_GE   0x8d
+#define CC_LE   0x8e
+#define CC_GT   0x8f
+
+/* Jumps to operand x if `cc` holds after `compare`. A label becomes a single jcc rel32; any other
+ * target is looked up before `compare`, which must therefore leave RDI alone. */
+#define COND_BRANCH(x, cc, compare)                                                 \
+    if (arg_types[x] == ARG_VALUE) {                                                \
+        { compare; }                                                                \
+        ASM_JCC_REL32(cc, arg_values[x]);                                           \
+    } else {                                                                        \
+        COMPUTE_ARG(x);                                                             \
+        CONVERT_RBX_TO_CODE_PTR();                                                  \
+        ASM_MOV_RBX_RDI();                                                          \
+        { compare; }                                                                \
+        ASM_JCC_REL8(((cc) ^ 1) - 0x10, 2);                                         \
+        ASM_JMP_RDI();                                                              \
+    }
+
+/* Flags = operand a compared with operand b. */
+#define COMPARE_ARGS(a, b)                                                          \
+    if (arg_types[a] == ARG_REGISTER && arg_types[b] == ARG_REGISTER) {             \
+        ASM_CMP_REG_REG(arg_values[a], arg_values[b]);                              \
+    } else if (arg_types[a] == ARG_REGISTER && arg_types[b] == ARG_VALUE &&         \
+               arg_values[b] == static_cast<int32_t>(arg_values[b])) {              \
+        ASM_CMP_IMM32_REG(arg_values[a], arg_values[b]);                            \
+    } else {                                                                        \
+        COMPUTE_ARG(b);                                                             \
+        ASM_MOV_RBX_RDX();                                                          \
+        COMPUTE_ARG(a);                                                             \
+        ASM_CMP_RDX_RBX();                                                          \
+    }
+
+/* Decrements operand x in place; ZF tells whether it reached zero. */
+#define DECREMENT_ARG(x)                                                            \
+    switch (arg_types[x]) {                                                         \
+        case ARG_VALUE:                                                             \
+            ASM_MOV_IMM64_RBX(arg_values[x]);                                       \
+            ASM_DEC_RBX();                                                          \
+            break;                                                                  \
+        case ARG_REGISTER:                                                          \
+            ASM_DEC_REG(arg_values[x]);                                             \
+            break;                                                                  \
+        default:                                                                    \
+            COMPUTE_ARG_ADDRESS(x);                                                 \
+            ASM_DEC_BY_RBX();                                                       \
+            break;                                                                  \
+    }
+
+/* Stores RDX into a destination operand; like POP, an immediate destination discards it. */
+#define STORE_RDX_TO_ARG(x)                                                         \
+    switch (arg_types[x]) {                                                         \
+        case ARG_VALUE:                                                             \
+            break;                                                                  \
+        case ARG_REGISTER:                                                          \
+            ASM_MOV_RDX_REG(arg_values[x]);                                         \
+            break;                                                                  \
+        default:                                                                    \
+            COMPUTE_ARG_ADDRESS(x);                                                 \
+            ASM_MOV_RDX_BY_RBX();                                                   \
+            break;                                                                  \
     }
 
 #define OVERFLOW_CALL       (reinterpret_cast<void*>(OverflowCall))
@@ -401,26 +1318,86 @@ std::ostream& operator<<(std::ostream& out, const Directly<T>& d) {
 #define READ_DOUBLE_CALL    (reinterpret_cast<void*>(ReadDoubleCall))
 #define WRITE_DOUBLE_CALL   (reinterpret_cast<void*>(WriteDoubleCall))
 #define HALT_CALL           (reinterpret_cast<void*>(HaltCall))
+#define NO_FRAME_CALL       (reinterpret_cast<void*>(NoFrameCall))
+#define INVALID_NATIVE_CALL (reinterpret_cast<void*>(InvalidNativeCall))
 #define FUNC_CALL           (reinterpret_cast<void*>(FuncCall))
 #define PRINT_DUMP_CALL     (reinterpret_cast<void*>(PrintDumpCall))
+#define CHECKPOINT_CALL     (reinterpret_cast<void*>(CheckpointCall))
+#define YIELD_CALL          (reinterpret_cast<void*>(YieldCall))
+#define SPAWN_CALL          (reinterpret_cast<void*>(SpawnCall))
+#define JOIN_CALL           (reinterpret_cast<void*>(JoinCall))
+#define THREAD_EXIT_CALL    (reinterpret_cast<void*>(ThreadExitCall))
+#define BAD_JUMP_CALL       (reinterpret_cast<void*>(BadJumpAddressHandler))
+#define MEMCPY_CALL         (reinterpret_cast<void*>(MemcpyCall))
+#define MEMSET_CALL         (reinterpret_cast<void*>(MemsetCall))
+#define VSUM_CALL           (reinterpret_cast<void*>(VectorSumCall<int64_t>))
+#define VADD_CALL           (reinterpret_cast<void*>(VectorAddCall<int64_t>))
+#define VMUL_CALL           (reinterpret_cast<void*>(VectorMulCall<int64_t>))
+#define VDOT_CALL           (reinterpret_cast<void*>(VectorDotCall<int64_t>))
+#define FVSUM_CALL          (reinterpret_cast<void*>(VectorSumCall<double>))
+#define FVADD_CALL          (reinterpret_cast<void*>(VectorAddCall<double>))
+#define FVMUL_CALL          (reinterpret_cast<void*>(VectorMulCall<double>))
+#define FVDOT_CALL          (reinterpret_cast<void*>(VectorDotCall<double>))
+#define ALLOC_CALL          (reinterpret_cast<void*>(AllocCall))
+#define FREE_CALL           (reinterpret_cast<void*>(FreeCall))
+#define REALLOC_CALL        (reinterpret_cast<void*>(ReallocCall))
+#define UNARY_MATH_CALL(fn) (reinterpret_cast<void*>(static_cast<double (*)(double)>(fn)))
+#define BINARY_MATH_CALL(fn) \
+                            (reinterpret_cast<void*>(static_cast<double (*)(double, double)>(fn)))
+#define FLOOR_CALL          UNARY_MATH_CALL(std::floor)
+#define CEIL_CALL           UNARY_MATH_CALL(std::ceil)
+#define TRUNC_CALL          UNARY_MATH_CALL(std::trunc)
+#define NEARBYINT_CALL      UNARY_MATH_CALL(std::nearbyint)
+#define SIN_CALL            UNARY_MATH_CALL(std::sin)
+#define COS_CALL            UNARY_MATH_CALL(std::cos)
+#define TAN_CALL            UNARY_MATH_CALL(std::tan)
+#define EXP_CALL            UNARY_MATH_CALL(std::exp)
+#define LOG_CALL            UNARY_MATH_CALL(std::log)
+#define ATAN2_CALL          BINARY_MATH_CALL(std::atan2)
+#define POW_CALL            BINARY_MATH_CALL(std::pow)
+#define FMA_CALL            (reinterpret_cast<void*>(static_cast<double (*)(double, double, double)>(std::fma)))
 
 struct Fixup {
     int64_t instruction_pointer;
     size_t native_code_offset;
 };
 
-void JITCompiler::Compile(const Object& obj) {
-    int64_t bytecode_size = obj.bytecode.size();
+void JITCompiler::Compile(const Executable& executable) {
+    BytecodeView bytecode = executable.GetBytecode();
+    if (!TryCompile(bytecode, executable.GetMetadata())) {
+        /* Metadata that does not belong to this bytecode; redo the analysis instead of trusting it. */
+        ProgramMetadata metadata;
+        AnalyzeProgram(bytecode, {}, &metadata);
+        TryCompile(bytecode, metadata);
+    }
+    program_hash_ = HashBytecode(bytecode);
+    heap_base_ = executable.GetBssSize();
+}
+
+bool JITCompiler::TryCompile(BytecodeView bytecode, const ProgramMetadata& metadata) {
+    int64_t bytecode_size = bytecode.size();
     code_addr_table_.assign(bytecode_size, reinterpret_cast<void*>(BadJumpAddressHandler));
     std::vector<int8_t> native_code;
     native_code.reserve(bytecode_size * 32);
 
     std::vector<Fixup> fixups;
+    fixups.reserve(metadata.instruction_starts.size());
+    /* Direct branches: target bytecode address and where its rel32 is. */
+    std::vector<Fixup> branch_fixups;
+
+    /* Entry stub: the data base arrives in RBX from the initial context, the rest of the guest
+     * state and the address to start at are on the user stack (see JITInstance::PrepareStart). */
+    ASM_MOV_RBX_RSI();
+    ASM_ENTRY_STUB();
+    size_t thread_exit_offset = native_code.size();
+    ASM_MOV_RAX_RDI();
+    ASM_MOV_RSP_RSI();
+    ASM_CALL_HELPER(THREAD_EXIT_CALL);
 
     int64_t instruction_pointer = 0;
     while (instruction_pointer < bytecode_size) {
         fixups.push_back(Fixup{instruction_pointer, native_code.size()});
-        int8_t opcode = obj.bytecode[instruction_pointer++];
+        int8_t opcode = bytecode[instruction_pointer++];
         switch (opcode) {
 #include <instruction_set.h>
             default:
@@ -428,18 +1405,77 @@ void JITCompiler::Compile(const Object& obj) {
         }
     }
 
+    if (fixups.size() != metadata.instruction_starts.size() ||
+        !std::equal(fixups.begin(), fixups.end(), metadata.instruction_starts.begin(),
+                    [](const Fixup& fixup, int64_t start) { return fixup.instruction_pointer == start; })) {
+        return false;
+    }
+
+    /* Direct branches to anything but an instruction end up here. */
+    size_t bad_jump_offset = native_code.size();
+    ASM_CALL_HELPER(BAD_JUMP_CALL);
+    std::vector<size_t> native_offsets(bytecode_size, bad_jump_offset);
+    for (auto& fixup : fixups) {
+        native_offsets[fixup.instruction_pointer] = fixup.native_code_offset;
+    }
+    for (auto& branch : branch_fixups) {
+        bool valid = branch.instruction_pointer >= 0 && branch.instruction_pointer < bytecode_size;
+        size_t target = valid ? native_offsets[branch.instruction_pointer] : bad_jump_offset;
+        int32_t displacement = static_cast<int32_t>(target - (branch.native_code_offset + sizeof(int32_t)));
+        std::memcpy(native_code.data() + branch.native_code_offset, &displacement, sizeof(displacement));
+    }
+
     code_.emplace(native_code.size(), PROT_READ | PROT_WRITE | PROT_EXEC);
     std::copy(native_code.begin(), native_code.end(), static_cast<int8_t*>(code_->Begin()));
+    thread_exit_offset_ = thread_exit_offset;
+    instruction_starts_.clear();
     for (auto& fixup : fixups) {
         code_addr_table_[fixup.instruction_pointer] = static_cast<int8_t*>(code_->Begin()) + fixup.native_code_offset;
+        instruction_starts_.push_back(fixup.instruction_pointer);
     }
+    code_->Protect(PROT_READ | PROT_EXEC);
+    return true;
 }
 
-void JITCompiler::Execute() {
+void* JITCompiler::EntryPoint() const {
     if (!code_) {
         throw std::runtime_error("No bytecode provided!");
     }
+    return code_->Begin();
+}
+
+uint64_t JITCompiler::GetProgramHash() const {
+    return program_hash_;
+}
+
+int64_t JITCompiler::HeapBase() const {
+    return heap_base_;
+}
+
+void* JITCompiler::InstructionAddress(uint64_t ip) const {
+    if (ip >= code_addr_table_.size()) {
+        return reinterpret_cast<void*>(BadJumpAddressHandler);
+    }
+    return code_addr_table_[ip];
+}
+
+/* A CALL's native return address points past its `call`, into the CALL itself, so it stands for
+ * the instruction that follows; addresses written by InstructionAddress() map back exactly. */
+uint64_t JITCompiler::ReturnAddressToIP(const void* return_address) const {
+    auto next = std::upper_bound(instruction_starts_.begin(), instruction_starts_.end(), return_address,
+                                 [this](const void* address, int64_t ip) { return address < code_addr_table_[ip]; });
+    if (next != instruction_starts_.begin() && code_addr_table_[*(next - 1)] == return_address) {
+        return *(next - 1);
+    }
+    return next == instruction_starts_.end() ? code_addr_table_.size() : *next;
+}
+
+uint64_t JITCompiler::HelperReturnAddressToIP(const void* return_address) const {
+    auto next = std::lower_bound(instruction_starts_.begin(), instruction_starts_.end(), return_address,
+                                 [this](int64_t ip, const void* address) { return code_addr_table_[ip] < address; });
+    return next == instruction_starts_.begin() ? 0 : *(next - 1);
+}
 
-    PrepareUserContext(user_context, static_cast<char*>(data_stack_.End()), call_stack_.End(), code_->Begin());
-    supervisor_context.SwitchTo(user_context);
+void* JITCompiler::ThreadExitPoint() const {
+    return static_cast<int8_t*>(EntryPoint()) + thread_exit_offset_;
 }
@@ -0,0 +1,89 @@
+#include <line_table.h>
+#include <algorithm>
+
+bool LineTable::Empty() const {
+    return rows.empty();
+}
+
+const LineTable::Row* LineTable::Find(int64_t position) const {
+    auto next = std::upper_bound(rows.begin(), rows.end(), position,
+                                 [](int64_t pos, const Row& row) { return pos < row.position; });
+    if (next == rows.begin() || (next - 1)->file < 0) {
+        return nullptr;
+    }
+    return &*(next - 1);
+}
+
+static void PutVarint(uint64_t value, std::string* out) {
+    while (value >= 0x80) {
+        out->push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<char>(value));
+}
+
+static bool TryGetVarint(const char** cursor, const char* end, uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*cursor == end) {
+            return false;
+        }
+        uint8_t byte = *(*cursor)++;
+        *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void EncodeLineRows(const std::vector<LineTable::Row>& rows, std::string* out) {
+    LineTable::Row previous{0, 0, 0};
+    for (const LineTable::Row& row : rows) {
+        bool file_changed = row.file != previous.file;
+        PutVarint(static_cast<uint64_t>(row.position - previous.position) << 1 | file_changed, out);
+        if (file_changed) {
+            /* -1 becomes 0, so real files start at 1. */
+            PutVarint(static_cast<uint64_t>(row.file + 1), out);
+        }
+        int64_t line_delta = static_cast<int64_t>(row.line) - previous.line;
+        PutVarint(static_cast<uint64_t>(line_delta) << 1 ^ static_cast<uint64_t>(line_delta >> 63), out);
+        previous = row;
+    }
+}
+
+bool TryDecodeLineRows(const char* data, size_t size, int64_t rows_cnt, int64_t files_cnt, int64_t bytecode_size,
+                       std::vector<LineTable::Row>* rows) {
+    const char* cursor = data;
+    const char* end = data + size;
+    /* Every row takes two bytes at least. */
+    if (rows_cnt < 0 || rows_cnt > static_cast<int64_t>(size / 2)) {
+        return false;
+    }
+    rows->clear();
+    rows->reserve(rows_cnt);
+    LineTable::Row row{0, 0, 0};
+    for (int64_t i = 0; i < rows_cnt; ++i) {
+        uint64_t position_delta = 0, file = 0, line_delta = 0;
+        if (!TryGetVarint(&cursor, end, &position_delta)) {
+            return false;
+        }
+        if ((position_delta & 1) != 0) {
+            if (!TryGetVarint(&cursor, end, &file) || file > static_cast<uint64_t>(files_cnt)) {
+                return false;
+            }
+            row.file = static_cast<int32_t>(file) - 1;
+        }
+        if (!TryGetVarint(&cursor, end, &line_delta)) {
+            return false;
+        }
+        position_delta >>= 1;
+        if ((i > 0 && position_delta == 0) || position_delta >= static_cast<uint64_t>(bytecode_size - row.position)) {
+            return false;
+        }
+        row.position += position_delta;
+        row.line += static_cast<int32_t>(static_cast<int64_t>(line_delta >> 1) ^ -static_cast<int64_t>(line_delta & 1));
+        rows->push_back(row);
+    }
+    return cursor == end;
+}
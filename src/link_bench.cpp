@@ -0,0 +1,131 @@
+#include <assembler.h>
+#include <linker.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+/* Times loading and linking generated objects with 1, 2, 4, ... threads up to the hardware's.
+ * Every object defines a constant, a variable, a function with a local loop calling another
+ * object's function and reading another object's variable, and a function nothing calls.
+ * Usage: link_bench [objects] [rounds] */
+
+static std::string GenerateSource(int k, int objects_cnt) {
+    std::string n = std::to_string(k);
+    std::string callee = std::to_string((k * 31LL + 1) % objects_cnt);
+    std::string read = std::to_string((k * 7LL + 3) % objects_cnt);
+    return "SYMBOL C" + n + " " + n + "\n"
+           "VAR v" + n + " 2\n"
+           "FUNC f" + n + "\n"
+           "    PUSH C" + n + "\n"
+           "    POP *v" + n + "\n"
+           "    MOV %1 4\n"
+           "FUNC .loop\n"
+           "    PUSH *v" + read + "\n"
+           "    POP %2\n"
+           "    CALL f" + callee + "\n"
+           "    DECJNZ %1 .loop\n"
+           "    RET\n"
+           "FUNC g" + n + "\n"
+           "    CALL f" + n + "\n"
+           "    RET\n";
+}
+
+static bool TryAssemble(const std::string& source_path, const std::string& source, const std::string& object_path) {
+    {
+        std::ofstream out(source_path);
+        out << source;
+    }
+    std::ifstream in(source_path);
+    std::ofstream out(object_path, std::ios_base::binary);
+    if (!in.good() || !out.good()) {
+        return false;
+    }
+    Assemble(&in, &out, kObjectFormatImage, source_path, 0);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    int objects_cnt = argc > 1 ? std::atoi(argv[1]) : 10000;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 3;
+    if (objects_cnt <= 0 || rounds <= 0) {
+        std::fprintf(stderr, "Usage: %s [objects] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    char dir_template[] = "/tmp/link_bench.XXXXXX";
+    const char* dir = mkdtemp(dir_template);
+    if (dir == nullptr) {
+        std::fprintf(stderr, "Cannot create a temporary directory\n");
+        return 1;
+    }
+    std::vector<std::string> sources, paths;
+    bool ok = TryAssemble(std::string(dir) + "/_start.s", "FUNC _start\n    CALL f0\n    HALT\n",
+                          std::string(dir) + "/_start.vobj");
+    paths.push_back(std::string(dir) + "/_start.vobj");
+    sources.push_back(std::string(dir) + "/_start.s");
+    for (int k = 0; k < objects_cnt && ok; ++k) {
+        std::string base = std::string(dir) + "/o" + std::to_string(k);
+        ok = TryAssemble(base + ".s", GenerateSource(k, objects_cnt), base + ".vobj");
+        sources.push_back(base + ".s");
+        paths.push_back(base + ".vobj");
+    }
+
+    std::printf("%d objects, best of %d rounds\n", objects_cnt, rounds);
+    std::printf("%-8s %10s %10s %10s\n", "threads", "load ms", "link ms", "speedup");
+    int max_threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+    double serial_ms = 0;
+    std::vector<int8_t> serial_bytecode;
+    for (int threads = 1; ok; threads = std::min(threads * 2, max_threads)) {
+        double best_load = 0, best_link = 0;
+        Object executable;
+        for (int round = 0; round < rounds && ok; ++round) {
+            std::string error;
+            std::vector<Object> objects;
+            auto start = std::chrono::steady_clock::now();
+            ok = TryLoadObjects(paths, threads, &objects, &error);
+            auto loaded = std::chrono::steady_clock::now();
+            LinkOptions options;
+            options.threads = threads;
+            executable = Object();
+            executable.proc_version = objects.empty() ? Object::ProcVersion() : objects[0].proc_version;
+            ok = ok && TryLink(objects, options, &executable, &error);
+            auto linked = std::chrono::steady_clock::now();
+            if (!ok) {
+                std::fprintf(stderr, "ERROR %s\n", error.c_str());
+                break;
+            }
+            std::chrono::duration<double, std::milli> load_ms = loaded - start, link_ms = linked - loaded;
+            best_load = round == 0 ? load_ms.count() : std::min(best_load, load_ms.count());
+            best_link = round == 0 ? link_ms.count() : std::min(best_link, link_ms.count());
+        }
+        if (!ok) {
+            break;
+        }
+        if (threads == 1) {
+            serial_ms = best_load + best_link;
+            serial_bytecode = executable.bytecode;
+        }
+        bool same = executable.bytecode == serial_bytecode;
+        ok = same;
+        std::printf("%-8d %10.2f %10.2f %9.2fx%s\n", threads, best_load, best_link,
+                    serial_ms / (best_load + best_link), same ? "" : "  MISMATCH");
+        if (threads >= max_threads) {
+            break;
+        }
+    }
+
+    for (const std::string& path : sources) {
+        std::remove(path.c_str());
+    }
+    for (const std::string& path : paths) {
+        std::remove(path.c_str());
+    }
+    rmdir(dir);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+#include <link_state.h>
+#include <symbol_pool.h>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+static constexpr char kLinkStateMagic[8] = {'V', 'S', 'V', 'M', 'L', 'N', 'K', '\0'};
+static constexpr int64_t kLinkStateFormatVersion = 1;
+
+bool TryHashFile(const char* path, uint64_t* hash) {
+    std::ifstream in(path, std::ios_base::binary);
+    if (!in.good()) {
+        return false;
+    }
+    std::string contents(std::istreambuf_iterator<char>(in), (std::istreambuf_iterator<char>()));
+    *hash = SymbolPool::Hash(contents);
+    return !in.bad();
+}
+
+/* Everything is stored as little-endian 64-bit integers, strings as their size and bytes. */
+static void PutInt(std::string* out, int64_t value) {
+    out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void PutString(std::string* out, const std::string& value) {
+    PutInt(out, value.size());
+    *out += value;
+}
+
+void WriteLinkState(const LinkState& state, std::ostream* out) {
+    std::string buffer(kLinkStateMagic, sizeof(kLinkStateMagic));
+    PutInt(&buffer, kLinkStateFormatVersion);
+    PutInt(&buffer, state.format);
+    PutInt(&buffer, state.executable_hash);
+    PutInt(&buffer, state.inputs.size());
+    for (const LinkState::Input& input : state.inputs) {
+        PutString(&buffer, input.path);
+        PutInt(&buffer, input.hash);
+        PutInt(&buffer, input.code_offset);
+        PutInt(&buffer, input.code_size);
+        PutInt(&buffer, input.code_used);
+        PutInt(&buffer, input.bss_offset);
+        PutInt(&buffer, input.bss_size);
+        PutInt(&buffer, input.bss_used);
+    }
+    PutInt(&buffer, state.definitions.size());
+    for (const LinkState::Definition& definition : state.definitions) {
+        PutString(&buffer, definition.name);
+        PutInt(&buffer, definition.input);
+        PutInt(&buffer, definition.symbol.position);
+        PutInt(&buffer, definition.symbol.type);
+    }
+    PutInt(&buffer, state.relocations.size());
+    for (const LinkState::Relocation& relocation : state.relocations) {
+        PutInt(&buffer, relocation.input);
+        PutInt(&buffer, relocation.position);
+        PutInt(&buffer, relocation.size);
+        PutString(&buffer, relocation.symbol);
+    }
+    out->write(buffer.data(), buffer.size());
+}
+
+namespace {
+
+class Reader {
+public:
+    explicit Reader(const std::string& data) : data_(data) {}
+
+    bool TryGet(int64_t* value) {
+        if (data_.size() - cursor_ < sizeof(*value)) {
+            return false;
+        }
+        std::memcpy(value, data_.data() + cursor_, sizeof(*value));
+        cursor_ += sizeof(*value);
+        return true;
+    }
+
+    template <class T>
+    bool TryGet(T* value) {
+        int64_t raw = 0;
+        if (!TryGet(&raw)) {
+            return false;
+        }
+        *value = static_cast<T>(raw);
+        return true;
+    }
+
+    bool TryGetCount(size_t item_size, size_t* cnt) {
+        int64_t raw = 0;
+        if (!TryGet(&raw) || raw < 0 || static_cast<uint64_t>(raw) > (data_.size() - cursor_) / item_size) {
+            return false;
+        }
+        *cnt = raw;
+        return true;
+    }
+
+    bool TryGet(std::string* value) {
+        size_t size = 0;
+        if (!TryGetCount(1, &size)) {
+            return false;
+        }
+        value->assign(data_, cursor_, size);
+        cursor_ += size;
+        return true;
+    }
+
+    bool AtEnd() const {
+        return cursor_ == data_.size();
+    }
+
+private:
+    const std::string& data_;
+    size_t cursor_ = sizeof(kLinkStateMagic);
+};
+
+}
+
+static bool TryParseLinkState(const std::string& data, LinkState* state) {
+    Reader reader(data);
+    int64_t version = 0;
+    size_t cnt = 0;
+    if (data.size() < sizeof(kLinkStateMagic) || std::memcmp(data.data(), kLinkStateMagic, sizeof(kLinkStateMagic)) != 0 ||
+        !reader.TryGet(&version) || version != kLinkStateFormatVersion || !reader.TryGet(&state->format) ||
+        !reader.TryGet(&state->executable_hash) || !reader.TryGetCount(9 * sizeof(int64_t), &cnt)) {
+        return false;
+    }
+    state->inputs.resize(cnt);
+    for (LinkState::Input& input : state->inputs) {
+        if (!reader.TryGet(&input.path) || !reader.TryGet(&input.hash) || !reader.TryGet(&input.code_offset) ||
+            !reader.TryGet(&input.code_size) || !reader.TryGet(&input.code_used) || !reader.TryGet(&input.bss_offset) ||
+            !reader.TryGet(&input.bss_size) || !reader.TryGet(&input.bss_used)) {
+            return false;
+        }
+    }
+    if (!reader.TryGetCount(4 * sizeof(int64_t), &cnt)) {
+        return false;
+    }
+    state->definitions.resize(cnt);
+    for (LinkState::Definition& definition : state->definitions) {
+        if (!reader.TryGet(&definition.name) || !reader.TryGet(&definition.input) ||
+            !reader.TryGet(&definition.symbol.position) || !reader.TryGet(&definition.symbol.type) ||
+            definition.input >= state->inputs.size()) {
+            return false;
+        }
+    }
+    if (!reader.TryGetCount(4 * sizeof(int64_t), &cnt)) {
+        return false;
+    }
+    state->relocations.resize(cnt);
+    for (LinkState::Relocation& relocation : state->relocations) {
+        if (!reader.TryGet(&relocation.input) || !reader.TryGet(&relocation.position) ||
+            !reader.TryGet(&relocation.size) || !reader.TryGet(&relocation.symbol) ||
+            relocation.input >= state->inputs.size() || relocation.size <= 0 || relocation.size > 8) {
+            return false;
+        }
+    }
+    return reader.AtEnd();
+}
+
+bool TryReadLinkState(const char* path, LinkState* state, std::string* error) {
+    std::ifstream in(path, std::ios_base::binary);
+    if (!in.good()) {
+        *error = std::string("Failed to open ") + path;
+        return false;
+    }
+    std::string data(std::istreambuf_iterator<char>(in), (std::istreambuf_iterator<char>()));
+    if (!TryParseLinkState(data, state)) {
+        *error = std::string(path) + ": malformed link state";
+        return false;
+    }
+    return true;
+}
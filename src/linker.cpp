@@ -1,28 +1,633 @@
 #include <linker.h>
-#include <oosf/input_data_stream.h>
+#include <image.h>
+#include <link_state.h>
+#include <bytecode_optimizer.h>
+#include <instruction_decoder.h>
+#include <symbol_pool.h>
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
 #include <sstream>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+enum Opcode : int8_t {
+#define DEF_CMD(name, code, ...) kOpcode##name = code,
+#include <instruction_set.h>
+#undef DEF_CMD
+};
 
 bool TryLoadObject(std::vector<Object>* obj, const char* filename) {
-    std::FILE* file = std::fopen(filename, "rb");
-    if (file == nullptr) {
+    std::string error;
+    obj->emplace_back();
+    if (!TryReadObjectFile(filename, &obj->back(), &error)) {
+        obj->pop_back();
         return false;
     }
-    InputDataStream dstream(file);
-    Object::RegisterIn(&dstream);
+    return true;
+}
 
-    obj->emplace_back();
-    ReadStatus result = dstream.TryRead(&obj->back());
-    std::fclose(file);
+/* Runs body(0), ..., body(cnt - 1) on up to `threads` threads, handing out indices one by one. */
+static void ParallelFor(size_t cnt, int threads, const std::function<void(size_t)>& body) {
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < cnt; i = next++) {
+            body(i);
+        }
+    };
+    threads = std::clamp<int>(threads, 1, std::max<size_t>(cnt, 1));
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (int i = 1; i < threads; ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+}
 
-    if (result != kStatusOk) {
-        obj->pop_back();
+static int ThreadsFor(int threads) {
+    return threads > 0 ? threads : std::max<int>(std::thread::hardware_concurrency(), 1);
+}
+
+/* The first error in object order, so that it does not depend on scheduling. */
+static bool TryTakeFirstError(std::vector<std::string>* errors, std::string* error) {
+    for (std::string& message : *errors) {
+        if (!message.empty()) {
+            *error = std::move(message);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TryLoadObjects(const std::vector<std::string>& paths, int threads, std::vector<Object>* objects,
+                    std::string* error) {
+    size_t first = objects->size();
+    objects->resize(first + paths.size());
+    std::vector<std::string> errors(paths.size());
+    ParallelFor(paths.size(), ThreadsFor(threads), [&](size_t i) {
+        TryReadObjectFile(paths[i].c_str(), &(*objects)[first + i], &errors[i]);
+    });
+    if (TryTakeFirstError(&errors, error)) {
+        objects->resize(first);
         return false;
     }
     return true;
 }
 
-bool TryLink(const std::vector<Object>& objects, Object* executable, std::string* error) {
+bool TryPullArchiveMembers(const std::vector<std::unique_ptr<MappedArchive>>& archives, std::vector<Object>* objects,
+                           std::string* error) {
+    std::unordered_set<std::string> defined;
+    std::vector<std::string> wanted;
+    auto add = [&defined, &wanted](const Object& object) {
+        for (const auto& [name, symbol] : object.defined_symbols) {
+            if (name[0] != '.') {
+                defined.insert(name);
+            }
+        }
+        for (const auto& [position, name] : object.required_symbols) {
+            if (object.defined_symbols.count(name) == 0) {
+                wanted.push_back(name);
+            }
+        }
+    };
+    for (const Object& object : *objects) {
+        add(object);
+    }
+
+    std::vector<std::vector<bool>> pulled(archives.size());
+    for (size_t a = 0; a < archives.size(); ++a) {
+        pulled[a].assign(archives[a]->MembersCnt(), false);
+    }
+    while (!wanted.empty()) {
+        std::string name = std::move(wanted.back());
+        wanted.pop_back();
+        if (defined.count(name) != 0) {
+            continue;
+        }
+        /* The first archive defining the symbol wins; undefined ones are left for TryLink to report. */
+        for (size_t a = 0; a < archives.size(); ++a) {
+            size_t member = 0;
+            if (!archives[a]->TryFindMember(name, &member)) {
+                continue;
+            }
+            if (!pulled[a][member]) {
+                pulled[a][member] = true;
+                objects->emplace_back();
+                if (!archives[a]->TryReadMember(member, &objects->back(), error)) {
+                    return false;
+                }
+                if (objects->back().object_type != Object::kObjectStaticLinkable) {
+                    *error = "Member " + std::string(archives[a]->MemberName(member)) + " is not static linkable";
+                    return false;
+                }
+                add(objects->back());
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+namespace {
+
+/* An immediate that a symbol's value goes into. Symbols start out in the field the assembler
+ * gave them and move to a wider one when their value does not fit. */
+struct RelocatedField {
+    int64_t position;
+    size_t instruction;
+    int operand;
+    int original_size;
+    int size;
+    std::string_view name;
+    uint64_t hash;
+    SymbolPool::Id id;
+};
+
+/* A symbol the object defines, with its name interned. */
+struct Definition {
+    const std::string* name;
+    uint64_t hash;
+    SymbolPool::Id id;
+    Symbol symbol;
+};
+
+struct ObjectLayout {
+    std::vector<InstructionLayout> instructions;
+    std::vector<RelocatedField> fields;
+    /* Per instruction: whether it is kept. Garbage collection clears the unreachable ones. */
+    std::vector<bool> live;
+    bool all_live = true;
+    /* Bytes the instructions before instruction k gained by relaxation or lost to garbage
+     * collection; one more entry for the object's end. */
+    std::vector<int64_t> growth_before;
+    /* The object's bytecode size before relaxation and collection. */
+    int64_t code_size = 0;
+    int64_t offset = 0;
+    /* The kept variables' new places in the object's bss, which is bss_size words long. */
+    std::unordered_map<int64_t, int64_t> variables;
+    int64_t bss_size = 0;
+    int64_t bss_offset = 0;
+    /* Sorted by id once the names are interned. */
+    std::vector<Definition> definitions;
+};
+
+constexpr size_t kNoObject = static_cast<size_t>(-1);
+/* The "object" of the symbols ld defines itself, __bss_size for now. */
+constexpr size_t kLinkerObject = static_cast<size_t>(-2);
+constexpr char kBssSizeSymbol[] = "__bss_size";
+
+/* Where a global symbol was defined. */
+struct GlobalSymbol {
+    size_t object = kNoObject;
+    Symbol symbol;
+};
+
+}
+
+static bool TryDecodeObject(const Object& object, size_t idx, ObjectLayout* layout, std::string* error) {
+    int64_t ip = 0;
+    while (ip < static_cast<int64_t>(object.bytecode.size())) {
+        layout->instructions.emplace_back();
+        if (!TryDecodeInstruction(object.bytecode, ip, &layout->instructions.back())) {
+            std::stringstream ss;
+            ss << "Object file #" << idx << " has corrupted bytecode at 0x" << std::hex << ip;
+            *error = ss.str();
+            return false;
+        }
+        ip += layout->instructions.back().size;
+    }
+    layout->code_size = ip;
+
+    std::vector<std::pair<int64_t, std::string_view>> relocations(object.required_symbols.begin(),
+                                                                 object.required_symbols.end());
+    std::sort(relocations.begin(), relocations.end());
+    size_t instruction = 0;
+    for (const auto& [position, name] : relocations) {
+        while (instruction < layout->instructions.size() &&
+               layout->instructions[instruction].start + layout->instructions[instruction].size <= position) {
+            ++instruction;
+        }
+        bool found = false;
+        if (instruction < layout->instructions.size()) {
+            const InstructionLayout& decoded = layout->instructions[instruction];
+            for (int i = 0; i < decoded.args_cnt && !found; ++i) {
+                int8_t type = decoded.arg_types[i];
+                if (ImmediateSize(type) > 0 && decoded.arg_offsets[i] == position) {
+                    layout->fields.push_back(RelocatedField{position, instruction, i, decoded.arg_sizes[i], decoded.arg_sizes[i],
+                                                            name, SymbolPool::Hash(name), SymbolPool::kNoId});
+                    found = true;
+                } else if (type == ARG_BASE_OFFSET && decoded.arg_offsets[i] + 1 == position) {
+                    layout->fields.push_back(RelocatedField{position, instruction, i, sizeof(int64_t), sizeof(int64_t), name,
+                                                            SymbolPool::Hash(name), SymbolPool::kNoId});
+                    found = true;
+                }
+            }
+        }
+        if (!found) {
+            std::stringstream ss;
+            ss << "Object file #" << idx << " has a relocation at 0x" << std::hex << position << " outside any immediate";
+            *error = ss.str();
+            return false;
+        }
+    }
+
+    layout->definitions.reserve(object.defined_symbols.size());
+    for (const auto& [name, symbol] : object.defined_symbols) {
+        layout->definitions.push_back(Definition{&name, SymbolPool::Hash(name), SymbolPool::kNoId, symbol});
+    }
+    layout->live.assign(layout->instructions.size(), true);
+    return true;
+}
+
+/* Where a position in an object's bytecode ends up in the executable. */
+static int64_t Relocate(const ObjectLayout& layout, int64_t position) {
+    auto next = std::lower_bound(layout.instructions.begin(), layout.instructions.end(), position,
+                                 [](const InstructionLayout& instruction, int64_t pos) { return instruction.start < pos; });
+    return layout.offset + position + layout.growth_before[next - layout.instructions.begin()];
+}
+
+/* Whether the code at `position` is kept; positions past the last instruction are. */
+static bool IsLive(const ObjectLayout& layout, int64_t position) {
+    auto next = std::lower_bound(layout.instructions.begin(), layout.instructions.end(), position,
+                                 [](const InstructionLayout& instruction, int64_t pos) { return instruction.start < pos; });
+    return next == layout.instructions.end() || layout.live[next - layout.instructions.begin()];
+}
+
+static int64_t SymbolValue(const std::vector<ObjectLayout>& layouts, size_t object, const Symbol& symbol) {
+    switch (symbol.type) {
+        case Symbol::kSymbolFunction:
+            return Relocate(layouts[object], symbol.position);
+        case Symbol::kSymbolVariable: {
+            /* Dropped variables are only named by dropped code. */
+            auto variable = layouts[object].variables.find(symbol.position);
+            return layouts[object].bss_offset + (variable == layouts[object].variables.end() ? 0 : variable->second);
+        }
+        default:
+            return symbol.position;
+    }
+}
+
+static bool IsSymbolLive(const std::vector<ObjectLayout>& layouts, size_t object, const Symbol& symbol) {
+    switch (symbol.type) {
+        case Symbol::kSymbolFunction:
+            return IsLive(layouts[object], symbol.position);
+        case Symbol::kSymbolVariable:
+            return layouts[object].variables.count(symbol.position) != 0;
+        default:
+            return true;
+    }
+}
+
+/* Marks what can run, starting from the entry point: the first object's code and _start. Code is
+ * kept a unit at a time, a unit running from one FUNC symbol, local ones included, to the next;
+ * whatever a kept unit's relocations name is kept, and so is the unit after it unless it ends in
+ * JMP, RET or HALT. Variables are kept when kept code names them. Code addresses written as numbers
+ * are not followed. */
+static void CollectGarbage(const std::vector<Object>& objects, const std::vector<std::vector<GlobalSymbol>>& targets,
+                           const GlobalSymbol* entry, std::vector<ObjectLayout>* layouts) {
+    /* Units are numbered across objects in link order, so that falling through is going to the
+     * next number even from one object into the next. */
+    std::vector<std::vector<size_t>> unit_of(objects.size());
+    std::vector<size_t> units_begin(objects.size() + 1, 0);
+    std::vector<std::pair<size_t, size_t>> unit_ends;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const auto& instructions = (*layouts)[i].instructions;
+        std::vector<bool> starts_unit(instructions.size(), false);
+        if (!instructions.empty()) {
+            starts_unit[0] = true;
+        }
+        for (const auto& [name, symbol] : objects[i].defined_symbols) {
+            if (symbol.type != Symbol::kSymbolFunction) {
+                continue;
+            }
+            auto next = std::lower_bound(instructions.begin(), instructions.end(), symbol.position,
+                                         [](const InstructionLayout& instruction, int64_t pos) { return instruction.start < pos; });
+            if (next != instructions.end()) {
+                starts_unit[next - instructions.begin()] = true;
+            }
+        }
+        units_begin[i] = unit_ends.size();
+        for (size_t k = 0; k < instructions.size(); ++k) {
+            if (starts_unit[k]) {
+                unit_ends.emplace_back(i, k);
+            }
+            unit_ends.back().second = k;
+            unit_of[i].push_back(unit_ends.size() - 1);
+        }
+    }
+    units_begin[objects.size()] = unit_ends.size();
+
+    std::vector<bool> unit_live(unit_ends.size(), false);
+    std::vector<std::unordered_map<int64_t, bool>> variable_live(objects.size());
+    std::vector<size_t> worklist;
+    auto mark = [&](size_t object, const Symbol& symbol) {
+        if (symbol.type == Symbol::kSymbolVariable) {
+            variable_live[object][symbol.position] = true;
+            return;
+        }
+        if (symbol.type != Symbol::kSymbolFunction) {
+            return;
+        }
+        const auto& instructions = (*layouts)[object].instructions;
+        auto next = std::lower_bound(instructions.begin(), instructions.end(), symbol.position,
+                                     [](const InstructionLayout& instruction, int64_t pos) { return instruction.start < pos; });
+        if (next == instructions.end()) {
+            return;
+        }
+        size_t unit = unit_of[object][next - instructions.begin()];
+        if (!unit_live[unit]) {
+            unit_live[unit] = true;
+            worklist.push_back(unit);
+        }
+    };
+
+    if (!objects.empty()) {
+        mark(0, Symbol(0, Symbol::kSymbolFunction));
+    }
+    if (entry != nullptr) {
+        mark(entry->object, entry->symbol);
+    }
+    std::vector<std::vector<size_t>> unit_fields(unit_ends.size());
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const auto& fields = (*layouts)[i].fields;
+        for (size_t f = 0; f < fields.size(); ++f) {
+            unit_fields[unit_of[i][fields[f].instruction]].push_back(f);
+        }
+    }
+    while (!worklist.empty()) {
+        size_t unit = worklist.back();
+        worklist.pop_back();
+        auto [object, last] = unit_ends[unit];
+        for (size_t f : unit_fields[unit]) {
+            mark(targets[object][f].object, targets[object][f].symbol);
+        }
+        int8_t opcode = (*layouts)[object].instructions[last].opcode;
+        bool falls_through = opcode != kOpcodeJMP && opcode != kOpcodeRET && opcode != kOpcodeHALT;
+        if (falls_through && unit + 1 < unit_ends.size() && !unit_live[unit + 1]) {
+            unit_live[unit + 1] = true;
+            worklist.push_back(unit + 1);
+        }
+    }
+
+    for (size_t i = 0; i < objects.size(); ++i) {
+        ObjectLayout& layout = (*layouts)[i];
+        for (size_t k = 0; k < layout.instructions.size(); ++k) {
+            layout.live[k] = unit_live[unit_of[i][k]];
+            layout.all_live = layout.all_live && layout.live[k];
+        }
+
+        std::vector<int64_t> variables;
+        for (const auto& [name, symbol] : objects[i].defined_symbols) {
+            if (symbol.type == Symbol::kSymbolVariable) {
+                variables.push_back(symbol.position);
+            }
+        }
+        std::sort(variables.begin(), variables.end());
+        variables.erase(std::unique(variables.begin(), variables.end()), variables.end());
+        layout.variables.clear();
+        layout.bss_size = variables.empty() ? objects[i].bss_size : variables[0];
+        for (size_t v = 0; v < variables.size(); ++v) {
+            int64_t end = v + 1 < variables.size() ? variables[v + 1] : objects[i].bss_size;
+            if (variable_live[i].count(variables[v]) != 0) {
+                layout.variables[variables[v]] = layout.bss_size;
+                layout.bss_size += end - variables[v];
+            }
+        }
+    }
+}
+
+/* Room left after an object's code and bss in incremental links, for it to grow into when it is
+ * relinked; the bss is counted in words. */
+static int64_t CodeSlack(int64_t code_size) {
+    return code_size / 4 + 64;
+}
+
+static int64_t BssSlack(int64_t bss_size) {
+    return bss_size / 4 + 16;
+}
+
+/* The object's code size in the executable. */
+static int64_t CodeUsed(const ObjectLayout& layout) {
+    return layout.code_size + layout.growth_before.back();
+}
+
+/* Recomputes growth_before and the offsets from the current field sizes, placing the objects from
+ * `offset` on, each followed by its CodeSlack if `reserve` is set. */
+static void Lay(std::vector<ObjectLayout>* layouts, int64_t offset, bool reserve) {
+    for (ObjectLayout& layout : *layouts) {
+        std::vector<int64_t> growth(layout.instructions.size(), 0);
+        for (const RelocatedField& field : layout.fields) {
+            growth[field.instruction] += field.size - field.original_size;
+        }
+        for (size_t k = 0; k < layout.instructions.size(); ++k) {
+            if (!layout.live[k]) {
+                growth[k] = -layout.instructions[k].size;
+            }
+        }
+        layout.growth_before.assign(layout.instructions.size() + 1, 0);
+        for (size_t k = 0; k < layout.instructions.size(); ++k) {
+            layout.growth_before[k + 1] = layout.growth_before[k] + growth[k];
+        }
+        layout.offset = offset;
+        offset += CodeUsed(layout) + (reserve ? CodeSlack(layout.code_size) : 0);
+    }
+}
+
+/* Copies the object's code into place, rewriting the instructions whose fields were widened. If
+ * `positions` is given, it gets where every field went; dropped fields get -1. */
+static void Emit(const Object& object, const ObjectLayout& layout, const std::vector<int64_t>& values,
+                 std::vector<int8_t>* bytecode, std::vector<int64_t>* positions = nullptr) {
+    int8_t* out = bytecode->data() + layout.offset;
+    if (positions != nullptr) {
+        positions->assign(layout.fields.size(), -1);
+    }
+    if (layout.all_live && layout.growth_before.back() == 0) {
+        std::copy(object.bytecode.begin(), object.bytecode.end(), out);
+        for (size_t f = 0; f < layout.fields.size(); ++f) {
+            WriteImmediate(out + layout.fields[f].position, values[f], layout.fields[f].size);
+            if (positions != nullptr) {
+                (*positions)[f] = layout.offset + layout.fields[f].position;
+            }
+        }
+        return;
+    }
+
+    size_t field = 0;
+    for (size_t k = 0; k < layout.instructions.size(); ++k) {
+        if (!layout.live[k]) {
+            while (field < layout.fields.size() && layout.fields[field].instruction == k) {
+                ++field;
+            }
+            continue;
+        }
+        const InstructionLayout& instruction = layout.instructions[k];
+        const int8_t* in = object.bytecode.data() + instruction.start;
+        int8_t* begin = out + instruction.start + layout.growth_before[k];
+        int8_t* cursor = begin;
+        *cursor++ = instruction.opcode;
+        if (instruction.args_cnt == 0) {
+            continue;
+        }
+        ArgDescriptor descriptor = 0;
+        std::memcpy(&descriptor, in + 1, sizeof(descriptor));
+        cursor += sizeof(descriptor);
+        for (int i = 0; i < instruction.args_cnt; ++i) {
+            const int8_t* operand = object.bytecode.data() + instruction.arg_offsets[i];
+            if (field < layout.fields.size() && layout.fields[field].instruction == k && layout.fields[field].operand == i) {
+                const RelocatedField& relocated = layout.fields[field];
+                if (instruction.arg_types[i] == ARG_BASE_OFFSET) {
+                    *cursor++ = operand[0];
+                } else {
+                    SetArgType(&descriptor, i, ImmediateArgType(instruction.arg_types[i], relocated.size));
+                }
+                if (positions != nullptr) {
+                    (*positions)[field] = cursor - bytecode->data();
+                }
+                WriteImmediate(cursor, values[field], relocated.size);
+                cursor += relocated.size;
+                ++field;
+            } else {
+                std::copy(operand, operand + instruction.arg_sizes[i], cursor);
+                cursor += instruction.arg_sizes[i];
+            }
+        }
+        std::memcpy(begin + 1, &descriptor, sizeof(descriptor));
+    }
+}
+
+/* Concatenates the objects' line tables in link order. Code from objects without one gets a row
+ * with no file, so that it is not attributed to the object before it; with `reserve`, so does the
+ * slack after every object. */
+static void MergeLineTables(const std::vector<Object>& objects, const std::vector<ObjectLayout>& layouts, bool reserve,
+                            LineTable* merged) {
+    std::unordered_map<std::string_view, int32_t> file_indices;
+    std::vector<int32_t> files;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const LineTable& table = objects[i].line_table;
+        if (table.Empty()) {
+            if (!merged->Empty() && merged->rows.back().file >= 0) {
+                merged->rows.push_back(LineTable::Row{layouts[i].offset, -1, 0});
+            }
+            continue;
+        }
+        files.clear();
+        for (const std::string& file : table.files) {
+            auto [iter, inserted] = file_indices.emplace(file, merged->files.size());
+            if (inserted) {
+                merged->files.push_back(file);
+            }
+            files.push_back(iter->second);
+        }
+        for (const LineTable::Row& row : table.rows) {
+            if (!IsLive(layouts[i], row.position)) {
+                continue;
+            }
+            int32_t file = row.file < 0 ? -1 : files[row.file];
+            merged->rows.push_back(LineTable::Row{Relocate(layouts[i], row.position), file, row.line});
+        }
+        if (reserve && merged->rows.back().file >= 0) {
+            merged->rows.push_back(LineTable::Row{layouts[i].offset + CodeUsed(layouts[i]), -1, 0});
+        }
+    }
+}
+
+/* Joins the objects into one, in link order. Local symbols get the object's number, ".3" + ".loop"
+ * for instance, so that they stay local and apart. */
+static bool TryMergeObjects(const std::vector<Object>& objects, Object* module, std::string* error) {
+    module->proc_version = objects[0].proc_version;
+    module->object_type = Object::kObjectStaticLinkable;
+    std::unordered_map<std::string_view, int32_t> file_indices;
+    std::vector<int32_t> files;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const Object& object = objects[i];
+        int64_t offset = module->bytecode.size();
+        auto rename = [&object, i](const std::string& name) {
+            bool local = name[0] == '.' && object.defined_symbols.count(name) != 0;
+            return local ? "." + std::to_string(i) + name : name;
+        };
+        for (const auto& [name, symbol] : object.defined_symbols) {
+            Symbol moved = symbol;
+            if (symbol.type == Symbol::kSymbolFunction) {
+                moved.position += offset;
+            } else if (symbol.type == Symbol::kSymbolVariable) {
+                moved.position += module->bss_size;
+            }
+            if (!module->defined_symbols.emplace(rename(name), moved).second) {
+                *error = "Redefinition of symbol " + name;
+                return false;
+            }
+        }
+        for (const auto& [position, name] : object.required_symbols) {
+            module->required_symbols.emplace(position + offset, rename(name));
+        }
+        module->bytecode.insert(module->bytecode.end(), object.bytecode.begin(), object.bytecode.end());
+        module->bss_size += object.bss_size;
+
+        LineTable& merged = module->line_table;
+        if (object.line_table.Empty()) {
+            if (!merged.Empty() && merged.rows.back().file >= 0) {
+                merged.rows.push_back(LineTable::Row{offset, -1, 0});
+            }
+            continue;
+        }
+        files.clear();
+        for (const std::string& file : object.line_table.files) {
+            auto [iter, inserted] = file_indices.emplace(file, merged.files.size());
+            if (inserted) {
+                merged.files.push_back(file);
+            }
+            files.push_back(iter->second);
+        }
+        for (const LineTable::Row& row : object.line_table.rows) {
+            merged.rows.push_back(LineTable::Row{row.position + offset, row.file < 0 ? -1 : files[row.file], row.line});
+        }
+    }
+    return true;
+}
+
+/* Records the link for TryRelink: the slots, the global symbols and the fields naming another
+ * object's symbols. */
+static void RecordLinkState(const std::vector<ObjectLayout>& layouts, const std::vector<std::vector<GlobalSymbol>>& targets,
+                            const std::vector<std::vector<int64_t>>& positions, const SymbolPool& pool,
+                            const std::vector<GlobalSymbol>& globals, LinkState* state) {
+    state->inputs.resize(layouts.size());
+    for (size_t i = 0; i < layouts.size(); ++i) {
+        LinkState::Input& input = state->inputs[i];
+        input.code_offset = layouts[i].offset;
+        input.code_used = CodeUsed(layouts[i]);
+        input.code_size = input.code_used + CodeSlack(layouts[i].code_size);
+        input.bss_offset = layouts[i].bss_offset;
+        input.bss_used = layouts[i].bss_size;
+        input.bss_size = input.bss_used + BssSlack(layouts[i].bss_size);
+    }
+    state->definitions.clear();
+    for (SymbolPool::Id id = 0; id < globals.size(); ++id) {
+        const GlobalSymbol& global = globals[id];
+        if (global.object < layouts.size()) {
+            state->definitions.push_back(LinkState::Definition{
+                std::string(pool.Name(id)), global.object,
+                Symbol(SymbolValue(layouts, global.object, global.symbol), global.symbol.type)});
+        }
+    }
+    state->relocations.clear();
+    for (size_t i = 0; i < layouts.size(); ++i) {
+        for (size_t f = 0; f < layouts[i].fields.size(); ++f) {
+            if (targets[i][f].object != i) {
+                const RelocatedField& field = layouts[i].fields[f];
+                state->relocations.push_back(LinkState::Relocation{i, positions[i][f], field.size, std::string(field.name)});
+            }
+        }
+    }
+}
+
+bool TryLink(const std::vector<Object>& objects, const LinkOptions& options, Object* executable, std::string* error,
+             LinkState* state) {
     for (size_t i = 0; i < objects.size(); ++i) {
         if (!objects[i].proc_version.CompatibleWith(executable->proc_version)) {
             std::stringstream ss;
@@ -37,65 +642,334 @@ bool TryLink(const std::vector<Object>& objects, Object* executable, std::string
         }
     }
 
-    std::vector<int64_t> offsets(objects.size(), 0);
-    std::vector<int64_t> bss_offsets(objects.size(), 0);
+    if (options.lto && state == nullptr && !objects.empty()) {
+        std::vector<Object> module(1);
+        if (!TryMergeObjects(objects, &module[0], error)) {
+            return false;
+        }
+        OptimizeProgram(&module[0]);
+        LinkOptions module_options = options;
+        module_options.lto = false;
+        return TryLink(module, module_options, executable, error);
+    }
 
-    size_t total_bytecode_size = 0;
+    const int threads = ThreadsFor(options.threads);
+    std::vector<ObjectLayout> layouts(objects.size());
+    std::vector<std::string> errors(objects.size());
+    ParallelFor(objects.size(), threads, [&](size_t i) {
+        TryDecodeObject(objects[i], i, &layouts[i], &errors[i]);
+    });
+    if (TryTakeFirstError(&errors, error)) {
+        return false;
+    }
+
+    /* Interning is the one step over all names that runs on a single thread; the hashes are in
+     * already. */
+    SymbolPool pool;
+    std::vector<GlobalSymbol> globals;
     for (size_t i = 0; i < objects.size(); ++i) {
-        offsets[i] = total_bytecode_size;
-        total_bytecode_size += objects[i].bytecode.size();
-        bss_offsets[i] = executable->bss_size;
-        executable->bss_size += objects[i].bss_size;
+        for (Definition& definition : layouts[i].definitions) {
+            definition.id = pool.Intern(*definition.name, definition.hash);
+            if ((*definition.name)[0] == '.') {
+                continue;
+            }
+            globals.resize(pool.Size());
+            if (globals[definition.id].object != kNoObject) {
+                *error = "Redefinition of symbol " + *definition.name;
+                return false;
+            }
+            globals[definition.id] = GlobalSymbol{i, definition.symbol};
+        }
+    }
+    /* Its value is the end of the bss, filled in once the bss is laid out. */
+    SymbolPool::Id bss_size = pool.Intern(kBssSizeSymbol, SymbolPool::Hash(kBssSizeSymbol));
+    globals.resize(pool.Size());
+    if (globals[bss_size].object != kNoObject) {
+        *error = std::string("Redefinition of symbol ") + kBssSizeSymbol;
+        return false;
+    }
+    globals[bss_size] = GlobalSymbol{kLinkerObject, Symbol(0, Symbol::kSymbolUndefined)};
 
-        for (const auto&[name, symbol] : objects[i].defined_symbols) {
-            if (name[0] != '.') {
-                if (executable->defined_symbols.find(name) != executable->defined_symbols.end()) {
-                    *error = "Redefinition of symbol " + name;
-                    return false;
-                }
-                int64_t symbol_pos = symbol.position;
-                if (symbol.type == Symbol::kSymbolFunction) {
-                    symbol_pos += offsets[i];
-                } else if (symbol.type == Symbol::kSymbolVariable) {
-                    symbol_pos += bss_offsets[i];
+    /* The symbol behind every field, looked up once: the object's own definition first. */
+    std::vector<std::vector<GlobalSymbol>> targets(objects.size());
+    ParallelFor(objects.size(), threads, [&](size_t i) {
+        std::vector<Definition>& definitions = layouts[i].definitions;
+        std::sort(definitions.begin(), definitions.end(),
+                  [](const Definition& lhs, const Definition& rhs) { return lhs.id < rhs.id; });
+        targets[i].reserve(layouts[i].fields.size());
+        for (RelocatedField& field : layouts[i].fields) {
+            field.id = pool.Find(field.name, field.hash);
+            auto local = std::lower_bound(definitions.begin(), definitions.end(), field.id,
+                                          [](const Definition& definition, SymbolPool::Id id) { return definition.id < id; });
+            if (field.id != SymbolPool::kNoId && local != definitions.end() && local->id == field.id) {
+                targets[i].push_back(GlobalSymbol{i, local->symbol});
+            } else if (field.id != SymbolPool::kNoId && globals[field.id].object != kNoObject) {
+                targets[i].push_back(globals[field.id]);
+            } else {
+                errors[i] = "Undefined symbol " + std::string(field.name);
+                return;
+            }
+        }
+    });
+    if (TryTakeFirstError(&errors, error)) {
+        return false;
+    }
+
+    if (options.collect_garbage && state == nullptr) {
+        SymbolPool::Id start = pool.Find("_start", SymbolPool::Hash("_start"));
+        bool has_start = start != SymbolPool::kNoId && globals[start].object != kNoObject;
+        CollectGarbage(objects, targets, has_start ? &globals[start] : nullptr, &layouts);
+    } else {
+        for (size_t i = 0; i < objects.size(); ++i) {
+            for (const auto& [name, symbol] : objects[i].defined_symbols) {
+                if (symbol.type == Symbol::kSymbolVariable) {
+                    layouts[i].variables[symbol.position] = symbol.position;
                 }
+            }
+            layouts[i].bss_size = objects[i].bss_size;
+        }
+    }
+    for (size_t i = 0; i < objects.size(); ++i) {
+        layouts[i].bss_offset = executable->bss_size;
+        executable->bss_size += layouts[i].bss_size + (state != nullptr ? BssSlack(layouts[i].bss_size) : 0);
+    }
+    for (std::vector<GlobalSymbol>& object_targets : targets) {
+        for (GlobalSymbol& target : object_targets) {
+            if (target.object == kLinkerObject) {
+                target.symbol.position = executable->bss_size;
+            }
+        }
+    }
 
-                executable->defined_symbols[name] = Symbol(symbol_pos, symbol.type);
+    /* Relaxation: widen the fields whose values do not fit until nothing changes. Fields only
+     * grow, so this ends after a few rounds at most. The objects are shards: each one's fields
+     * are computed on one thread from layouts that stay put during the round. */
+    std::vector<std::vector<int64_t>> values(objects.size());
+    for (bool changed = true; changed;) {
+        std::atomic<bool> widened{false};
+        Lay(&layouts, 0, state != nullptr);
+        ParallelFor(objects.size(), threads, [&](size_t i) {
+            values[i].resize(layouts[i].fields.size());
+            for (size_t f = 0; f < layouts[i].fields.size(); ++f) {
+                RelocatedField& field = layouts[i].fields[f];
+                if (!layouts[i].live[field.instruction]) {
+                    continue;
+                }
+                values[i][f] = SymbolValue(layouts, targets[i][f].object, targets[i][f].symbol);
+                if (ImmediateSizeFor(values[i][f]) > field.size) {
+                    field.size = ImmediateSizeFor(values[i][f]);
+                    widened = true;
+                }
             }
+        });
+        changed = widened;
+    }
+
+    for (SymbolPool::Id id = 0; id < globals.size(); ++id) {
+        const GlobalSymbol& global = globals[id];
+        if (global.object >= objects.size() || !IsSymbolLive(layouts, global.object, global.symbol)) {
+            continue;
         }
+        executable->defined_symbols[std::string(pool.Name(id))] = Symbol(SymbolValue(layouts, global.object, global.symbol),
+                                                                         global.symbol.type);
+    }
+    executable->defined_symbols[kBssSizeSymbol] = Symbol(executable->bss_size, Symbol::kSymbolVariable);
 
-        executable->bss_size += objects[i].bss_size;
+    /* Slack is filled with NOPs, so that code falling through into it goes on to the next object. */
+    int64_t code_end = objects.empty() ? 0 : layouts.back().offset + CodeUsed(layouts.back()) +
+                                             (state != nullptr ? CodeSlack(layouts.back().code_size) : 0);
+    executable->bytecode.assign(code_end, kOpcodeNOP);
+    std::vector<std::vector<int64_t>> positions(state != nullptr ? objects.size() : 0);
+    ParallelFor(objects.size(), threads, [&](size_t i) {
+        Emit(objects[i], layouts[i], values[i], &executable->bytecode, state != nullptr ? &positions[i] : nullptr);
+    });
+    MergeLineTables(objects, layouts, state != nullptr, &executable->line_table);
+    if (state != nullptr) {
+        RecordLinkState(layouts, targets, positions, pool, globals, state);
     }
-    executable->defined_symbols["__bss_size"] = Symbol(executable->bss_size, Symbol::kSymbolVariable);
 
-    executable->bytecode.resize(total_bytecode_size);
-    for (size_t i = 0; i < objects.size(); ++i) {
-        std::copy(objects[i].bytecode.begin(), objects[i].bytecode.end(), executable->bytecode.begin() + offsets[i]);
-        for (const auto& [pos, name]: objects[i].required_symbols) {
-            int64_t real_pos = pos + offsets[i];
-            int64_t real_value = 0;
-            auto iter = objects[i].defined_symbols.find(name);
-            if (iter != objects[i].defined_symbols.end()) {
-                real_value = iter->second.position;
-                switch (iter->second.type) {
-                    case Symbol::kSymbolFunction:
-                        real_value += offsets[i];
-                        break;
-                    case Symbol::kSymbolVariable:
-                        real_value += bss_offsets[i];
-                        break;
-                    default:
-                        break;
-                }
-            } else if ((iter = executable->defined_symbols.find(name)) != executable->defined_symbols.end()) {
-                real_value = iter->second.position;
-            } else {
-                *error = "Undefined symbol " + name;
-                return false;
+    return true;
+}
+
+/* Replaces the rows of the slot starting at the layout's offset with the object's. The slack after
+ * the object's code gets a row with no file, as MergeLineTables gives it. */
+static void SpliceLineRows(const Object& object, const ObjectLayout& layout, int64_t slot_end, int64_t code_end,
+                           LineTable* merged) {
+    auto by_position = [](const LineTable::Row& row, int64_t position) { return row.position < position; };
+    auto begin = std::lower_bound(merged->rows.begin(), merged->rows.end(), layout.offset, by_position);
+    auto end = std::lower_bound(begin, merged->rows.end(), slot_end, by_position);
+    int64_t used_end = layout.offset + CodeUsed(layout);
+    bool covered_after = used_end >= code_end || (end != merged->rows.end() && end->position == used_end);
+
+    std::vector<int32_t> files;
+    for (const std::string& file : object.line_table.files) {
+        auto known = std::find(merged->files.begin(), merged->files.end(), file);
+        files.push_back(known - merged->files.begin());
+        if (known == merged->files.end()) {
+            merged->files.push_back(file);
+        }
+    }
+    std::vector<LineTable::Row> rows;
+    const std::vector<LineTable::Row>& own = object.line_table.rows;
+    if (own.empty() || own[0].position > 0) {
+        rows.push_back(LineTable::Row{layout.offset, -1, 0});
+    }
+    for (const LineTable::Row& row : own) {
+        rows.push_back(LineTable::Row{Relocate(layout, row.position), row.file < 0 ? -1 : files[row.file], row.line});
+    }
+    if (!covered_after && rows.back().file >= 0) {
+        rows.push_back(LineTable::Row{used_end, -1, 0});
+    }
+    size_t first = begin - merged->rows.begin();
+    merged->rows.erase(begin, end);
+    merged->rows.insert(merged->rows.begin() + first, rows.begin(), rows.end());
+}
+
+bool TryRelink(const Object& object, size_t input, Object* executable, LinkState* state, std::string* error) {
+    if (input >= state->inputs.size()) {
+        *error = "No object #" + std::to_string(input) + " in the previous link";
+        return false;
+    }
+    if (!object.proc_version.CompatibleWith(executable->proc_version)) {
+        *error = "Object file #" + std::to_string(input) + " is not compatible with current processor version";
+        return false;
+    }
+    LinkState::Input& slot = state->inputs[input];
+    int64_t code_end = executable->bytecode.size();
+    if (slot.code_offset < 0 || slot.code_size < 0 || slot.code_offset > code_end - slot.code_size) {
+        *error = "The previous link does not match the executable";
+        return false;
+    }
+    std::vector<ObjectLayout> layouts(1);
+    ObjectLayout& layout = layouts[0];
+    if (!TryDecodeObject(object, input, &layout, error)) {
+        return false;
+    }
+
+    /* The other objects' symbols stay where they are, so their values are plain numbers here. */
+    std::unordered_map<std::string_view, const LinkState::Definition*> others;
+    for (const LinkState::Definition& definition : state->definitions) {
+        if (definition.input != input) {
+            others.emplace(definition.name, &definition);
+        }
+    }
+    /* Slots keep their places, so the end of the bss does not move. */
+    LinkState::Definition bss_size{kBssSizeSymbol, state->inputs.size(),
+                                   Symbol(executable->bss_size, Symbol::kSymbolVariable)};
+    others.emplace(bss_size.name, &bss_size);
+    constexpr size_t kOtherObject = 1;
+    std::vector<GlobalSymbol> targets;
+    targets.reserve(layout.fields.size());
+    for (const RelocatedField& field : layout.fields) {
+        auto own = object.defined_symbols.find(std::string(field.name));
+        auto other = others.find(field.name);
+        if (own != object.defined_symbols.end()) {
+            targets.push_back(GlobalSymbol{0, own->second});
+        } else if (other != others.end()) {
+            targets.push_back(GlobalSymbol{kOtherObject, Symbol(other->second->symbol.position, Symbol::kSymbolUndefined)});
+        } else {
+            *error = "Undefined symbol " + std::string(field.name);
+            return false;
+        }
+    }
+
+    for (const auto& [name, symbol] : object.defined_symbols) {
+        if (symbol.type == Symbol::kSymbolVariable) {
+            layout.variables[symbol.position] = symbol.position;
+        }
+    }
+    layout.bss_size = object.bss_size;
+    layout.bss_offset = slot.bss_offset;
+    if (layout.bss_size > slot.bss_size) {
+        *error = "Object file #" + std::to_string(input) + " outgrew the bss left for it";
+        return false;
+    }
+    std::vector<int64_t> values(layout.fields.size());
+    for (bool changed = true; changed;) {
+        changed = false;
+        Lay(&layouts, slot.code_offset, false);
+        for (size_t f = 0; f < layout.fields.size(); ++f) {
+            RelocatedField& field = layout.fields[f];
+            values[f] = targets[f].object == kOtherObject ? targets[f].symbol.position
+                                                          : SymbolValue(layouts, 0, targets[f].symbol);
+            if (ImmediateSizeFor(values[f]) > field.size) {
+                field.size = ImmediateSizeFor(values[f]);
+                changed = true;
             }
-            *reinterpret_cast<int64_t*>(&executable->bytecode[real_pos]) = real_value;
         }
     }
+    if (CodeUsed(layout) > slot.code_size) {
+        *error = "Object file #" + std::to_string(input) + " outgrew the code left for it";
+        return false;
+    }
 
+    std::unordered_map<std::string, Symbol> defined;
+    for (const auto& [name, symbol] : object.defined_symbols) {
+        if (name[0] == '.') {
+            continue;
+        }
+        if (others.count(name) != 0) {
+            *error = "Redefinition of symbol " + name;
+            return false;
+        }
+        defined.emplace(name, Symbol(SymbolValue(layouts, 0, symbol), symbol.type));
+    }
+    /* The other objects' fields keep their sizes; values that no longer fit take a full link. */
+    for (const LinkState::Relocation& relocation : state->relocations) {
+        if (relocation.position < 0 || relocation.position > code_end - relocation.size) {
+            *error = "The previous link does not match the executable";
+            return false;
+        }
+        if (relocation.input == input || others.count(relocation.symbol) != 0) {
+            continue;
+        }
+        auto definition = defined.find(relocation.symbol);
+        if (definition == defined.end()) {
+            *error = "Undefined symbol " + relocation.symbol;
+            return false;
+        }
+        if (ImmediateSizeFor(definition->second.position) > relocation.size) {
+            *error = "The new value of " + relocation.symbol + " does not fit its fields";
+            return false;
+        }
+    }
+
+    /* Nothing can fail from here on. */
+    int8_t* code = executable->bytecode.data();
+    std::fill(code + slot.code_offset, code + slot.code_offset + slot.code_size, kOpcodeNOP);
+    std::vector<int64_t> positions;
+    Emit(object, layout, values, &executable->bytecode, &positions);
+    for (const LinkState::Relocation& relocation : state->relocations) {
+        auto definition = defined.find(relocation.symbol);
+        if (relocation.input != input && definition != defined.end()) {
+            WriteImmediate(code + relocation.position, definition->second.position, relocation.size);
+        }
+    }
+    if (!executable->line_table.Empty()) {
+        SpliceLineRows(object, layout, slot.code_offset + slot.code_size, code_end, &executable->line_table);
+    }
+
+    auto is_input = [input](const auto& entry) { return entry.input == input; };
+    for (const LinkState::Definition& definition : state->definitions) {
+        if (definition.input == input) {
+            executable->defined_symbols.erase(definition.name);
+        }
+    }
+    state->definitions.erase(std::remove_if(state->definitions.begin(), state->definitions.end(), is_input),
+                             state->definitions.end());
+    for (const auto& [name, symbol] : defined) {
+        executable->defined_symbols[name] = symbol;
+        state->definitions.push_back(LinkState::Definition{name, input, symbol});
+    }
+    state->relocations.erase(std::remove_if(state->relocations.begin(), state->relocations.end(), is_input),
+                             state->relocations.end());
+    for (size_t f = 0; f < layout.fields.size(); ++f) {
+        if (targets[f].object == kOtherObject) {
+            state->relocations.push_back(LinkState::Relocation{input, positions[f], layout.fields[f].size,
+                                                               std::string(layout.fields[f].name)});
+        }
+    }
+    slot.code_used = CodeUsed(layout);
+    slot.bss_used = layout.bss_size;
     return true;
 }
@@ -1,45 +1,241 @@
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <object.h>
+#include <image.h>
 #include <vector>
 #include <fstream>
-#include <oosf/output_data_stream.h>
+#include <functional>
 #include <linker.h>
+#include <program_metadata.h>
 #include <instruction_set.h>
 
+static constexpr char kExecutablePath[] = "a.vexe";
+static constexpr char kLinkStatePath[] = "a.vexe.ldstate";
+
+/* Relinks the inputs that changed since the link recorded in `state`, if that link made a.vexe
+ * and every changed input still fits in its slot. */
+static bool TryLinkIncrementally(const std::vector<std::string>& inputs, const LinkState& state,
+                                 std::vector<uint64_t>* hashes, Object* executable, LinkState* relinked,
+                                 std::string* error) {
+    uint64_t executable_hash = 0;
+    if (!TryHashFile(kExecutablePath, &executable_hash) || executable_hash != state.executable_hash) {
+        *error = std::string(kExecutablePath) + " is not the result of the previous link";
+        return false;
+    }
+    if (!TryReadObjectFile(kExecutablePath, executable, error)) {
+        return false;
+    }
+    *relinked = state;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if ((*hashes)[i] == state.inputs[i].hash) {
+            continue;
+        }
+        Object object;
+        if (!TryReadObjectFile(inputs[i].c_str(), &object, error)) {
+            return false;
+        }
+        if (object.object_type != Object::kObjectStaticLinkable) {
+            *error = "file " + inputs[i] + " is not static linkable";
+            return false;
+        }
+        if (!TryRelink(object, i, executable, relinked, error)) {
+            *error = inputs[i] + ": " + *error;
+            return false;
+        }
+        relinked->inputs[i].hash = (*hashes)[i];
+    }
+    return true;
+}
+
+/* Writes next to `path` and renames over it. vm maps executables in place, so rewriting a running
+ * one would change its code under it or make it fault past a shrunken end. */
+static bool TryReplaceFile(const char* path, const std::function<void(std::ostream*)>& write) {
+    std::string temp_path = std::string(path) + ".tmp";
+    std::ofstream out(temp_path, std::ios_base::binary);
+    write(&out);
+    out.close();
+    if (!out.good() || std::rename(temp_path.c_str(), path) != 0) {
+        std::remove(temp_path.c_str());
+        std::fprintf(stderr, "ERROR cannot write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+/* Analyzes the executable and writes it, along with the link state for the next incremental link
+ * if there is one. */
+static int WriteExecutable(Object* executable, ObjectFormat format, LinkState* state) {
+    std::vector<int64_t> function_starts;
+    for (const auto& [name, symbol] : executable->defined_symbols) {
+        if (symbol.type == Symbol::kSymbolFunction) {
+            function_starts.push_back(symbol.position);
+        }
+    }
+    executable->metadata.emplace();
+    AnalyzeProgram(executable->bytecode, std::move(function_starts), &*executable->metadata);
+
+    if (!TryReplaceFile(kExecutablePath, [&](std::ostream* out) { WriteObject(*executable, format, out); })) {
+        return 1;
+    }
+    if (state == nullptr) {
+        return 0;
+    }
+
+    state->format = format;
+    if (!TryHashFile(kExecutablePath, &state->executable_hash)) {
+        std::fprintf(stderr, "ERROR cannot read %s back\n", kExecutablePath);
+        return 1;
+    }
+    return TryReplaceFile(kLinkStatePath, [state](std::ostream* out) { WriteLinkState(*state, out); }) ? 0 : 1;
+}
+
 int main(int argc, char* argv[]) {
+    ObjectFormat format = kObjectFormatImage;
+    LinkOptions options;
+    bool incremental = false;
+    int first_input = 1;
+    for (; first_input < argc && argv[first_input][0] == '-'; ++first_input) {
+        const char* option = argv[first_input];
+        if (std::strcmp(option, "-f") == 0 && first_input + 1 < argc) {
+            if (!TryParseObjectFormat(argv[++first_input], &format)) {
+                std::fprintf(stderr, "ERROR unknown object format %s (expected image or oosf)\n", argv[first_input]);
+                return 1;
+            }
+        } else if (std::strcmp(option, "-no-gc") == 0) {
+            options.collect_garbage = false;
+        } else if (std::strcmp(option, "-lto") == 0) {
+            options.lto = true;
+        } else if (std::strcmp(option, "-j") == 0 && first_input + 1 < argc) {
+            options.threads = std::atoi(argv[++first_input]);
+        } else if (std::strcmp(option, "-incremental") == 0) {
+            incremental = true;
+        } else {
+            std::fprintf(stderr, "ERROR unknown option %s (expected -f image|oosf, -no-gc, -lto, -j threads or "
+                                 "-incremental)\n", option);
+            return 1;
+        }
+    }
+
+    std::string error;
+    std::vector<std::unique_ptr<MappedArchive>> archives;
+    for (int i = first_input; i < argc; ++i) {
+        if (MappedArchive::IsArchiveFile(argv[i])) {
+            archives.push_back(std::make_unique<MappedArchive>());
+            if (!archives.back()->TryMap(argv[i], &error)) {
+                std::fprintf(stderr, "ERROR %s\n", error.c_str());
+                return 1;
+            }
+        }
+    }
+
+    if (incremental && !archives.empty()) {
+        std::fprintf(stderr, "WARNING archives are not linked incrementally, linking in full\n");
+        incremental = false;
+    }
+
+    /* Incremental links are of _start.vobj and the objects given, in that order, and relink only
+     * those whose contents changed since the last one. Anything the previous link cannot take
+     * in place leads to a full link. */
+    std::vector<std::string> inputs{"_start.vobj"};
+    std::vector<uint64_t> hashes;
+    LinkState state;
+    Object executable;
+    bool relinked = false;
+    if (incremental) {
+        for (int i = first_input; i < argc; ++i) {
+            inputs.emplace_back(argv[i]);
+        }
+        hashes.resize(inputs.size());
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (!TryHashFile(inputs[i].c_str(), &hashes[i])) {
+                std::fprintf(stderr, "ERROR cannot load %s\n", inputs[i].c_str());
+                return 1;
+            }
+        }
+        LinkState previous;
+        bool same_inputs = TryReadLinkState(kLinkStatePath, &previous, &error) && previous.format == format &&
+                           previous.inputs.size() == inputs.size() &&
+                           std::equal(inputs.begin(), inputs.end(), previous.inputs.begin(),
+                                      [](const std::string& path, const LinkState::Input& input) { return path == input.path; });
+        if (same_inputs) {
+            size_t changed = 0;
+            for (size_t i = 0; i < inputs.size(); ++i) {
+                changed += hashes[i] != previous.inputs[i].hash;
+            }
+            uint64_t executable_hash = 0;
+            if (changed == 0 && TryHashFile(kExecutablePath, &executable_hash) &&
+                executable_hash == previous.executable_hash) {
+                std::fprintf(stderr, "NOTE %s is up to date\n", kExecutablePath);
+                return 0;
+            }
+            relinked = TryLinkIncrementally(inputs, previous, &hashes, &executable, &state, &error);
+            if (!relinked) {
+                std::fprintf(stderr, "NOTE linking in full: %s\n", error.c_str());
+                executable = Object();
+                state = LinkState();
+            }
+        }
+    }
+    if (relinked) {
+        return WriteExecutable(&executable, format, &state);
+    }
+
+    /* The entry point comes first: from _start.vobj, or else from the archive member defining
+     * _start. */
     std::vector<Object> objects;
     if (!TryLoadObject(&objects, "_start.vobj")) {
-        std::fprintf(stderr, "FATAL ERROR cannot load _start.vobj\n");
-        return 1;
-    }
-    for (int i = 1; i < argc; ++i) {
-        if (!TryLoadObject(&objects, argv[i])) {
-            std::fprintf(stderr, "ERROR cannot load %s\n", argv[i]);
+        size_t member = 0;
+        auto archive = std::find_if(archives.begin(), archives.end(), [&member](const auto& archive) {
+            return archive->TryFindMember("_start", &member);
+        });
+        if (archive == archives.end()) {
+            std::fprintf(stderr, "FATAL ERROR cannot load _start.vobj and no archive defines _start\n");
+            return 1;
+        }
+        objects.emplace_back();
+        if (!(*archive)->TryReadMember(member, &objects.back(), &error)) {
+            std::fprintf(stderr, "FATAL ERROR %s\n", error.c_str());
             return 1;
         }
-        if (objects.back().object_type != Object::kObjectStaticLinkable) {
-            std::fprintf(stderr, "ERROR file %s is not static linkable\n", argv[i]);
+    }
+    std::vector<std::string> paths;
+    for (int i = first_input; i < argc; ++i) {
+        if (!MappedArchive::IsArchiveFile(argv[i])) {
+            paths.emplace_back(argv[i]);
+        }
+    }
+    size_t first_loaded = objects.size();
+    if (!TryLoadObjects(paths, options.threads, &objects, &error)) {
+        std::fprintf(stderr, "ERROR cannot load: %s\n", error.c_str());
+        return 1;
+    }
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (objects[first_loaded + i].object_type != Object::kObjectStaticLinkable) {
+            std::fprintf(stderr, "ERROR file %s is not static linkable\n", paths[i].c_str());
             return 1;
         }
     }
 
-    Object executable;
+    if (!TryPullArchiveMembers(archives, &objects, &error)) {
+        std::fprintf(stderr, "ERROR %s\n", error.c_str());
+        return 1;
+    }
+
     executable.proc_version.major = PROC_VERSION_MAJOR;
     executable.proc_version.minor = PROC_VERSION_MINOR;
     executable.proc_version.patch = PROC_VERSION_PATCH;
     executable.object_type = Object::kObjectExecutable;
 
-    std::string error;
-    if (!TryLink(objects, &executable, &error)) {
+    if (!TryLink(objects, options, &executable, &error, incremental ? &state : nullptr)) {
         std::fprintf(stderr, "ERROR %s\n", error.c_str());
         return 1;
     }
+    for (size_t i = 0; i < state.inputs.size(); ++i) {
+        state.inputs[i].path = inputs[i];
+        state.inputs[i].hash = hashes[i];
+    }
 
-    std::ofstream out("a.vexe", std::ios_base::binary);
-    OutputDataStream dstream(&out);
-    Object::RegisterIn(&dstream);
-    dstream.Write(executable);
-    out.close();
-
-    return 0;
+    return WriteExecutable(&executable, format, incremental ? &state : nullptr);
 }
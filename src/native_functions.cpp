@@ -0,0 +1,29 @@
+#include <native_functions.h>
+#include <array>
+
+static std::array<NativeFunction, kMaxNativeFunctions> native_functions;
+
+bool TryRegisterNativeFunction(int64_t id, const NativeFunction& function, std::string* error) {
+    if (id < 0 || id >= kMaxNativeFunctions) {
+        *error = "Native function id " + std::to_string(id) + " is out of range";
+        return false;
+    }
+    if (function.address == nullptr || function.invoke == nullptr ||
+        function.args_cnt < 0 || function.args_cnt > kMaxNativeArgs) {
+        *error = "Invalid native function";
+        return false;
+    }
+    if (native_functions[id].address != nullptr) {
+        *error = "Native function " + std::to_string(id) + " is already registered";
+        return false;
+    }
+    native_functions[id] = function;
+    return true;
+}
+
+const NativeFunction* FindNativeFunction(int64_t id) {
+    if (id < 0 || id >= kMaxNativeFunctions || native_functions[id].address == nullptr) {
+        return nullptr;
+    }
+    return &native_functions[id];
+}
@@ -1,6 +1,8 @@
 #include <object.h>
 #include <argument_descriptors.h>
+#include <program_metadata.h>
 #include <cstdio>
+#include <cstring>
 
 static inline const char* GetName(Symbol::SymbolType type) {
     switch (type) {
@@ -42,21 +44,38 @@ void PrintSymbols(const Object& obj) {
     std::printf("Total %lu symbols.\n", obj.defined_symbols.size());
 }
 
+static void PrintImmediate(const Object& obj, size_t* instruction_pointer, int size = sizeof(int64_t)) {
+    int64_t addr = ReadImmediate(&obj.bytecode[*instruction_pointer], size);
+    auto iter = obj.required_symbols.find(*instruction_pointer);
+    *instruction_pointer += size;
+    if (iter != obj.required_symbols.end()) {
+        std::printf("%s", iter->second.c_str());
+    } else {
+        /* As many digits as the field has, so compact immediates show their width. */
+        uint64_t mask = size == sizeof(int64_t) ? ~uint64_t(0) : (uint64_t(1) << (8 * size)) - 1;
+        std::printf("0x%0*lx", 2 * size, addr & mask);
+    }
+}
+
 void PrintArgument(int8_t arg_type, const Object& obj, size_t* instruction_pointer) {
     std::fputc(' ', stdout);
     switch (arg_type) {
         case ARG_POINTER:
             std::fputc(ASM_PREFIX_POINTER, stdout);
-        case ARG_VALUE: {
-                int64_t addr = *reinterpret_cast<const int64_t*>(&obj.bytecode[*instruction_pointer]);
-                auto iter = obj.required_symbols.find(*instruction_pointer);
-                *instruction_pointer += 8;
-                if (iter != obj.required_symbols.end()) {
-                    std::printf("%s", iter->second.c_str());
-                } else {
-                    std::printf("0x%016lx", addr);
-                }
-            } break;
+        case ARG_VALUE:
+            PrintImmediate(obj, instruction_pointer);
+            break;
+        case ARG_POINTER_8:
+        case ARG_POINTER_16:
+        case ARG_POINTER_32:
+            std::fputc(ASM_PREFIX_POINTER, stdout);
+            PrintImmediate(obj, instruction_pointer, ImmediateSize(arg_type));
+            break;
+        case ARG_VALUE_8:
+        case ARG_VALUE_16:
+        case ARG_VALUE_32:
+            PrintImmediate(obj, instruction_pointer, ImmediateSize(arg_type));
+            break;
         case ARG_REGISTER:
             std::printf("%c%hhu", ASM_PREFIX_REGISTER, obj.bytecode[*instruction_pointer]);
             *instruction_pointer += 1;
@@ -65,10 +84,47 @@ void PrintArgument(int8_t arg_type, const Object& obj, size_t* instruction_point
             std::printf("%c%hhu", ASM_PREFIX_REGISTER_POINTER, obj.bytecode[*instruction_pointer]);
             *instruction_pointer += 1;
             break;
+        case ARG_BASE_OFFSET:
+            std::printf("%c%hhu+", ASM_PREFIX_REGISTER_POINTER, obj.bytecode[*instruction_pointer]);
+            *instruction_pointer += 1;
+            PrintImmediate(obj, instruction_pointer);
+            break;
+        case ARG_BASE_INDEX:
+            std::printf("%c%hhu+%c%hhu", ASM_PREFIX_REGISTER_POINTER, obj.bytecode[*instruction_pointer],
+                        ASM_PREFIX_REGISTER, obj.bytecode[*instruction_pointer + 1]);
+            *instruction_pointer += 2;
+            break;
+        case ARG_FRAME: {
+            uint16_t slot = 0;
+            std::memcpy(&slot, &obj.bytecode[*instruction_pointer], sizeof(slot));
+            std::printf("%c%hu", ASM_PREFIX_FRAME, slot);
+            *instruction_pointer += sizeof(slot);
+            break;
+        }
+        default:
+            std::printf("???");
+            break;
+    }
+}
+
+void PrintMetadata(const ProgramMetadata& metadata, bool stored) {
+    std::printf("Metadata (%s): %lu instructions, %lu blocks, %lu functions, registers used 0x%02x\n",
+                stored ? "stored" : "computed", metadata.instruction_starts.size(), metadata.blocks.size(),
+                metadata.functions.size(), metadata.used_registers);
+    if (metadata.invalid_at >= 0) {
+        std::printf("Bytecode does not decode from 0x%lx on\n", metadata.invalid_at);
     }
 }
 
-void PrintListing(const Object& obj) {
+/* Ends an instruction's line with where it came from. */
+static void PrintSourceLine(const LineTable& lines, int64_t position) {
+    if (const LineTable::Row* row = lines.Find(position)) {
+        std::printf("    ; %s:%d", lines.files[row->file].c_str(), row->line);
+    }
+    std::fputc('\n', stdout);
+}
+
+void PrintListing(const Object& obj, const ProgramMetadata& metadata) {
     std::printf("Listing:\n\n");
 
     std::unordered_map<int64_t, std::string_view> functions;
@@ -79,23 +135,35 @@ void PrintListing(const Object& obj) {
     }
 
     size_t instruction_pointer = 0;
+    size_t block = 0;
     while (instruction_pointer < obj.bytecode.size()) {
         auto iter = functions.find(instruction_pointer);
         if (iter != functions.end()) {
             std::printf("%*s FUNC %.*s\n", 16, "", static_cast<int>(iter->second.size()), iter->second.data());
         }
+        while (block < metadata.blocks.size() && metadata.blocks[block].start < static_cast<int64_t>(instruction_pointer)) {
+            ++block;
+        }
+        if (block < metadata.blocks.size() && metadata.blocks[block].start == static_cast<int64_t>(instruction_pointer)) {
+            const BasicBlock& info = metadata.blocks[block];
+            std::printf("%*s ; block to 0x%lx, stack %+d (lowest %d)%s\n", 16, "", info.end, info.stack_delta,
+                        info.stack_min, info.jump_target ? ", jump target" : "");
+        }
         std::printf("%016lx:", instruction_pointer);
+        int64_t instruction_start = instruction_pointer;
         int8_t cur_opcode = obj.bytecode[instruction_pointer++];
 
 #define DEF_CMD(name, opcode, argcnt, ...) case opcode: {                                   \
     std::printf("    %s", #name );                                                          \
     if (argcnt > 0) {                                                                       \
-        int8_t argument_descriptor = obj.bytecode[instruction_pointer++];                   \
+        ArgDescriptor argument_descriptor = 0;                                              \
+        std::memcpy(&argument_descriptor, &obj.bytecode[instruction_pointer], sizeof(ArgDescriptor)); \
+        instruction_pointer += sizeof(ArgDescriptor);                                       \
         for (int i = 0; i < argcnt; ++i) {                                                  \
             PrintArgument(GetArgType(argument_descriptor, i), obj, &instruction_pointer);   \
         }                                                                                   \
     }                                                                                       \
-    std::fputc('\n', stdout);                                                               \
+    PrintSourceLine(obj.line_table, instruction_start);                                     \
 } break;
         switch (cur_opcode) {
             #include <instruction_set.h>
@@ -113,6 +181,19 @@ void PrintObject(const Object& obj) {
     PrintProcInfo(obj);
     PrintObjectType(obj);
     PrintSymbols(obj);
-    PrintListing(obj);
+
+    ProgramMetadata computed;
+    if (!obj.metadata) {
+        std::vector<int64_t> function_starts;
+        for (const auto&[name, symbol] : obj.defined_symbols) {
+            if (symbol.type == Symbol::kSymbolFunction) {
+                function_starts.push_back(symbol.position);
+            }
+        }
+        AnalyzeProgram(obj.bytecode, std::move(function_starts), &computed);
+    }
+    const ProgramMetadata& metadata = obj.metadata ? *obj.metadata : computed;
+    PrintMetadata(metadata, obj.metadata.has_value());
+    PrintListing(obj, metadata);
 }
 
@@ -1,5 +1,5 @@
 #include <object.h>
-#include <oosf/input_data_stream.h>
+#include <image.h>
 #include <cstdio>
 #include <objdump.h>
 
@@ -11,17 +11,13 @@ int main(int argc, char* argv[]) {
         if (argc > 2) {
             std::printf("File %s\n", argv[i]);
         }
-        std::FILE* file = std::fopen(argv[i], "rb");
         Object obj;
-        InputDataStream dstream(file);
-        Object::RegisterIn(&dstream);
-        if (dstream.TryRead(&obj) == kStatusOk) {
+        std::string error;
+        if (TryReadObjectFile(argv[i], &obj, &error)) {
             PrintObject(obj);
         } else {
-            std::printf("Failed to parse %s\n", argv[i]);
+            std::printf("Failed to parse %s: %s\n", argv[i], error.c_str());
         }
-
-        std::fclose(file);
     }
     return 0;
 }
@@ -1,7 +1,11 @@
 #include <processor.h>
 #include <algorithm>
 #include <argument_descriptors.h>
+#include <vector_kernels.h>
+#include <native_functions.h>
 #include <cmath>
+#include <cstring>
+#include <limits>
 #include <map>
 #include <string_view>
 
@@ -9,8 +13,34 @@ const Object::ProcVersion& Processor::GetVersion() const {
     return version_;
 }
 
+void Processor::SetIO(InputStream* input, OutputStream* output) {
+    input_ = input;
+    output_ = output;
+}
+
+void Processor::Reset() {
+    registers_.fill(0);
+    data_stack_.clear();
+    call_stack_.clear();
+    frame_stack_.clear();
+    instruction_pointer_ = 0;
+    status_ = kExecStatusOk;
+    io_mutex_ = nullptr;
+    heap_.Reset();
+}
+
+/* A compact immediate of `size` bytes, sign-extended. */
+static inline Processor::ExecutionStatus TryGetImmediate(BytecodeView bytecode, uint64_t* ip, int64_t* dest, int size) {
+    if ((*ip + size) > bytecode.size()) {
+        return Processor::kExecStatusIPOutOfRange;
+    }
+    *dest = ReadImmediate(&bytecode[*ip], size);
+    *ip += size;
+    return Processor::kExecStatusOk;
+}
+
 template <class T>
-static inline Processor::ExecutionStatus TryGet(const std::vector<int8_t>& bytecode, uint64_t* ip, T* dest) {
+static inline Processor::ExecutionStatus TryGet(BytecodeView bytecode, uint64_t* ip, T* dest) {
     if ((*ip + sizeof(T)) > bytecode.size()) {
         return Processor::kExecStatusIPOutOfRange;
     }
@@ -19,19 +49,52 @@ static inline Processor::ExecutionStatus TryGet(const std::vector<int8_t>& bytec
     return Processor::kExecStatusOk;
 }
 
+bool Processor::HasFrame() const {
+    return !frame_stack_.empty() &&
+           frame_stack_[frame_stack_.size() - 2] == static_cast<int64_t>(call_stack_.size());
+}
+
+void Processor::LeaveFrame() {
+    frame_stack_.resize(frame_stack_.size() - 2 - frame_stack_.back());
+}
 
-bool Processor::FillArgs(const std::vector<int8_t>& bytecode, int64_t** args, int64_t* arg_stubs, RAM* ram, int argcnt, uint64_t* ip) {
+bool Processor::TryNativeCall(int64_t id) {
+    const NativeFunction* function = FindNativeFunction(id);
+    if (function == nullptr) {
+        status_ = kExecStatusInvalidNativeCall;
+        return false;
+    }
+    if (data_stack_.size() < static_cast<size_t>(function->args_cnt)) {
+        status_ = kExecStatusEmptyDataStack;
+        return false;
+    }
+    if (function->has_result && function->args_cnt == 0 && data_stack_.size() == kDataStackMaxSize) {
+        status_ = kExecStatusDataStackOverflow;
+        return false;
+    }
+    int64_t result = function->invoke(function->address, data_stack_.data() + data_stack_.size() - function->args_cnt);
+    data_stack_.resize(data_stack_.size() - function->args_cnt);
+    if (function->has_result) {
+        data_stack_.push_back(result);
+    }
+    return true;
+}
+
+bool Processor::FillArgs(BytecodeView bytecode, int64_t** args, int64_t* arg_stubs, RAM* ram, int argcnt, uint64_t* ip) {
 #define TRY_GET(...) if ((status_ = TryGet(__VA_ARGS__)) != kExecStatusOk) { return false; }
+#define TRY_GET_IMMEDIATE(...) if ((status_ = TryGetImmediate(__VA_ARGS__)) != kExecStatusOk) { return false; }
     if (argcnt == 0) {
         return true;
     }
-    int8_t arg_descriptor = 0;
+    ArgDescriptor arg_descriptor = 0;
     if ((status_ = TryGet(bytecode, ip, &arg_descriptor)) != kExecStatusOk) {
         return false;
     }
     for (int i = 0; i < argcnt; ++i) {
         int8_t arg_type = GetArgType(arg_descriptor, i);
         uint8_t reg_buffer = 0;
+        uint8_t index_buffer = 0;
+        uint16_t slot_buffer = 0;
         bool ram_ok = true;
 
         switch (arg_type) {
@@ -39,6 +102,22 @@ bool Processor::FillArgs(const std::vector<int8_t>& bytecode, int64_t** args, in
                 TRY_GET(bytecode, ip, arg_stubs + i);
                 args[i] = arg_stubs + i;
                 break;
+            case ARG_VALUE_8:
+            case ARG_VALUE_16:
+            case ARG_VALUE_32:
+                TRY_GET_IMMEDIATE(bytecode, ip, arg_stubs + i, ImmediateSize(arg_type));
+                args[i] = arg_stubs + i;
+                break;
+            case ARG_POINTER_8:
+            case ARG_POINTER_16:
+            case ARG_POINTER_32:
+                TRY_GET_IMMEDIATE(bytecode, ip, arg_stubs + i, ImmediateSize(arg_type));
+                args[i] = ram->At(arg_stubs[i], &ram_ok);
+                if (!ram_ok) {
+                    status_ = kExecStatusAddressOutOfRange;
+                    return false;
+                }
+                break;
             case ARG_POINTER:
                 TRY_GET(bytecode, ip, arg_stubs + i);
                 args[i] = ram->At(arg_stubs[i], &ram_ok);
@@ -67,26 +146,124 @@ bool Processor::FillArgs(const std::vector<int8_t>& bytecode, int64_t** args, in
                     return false;
                 }
                 break;
+            case ARG_BASE_OFFSET:
+            case ARG_BASE_INDEX:
+                TRY_GET(bytecode, ip, &reg_buffer);
+                if (arg_type == ARG_BASE_OFFSET) {
+                    TRY_GET(bytecode, ip, arg_stubs + i);
+                } else {
+                    TRY_GET(bytecode, ip, &index_buffer);
+                }
+                if (reg_buffer >= registers_.size() || index_buffer >= registers_.size()) {
+                    status_ = kExecStatusRegisterOutOfRange;
+                    return false;
+                }
+                args[i] = ram->At(registers_[reg_buffer] +
+                                  (arg_type == ARG_BASE_OFFSET ? arg_stubs[i] : registers_[index_buffer]), &ram_ok);
+                if (!ram_ok) {
+                    status_ = kExecStatusAddressOutOfRange;
+                    return false;
+                }
+                break;
+            case ARG_FRAME:
+                TRY_GET(bytecode, ip, &slot_buffer);
+                if (!HasFrame() || slot_buffer >= frame_stack_.back()) {
+                    status_ = kExecStatusAddressOutOfRange;
+                    return false;
+                }
+                args[i] = &frame_stack_[frame_stack_.size() - 2 - frame_stack_.back() + slot_buffer];
+                break;
+            default:
+                status_ = kExecStatusInvalidOpcode;
+                return false;
         }
     }
     return true;
 #undef TRY_GET
+#undef TRY_GET_IMMEDIATE
 }
 
-bool Processor::Execute(const std::vector<int8_t>& bytecode, RAM* ram) {
+/* The heap grows the RAM it carves from, up to RAM's hard limit. */
+class RAMHeapMemory : public HeapMemory {
+public:
+    explicit RAMHeapMemory(RAM* ram) : ram_(ram) {
+    }
+    int64_t* Word(int64_t idx) override {
+        bool ok = true;
+        int64_t* word = ram_->At(idx, &ok);
+        return ok ? word : nullptr;
+    }
+    bool Reserve(int64_t end) override {
+        return ram_->Grow(end - 1);
+    }
+
+private:
+    RAM* ram_;
+};
+
+/* Calls visit(a_piece, b_piece, len) over [a, a + cnt) and [b, b + cnt) split at chunk borders,
+ * once both ranges are known to be in RAM. */
+template <class Visitor>
+static bool ForEachPiece(RAM* ram, int64_t a, int64_t b, int64_t cnt, Visitor visit) {
+    if (cnt < 0 || a < 0 || b < 0 || std::max(a, b) > std::numeric_limits<int64_t>::max() - cnt) {
+        return false;
+    }
+    if (cnt > 0) {
+        bool a_ok = true;
+        bool b_ok = true;
+        ram->At(a + cnt - 1, &a_ok);
+        ram->At(b + cnt - 1, &b_ok);
+        if (!a_ok || !b_ok) {
+            return false;
+        }
+    }
+    bool ok = true;
+    while (cnt > 0) {
+        int64_t len = cnt;
+        int64_t* a_piece = ram->Span(a, &len, &ok);
+        int64_t* b_piece = ram->Span(b, &len, &ok);
+        visit(a_piece, b_piece, len);
+        a += len;
+        b += len;
+        cnt -= len;
+    }
+    return true;
+}
+
+/* MEMCPY has memmove semantics. Copying piece by piece is only wrong when dst overlaps the tail of
+ * src, and then the source goes through a buffer. */
+static bool BulkCopy(RAM* ram, int64_t dst, int64_t src, int64_t cnt) {
+    if (src < dst && dst - src < cnt) {
+        std::vector<int64_t> buffer(cnt);
+        int64_t* out = buffer.data();
+        const int64_t* in = buffer.data();
+        return ForEachPiece(ram, src, src, cnt, [&out](int64_t* piece, int64_t*, int64_t len) {
+            out = std::copy(piece, piece + len, out);
+        }) && ForEachPiece(ram, dst, dst, cnt, [&in](int64_t* piece, int64_t*, int64_t len) {
+            std::copy(in, in + len, piece);
+            in += len;
+        });
+    }
+    return ForEachPiece(ram, dst, src, cnt, [](int64_t* dst_piece, int64_t* src_piece, int64_t len) {
+        std::memmove(dst_piece, src_piece, len * sizeof(int64_t));
+    });
+}
+
+bool Processor::Execute(BytecodeView bytecode, RAM* ram) {
 
 #define FROM_STACK(idx)         from_stack[(idx)]
 #define TO_STACK(idx)           to_stack[(idx)]
 #define LOAD_ARG(idx, dest)     dest = *args[(idx)]
 #define STORE_ARG(idx, src)     *args[(idx)] = src
 #define AS_DOUBLE(expr)         (*reinterpret_cast<double*>(&(expr)))
-#define READ_INT(dest)          std::scanf("%ld",  &(dest))
-#define WRITE_INT(src)          std::printf("%ld\n", (src))
-#define READ_DOUBLE(dest)       std::scanf("%lf",  &(dest))
-#define WRITE_DOUBLE(src)       std::printf("%lf\n", (src))
+#define READ_INT(dest)          { OptionalLock lock(io_mutex_); input_->ReadInt(&(dest)); }
+#define WRITE_INT(src)          { OptionalLock lock(io_mutex_); output_->WriteInt(src); }
+#define READ_DOUBLE(dest)       { OptionalLock lock(io_mutex_); input_->ReadDouble(&(dest)); }
+#define WRITE_DOUBLE(src)       { OptionalLock lock(io_mutex_); output_->WriteDouble(src); }
 #define JUMP_TO(expr)           instruction_pointer_copy = (expr)
 #define STOP_PROCESSOR          { status_ = kExecStatusOk; return true; }
-#define PRINT_DUMP()            Dump()
+#define PRINT_DUMP()            { OptionalLock lock(io_mutex_); Dump(); }
+#define SUSPEND_FOR_CHECKPOINT() { instruction_pointer_ = instruction_pointer_copy; status_ = kExecStatusCheckpoint; return true; }
 
 #define SAVE_ADDR()                                 \
 if (call_stack_.size() == kCallStackMaxSize) {      \
@@ -98,13 +275,85 @@ call_stack_.push_back(instruction_pointer_copy);
 #define RESTORE_ADDR()                              \
 if (call_stack_.empty()) {                          \
     status_ = kExecStatusEmptyCallStack;            \
-    return false;                                   \
+    return is_thread_;                              \
+}                                                   \
+while (HasFrame()) {                                \
+    LeaveFrame();                                   \
 }                                                   \
 instruction_pointer_copy = call_stack_.back();      \
 call_stack_.pop_back();
 
+#define ENTER_FRAME(size)                                                           \
+if ((size) < 0 || (size) > kFrameStackMaxSize - 2 - static_cast<int64_t>(frame_stack_.size())) { \
+    status_ = kExecStatusCallStackOverflow;                                         \
+    return false;                                                                   \
+}                                                                                   \
+frame_stack_.resize(frame_stack_.size() + (size), 0);                               \
+frame_stack_.push_back(call_stack_.size());                                         \
+frame_stack_.push_back(size);
+
+#define LEAVE_FRAME()                               \
+if (!HasFrame()) {                                  \
+    status_ = kExecStatusNoFrame;                   \
+    return false;                                   \
+}                                                   \
+LeaveFrame();
+
+#define NATIVE_CALL(id)         if (!TryNativeCall(id)) { return false; }
+
+#define HEAP_OR_FAIL(expr) {                                                \
+    RAMHeapMemory memory(ram);                                              \
+    if (!(expr)) {                                                          \
+        status_ = kExecStatusInvalidHeapPointer;                            \
+        return false;                                                       \
+    }                                                                       \
+}
+#define HEAP_ALLOC(words, ptr)          HEAP_OR_FAIL(heap_.TryAlloc(&memory, (words), &(ptr)))
+#define HEAP_FREE(ptr)                  HEAP_OR_FAIL(heap_.TryFree(&memory, (ptr)))
+#define HEAP_REALLOC(ptr, words, new_ptr) HEAP_OR_FAIL(heap_.TryRealloc(&memory, (ptr), (words), &(new_ptr)))
+
 #define ERROR_DIV_ZERO { status_ = kExecStatusDivZero; return false; }
 
+#define SPAWN_THREAD(entry, arg, handle)                                        \
+    if (!TrySpawn(bytecode, ram, (entry), (arg), &(handle))) {                  \
+        return false;                                                           \
+    }
+#define JOIN_THREAD(handle, result)                                             \
+    if (threads_ == nullptr || !threads_->Join((handle), &(result))) {          \
+        status_ = kExecStatusInvalidThread;                                     \
+        return false;                                                           \
+    }
+#define ATOMIC_COMPARE_EXCHANGE(idx, expected, desired) \
+    __atomic_compare_exchange_n(args[(idx)], &(expected), (desired), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#define ATOMIC_FETCH_ADD(idx, value)    __atomic_fetch_add(args[(idx)], (value), __ATOMIC_SEQ_CST)
+#define ATOMIC_EXCHANGE(idx, value)     __atomic_exchange_n(args[(idx)], (value), __ATOMIC_SEQ_CST)
+#define MEMORY_FENCE()                  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#define BULK_OR_FAIL(expr) if (!(expr)) { status_ = kExecStatusAddressOutOfRange; return false; }
+#define BULK_COPY(dst, src, cnt)            BULK_OR_FAIL(BulkCopy(ram, (dst), (src), (cnt)))
+#define BULK_FILL(dst, value, cnt)                                                          \
+    BULK_OR_FAIL(ForEachPiece(ram, (dst), (dst), (cnt), [&](int64_t* piece, int64_t*, int64_t len) { \
+        VectorFill(piece, (value), len);                                                    \
+    }))
+#define BULK_UPDATE(type, kernel, dst, src, cnt)                                            \
+    BULK_OR_FAIL(ForEachPiece(ram, (dst), (src), (cnt), [](int64_t* dst_piece, int64_t* src_piece, int64_t len) { \
+        kernel(reinterpret_cast<type*>(dst_piece), reinterpret_cast<const type*>(src_piece), len); \
+    }))
+#define BULK_SUM(type, src, cnt, result) {                                                  \
+    VectorLanes<type> sum;                                                                  \
+    BULK_OR_FAIL(ForEachPiece(ram, (src), (src), (cnt), [&sum](int64_t* piece, int64_t*, int64_t len) { \
+        VectorSum(reinterpret_cast<const type*>(piece), len, &sum);                         \
+    }));                                                                                    \
+    *reinterpret_cast<type*>(&(result)) = sum.Total();                                      \
+}
+#define BULK_DOT(type, a, b, cnt, result) {                                                 \
+    VectorLanes<type> sum;                                                                  \
+    BULK_OR_FAIL(ForEachPiece(ram, (a), (b), (cnt), [&sum](int64_t* a_piece, int64_t* b_piece, int64_t len) { \
+        VectorDot(reinterpret_cast<const type*>(a_piece), reinterpret_cast<const type*>(b_piece), len, &sum); \
+    }));                                                                                    \
+    *reinterpret_cast<type*>(&(result)) = sum.Total();                                      \
+}
+
 
 #define DEF_CMD(name, code, argcnt, from_stack_cnt, to_stack_cnt, handler, ...)             \
 case code: {                                                                                \
@@ -131,7 +380,18 @@ case code: {
 }
 
 
+    status_ = kExecStatusOk;
+    int64_t fuel = fuel_per_run_ > 0 ? fuel_per_run_ : std::numeric_limits<int64_t>::max();
     while (true) {
+        if (--fuel < 0) {
+            status_ = kExecStatusOutOfFuel;
+            return true;
+        }
+        if (checkpoint_requested && !is_thread_) {
+            checkpoint_requested = 0;
+            status_ = kExecStatusCheckpoint;
+            return true;
+        }
         uint64_t instruction_pointer_copy = instruction_pointer_;
 
         int8_t opcode = bytecode[instruction_pointer_copy++];
@@ -146,14 +406,101 @@ case code: {
 #undef DEF_CMD
 }
 
+Processor::ExecutionStatus Processor::GetStatus() const {
+    return status_;
+}
+
+void Processor::SetThreads(GuestThreads* threads) {
+    threads_ = threads;
+}
+
+void Processor::SetHeapBase(int64_t base) {
+    heap_.SetBase(base);
+}
+
+void Processor::FlushHeap(RAM* ram) {
+    RAMHeapMemory memory(ram);
+    heap_.Flush(&memory);
+}
+
+/* The new thread runs its own Processor over the same bytecode and RAM. Guest I/O is serialized
+ * from now on, in the spawning thread too. */
+bool Processor::TrySpawn(BytecodeView bytecode, RAM* ram, uint64_t entry, int64_t arg, int64_t* handle) {
+    if (threads_ == nullptr) {
+        status_ = kExecStatusInvalidThread;
+        return false;
+    }
+    if (entry >= bytecode.size()) {
+        status_ = kExecStatusIPOutOfRange;
+        return false;
+    }
+    io_mutex_ = threads_->IOMutex();
+    heap_.SetMutex(threads_->HeapMutex());
+
+    auto thread = std::make_shared<Processor>();
+    thread->registers_ = registers_;
+    thread->data_stack_.push_back(arg);
+    thread->instruction_pointer_ = entry;
+    thread->fuel_per_run_ = fuel_per_run_;
+    thread->threads_ = threads_;
+    thread->io_mutex_ = io_mutex_;
+    thread->heap_ = heap_;
+    thread->heap_.Reset();
+    thread->heap_.SetMutex(threads_->HeapMutex());
+    thread->is_thread_ = true;
+    thread->SetIO(input_, output_);
+
+    *handle = threads_->Spawn([thread, bytecode, ram](int64_t* result) {
+        bool ok = thread->Execute(bytecode, ram);
+        while (ok && thread->status_ != kExecStatusOk && thread->status_ != kExecStatusEmptyCallStack) {
+            ok = thread->Execute(bytecode, ram);
+        }
+        thread->FlushHeap(ram);
+        if (!ok) {
+            OptionalLock lock(thread->io_mutex_);
+            thread->Dump();
+        }
+        *result = thread->data_stack_.empty() ? 0 : thread->data_stack_.back();
+        return ok;
+    });
+    return true;
+}
+
+void Processor::SetFuel(int64_t fuel) {
+    fuel_per_run_ = fuel;
+}
+
+void Processor::SaveState(Snapshot* snapshot) const {
+    snapshot->instruction_pointer = instruction_pointer_;
+    snapshot->registers = registers_;
+    snapshot->data_stack = data_stack_;
+    snapshot->call_stack = call_stack_;
+    snapshot->frame_stack = frame_stack_;
+}
+
+bool Processor::TryRestoreState(const Snapshot& snapshot) {
+    std::vector<SnapshotFrame> frames;
+    if (snapshot.data_stack.size() > kDataStackMaxSize || snapshot.call_stack.size() > kCallStackMaxSize ||
+        snapshot.frame_stack.size() > kFrameStackMaxSize || !TryParseFrames(snapshot, &frames)) {
+        return false;
+    }
+    instruction_pointer_ = snapshot.instruction_pointer;
+    registers_ = snapshot.registers;
+    data_stack_ = snapshot.data_stack;
+    call_stack_ = snapshot.call_stack;
+    frame_stack_ = snapshot.frame_stack;
+    status_ = kExecStatusOk;
+    return true;
+}
+
 static constexpr int kRegsInRow = 4;
 
-static void PrintTable(const int64_t* data, int size, int items_in_row) {
+static void PrintTable(OutputStream* out, const int64_t* data, int size, int items_in_row) {
     for (int i = 0; i < size; ++i) {
         if (i % items_in_row == 0) {
-            std::printf("\n%04X: ", i);
+            out->Printf("\n%04X: ", i);
         }
-        std::printf("0x%016lX ", data[i]);
+        out->Printf("0x%016lX ", data[i]);
     }
 }
 
@@ -179,6 +526,18 @@ static inline const char* GetProcessorStatusDescription(Processor::ExecutionStat
             return "Invalid register number";
         case Processor::kExecStatusDivZero:
             return "Division by zero";
+        case Processor::kExecStatusCheckpoint:
+            return "Suspended at checkpoint";
+        case Processor::kExecStatusOutOfFuel:
+            return "Out of fuel";
+        case Processor::kExecStatusInvalidThread:
+            return "Invalid thread handle or failed thread";
+        case Processor::kExecStatusNoFrame:
+            return "LEAVE without a frame";
+        case Processor::kExecStatusInvalidNativeCall:
+            return "Unknown native function";
+        case Processor::kExecStatusInvalidHeapPointer:
+            return "Invalid heap pointer or corrupted heap";
         default:
             return "???";
 
@@ -186,35 +545,42 @@ static inline const char* GetProcessorStatusDescription(Processor::ExecutionStat
 }
 
 void Processor::Dump() const {
-    std::printf("Processor status: 0x%02x (%s)\n", status_, GetProcessorStatusDescription(status_));
-    std::printf("Regiters:");
-    PrintTable(registers_.data(), registers_.size(), kRegsInRow);
-    std::printf("\n");
+    output_->Printf("Processor status: 0x%02x (%s)\n", status_, GetProcessorStatusDescription(status_));
+    output_->Printf("Regiters:");
+    PrintTable(output_, registers_.data(), registers_.size(), kRegsInRow);
+    output_->Printf("\n");
 }
 
-void PrintCallStackLine(const std::map<int64_t, std::string_view>& functions, int64_t addr, int depth) {
-    std::printf("\n%04d: 0x%016lX", depth, addr);
+/* Return addresses are looked up one byte back, so that a caller's line is the one of its CALL. */
+static void PrintCallStackLine(OutputStream* out, const Executable& executable, int64_t addr, bool is_return_address,
+                               int depth) {
+    const auto& functions = executable.GetFunctions();
+    out->Printf("\n%04d: 0x%016lX", depth, addr);
     auto func_table_iter = functions.upper_bound(addr);
     if (func_table_iter != functions.begin()) {
         --func_table_iter;
-        std::printf(" <%.*s+0x%lX>", static_cast<int>(func_table_iter->second.length()),
+        out->Printf(" <%.*s+0x%lX>", static_cast<int>(func_table_iter->second.length()),
                     func_table_iter->second.data(), addr - func_table_iter->first);
     }
-}
-
-void Processor::PrintStackTrace(const Object& obj) const {
-    std::printf("Stack trace:");
-    std::map<int64_t, std::string_view> functions;
-    for (const auto& [name, symbol] : obj.defined_symbols) {
-        if (symbol.type == Symbol::kSymbolFunction) {
-            functions[symbol.position] = name;
-        }
+    const LineTable& lines = executable.GetLineTable();
+    if (const LineTable::Row* row = lines.Find(is_return_address ? addr - 1 : addr)) {
+        const std::string& file = lines.files[row->file];
+        out->Printf(" at %.*s:%d", static_cast<int>(file.length()), file.data(), row->line);
     }
+}
 
+void PrintStackTrace(OutputStream* out, const Executable& executable, int64_t ip, const std::vector<int64_t>& call_stack) {
+    out->Printf("Stack trace:");
     int pointer_index = 0;
-    PrintCallStackLine(functions, instruction_pointer_, pointer_index++);
-    for (auto iter = call_stack_.rbegin(); iter != call_stack_.rend(); ++iter) {
-        PrintCallStackLine(functions, *iter, pointer_index++);
+    if (ip >= 0) {
+        PrintCallStackLine(out, executable, ip, false, pointer_index++);
     }
-    std::printf("\n");
+    for (auto iter = call_stack.rbegin(); iter != call_stack.rend(); ++iter) {
+        PrintCallStackLine(out, executable, *iter, true, pointer_index++);
+    }
+    out->Printf("\n");
+}
+
+void Processor::PrintStackTrace(const Executable& executable) const {
+    ::PrintStackTrace(output_, executable, instruction_pointer_, call_stack_);
 }
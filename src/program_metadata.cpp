@@ -0,0 +1,154 @@
+#include <program_metadata.h>
+#include <instruction_decoder.h>
+#include <algorithm>
+
+enum Opcode : int8_t {
+#define DEF_CMD(name, code, ...) kOpcode##name = code,
+#include <instruction_set.h>
+#undef DEF_CMD
+};
+
+/* What the block analysis needs to keep of an instruction. */
+struct InstructionSummary {
+    int64_t start = 0;
+    int8_t opcode = 0;
+    int8_t from_stack_cnt = 0;
+    int8_t to_stack_cnt = 0;
+};
+
+/* Which operand names the destination, -1 for instructions that do not transfer control. */
+static int TargetOperand(int8_t opcode) {
+    switch (opcode) {
+        case kOpcodeJMP:
+        case kOpcodeJEQ:
+        case kOpcodeJGT:
+        case kOpcodeJLT:
+        case kOpcodeJNE:
+        case kOpcodeJGE:
+        case kOpcodeJLE:
+        case kOpcodeCALL:
+        case kOpcodeSPAWN:
+            return 0;
+        case kOpcodeDECJNZ:
+            return 1;
+        case kOpcodeBEQ:
+        case kOpcodeBNE:
+        case kOpcodeBLT:
+        case kOpcodeBLE:
+        case kOpcodeBGT:
+        case kOpcodeBGE:
+            return 2;
+        default:
+            return -1;
+    }
+}
+
+/* The next instruction starts a new block: control may leave here or come back after a call. */
+static bool EndsBlock(int8_t opcode) {
+    return opcode != kOpcodeSPAWN && (TargetOperand(opcode) >= 0 || opcode == kOpcodeRET || opcode == kOpcodeHALT);
+}
+
+/* Where a direct jump, branch, CALL or SPAWN goes, -1 if it does not or not directly. */
+static int64_t DirectTarget(BytecodeView bytecode, const InstructionLayout& instruction) {
+    int operand = TargetOperand(instruction.opcode);
+    if (operand < 0 || ImmediateSize(instruction.arg_types[operand]) == 0 ||
+        WideArgType(instruction.arg_types[operand]) != ARG_VALUE) {
+        return -1;
+    }
+    return ReadImmediate(bytecode.data() + instruction.arg_offsets[operand], instruction.arg_sizes[operand]);
+}
+
+static uint8_t UsedRegisters(BytecodeView bytecode, const InstructionLayout& instruction) {
+    uint8_t used = 0;
+    for (int i = 0; i < instruction.args_cnt; ++i) {
+        int64_t offset = instruction.arg_offsets[i];
+        switch (instruction.arg_types[i]) {
+            case ARG_BASE_INDEX:
+                used |= 1 << bytecode[offset + 1];
+                [[fallthrough]];
+            case ARG_REGISTER:
+            case ARG_REGISTER_POINTER:
+            case ARG_BASE_OFFSET:
+                used |= 1 << bytecode[offset];
+                break;
+        }
+    }
+    return used;
+}
+
+void AnalyzeProgram(BytecodeView bytecode, std::vector<int64_t> function_starts, ProgramMetadata* metadata) {
+    *metadata = ProgramMetadata();
+    int64_t bytecode_size = bytecode.size();
+
+    std::vector<InstructionSummary> instructions;
+    std::vector<int64_t> targets;
+    int64_t ip = 0;
+    while (ip < bytecode_size) {
+        InstructionLayout instruction;
+        if (!TryDecodeInstruction(bytecode, ip, &instruction)) {
+            metadata->invalid_at = ip;
+            break;
+        }
+        metadata->used_registers |= UsedRegisters(bytecode, instruction);
+        targets.push_back(DirectTarget(bytecode, instruction));
+        instructions.push_back(InstructionSummary{ip, instruction.opcode, static_cast<int8_t>(instruction.from_stack_cnt),
+                                                  static_cast<int8_t>(instruction.to_stack_cnt)});
+        metadata->instruction_starts.push_back(ip);
+        ip += instruction.size;
+    }
+    int64_t decoded_end = metadata->invalid_at < 0 ? bytecode_size : metadata->invalid_at;
+    const auto& starts = metadata->instruction_starts;
+
+    /* Block leaders, by instruction index; 2 marks a jump target. */
+    std::vector<int8_t> leaders(instructions.size(), 0);
+    auto instruction_index = [&starts](int64_t position) -> int64_t {
+        auto iter = std::lower_bound(starts.begin(), starts.end(), position);
+        return iter != starts.end() && *iter == position ? iter - starts.begin() : -1;
+    };
+    for (size_t i = 0; i < instructions.size(); ++i) {
+        if (i == 0 || EndsBlock(instructions[i - 1].opcode)) {
+            leaders[i] = std::max<int8_t>(leaders[i], 1);
+        }
+        int64_t target = targets[i] >= 0 ? instruction_index(targets[i]) : -1;
+        if (target >= 0) {
+            leaders[target] = 2;
+        }
+    }
+
+    std::sort(function_starts.begin(), function_starts.end());
+    function_starts.erase(std::unique(function_starts.begin(), function_starts.end()), function_starts.end());
+    for (int64_t start : function_starts) {
+        if (start < 0 || start >= bytecode_size) {
+            continue;
+        }
+        if (!metadata->functions.empty()) {
+            metadata->functions.back().end = start;
+        }
+        metadata->functions.push_back(FunctionExtent{start, bytecode_size});
+        int64_t index = instruction_index(start);
+        if (index >= 0) {
+            leaders[index] = std::max<int8_t>(leaders[index], 1);
+        }
+    }
+
+    int32_t depth = 0;
+    for (size_t i = 0; i < instructions.size(); ++i) {
+        if (leaders[i] != 0) {
+            if (!metadata->blocks.empty()) {
+                metadata->blocks.back().end = instructions[i].start;
+            }
+            metadata->blocks.emplace_back();
+            metadata->blocks.back().start = instructions[i].start;
+            metadata->blocks.back().jump_target = leaders[i] == 2;
+            depth = 0;
+        }
+        BasicBlock& block = metadata->blocks.back();
+        depth -= instructions[i].from_stack_cnt;
+        block.stack_min = std::min(block.stack_min, depth);
+        depth += instructions[i].to_stack_cnt;
+        block.stack_delta = depth;
+    }
+    if (!metadata->blocks.empty()) {
+        metadata->blocks.back().end = decoded_end;
+    }
+}
@@ -1,5 +1,8 @@
 #include <ram.h>
 #include <algorithm>
+#include <sys/mman.h>
+
+static_assert(sizeof(RAM::Chunk) % 4096 == 0, "RAM chunks must be page-aligned in snapshot images");
 
 RAM::RAM() {
     std::fill(chunk_table_.begin(), chunk_table_.end(), nullptr);
@@ -10,19 +13,31 @@ RAM::~RAM() {
     while (pool_size_ > 0) {
         delete ExtractFromPool();
     }
+    UnmapImage();
 }
 
 int64_t* RAM::At(int64_t idx, bool* ok) {
-    int chunk_idx = idx >> kChunkSizeLog;
-    if (chunk_idx >= chunks_cnt_) {
+    int64_t chunk_idx = idx >> kChunkSizeLog;
+    if (idx < 0 || chunk_idx >= __atomic_load_n(&chunks_cnt_, __ATOMIC_RELAXED)) {
         *ok = false;
         return nullptr;
     }
-    if (chunk_table_[chunk_idx] == nullptr) {
-        chunk_table_[chunk_idx] = AllocateChunk();
+    Chunk* chunk = __atomic_load_n(&chunk_table_[chunk_idx], __ATOMIC_ACQUIRE);
+    if (chunk == nullptr) {
+        std::lock_guard<std::mutex> lock(allocation_mutex_);
+        chunk = chunk_table_[chunk_idx];
+        if (chunk == nullptr) {
+            chunk = AllocateChunk();
+            __atomic_store_n(&chunk_table_[chunk_idx], chunk, __ATOMIC_RELEASE);
+        }
     }
     *ok = true;
-    return &chunk_table_[chunk_idx]->at(idx & (kChunkSize - 1));
+    return &chunk->at(idx & (kChunkSize - 1));
+}
+
+int64_t* RAM::Span(int64_t idx, int64_t* cnt, bool* ok) {
+    *cnt = std::min<int64_t>(*cnt, kChunkSize - (idx & (kChunkSize - 1)));
+    return At(idx, ok);
 }
 
 bool RAM::Resize(int64_t max_idx) {
@@ -52,11 +67,78 @@ bool RAM::Resize(int64_t max_idx) {
     return true;
 }
 
+bool RAM::Grow(int64_t max_idx) {
+    int64_t new_chunks_cnt = (max_idx >> kChunkSizeLog) + 1;
+    if (max_idx < 0 || new_chunks_cnt <= __atomic_load_n(&chunks_cnt_, __ATOMIC_RELAXED)) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(allocation_mutex_);
+    if (new_chunks_cnt > kMaxChunksCnt - pool_size_) {
+        return false;
+    }
+    if (new_chunks_cnt > chunks_cnt_) {
+        __atomic_store_n(&chunks_cnt_, new_chunks_cnt, __ATOMIC_RELAXED);
+    }
+    return true;
+}
+
+void RAM::Clear() {
+    for (int i = 0; i < chunks_cnt_; ++i) {
+        if (IsMapped(chunk_table_[i])) {
+            chunk_table_[i] = nullptr;
+        } else if (chunk_table_[i] != nullptr) {
+            chunk_table_[i]->fill(0);
+        }
+    }
+    UnmapImage();
+}
+
+void RAM::GetTouchedChunks(std::vector<int64_t>* indices, std::vector<const void*>* chunks) const {
+    indices->clear();
+    chunks->clear();
+    for (int i = 0; i < chunks_cnt_; ++i) {
+        if (chunk_table_[i] != nullptr) {
+            indices->push_back(i);
+            chunks->push_back(chunk_table_[i]->data());
+        }
+    }
+}
+
+bool RAM::TryMapImage(int fd, int64_t offset, const std::vector<int64_t>& indices) {
+    for (int64_t idx : indices) {
+        if (idx < 0 || idx >= kMaxChunksCnt - pool_size_) {
+            return false;
+        }
+    }
+    Clear();
+    if (indices.empty()) {
+        return true;
+    }
+
+    void* image = mmap(nullptr, sizeof(Chunk) * indices.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+    if (image == MAP_FAILED) {
+        return false;
+    }
+    image_ = static_cast<Chunk*>(image);
+    image_chunks_cnt_ = indices.size();
+
+    for (size_t i = 0; i < indices.size(); ++i) {
+        if (indices[i] >= chunks_cnt_) {
+            Resize(indices[i] << kChunkSizeLog);
+        }
+        delete chunk_table_[indices[i]];
+        chunk_table_[indices[i]] = image_ + i;
+    }
+    return true;
+}
+
 RAM::Chunk* RAM::AllocateChunk() {
     if (pool_size_ > 0) {
-        return ExtractFromPool();
+        Chunk* chunk = ExtractFromPool();
+        chunk->fill(0);
+        return chunk;
     }
-    return new Chunk;
+    return new Chunk();
 }
 
 RAM::Chunk* RAM::ExtractFromPool() {
@@ -67,5 +149,20 @@ RAM::Chunk* RAM::ExtractFromPool() {
 }
 
 void RAM::InsertInPool(RAM::Chunk* chunk) {
+    if (IsMapped(chunk)) {
+        return;
+    }
     chunk_table_[kMaxChunksCnt - (++pool_size_)] = chunk;
 }
+
+bool RAM::IsMapped(const Chunk* chunk) const {
+    return chunk >= image_ && chunk < image_ + image_chunks_cnt_;
+}
+
+void RAM::UnmapImage() {
+    if (image_ != nullptr) {
+        munmap(image_, sizeof(Chunk) * image_chunks_cnt_);
+        image_ = nullptr;
+        image_chunks_cnt_ = 0;
+    }
+}
@@ -0,0 +1,80 @@
+#include <scheduler.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+class WorkQueue {
+public:
+    void Push(GreenThread* thread) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        threads_.push_back(thread);
+    }
+
+    /* The owner serves its queue round-robin from the front... */
+    GreenThread* Pop() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (threads_.empty()) {
+            return nullptr;
+        }
+        GreenThread* thread = threads_.front();
+        threads_.pop_front();
+        return thread;
+    }
+
+    /* ...and thieves take from the back, away from the owner's next pick. */
+    GreenThread* Steal() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (threads_.empty()) {
+            return nullptr;
+        }
+        GreenThread* thread = threads_.back();
+        threads_.pop_back();
+        return thread;
+    }
+
+private:
+    std::mutex mutex_;
+    std::deque<GreenThread*> threads_;
+};
+
+}  // namespace
+
+void RunGreenThreads(std::vector<GreenThread> threads, int workers_cnt) {
+    workers_cnt = std::clamp<int>(workers_cnt, 1, std::max<size_t>(threads.size(), 1));
+    std::vector<WorkQueue> queues(workers_cnt);
+    for (size_t i = 0; i < threads.size(); ++i) {
+        queues[i % workers_cnt].Push(&threads[i]);
+    }
+    std::atomic<size_t> unfinished{threads.size()};
+
+    auto worker = [&](int index) {
+        while (unfinished > 0) {
+            GreenThread* thread = queues[index].Pop();
+            for (int shift = 1; thread == nullptr && shift < workers_cnt; ++shift) {
+                thread = queues[(index + shift) % workers_cnt].Steal();
+            }
+            if (thread == nullptr) {
+                std::this_thread::yield();
+                continue;
+            }
+            if ((*thread)()) {
+                queues[index].Push(thread);
+            } else {
+                --unfinished;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(workers_cnt);
+    for (int i = 0; i < workers_cnt; ++i) {
+        workers.emplace_back(worker, i);
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+}
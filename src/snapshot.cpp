@@ -0,0 +1,160 @@
+#include <snapshot.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static constexpr char kSnapshotMagic[8] = {'V', 'S', 'N', 'A', 'P', 'S', 'H', 'T'};
+static constexpr int64_t kSnapshotFormatVersion = 2;
+
+struct SnapshotHeader {
+    char magic[8];
+    int64_t format_version;
+    uint64_t program_hash;
+    uint64_t instruction_pointer;
+    int64_t registers[(MAX_REGISTER) + 1];
+    int64_t data_stack_size;
+    int64_t call_stack_size;
+    int64_t frame_stack_size;
+    int64_t chunks_cnt;
+    int64_t image_offset;
+};
+
+Snapshot::~Snapshot() {
+    if (image_fd >= 0) {
+        close(image_fd);
+    }
+}
+
+uint64_t HashBytecode(BytecodeView bytecode) {
+    /* FNV-1a */
+    uint64_t hash = 14695981039346656037ULL;
+    for (int8_t byte : bytecode) {
+        hash ^= static_cast<uint8_t>(byte);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool TryParseFrames(const Snapshot& snapshot, std::vector<SnapshotFrame>* frames) {
+    const auto& stack = snapshot.frame_stack;
+    frames->clear();
+    for (int64_t end = stack.size(); end > 0; end = frames->back().begin) {
+        if (end < 2 || stack[end - 1] < 0 || stack[end - 1] > end - 2) {
+            return false;
+        }
+        int64_t size = stack[end - 1];
+        int64_t depth = stack[end - 2];
+        int64_t max_depth = frames->empty() ? snapshot.call_stack.size() : frames->back().depth;
+        if (depth < 0 || depth > max_depth) {
+            return false;
+        }
+        frames->push_back(SnapshotFrame{end - 2 - size, size, depth});
+    }
+    std::reverse(frames->begin(), frames->end());
+    return true;
+}
+
+static int64_t RoundUpToChunk(int64_t value) {
+    return (value + Snapshot::kChunkBytes - 1) / Snapshot::kChunkBytes * Snapshot::kChunkBytes;
+}
+
+bool TryWriteSnapshot(const char* path, const Snapshot& snapshot, std::string* error) {
+    SnapshotHeader header{};
+    std::memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+    header.format_version = kSnapshotFormatVersion;
+    header.program_hash = snapshot.program_hash;
+    header.instruction_pointer = snapshot.instruction_pointer;
+    std::copy(snapshot.registers.begin(), snapshot.registers.end(), header.registers);
+    header.data_stack_size = snapshot.data_stack.size();
+    header.call_stack_size = snapshot.call_stack.size();
+    header.frame_stack_size = snapshot.frame_stack.size();
+    header.chunks_cnt = snapshot.chunk_indices.size();
+    header.image_offset = RoundUpToChunk(sizeof(header) + sizeof(int64_t) *
+            (snapshot.data_stack.size() + snapshot.call_stack.size() + snapshot.frame_stack.size() +
+             snapshot.chunk_indices.size()));
+
+    /* Write next to the target and rename, so a crash never leaves a torn snapshot behind. */
+    std::string temp_path = std::string(path) + ".tmp";
+    std::FILE* file = std::fopen(temp_path.c_str(), "wb");
+    if (file == nullptr) {
+        *error = "Failed to open " + temp_path;
+        return false;
+    }
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    for (const auto* part : {&snapshot.data_stack, &snapshot.call_stack, &snapshot.frame_stack,
+                             &snapshot.chunk_indices}) {
+        ok = ok && std::fwrite(part->data(), sizeof(int64_t), part->size(), file) == part->size();
+    }
+    ok = ok && std::fseek(file, header.image_offset, SEEK_SET) == 0;
+    for (const void* chunk : snapshot.chunks) {
+        ok = ok && std::fwrite(chunk, Snapshot::kChunkBytes, 1, file) == 1;
+    }
+    ok = (std::fclose(file) == 0) && ok;
+
+    if (!ok || std::rename(temp_path.c_str(), path) != 0) {
+        std::remove(temp_path.c_str());
+        *error = std::string("Failed to write ") + path;
+        return false;
+    }
+    return true;
+}
+
+static bool TryReadArray(int fd, int64_t offset, std::vector<int64_t>* dest, int64_t size) {
+    dest->resize(size);
+    ssize_t bytes = sizeof(int64_t) * size;
+    return pread(fd, dest->data(), bytes, offset) == bytes;
+}
+
+bool TryReadSnapshot(const char* path, Snapshot* snapshot, std::string* error) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *error = std::string("Failed to open ") + path;
+        return false;
+    }
+    if (snapshot->image_fd >= 0) {
+        close(snapshot->image_fd);
+    }
+    snapshot->image_fd = fd;
+
+    SnapshotHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        std::memcmp(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 ||
+        header.format_version != kSnapshotFormatVersion ||
+        header.data_stack_size < 0 || header.call_stack_size < 0 || header.frame_stack_size < 0 ||
+        header.chunks_cnt < 0) {
+        *error = std::string(path) + " is not a snapshot";
+        return false;
+    }
+
+    snapshot->program_hash = header.program_hash;
+    snapshot->instruction_pointer = header.instruction_pointer;
+    std::copy(std::begin(header.registers), std::end(header.registers), snapshot->registers.begin());
+    snapshot->image_offset = header.image_offset;
+
+    int64_t offset = sizeof(header);
+    if (!TryReadArray(fd, offset, &snapshot->data_stack, header.data_stack_size) ||
+        !TryReadArray(fd, offset += sizeof(int64_t) * header.data_stack_size, &snapshot->call_stack, header.call_stack_size) ||
+        !TryReadArray(fd, offset += sizeof(int64_t) * header.call_stack_size, &snapshot->frame_stack, header.frame_stack_size) ||
+        !TryReadArray(fd, offset += sizeof(int64_t) * header.frame_stack_size, &snapshot->chunk_indices, header.chunks_cnt)) {
+        *error = std::string("Failed to read ") + path;
+        return false;
+    }
+    return true;
+}
+
+volatile std::sig_atomic_t checkpoint_requested = 0;
+
+static void CheckpointSignalHandler(int) {
+    checkpoint_requested = 1;
+}
+
+void InstallCheckpointSignalHandler() {
+    struct sigaction action{};
+    action.sa_handler = CheckpointSignalHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, nullptr);
+}
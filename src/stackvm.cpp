@@ -0,0 +1,351 @@
+#include <stackvm.h>
+#include <batch_runner.h>
+#include <fork_server.h>
+#include <oosf/input_data_stream.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+////////////////////////////////////////////////////////////////////////////////
+
+PreparedProgram::PreparedProgram(Executable executable, Engine engine)
+    : executable_(std::move(executable)), engine_(engine) {
+}
+
+std::shared_ptr<const PreparedProgram> PreparedProgram::TryPrepare(Object executable, Engine engine, std::string* error) {
+    return TryPrepare(Executable(std::move(executable)), engine, error);
+}
+
+std::shared_ptr<const PreparedProgram> PreparedProgram::TryPrepare(Executable executable, Engine engine, std::string* error) {
+    if (executable.GetObjectType() != Object::kObjectExecutable) {
+        *error = "object file is not executable";
+        return nullptr;
+    }
+
+    const Object::ProcVersion required_version{PROC_VERSION_MAJOR, PROC_VERSION_MINOR, PROC_VERSION_PATCH};
+    Object::ProcVersion version = executable.GetProcVersion();
+    if (!version.CompatibleWith(required_version)) {
+        std::stringstream ss;
+        ss << "incompatible processor version (required >=" << required_version.major << ".0.0, found "
+           << version.major << '.' << version.minor << '.' << version.patch
+           << ")";
+        *error = ss.str();
+        return nullptr;
+    }
+
+    int64_t invalid_at = executable.GetMetadata().invalid_at;
+    if (invalid_at >= 0) {
+        std::stringstream ss;
+        ss << "corrupted bytecode at 0x" << std::hex << invalid_at;
+        *error = ss.str();
+        return nullptr;
+    }
+
+    std::shared_ptr<PreparedProgram> program(new PreparedProgram(std::move(executable), engine));
+    if (engine == kEngineJIT) {
+        program->compiler_.emplace();
+        program->compiler_->Compile(program->executable_);
+    }
+    return program;
+}
+
+PreparedProgram::Engine PreparedProgram::GetEngine() const {
+    return engine_;
+}
+
+const Executable& PreparedProgram::GetExecutable() const {
+    return executable_;
+}
+
+const JITCompiler& PreparedProgram::GetCompiler() const {
+    return *compiler_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ProgramInstance::ProgramInstance(std::shared_ptr<const PreparedProgram> program)
+    : program_(std::move(program)) {
+    if (program_->GetEngine() == PreparedProgram::kEngineJIT) {
+        jit_instance_ = std::make_unique<JITInstance>();
+    } else {
+        vm_ = std::make_unique<VirtualMachine>();
+    }
+}
+
+void ProgramInstance::SetInputMode(bool map_input, bool binary_input) {
+    map_input_ = map_input;
+    binary_input_ = binary_input;
+}
+
+void ProgramInstance::SetIO(std::FILE* input, std::FILE* output) {
+    std::fflush(output);
+    SetIO(fileno(input), fileno(output));
+}
+
+void ProgramInstance::SetIO(int input_fd, int output_fd) {
+    if (map_input_ && input_mapping_.TryMap(input_fd)) {
+        own_input_.Attach(input_mapping_.Data(), input_mapping_.Size());
+    } else {
+        input_mapping_.Unmap();
+        own_input_.Attach(input_fd);
+    }
+    own_input_.SetBinary(binary_input_);
+    own_output_.Attach(output_fd);
+    input_ = &own_input_;
+    output_ = &own_output_;
+}
+
+void ProgramInstance::SetInputBuffer(const char* data, size_t size) {
+    input_mapping_.Unmap();
+    own_input_.Attach(data, size);
+    own_input_.SetBinary(binary_input_);
+    input_ = &own_input_;
+}
+
+void ProgramInstance::SetOutputBuffer(char* buffer, size_t capacity) {
+    own_output_.Attach(buffer, capacity);
+    output_ = &own_output_;
+}
+
+size_t ProgramInstance::GetOutputSize() {
+    output_->Flush();
+    return output_->GetMemorySize();
+}
+
+static const char* GetStatusDescription(Processor::ExecutionStatus status) {
+    switch (status) {
+        case Processor::kExecStatusAddressOutOfRange:
+            return "Pointer out of bounds";
+        case Processor::kExecStatusIPOutOfRange:
+            return "Jump to invalid address";
+        case Processor::kExecStatusNoFrame:
+            return "LEAVE without a frame";
+        case Processor::kExecStatusInvalidNativeCall:
+            return "Unknown native function";
+        case Processor::kExecStatusInvalidHeapPointer:
+            return "Invalid heap pointer or corrupted heap";
+        default:
+            return "Execution failed";
+    }
+}
+
+bool ProgramInstance::Run() {
+    input_->Tie(output_);
+    bool ok = false;
+    if (jit_instance_) {
+        jit_instance_->SetIO(input_, output_);
+        ok = jit_instance_->Execute(program_->GetCompiler());
+        if (!ok) {
+            output_->Printf("%s! Stopping...\n", GetStatusDescription(jit_instance_->GetStatus()));
+            PrintStackTrace(output_, program_->GetExecutable(), jit_instance_->GetFailureIP(),
+                            jit_instance_->GetFailureCallStack());
+        }
+    } else {
+        vm_->SetIO(input_, output_);
+        ok = vm_->Execute(program_->GetExecutable());
+    }
+    output_->Flush();
+    return ok;
+}
+
+void ProgramInstance::Reset() {
+    if (jit_instance_) {
+        jit_instance_->Reset();
+    } else {
+        vm_->Reset();
+    }
+    input_->Rewind();
+    output_->Rewind();
+}
+
+void ProgramInstance::SetCheckpointPath(std::string path) {
+    if (jit_instance_) {
+        jit_instance_->SetCheckpointPath(std::move(path));
+    } else {
+        vm_->SetCheckpointPath(std::move(path));
+    }
+}
+
+bool ProgramInstance::TryRestore(const char* snapshot_path, std::string* error) {
+    if (jit_instance_) {
+        return jit_instance_->TryRestore(program_->GetCompiler(), snapshot_path, error);
+    }
+    return vm_->TryRestore(program_->GetExecutable(), snapshot_path, error);
+}
+
+void ProgramInstance::SetStopAtCheckpoint(bool stop) {
+    if (jit_instance_) {
+        jit_instance_->SetStopAtCheckpoint(stop);
+    } else {
+        vm_->SetStopAtCheckpoint(stop);
+    }
+}
+
+void ProgramInstance::SetFuel(int64_t fuel) {
+    if (jit_instance_) {
+        jit_instance_->SetFuel(fuel);
+    } else {
+        vm_->SetFuel(fuel);
+    }
+}
+
+Processor::ExecutionStatus ProgramInstance::GetStatus() const {
+    return jit_instance_ ? jit_instance_->GetStatus() : vm_->GetStatus();
+}
+
+bool ProgramInstance::IsSuspended() const {
+    return jit_instance_ ? jit_instance_->IsSuspended() : vm_->IsSuspended();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void PrintUsage(const char* tool_name) {
+    std::fprintf(stderr, "Usage: %s [-j <threads>] [-m] [-b] [-c <snapshot>] [-r <snapshot>] [-s <socket>]\n"
+                         "       [-f <fuel>] <executable> [<input>...]\n"
+                         "  -j <threads>   run the inputs on this many worker threads\n"
+                         "  -m             mmap input files and parse them in place\n"
+                         "  -b             binary input: RDINT/RDDBL read raw little-endian 8-byte words\n"
+                         "  -c <snapshot>  write a snapshot at every CHKPT and on SIGUSR1 (single run only)\n"
+                         "  -r <snapshot>  start every run from a snapshot instead of the entry point\n"
+                         "  -s <socket>    run up to the first CHKPT, then serve every connection on a Unix\n"
+                         "                 socket from a forked copy of that state\n"
+                         "  -f <fuel>      start all inputs at once and preempt each after <fuel> instructions\n"
+                         "                 (vm) or back-edges and calls (jit), as green threads over the workers\n",
+                 tool_name);
+}
+
+/* Initialization runs once, on the server's own stdin/stdout; every request then resumes a
+ * copy-on-write fork of the suspended instance with the connection as its stdin and stdout. */
+static int ServePrepared(ProgramInstance* instance, const char* socket_path) {
+    instance->SetStopAtCheckpoint(true);
+    if (!instance->Run()) {
+        return 1;
+    }
+    if (instance->GetStatus() != Processor::kExecStatusCheckpoint) {
+        std::fprintf(stderr, "The program finished without reaching CHKPT, nothing to serve\n");
+        return 1;
+    }
+    instance->SetStopAtCheckpoint(false);
+
+    return RunForkServer(socket_path, [instance](int connection_fd) {
+        instance->SetIO(connection_fd, connection_fd);
+        return instance->Run();
+    });
+}
+
+int RunStackVMTool(int argc, char* argv[], PreparedProgram::Engine engine) {
+    int workers_cnt = std::max<int>(std::thread::hardware_concurrency(), 1);
+    bool map_input = false, binary_input = false;
+    const char* checkpoint_path = nullptr;
+    const char* restore_path = nullptr;
+    const char* socket_path = nullptr;
+    int64_t fuel = 0;
+    int arg_index = 1;
+    for (; arg_index < argc && argv[arg_index][0] == '-'; ++arg_index) {
+        if (std::strcmp(argv[arg_index], "-j") == 0 && arg_index + 1 < argc) {
+            workers_cnt = std::atoi(argv[++arg_index]);
+        } else if (std::strcmp(argv[arg_index], "-m") == 0) {
+            map_input = true;
+        } else if (std::strcmp(argv[arg_index], "-b") == 0) {
+            binary_input = true;
+        } else if (std::strcmp(argv[arg_index], "-c") == 0 && arg_index + 1 < argc) {
+            checkpoint_path = argv[++arg_index];
+        } else if (std::strcmp(argv[arg_index], "-r") == 0 && arg_index + 1 < argc) {
+            restore_path = argv[++arg_index];
+        } else if (std::strcmp(argv[arg_index], "-s") == 0 && arg_index + 1 < argc) {
+            socket_path = argv[++arg_index];
+        } else if (std::strcmp(argv[arg_index], "-f") == 0 && arg_index + 1 < argc) {
+            fuel = std::atoll(argv[++arg_index]);
+        } else {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (arg_index >= argc || workers_cnt <= 0 || fuel < 0) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    const char* executable_path = argv[arg_index++];
+    std::vector<std::string> input_paths(argv + arg_index, argv + argc);
+    if ((checkpoint_path != nullptr || socket_path != nullptr) && !input_paths.empty()) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    Executable executable;
+    std::string error;
+    if (!executable.TryLoad(executable_path, &error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    auto program = PreparedProgram::TryPrepare(std::move(executable), engine, &error);
+    if (!program) {
+        std::fprintf(stderr, "Failed to execute %s: %s\n", executable_path, error.c_str());
+        return 1;
+    }
+
+    if (input_paths.empty()) {
+        ProgramInstance instance(program);
+        if (checkpoint_path != nullptr) {
+            InstallCheckpointSignalHandler();
+            instance.SetCheckpointPath(checkpoint_path);
+        }
+        if (restore_path != nullptr && !instance.TryRestore(restore_path, &error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        instance.SetInputMode(map_input, binary_input);
+        instance.SetIO(stdin, stdout);
+        if (socket_path != nullptr) {
+            return ServePrepared(&instance, socket_path);
+        }
+        instance.SetFuel(fuel);
+        while (instance.Run() && instance.IsSuspended()) {
+        }
+        return 0;
+    }
+
+    if (fuel > 0) {
+        int failed_jobs = RunPreemptibleBatch(input_paths, workers_cnt, [&]() -> PreemptibleJob {
+            auto instance = std::make_shared<ProgramInstance>(program);
+            instance->SetInputMode(map_input, binary_input);
+            instance->SetFuel(fuel);
+            return [instance, restore_path, started = false](std::FILE* input, std::FILE* output, bool* ok) mutable {
+                if (!started) {
+                    started = true;
+                    std::string error;
+                    if (restore_path != nullptr && !instance->TryRestore(restore_path, &error)) {
+                        std::fprintf(stderr, "%s\n", error.c_str());
+                        *ok = false;
+                        return false;
+                    }
+                    instance->SetIO(input, output);
+                }
+                *ok = instance->Run();
+                return *ok && instance->IsSuspended();
+            };
+        });
+        return failed_jobs == 0 ? 0 : 1;
+    }
+
+    int failed_jobs = RunBatch(input_paths, workers_cnt, [&program, map_input, binary_input, restore_path]() -> BatchJobHandler {
+        auto instance = std::make_shared<ProgramInstance>(program);
+        instance->SetInputMode(map_input, binary_input);
+        return [instance, restore_path](std::FILE* input, std::FILE* output) {
+            instance->Reset();
+            std::string error;
+            if (restore_path != nullptr && !instance->TryRestore(restore_path, &error)) {
+                std::fprintf(stderr, "%s\n", error.c_str());
+                return false;
+            }
+            instance->SetIO(input, output);
+            return instance->Run();
+        };
+    });
+
+    return failed_jobs == 0 ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+#include <symbol_pool.h>
+#include <algorithm>
+#include <cstring>
+
+static constexpr size_t kBlockSize = 64 * 1024;
+
+uint64_t SymbolPool::Hash(std::string_view name) {
+    /* FNV-1a. */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (char c : name) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+SymbolPool::Id SymbolPool::Intern(std::string_view name, uint64_t hash) {
+    if ((entries_.size() + 1) * 2 > slots_.size()) {
+        Rehash();
+    }
+    size_t slot = Slot(name, hash);
+    if (slots_[slot] == kNoId) {
+        slots_[slot] = entries_.size();
+        entries_.push_back(Entry{Store(name), hash});
+    }
+    return slots_[slot];
+}
+
+SymbolPool::Id SymbolPool::Find(std::string_view name, uint64_t hash) const {
+    return slots_.empty() ? kNoId : slots_[Slot(name, hash)];
+}
+
+std::string_view SymbolPool::Name(Id id) const {
+    return entries_[id].name;
+}
+
+size_t SymbolPool::Size() const {
+    return entries_.size();
+}
+
+size_t SymbolPool::Slot(std::string_view name, uint64_t hash) const {
+    size_t mask = slots_.size() - 1;
+    size_t slot = hash & mask;
+    while (slots_[slot] != kNoId &&
+           (entries_[slots_[slot]].hash != hash || entries_[slots_[slot]].name != name)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void SymbolPool::Rehash() {
+    slots_.assign(slots_.empty() ? 1024 : slots_.size() * 2, kNoId);
+    size_t mask = slots_.size() - 1;
+    for (Id id = 0; id < entries_.size(); ++id) {
+        size_t slot = entries_[id].hash & mask;
+        while (slots_[slot] != kNoId) {
+            slot = (slot + 1) & mask;
+        }
+        slots_[slot] = id;
+    }
+}
+
+std::string_view SymbolPool::Store(std::string_view name) {
+    if (blocks_.empty() || name.size() > block_size_ - block_used_) {
+        block_size_ = std::max(kBlockSize, name.size());
+        block_used_ = 0;
+        blocks_.push_back(std::make_unique<char[]>(block_size_));
+    }
+    char* copy = blocks_.back().get() + block_used_;
+    std::memcpy(copy, name.data(), name.size());
+    block_used_ += name.size();
+    return std::string_view(copy, name.size());
+}
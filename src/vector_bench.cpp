@@ -0,0 +1,133 @@
+#include <vector_kernels.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+/* Times the kernels behind the bulk instructions against the scalar loops they replace.
+ * Usage: vector_bench [words] [rounds] */
+
+static double NanosecondsPerWord(const std::function<void()>& body, int64_t words, int rounds) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+        body();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (static_cast<double>(words) * rounds);
+}
+
+static bool Compare(const char* name, const std::function<void()>& scalar, const std::function<void()>& vector,
+                    const std::function<bool()>& same, int64_t words, int rounds) {
+    double scalar_ns = NanosecondsPerWord(scalar, words, rounds);
+    double vector_ns = NanosecondsPerWord(vector, words, rounds);
+    bool ok = same();
+    std::printf("%-8s %10.3f %10.3f %9.2fx%s\n", name, scalar_ns, vector_ns, scalar_ns / vector_ns,
+                ok ? "" : "  MISMATCH");
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    int64_t words = argc > 1 ? std::atoll(argv[1]) : (1 << 16);
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 200;
+    if (words <= 0 || rounds <= 0) {
+        std::fprintf(stderr, "Usage: %s [words] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    /* Small integers keep double sums exact, so both sides must agree bit for bit. */
+    std::vector<int64_t> a(words), b(words), scalar_dst(words), vector_dst(words);
+    std::vector<double> da(words), db(words), scalar_ddst(words), vector_ddst(words);
+    for (int64_t i = 0; i < words; ++i) {
+        a[i] = i % 1000 - 500;
+        b[i] = i % 7 + 1;
+        da[i] = static_cast<double>(a[i]);
+        db[i] = static_cast<double>(b[i]);
+    }
+    int64_t scalar_sum = 0, vector_sum = 0;
+    double scalar_dsum = 0, vector_dsum = 0;
+
+    std::printf("kernels: %s, %lld words x %d rounds\n", VectorKernelsISA(), static_cast<long long>(words), rounds);
+    std::printf("%-8s %10s %10s %10s\n", "op", "scalar ns", "kernel ns", "speedup");
+
+    bool ok = true;
+    ok &= Compare("MEMCPY", [&] {
+        for (int64_t i = 0; i < words; ++i) scalar_dst[i] = a[i];
+    }, [&] {
+        std::memmove(vector_dst.data(), a.data(), words * sizeof(int64_t));
+    }, [&] { return scalar_dst == vector_dst; }, words, rounds);
+
+    ok &= Compare("MEMSET", [&] {
+        for (int64_t i = 0; i < words; ++i) scalar_dst[i] = 42;
+    }, [&] {
+        VectorFill(vector_dst.data(), 42, words);
+    }, [&] { return scalar_dst == vector_dst; }, words, rounds);
+
+    ok &= Compare("VSUM", [&] {
+        scalar_sum = 0;
+        for (int64_t i = 0; i < words; ++i) scalar_sum += a[i];
+    }, [&] {
+        VectorLanes<int64_t> sum;
+        VectorSum(a.data(), words, &sum);
+        vector_sum = sum.Total();
+    }, [&] { return scalar_sum == vector_sum; }, words, rounds);
+
+    /* The element-wise ops run on a fresh copy each round so values do not drift apart. */
+    ok &= Compare("VADD", [&] {
+        for (int64_t i = 0; i < words; ++i) scalar_dst[i] = a[i] + b[i];
+    }, [&] {
+        std::memcpy(vector_dst.data(), a.data(), words * sizeof(int64_t));
+        VectorAdd(vector_dst.data(), b.data(), words);
+    }, [&] { return scalar_dst == vector_dst; }, words, rounds);
+
+    ok &= Compare("VMUL", [&] {
+        for (int64_t i = 0; i < words; ++i) scalar_dst[i] = a[i] * b[i];
+    }, [&] {
+        std::memcpy(vector_dst.data(), a.data(), words * sizeof(int64_t));
+        VectorMul(vector_dst.data(), b.data(), words);
+    }, [&] { return scalar_dst == vector_dst; }, words, rounds);
+
+    ok &= Compare("VDOT", [&] {
+        scalar_sum = 0;
+        for (int64_t i = 0; i < words; ++i) scalar_sum += a[i] * b[i];
+    }, [&] {
+        VectorLanes<int64_t> sum;
+        VectorDot(a.data(), b.data(), words, &sum);
+        vector_sum = sum.Total();
+    }, [&] { return scalar_sum == vector_sum; }, words, rounds);
+
+    ok &= Compare("FVSUM", [&] {
+        scalar_dsum = 0;
+        for (int64_t i = 0; i < words; ++i) scalar_dsum += da[i];
+    }, [&] {
+        VectorLanes<double> sum;
+        VectorSum(da.data(), words, &sum);
+        vector_dsum = sum.Total();
+    }, [&] { return scalar_dsum == vector_dsum; }, words, rounds);
+
+    ok &= Compare("FVADD", [&] {
+        for (int64_t i = 0; i < words; ++i) scalar_ddst[i] = da[i] + db[i];
+    }, [&] {
+        std::memcpy(vector_ddst.data(), da.data(), words * sizeof(double));
+        VectorAdd(vector_ddst.data(), db.data(), words);
+    }, [&] { return scalar_ddst == vector_ddst; }, words, rounds);
+
+    ok &= Compare("FVMUL", [&] {
+        for (int64_t i = 0; i < words; ++i) scalar_ddst[i] = da[i] * db[i];
+    }, [&] {
+        std::memcpy(vector_ddst.data(), da.data(), words * sizeof(double));
+        VectorMul(vector_ddst.data(), db.data(), words);
+    }, [&] { return scalar_ddst == vector_ddst; }, words, rounds);
+
+    ok &= Compare("FVDOT", [&] {
+        scalar_dsum = 0;
+        for (int64_t i = 0; i < words; ++i) scalar_dsum += da[i] * db[i];
+    }, [&] {
+        VectorLanes<double> sum;
+        VectorDot(da.data(), db.data(), words, &sum);
+        vector_dsum = sum.Total();
+    }, [&] { return scalar_dsum == vector_dsum; }, words, rounds);
+
+    return ok ? 0 : 1;
+}
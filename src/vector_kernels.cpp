@@ -0,0 +1,330 @@
+#include <vector_kernels.h>
+#include <immintrin.h>
+
+/* Integer kernels wrap around like the scalar instructions do, hence the unsigned arithmetic. */
+static inline int64_t WrapAdd(int64_t a, int64_t b) {
+    return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b));
+}
+
+static inline int64_t WrapMul(int64_t a, int64_t b) {
+    return static_cast<int64_t>(static_cast<uint64_t>(a) * static_cast<uint64_t>(b));
+}
+
+template <>
+void VectorLanes<int64_t>::Add(int64_t x) {
+    lane[phase] = WrapAdd(lane[phase], x);
+    phase = (phase + 1) % kVectorLanes;
+}
+
+template <>
+int64_t VectorLanes<int64_t>::Total() const {
+    return WrapAdd(WrapAdd(lane[0], lane[1]), WrapAdd(lane[2], lane[3]));
+}
+
+template <>
+void VectorLanes<double>::Add(double x) {
+    lane[phase] += x;
+    phase = (phase + 1) % kVectorLanes;
+}
+
+template <>
+double VectorLanes<double>::Total() const {
+    return (lane[0] + lane[1]) + (lane[2] + lane[3]);
+}
+
+/* One implementation per ISA. The element-wise kernels take any count; the reductions take a
+ * multiple of kVectorLanes and add element i to lanes[i % kVectorLanes]. */
+struct KernelTable {
+    const char* isa;
+    void (*fill)(int64_t*, int64_t, int64_t);
+    void (*add_int)(int64_t*, const int64_t*, int64_t);
+    void (*add_double)(double*, const double*, int64_t);
+    void (*mul_int)(int64_t*, const int64_t*, int64_t);
+    void (*mul_double)(double*, const double*, int64_t);
+    void (*sum_int)(const int64_t*, int64_t, int64_t*);
+    void (*sum_double)(const double*, int64_t, double*);
+    void (*dot_int)(const int64_t*, const int64_t*, int64_t, int64_t*);
+    void (*dot_double)(const double*, const double*, int64_t, double*);
+};
+
+/* SSE2 is part of x86-64, so these need no target attribute. Each reduction keeps two registers of
+ * two lanes each. */
+
+static inline __m128i MulLo64(__m128i a, __m128i b) {
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b), _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+    return _mm_add_epi64(_mm_mul_epu32(a, b), _mm_slli_epi64(cross, 32));
+}
+
+static void FillSSE2(int64_t* dst, int64_t value, int64_t cnt) {
+    __m128i v = _mm_set1_epi64x(value);
+    int64_t i = 0;
+    for (; i + 2 <= cnt; i += 2) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), v);
+    }
+    for (; i < cnt; ++i) {
+        dst[i] = value;
+    }
+}
+
+static void AddIntSSE2(int64_t* dst, const int64_t* src, int64_t cnt) {
+    int64_t i = 0;
+    for (; i + 2 <= cnt; i += 2) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_add_epi64(a, b));
+    }
+    for (; i < cnt; ++i) {
+        dst[i] = WrapAdd(dst[i], src[i]);
+    }
+}
+
+static void AddDoubleSSE2(double* dst, const double* src, int64_t cnt) {
+    int64_t i = 0;
+    for (; i + 2 <= cnt; i += 2) {
+        _mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(dst + i), _mm_loadu_pd(src + i)));
+    }
+    for (; i < cnt; ++i) {
+        dst[i] += src[i];
+    }
+}
+
+static void MulIntSSE2(int64_t* dst, const int64_t* src, int64_t cnt) {
+    int64_t i = 0;
+    for (; i + 2 <= cnt; i += 2) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), MulLo64(a, b));
+    }
+    for (; i < cnt; ++i) {
+        dst[i] = WrapMul(dst[i], src[i]);
+    }
+}
+
+static void MulDoubleSSE2(double* dst, const double* src, int64_t cnt) {
+    int64_t i = 0;
+    for (; i + 2 <= cnt; i += 2) {
+        _mm_storeu_pd(dst + i, _mm_mul_pd(_mm_loadu_pd(dst + i), _mm_loadu_pd(src + i)));
+    }
+    for (; i < cnt; ++i) {
+        dst[i] *= src[i];
+    }
+}
+
+static void SumIntSSE2(const int64_t* src, int64_t cnt, int64_t* lanes) {
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes + 2));
+    for (int64_t i = 0; i < cnt; i += kVectorLanes) {
+        lo = _mm_add_epi64(lo, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+        hi = _mm_add_epi64(hi, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 2)));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 2), hi);
+}
+
+static void SumDoubleSSE2(const double* src, int64_t cnt, double* lanes) {
+    __m128d lo = _mm_loadu_pd(lanes);
+    __m128d hi = _mm_loadu_pd(lanes + 2);
+    for (int64_t i = 0; i < cnt; i += kVectorLanes) {
+        lo = _mm_add_pd(lo, _mm_loadu_pd(src + i));
+        hi = _mm_add_pd(hi, _mm_loadu_pd(src + i + 2));
+    }
+    _mm_storeu_pd(lanes, lo);
+    _mm_storeu_pd(lanes + 2, hi);
+}
+
+static void DotIntSSE2(const int64_t* a, const int64_t* b, int64_t cnt, int64_t* lanes) {
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes + 2));
+    for (int64_t i = 0; i < cnt; i += kVectorLanes) {
+        lo = _mm_add_epi64(lo, MulLo64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                                       _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))));
+        hi = _mm_add_epi64(hi, MulLo64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 2)),
+                                       _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 2))));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 2), hi);
+}
+
+static void DotDoubleSSE2(const double* a, const double* b, int64_t cnt, double* lanes) {
+    __m128d lo = _mm_loadu_pd(lanes);
+    __m128d hi = _mm_loadu_pd(lanes + 2);
+    for (int64_t i = 0; i < cnt; i += kVectorLanes) {
+        lo = _mm_add_pd(lo, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        hi = _mm_add_pd(hi, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    _mm_storeu_pd(lanes, lo);
+    _mm_storeu_pd(lanes + 2, hi);
+}
+
+/* AVX2 has exactly kVectorLanes 64-bit lanes per register. No FMA: DOT must round like SSE2. */
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i MulLo64AVX2(__m256i a, __m256i b) {
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+}
+
+AVX2 static void FillAVX2(int64_t* dst, int64_t value, int64_t cnt) {
+    __m256i v = _mm256_set1_epi64x(value);
+    int64_t i = 0;
+    for (; i + 4 <= cnt; i += 4) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), v);
+    }
+    for (; i < cnt; ++i) {
+        dst[i] = value;
+    }
+}
+
+AVX2 static void AddIntAVX2(int64_t* dst, const int64_t* src, int64_t cnt) {
+    int64_t i = 0;
+    for (; i + 4 <= cnt; i += 4) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_add_epi64(a, b));
+    }
+    for (; i < cnt; ++i) {
+        dst[i] = WrapAdd(dst[i], src[i]);
+    }
+}
+
+AVX2 static void AddDoubleAVX2(double* dst, const double* src, int64_t cnt) {
+    int64_t i = 0;
+    for (; i + 4 <= cnt; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(dst + i), _mm256_loadu_pd(src + i)));
+    }
+    for (; i < cnt; ++i) {
+        dst[i] += src[i];
+    }
+}
+
+AVX2 static void MulIntAVX2(int64_t* dst, const int64_t* src, int64_t cnt) {
+    int64_t i = 0;
+    for (; i + 4 <= cnt; i += 4) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), MulLo64AVX2(a, b));
+    }
+    for (; i < cnt; ++i) {
+        dst[i] = WrapMul(dst[i], src[i]);
+    }
+}
+
+AVX2 static void MulDoubleAVX2(double* dst, const double* src, int64_t cnt) {
+    int64_t i = 0;
+    for (; i + 4 <= cnt; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(dst + i), _mm256_loadu_pd(src + i)));
+    }
+    for (; i < cnt; ++i) {
+        dst[i] *= src[i];
+    }
+}
+
+AVX2 static void SumIntAVX2(const int64_t* src, int64_t cnt, int64_t* lanes) {
+    __m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes));
+    for (int64_t i = 0; i < cnt; i += kVectorLanes) {
+        acc = _mm256_add_epi64(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+}
+
+AVX2 static void SumDoubleAVX2(const double* src, int64_t cnt, double* lanes) {
+    __m256d acc = _mm256_loadu_pd(lanes);
+    for (int64_t i = 0; i < cnt; i += kVectorLanes) {
+        acc = _mm256_add_pd(acc, _mm256_loadu_pd(src + i));
+    }
+    _mm256_storeu_pd(lanes, acc);
+}
+
+AVX2 static void DotIntAVX2(const int64_t* a, const int64_t* b, int64_t cnt, int64_t* lanes) {
+    __m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes));
+    for (int64_t i = 0; i < cnt; i += kVectorLanes) {
+        acc = _mm256_add_epi64(acc, MulLo64AVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                                                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i))));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+}
+
+AVX2 static void DotDoubleAVX2(const double* a, const double* b, int64_t cnt, double* lanes) {
+    __m256d acc = _mm256_loadu_pd(lanes);
+    for (int64_t i = 0; i < cnt; i += kVectorLanes) {
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    _mm256_storeu_pd(lanes, acc);
+}
+
+#undef AVX2
+
+static const KernelTable kSSE2Kernels = {
+    "sse2", FillSSE2, AddIntSSE2, AddDoubleSSE2, MulIntSSE2, MulDoubleSSE2,
+    SumIntSSE2, SumDoubleSSE2, DotIntSSE2, DotDoubleSSE2,
+};
+
+static const KernelTable kAVX2Kernels = {
+    "avx2", FillAVX2, AddIntAVX2, AddDoubleAVX2, MulIntAVX2, MulDoubleAVX2,
+    SumIntAVX2, SumDoubleAVX2, DotIntAVX2, DotDoubleAVX2,
+};
+
+static const KernelTable& Kernels() {
+    static const KernelTable& table = __builtin_cpu_supports("avx2") ? kAVX2Kernels : kSSE2Kernels;
+    return table;
+}
+
+const char* VectorKernelsISA() {
+    return Kernels().isa;
+}
+
+void VectorFill(int64_t* dst, int64_t value, int64_t cnt) {
+    Kernels().fill(dst, value, cnt);
+}
+
+void VectorAdd(int64_t* dst, const int64_t* src, int64_t cnt) {
+    Kernels().add_int(dst, src, cnt);
+}
+
+void VectorAdd(double* dst, const double* src, int64_t cnt) {
+    Kernels().add_double(dst, src, cnt);
+}
+
+void VectorMul(int64_t* dst, const int64_t* src, int64_t cnt) {
+    Kernels().mul_int(dst, src, cnt);
+}
+
+void VectorMul(double* dst, const double* src, int64_t cnt) {
+    Kernels().mul_double(dst, src, cnt);
+}
+
+/* Scalar until the next element lands in lane 0, whole kernel blocks, then the scalar tail. */
+template <class T, class Kernel, class Element>
+static void Reduce(int64_t cnt, VectorLanes<T>* sum, Kernel kernel, Element element) {
+    int64_t i = 0;
+    for (; i < cnt && sum->phase != 0; ++i) {
+        sum->Add(element(i));
+    }
+    int64_t body = (cnt - i) / kVectorLanes * kVectorLanes;
+    kernel(i, body, sum->lane);
+    for (i += body; i < cnt; ++i) {
+        sum->Add(element(i));
+    }
+}
+
+void VectorSum(const int64_t* src, int64_t cnt, VectorLanes<int64_t>* sum) {
+    Reduce(cnt, sum, [src](int64_t from, int64_t n, int64_t* lanes) { Kernels().sum_int(src + from, n, lanes); },
+           [src](int64_t i) { return src[i]; });
+}
+
+void VectorSum(const double* src, int64_t cnt, VectorLanes<double>* sum) {
+    Reduce(cnt, sum, [src](int64_t from, int64_t n, double* lanes) { Kernels().sum_double(src + from, n, lanes); },
+           [src](int64_t i) { return src[i]; });
+}
+
+void VectorDot(const int64_t* a, const int64_t* b, int64_t cnt, VectorLanes<int64_t>* sum) {
+    Reduce(cnt, sum, [a, b](int64_t from, int64_t n, int64_t* lanes) { Kernels().dot_int(a + from, b + from, n, lanes); },
+           [a, b](int64_t i) { return WrapMul(a[i], b[i]); });
+}
+
+void VectorDot(const double* a, const double* b, int64_t cnt, VectorLanes<double>* sum) {
+    Reduce(cnt, sum, [a, b](int64_t from, int64_t n, double* lanes) { Kernels().dot_double(a + from, b + from, n, lanes); },
+           [a, b](int64_t i) { return a[i] * b[i]; });
+}
@@ -1,15 +1,98 @@
 #include <virtual_machine.h>
+#include <cstdio>
+
+VirtualMachine::VirtualMachine() {
+    processor_.SetThreads(&threads_);
+}
 
 const Object::ProcVersion& VirtualMachine::GetProcessorVersion() const {
     return processor_.GetVersion();
 }
 
-void VirtualMachine::Execute(const Object& obj) {
-    bool ok = processor_.Execute(obj.bytecode, &ram_);
+void VirtualMachine::SetIO(InputStream* input, OutputStream* output) {
+    output_ = output;
+    processor_.SetIO(input, output);
+}
+
+bool VirtualMachine::Execute(const Executable& executable) {
+    BytecodeView bytecode = executable.GetBytecode();
+    processor_.SetHeapBase(executable.GetBssSize());
+    bool ok = processor_.Execute(bytecode, &ram_);
+    while (ok && processor_.GetStatus() == Processor::kExecStatusCheckpoint) {
+        processor_.FlushHeap(&ram_);
+        WriteCheckpoint(executable);
+        if (stop_at_checkpoint_) {
+            break;
+        }
+        ok = processor_.Execute(bytecode, &ram_);
+    }
+    if (!IsSuspended()) {
+        /* The program is over once the main thread is, but RAM has to outlive its threads. */
+        threads_.JoinAll();
+    }
     if (!ok) {
         processor_.Dump();
-        processor_.PrintStackTrace(obj);
+        processor_.PrintStackTrace(executable);
     }
+    output_->Flush();
+    return ok;
+}
+
+void VirtualMachine::Reset() {
+    threads_.Clear();
+    processor_.Reset();
+    ram_.Clear();
+}
+
+void VirtualMachine::SetCheckpointPath(std::string path) {
+    checkpoint_path_ = std::move(path);
+}
+
+void VirtualMachine::SetStopAtCheckpoint(bool stop) {
+    stop_at_checkpoint_ = stop;
+}
+
+void VirtualMachine::SetFuel(int64_t fuel) {
+    processor_.SetFuel(fuel);
+}
+
+Processor::ExecutionStatus VirtualMachine::GetStatus() const {
+    return processor_.GetStatus();
 }
 
+bool VirtualMachine::IsSuspended() const {
+    return GetStatus() == Processor::kExecStatusCheckpoint || GetStatus() == Processor::kExecStatusOutOfFuel;
+}
 
+void VirtualMachine::WriteCheckpoint(const Executable& executable) {
+    if (checkpoint_path_.empty()) {
+        return;
+    }
+    Snapshot snapshot;
+    snapshot.program_hash = HashBytecode(executable.GetBytecode());
+    processor_.SaveState(&snapshot);
+    ram_.GetTouchedChunks(&snapshot.chunk_indices, &snapshot.chunks);
+
+    std::string error;
+    output_->Flush();
+    if (!TryWriteSnapshot(checkpoint_path_.c_str(), snapshot, &error)) {
+        std::fprintf(stderr, "Checkpoint failed: %s\n", error.c_str());
+    }
+}
+
+bool VirtualMachine::TryRestore(const Executable& executable, const char* path, std::string* error) {
+    Snapshot snapshot;
+    if (!TryReadSnapshot(path, &snapshot, error)) {
+        return false;
+    }
+    if (snapshot.program_hash != HashBytecode(executable.GetBytecode())) {
+        *error = std::string(path) + " was taken from a different program";
+        return false;
+    }
+    if (!processor_.TryRestoreState(snapshot) ||
+        !ram_.TryMapImage(snapshot.image_fd, snapshot.image_offset, snapshot.chunk_indices)) {
+        *error = std::string(path) + " does not fit into the virtual machine";
+        return false;
+    }
+    return true;
+}